@@ -0,0 +1,4 @@
+# The desktop board, rendering offline with the null audio driver instead of
+# running on JACK. See boards/parts/audio/null
+otto_include_board(parts/audio/null)
+otto_include_board(parts/ui/glfw)
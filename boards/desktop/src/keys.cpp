@@ -11,7 +11,7 @@ namespace otto::board::ui {
       if (action == Action::press) {
         auto evt = core::midi::NoteOnEvent{note};
         service::audio::send_midi_event(evt);
-        LOGI("Press key {}", evt.key);
+        LOGI("Press key {}", evt.key());
       } else if (action == Action::release) {
         service::audio::send_midi_event(core::midi::NoteOffEvent{note});
         LOGI("Release key {}", note);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <atomic>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 #include <thread>
@@ -8,12 +11,31 @@
 #define ALSA_PCM_NEW_HW_PARAMS_API
 #include <alsa/asoundlib.h>
 
+#include "core/audio/drift_monitor.hpp"
+#include "core/audio/latency_tuner.hpp"
 #include "core/audio/midi.hpp"
+#include "core/audio/midi_parser.hpp"
+#include "core/audio/midi_queue.hpp"
 #include "core/audio/processor.hpp"
 
-#include "util/locked.hpp"
-
 namespace otto::service::audio {
+  /// An audio driver for ALSA devices, with midi from the ALSA sequencer.
+  ///
+  /// By default, the devices are accessed through their memory mapped ring
+  /// buffers, and the audio thread sleeps in `poll` until a period of input
+  /// is available. Set the environment variable `OTTO_ALSA_ACCESS` to `rw`
+  /// to use `snd_pcm_readi`/`snd_pcm_writei` instead. Devices that do not
+  /// support memory mapped access fall back to read/write access.
+  ///
+  /// The capture and playback streams are linked, so they start in phase.
+  /// The drift between their clocks is tracked by a
+  /// [core::audio::DriftMonitor](), and corrected by skipping or repeating a
+  /// frame of input.
+  ///
+  /// The period size and count are chosen by a [core::audio::LatencyTuner](),
+  /// starting from the lowest latency the devices support. The configuration
+  /// it settles on is stored in the state, per device, and used as the
+  /// start the next time.
   struct AlsaAudioDriver {
     static AlsaAudioDriver& get() noexcept;
 
@@ -21,24 +43,68 @@ namespace otto::service::audio {
     void shutdown();
 
     std::atomic_int samplerate = 44100;
+    /// The measured frames from a sample being output, to a sample captured
+    /// when it is heard arriving as input
+    std::atomic_int round_trip_latency = 0;
 
-    void send_midi_event(core::midi::AnyMidiEvent);
+    void send_midi_event(core::midi::Event);
 
   private:
     AlsaAudioDriver() = default;
     ~AlsaAudioDriver() noexcept = default;
 
     void main_loop();
-    int process_callback(int nframes);
+    /// Set up both devices with `config`
+    ///
+    /// \effects Stops the streams, records `config` as the last one used with
+    /// the device, and fires [events::buffersize_change]() with the new period
+    /// size
+    void configure(core::audio::LatencyTuner::Config config);
+    /// Wait for the next period of input, and get it
+    ///
+    /// With memory mapped access, the audio is read from the ring buffer of
+    /// the capture device, and stays there until [commit_input]().
+    /// \returns The number of frames, or a negative error code
+    snd_pcm_sframes_t read_input(int nframes, float*& data);
+    /// Release the input of the current period
+    int commit_input();
+    /// Write `nframes` interleaved stereo frames to the playback device
+    snd_pcm_sframes_t write_output(const float* data, int nframes);
+    /// Reads the sequencer, and queues its events for the audio thread
+    void midi_loop();
 
     snd_pcm_t* playback_handle;
     snd_pcm_t* capture_handle;
     snd_seq_t* seq_handle;
+    bool mmap_requested = true;
+    bool capture_mmap   = false;
+    bool playback_mmap  = false;
+    bool linked         = false;
+    core::audio::DriftMonitor drift;
+    std::string device_name;
+
+    /// The configuration the devices are set up with
+    core::audio::LatencyTuner::Config period;
+    std::optional<core::audio::LatencyTuner> tuner;
+    /// The last configuration used with each device
+    std::map<std::string, core::audio::LatencyTuner::Config> saved_configs;
+    /// Guards `saved_configs`, which the audio thread updates while the state
+    /// may be saved
+    std::mutex saved_configs_mutex;
+    std::vector<pollfd> capture_fds;
+    std::vector<pollfd> playback_fds;
+    /// The input left in the capture ring buffer by [read_input]()
+    snd_pcm_uframes_t capture_offset = 0;
+    snd_pcm_uframes_t capture_frames = 0;
 
     core::audio::ProcessBuffer<1> in_data;
-    util::atomic_swap<std::vector<core::midi::AnyMidiEvent>> midi_bufs;
+    core::midi::EventQueue midi_queue;
+    core::midi::EventBuffer<> midi_in;
+    /// Only used on the midi thread
+    core::midi::Parser midi_parser;
 
     std::thread audio_thread;
+    std::thread midi_thread;
   };
 
   using AudioDriver = AlsaAudioDriver;
@@ -1,6 +1,13 @@
 #include "board/audio_driver.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <fmt/format.h>
@@ -11,6 +18,7 @@
 /* All of the ALSA library API is defined
  * in this header */
 #include <alsa/asoundlib.h>
+#include <poll.h>
 
 #include "util/timer.hpp"
 
@@ -18,13 +26,13 @@
 #include "core/globals.hpp"
 
 #include "services/audio.hpp"
+#include "services/state.hpp"
 #include "services/engines.hpp"
 #include "services/logger.hpp"
 
 namespace otto::service::audio {
 
-  static int buffer_size = 512;
-  static unsigned periods = 4;
+  using core::audio::LatencyTuner;
 
   static void debug_snd_params(snd_pcm_hw_params_t* params)
   {
@@ -118,7 +126,14 @@ namespace otto::service::audio {
     LOGI("can sync start = {}", val);
   }
 
-  static void setup_alsa_device(snd_pcm_t* handle, int channels)
+  /// \param mmap Try to use memory mapped access
+  /// \param config The period configuration to request. Set to the one the
+  /// device chose.
+  /// \returns Whether memory mapped access is used
+  static bool setup_alsa_device(snd_pcm_t* handle,
+                                int channels,
+                                bool mmap,
+                                LatencyTuner::Config& config)
   {
     int rc;
     snd_pcm_hw_params_t* params;
@@ -136,9 +151,17 @@ namespace otto::service::audio {
     /* Set the desired hardware parameters. */
 
     /* Interleaved mode */
-    rc = snd_pcm_hw_params_set_access(handle, params,
-                                      SND_PCM_ACCESS_RW_INTERLEAVED);
-    LOGE_IF(rc < 0, "Error setting access: {}", snd_strerror(rc));
+    if (mmap) {
+      rc = snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+      LOGW_IF(rc < 0, "Memory mapped access is not supported, using read/write access: {}",
+              snd_strerror(rc));
+      mmap = rc >= 0;
+    }
+    if (!mmap) {
+      rc = snd_pcm_hw_params_set_access(handle, params,
+                                        SND_PCM_ACCESS_RW_INTERLEAVED);
+      LOGE_IF(rc < 0, "Error setting access: {}", snd_strerror(rc));
+    }
 
     /* Signed 16-bit little-endian format */
     rc = snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_FLOAT);
@@ -154,18 +177,16 @@ namespace otto::service::audio {
     LOGE_IF(rc < 0, "Error setting sample rate: {}", snd_strerror(rc));
     AudioDriver::get().samplerate = rate;
 
-    // Set periods
-    rc = snd_pcm_hw_params_set_periods_near(handle, params, &periods, 0);
-    LOGE_IF(rc < 0, "Error setting periods: {}", snd_strerror(rc));
+    // Sizes are in frames
+    snd_pcm_uframes_t period_size = config.period_size;
+    rc = snd_pcm_hw_params_set_period_size_near(handle, params, &period_size, &dir);
+    LOGE_IF(rc < 0, "Error setting period size: {}", snd_strerror(rc));
+    config.period_size = period_size;
 
-    snd_pcm_uframes_t frame_size = channels * sizeof(float);
-    snd_pcm_uframes_t frames = buffer_size * periods / frame_size;
-    rc = snd_pcm_hw_params_set_buffer_size_near(handle, params, &frames);
-    LOGE_IF(rc < 0, "Error setting buffer size: {}", snd_strerror(rc));
-
-    if (frames != buffer_size * periods / frame_size) {
-      buffer_size = frames * frame_size / periods;
-    }
+    unsigned periods = config.periods;
+    rc = snd_pcm_hw_params_set_periods_near(handle, params, &periods, &dir);
+    LOGE_IF(rc < 0, "Error setting periods: {}", snd_strerror(rc));
+    config.periods = periods;
 
     /* Display information about the PCM interface */
 
@@ -178,6 +199,75 @@ namespace otto::service::audio {
     /* Write the parameters to the driver */
     rc = snd_pcm_hw_params(handle, params);
     LOGF_IF(rc < 0, "Unable to set HW params: {}", snd_strerror(rc));
+    snd_pcm_hw_params_free(params);
+
+    // The streams are started explicitly, and together, instead of when
+    // enough frames have been written or read
+    snd_pcm_sw_params_t* sw_params;
+    rc = snd_pcm_sw_params_malloc(&sw_params);
+    LOGF_IF(rc < 0, "Unable to allocate software param struct: {}", snd_strerror(rc));
+    snd_pcm_sw_params_current(handle, sw_params);
+    snd_pcm_uframes_t boundary;
+    snd_pcm_sw_params_get_boundary(sw_params, &boundary);
+    rc = snd_pcm_sw_params_set_start_threshold(handle, sw_params, boundary);
+    LOGE_IF(rc < 0, "Error setting start threshold: {}", snd_strerror(rc));
+    rc = snd_pcm_sw_params(handle, sw_params);
+    LOGE_IF(rc < 0, "Unable to set SW params: {}", snd_strerror(rc));
+    snd_pcm_sw_params_free(sw_params);
+
+    return mmap;
+  }
+
+  /// Narrow `limits` to the period configurations `handle` supports
+  static LatencyTuner::Limits device_limits(snd_pcm_t* handle, LatencyTuner::Limits limits)
+  {
+    snd_pcm_hw_params_t* params;
+    if (snd_pcm_hw_params_malloc(&params) < 0) return limits;
+    snd_pcm_hw_params_any(handle, params);
+
+    snd_pcm_uframes_t frames;
+    unsigned count;
+    int dir = 0;
+    if (snd_pcm_hw_params_get_period_size_min(params, &frames, &dir) >= 0) {
+      limits.min_period_size = std::max(limits.min_period_size, int(frames));
+    }
+    if (snd_pcm_hw_params_get_period_size_max(params, &frames, &dir) >= 0) {
+      limits.max_period_size = std::min<snd_pcm_uframes_t>(limits.max_period_size, frames);
+    }
+    if (snd_pcm_hw_params_get_periods_min(params, &count, &dir) >= 0) {
+      limits.min_periods = std::max(limits.min_periods, int(count));
+    }
+    if (snd_pcm_hw_params_get_periods_max(params, &count, &dir) >= 0) {
+      limits.max_periods = std::min(limits.max_periods, int(count));
+    }
+
+    snd_pcm_hw_params_free(params);
+    return limits;
+  }
+
+  /// Wait until `handle` has `nframes` frames available
+  ///
+  /// \returns 0, or a negative error code
+  static int wait_for_frames(snd_pcm_t* handle, std::vector<pollfd>& fds, int nframes)
+  {
+    while (global::running()) {
+      auto avail = snd_pcm_avail_update(handle);
+      if (avail < 0) return avail;
+      if (avail >= nframes) return 0;
+      // Time out regularly, to notice when OTTO shuts down
+      if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) return -errno;
+      unsigned short revents = 0;
+      snd_pcm_poll_descriptors_revents(handle, fds.data(), fds.size(), &revents);
+      if (revents & POLLERR) return -EIO;
+    }
+    return -ESHUTDOWN;
+  }
+
+  static std::vector<pollfd> poll_descriptors(snd_pcm_t* handle)
+  {
+    std::vector<pollfd> fds(snd_pcm_poll_descriptors_count(handle));
+    snd_pcm_poll_descriptors(handle, fds.data(), fds.size());
+    return fds;
   }
 
   AlsaAudioDriver& AlsaAudioDriver::get() noexcept
@@ -195,8 +285,44 @@ namespace otto::service::audio {
     rc = snd_pcm_open(&capture_handle, "default", SND_PCM_STREAM_CAPTURE, 0);
     LOGF_IF(rc < 0, "Unable to open PCM playback device: {}", snd_strerror(rc));
 
-    setup_alsa_device(playback_handle, 2);
-    setup_alsa_device(capture_handle, 1);
+    const char* access = std::getenv("OTTO_ALSA_ACCESS");
+    mmap_requested     = access == nullptr || std::string_view(access) != "rw";
+    device_name        = snd_pcm_name(playback_handle);
+
+    auto load = [this](nlohmann::json& data) {
+      if (!data.is_object()) return;
+      std::unique_lock lock(saved_configs_mutex);
+      for (auto it = data.begin(); it != data.end(); ++it) {
+        saved_configs[it.key()] = it.value().get<LatencyTuner::Config>();
+      }
+    };
+    // The tuner is only used on the audio thread. What it settles on is
+    // recorded by configure.
+    auto save = [this] {
+      std::unique_lock lock(saved_configs_mutex);
+      nlohmann::json data = nlohmann::json::object();
+      for (auto& [name, config] : saved_configs) data[name] = config;
+      return data;
+    };
+    service::state::attach("ALSA", load, save);
+
+    // Start from the configuration that was last used with the device, or
+    // from the lowest latency it supports
+    LatencyTuner::Limits limits;
+    limits.min_period_size = 32;
+    limits = device_limits(capture_handle, device_limits(playback_handle, limits));
+    LatencyTuner::Config start = {limits.min_period_size, limits.min_periods};
+    {
+      std::unique_lock lock(saved_configs_mutex);
+      if (auto found = saved_configs.find(device_name); found != saved_configs.end()) {
+        start = found->second;
+      }
+    }
+    // The sample rate is known once the devices are set up
+    configure(limits.clamp(start));
+    tuner.emplace(period, limits, samplerate);
+    LOGI("Using {} playback and {} capture", playback_mmap ? "memory mapped" : "read/write",
+         capture_mmap ? "memory mapped" : "read/write");
 
     rc = snd_seq_open(&seq_handle, "default", SND_SEQ_OPEN_DUPLEX, 0);
     LOGF_IF(rc < 0, "Unable to open sequencer device: {}", snd_strerror(rc));
@@ -206,45 +332,132 @@ namespace otto::service::audio {
       seq_handle, "OTTO", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
       SND_SEQ_PORT_TYPE_APPLICATION);
     LOGF_IF(rc < 0, "Error creating sequencer port: {}", snd_strerror(rc));
+    snd_seq_nonblock(seq_handle, 1);
 
     LOGI("Opened sequencer");
 
     audio_thread = std::thread([this] { main_loop(); });
+    midi_thread  = std::thread([this] { midi_loop(); });
 
-    events::buffersize_change().fire(buffer_size);
     events::samplerate_change().fire(samplerate);
   }
 
+  void AlsaAudioDriver::configure(LatencyTuner::Config config)
+  {
+    snd_pcm_drop(capture_handle);
+    snd_pcm_drop(playback_handle);
+    capture_frames = 0;
+    if (linked) snd_pcm_unlink(capture_handle);
+
+    playback_mmap = setup_alsa_device(playback_handle, 2, mmap_requested, config);
+    // The input has to come in the same periods as the output
+    auto capture_config = config;
+    capture_mmap        = setup_alsa_device(capture_handle, 1, mmap_requested, capture_config);
+    LOGE_IF(capture_config != config,
+            "Capture device chose {}x{} frames, while playback chose {}x{}",
+            capture_config.periods, capture_config.period_size, config.periods,
+            config.period_size);
+    playback_fds = poll_descriptors(playback_handle);
+    capture_fds  = poll_descriptors(capture_handle);
+
+    // Linked streams are prepared, started and stopped as one, so they start
+    // in phase. That only works if they are on the same card.
+    int rc = snd_pcm_link(capture_handle, playback_handle);
+    linked = rc >= 0;
+    LOGW_IF(!linked, "Unable to link the capture and playback streams: {}", snd_strerror(rc));
+
+    period = config;
+    {
+      std::unique_lock lock(saved_configs_mutex);
+      saved_configs[device_name] = config;
+    }
+    LOGI("Using {} periods of {} frames", config.periods, config.period_size);
+    events::buffersize_change().fire(config.period_size);
+  }
+
   void AlsaAudioDriver::shutdown()
   {
+    if (midi_thread.joinable()) midi_thread.join();
+    snd_seq_close(seq_handle);
+    // The audio thread uses the devices until it sees that OTTO is stopping
+    if (audio_thread.joinable()) audio_thread.join();
+    if (linked) snd_pcm_unlink(capture_handle);
+    snd_pcm_close(capture_handle);
     snd_pcm_close(playback_handle);
     LOG_F(INFO, "Closing Alsa client");
   }
 
-  int AlsaAudioDriver::process_callback(int nframes)
+  void AlsaAudioDriver::send_midi_event(core::midi::Event evt)
   {
-    auto running = audio::running() && global::running();
-    if (!running) {
-      return nframes;
-    }
-
-    TIME_SCOPE("AlsaAudio::Process");
-
-    // gatherMidiInput(nframes);
+    midi_queue.push(evt);
+  }
 
-    auto out_data = engines::process({{in_data.data(), nframes}, {}, nframes});
+  snd_pcm_sframes_t AlsaAudioDriver::read_input(int nframes, float*& data)
+  {
+    if (int rc = wait_for_frames(capture_handle, capture_fds, nframes); rc < 0) return rc;
 
-    audio::process_audio_output(out_data);
+    if (!capture_mmap) {
+      data = in_data.data()->data();
+      return snd_pcm_readi(capture_handle, data, nframes);
+    }
 
-    LOGW_IF(out_data.nframes != nframes, "Frames went missing!");
+    snd_pcm_uframes_t done = 0;
+    while (done < snd_pcm_uframes_t(nframes)) {
+      const snd_pcm_channel_area_t* areas;
+      snd_pcm_uframes_t offset;
+      snd_pcm_uframes_t frames = nframes - done;
+      if (int rc = snd_pcm_mmap_begin(capture_handle, &areas, &offset, &frames); rc < 0) {
+        return rc;
+      }
+      auto* ring = static_cast<float*>(areas[0].addr) + areas[0].first / 32 + offset;
+      if (done == 0 && frames == snd_pcm_uframes_t(nframes)) {
+        // The whole period is contiguous in the ring buffer, so the engines
+        // can read it in place. It is committed after they are done.
+        data           = ring;
+        capture_offset = offset;
+        capture_frames = frames;
+        return nframes;
+      }
+      // The period wraps around the end of the ring buffer
+      std::copy(ring, ring + frames, in_data.data()->data() + done);
+      if (auto rc = snd_pcm_mmap_commit(capture_handle, offset, frames); rc < 0) return rc;
+      done += frames;
+    }
+    data = in_data.data()->data();
+    return nframes;
+  }
 
-    return snd_pcm_writei(playback_handle, out_data.audio.data(),
-                          out_data.nframes);
+  int AlsaAudioDriver::commit_input()
+  {
+    if (capture_frames == 0) return 0;
+    auto rc        = snd_pcm_mmap_commit(capture_handle, capture_offset, capture_frames);
+    capture_frames = 0;
+    return rc < 0 ? rc : 0;
   }
 
-  void AlsaAudioDriver::send_midi_event(core::midi::AnyMidiEvent evt)
+  snd_pcm_sframes_t AlsaAudioDriver::write_output(const float* data, int nframes)
   {
-    midi_bufs.outer().emplace_back(std::move(evt));
+    constexpr int channels = 2;
+    if (!playback_mmap) {
+      return snd_pcm_writei(playback_handle, data, nframes);
+    }
+
+    if (int rc = wait_for_frames(playback_handle, playback_fds, nframes); rc < 0) return rc;
+
+    snd_pcm_uframes_t done = 0;
+    while (done < snd_pcm_uframes_t(nframes)) {
+      const snd_pcm_channel_area_t* areas;
+      snd_pcm_uframes_t offset;
+      snd_pcm_uframes_t frames = nframes - done;
+      if (int rc = snd_pcm_mmap_begin(playback_handle, &areas, &offset, &frames); rc < 0) {
+        return rc;
+      }
+      auto* ring = static_cast<float*>(areas[0].addr) + areas[0].first / 32 + offset * channels;
+      std::copy(data + done * channels, data + (done + frames) * channels, ring);
+      if (auto rc = snd_pcm_mmap_commit(playback_handle, offset, frames); rc < 0) return rc;
+      done += frames;
+    }
+    return nframes;
   }
 
   void AlsaAudioDriver::main_loop()
@@ -252,17 +465,23 @@ namespace otto::service::audio {
     sched_param sch_params;
     sch_params.sched_priority = 100;
     pthread_setschedparam(audio_thread.native_handle(), SCHED_RR, &sch_params);
-    int nframes, inframes, outframes, frame_size;
-    int channels = 2;
-    frame_size = channels * sizeof(float);
-    nframes = buffer_size / frame_size;
+
+    std::vector<std::array<float, 2>> silence(core::audio::max_block_size, {{0, 0}});
 
     bool restarting = true;
 
+    // Raise the latency if needed, after an xrun
+    auto xrun = [&] {
+      if (tuner->xrun()) configure(tuner->config());
+      restarting = true;
+    };
+
     while (global::running()) {
+      int nframes = period.period_size;
       if (restarting) {
         restarting = false;
         /* drop any output we might got and stop */
+        capture_frames = 0;
         snd_pcm_drop(capture_handle);
         snd_pcm_drop(playback_handle);
         /* prepare for use */
@@ -270,42 +489,123 @@ namespace otto::service::audio {
         snd_pcm_prepare(playback_handle);
 
         /* fill the whole output buffer */
-        for (int i = 0; i < periods; i += 1)
-          snd_pcm_writei(playback_handle, in_data.data(), nframes);
+        for (int i = 0; i < period.periods; i += 1)
+          write_output(silence.data()->data(), nframes);
+        snd_pcm_start(capture_handle);
+        if (!linked) snd_pcm_start(playback_handle);
+        drift.reset();
       }
 
-      while ((inframes =
-                snd_pcm_readi(capture_handle, in_data.data(), nframes)) < 0) {
-        if (inframes == -EAGAIN) continue;
-        LOGE("Input Overrun {}", snd_strerror(-inframes));
-        //restarting = 1;
-        snd_pcm_prepare(capture_handle);
+      float* input;
+      auto inframes = read_input(nframes, input);
+      if (inframes == -ESHUTDOWN) break;
+      if (inframes < 0) {
+        LOGE("Input overrun: {}", snd_strerror(inframes));
+        xrun();
+        continue;
       }
 
+      // The capture device has just filled a period, so this is the start of
+      // the block on the PCM clock
+      auto block_start = core::midi::EventQueue::clock::now();
+
       LOGE_IF(inframes != nframes,
               "Short read from capture device: {}, expecting {}", inframes,
               nframes);
 
-      midi_bufs.swap();
+      // Measured right after a period of input arrived, so only the drift of
+      // the clocks changes the sum from period to period
+      int correction = 0;
+      snd_pcm_sframes_t playback_delay, capture_delay;
+      if (snd_pcm_delay(playback_handle, &playback_delay) >= 0 &&
+          snd_pcm_delay(capture_handle, &capture_delay) >= 0) {
+        correction = drift.update(playback_delay + capture_delay);
+        // The input of the current block was captured before the delays
+        round_trip_latency = drift.delay() + nframes;
+      }
+
+      midi_in.clear();
+      midi_queue.pop_block(block_start, nframes, samplerate, midi_in);
 
-      auto out_data =
-        engines::process({{in_data.data(), nframes}, midi_bufs.inner(), nframes});
+      auto out_data = engines::process(
+        {{reinterpret_cast<std::array<float, 1>*>(input), std::size_t(inframes)},
+         midi_in.events(),
+         inframes});
 
       audio::process_audio_output(out_data);
 
-      LOGW_IF(out_data.nframes != nframes, "Frames went missing!");
+      LOGW_IF(out_data.nframes != inframes, "Frames went missing!");
 
-      while ((outframes = snd_pcm_writei(playback_handle, out_data.audio.data(),
-                                         out_data.nframes)) < 0) {
-        if (outframes == -EAGAIN) continue;
-        LOGE("Output underrun {}", snd_strerror(inframes));
-        //restarting = 1;
-        snd_pcm_prepare(playback_handle);
+      if (int rc = commit_input(); rc < 0) {
+        LOGE("Input overrun: {}", snd_strerror(rc));
+        xrun();
+        continue;
+      }
+      // Skip or repeat a frame of input, to keep it in line with the output
+      if (correction > 0) snd_pcm_forward(capture_handle, correction);
+      if (correction < 0) snd_pcm_rewind(capture_handle, -correction);
+
+      std::chrono::duration<float> busy = core::midi::EventQueue::clock::now() - block_start;
+      float load = busy.count() * samplerate / nframes;
+
+      auto outframes = write_output(out_data.audio.data()->data(), out_data.nframes);
+      if (outframes == -ESHUTDOWN) break;
+      if (outframes < 0) {
+        LOGE("Output underrun: {}", snd_strerror(outframes));
+        xrun();
+        continue;
       }
 
-      LOGE_IF(outframes != nframes,
-              "Short write to capture device: {}, expecting {}", outframes,
-              nframes);
+      LOGE_IF(outframes != out_data.nframes,
+              "Short write to playback device: {}, expecting {}", outframes,
+              out_data.nframes);
+
+      if (tuner->period(load)) {
+        configure(tuner->config());
+        restarting = true;
+      }
+    }
+  }
+
+  void AlsaAudioDriver::midi_loop()
+  {
+    sched_param sch_params;
+    sch_params.sched_priority = 90;
+    pthread_setschedparam(midi_thread.native_handle(), SCHED_RR, &sch_params);
+
+    // Sequencer events are turned back into bytes, and parsed like the
+    // input of any other driver
+    snd_midi_event_t* decoder;
+    int rc = snd_midi_event_new(core::midi::Parser::max_sysex_size, &decoder);
+    if (rc < 0) {
+      LOGE("Unable to create midi decoder: {}", snd_strerror(rc));
+      return;
     }
+    snd_midi_event_no_status(decoder, 1);
+
+    std::vector<pollfd> fds(snd_seq_poll_descriptors_count(seq_handle, POLLIN));
+    snd_seq_poll_descriptors(seq_handle, fds.data(), fds.size(), POLLIN);
+    std::array<unsigned char, core::midi::Parser::max_sysex_size> bytes;
+
+    while (global::running()) {
+      // Time out regularly, to notice when OTTO shuts down
+      if (poll(fds.data(), fds.size(), 100) <= 0) continue;
+
+      snd_seq_event_t* seq_event;
+      while ((rc = snd_seq_event_input(seq_handle, &seq_event)) >= 0) {
+        // Events that are not midi messages, like port subscriptions, give 0
+        long n = snd_midi_event_decode(decoder, bytes.data(), bytes.size(), seq_event);
+        core::midi::Event event;
+        for (long i = 0; i < n; i++) {
+          // System exclusive payloads do not fit in the queue
+          if (!midi_parser.feed(bytes[i], event)) continue;
+          if (event.type == core::midi::Event::Type::SysEx) continue;
+          LOGW_IF(!midi_queue.push(event), "Midi queue full, dropped an event");
+        }
+      }
+      LOGW_IF(rc == -ENOSPC, "Midi input overran, events were lost");
+    }
+
+    snd_midi_event_free(decoder);
   }
 } // namespace otto::service::audio
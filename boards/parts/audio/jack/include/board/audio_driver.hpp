@@ -7,10 +7,20 @@
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include "core/audio/midi.hpp"
-
-#include "util/locked.hpp"
+#include "core/audio/midi_parser.hpp"
+#include "core/audio/midi_queue.hpp"
 
 namespace otto::service::audio {
+  /// Audio through a JACK client
+  ///
+  /// Besides the mono input and the stereo master output, these ports are
+  /// registered at init, if asked for by environment variables:
+  ///
+  ///  - `OTTO_JACK_DIRECT_OUTS=1`: An output per tape track, `track1` to
+  ///    `track4`, carrying the tracks as they are played back, before they are
+  ///    mixed. They are not connected, so other clients can record stems.
+  ///  - `OTTO_JACK_INPUTS=<n>`: `n` input ports instead of one, connected to
+  ///    the first `n` physical capture ports. They are mixed into the input.
   struct JackAudioDriver {
     static JackAudioDriver& get() noexcept;
 
@@ -18,8 +28,11 @@ namespace otto::service::audio {
     void shutdown();
 
     std::atomic_int samplerate;
+    /// The frames from a sample being output, to a sample captured when it is
+    /// heard arriving as input, as reported by the port latencies
+    std::atomic_int round_trip_latency = 0;
 
-    void send_midi_event(core::midi::AnyMidiEvent) noexcept;
+    void send_midi_event(core::midi::Event) noexcept;
 
   private:
     JackAudioDriver() noexcept = default;
@@ -30,19 +43,28 @@ namespace otto::service::audio {
     static constexpr const char* const clientName = "OTTO";
 
     struct {
-      jack_port_t *outL;
-      jack_port_t *outR;
-      jack_port_t *input;
-      jack_port_t *midiIn;
-      jack_port_t *midiOut;
+      jack_port_t *outL = nullptr;
+      jack_port_t *outR = nullptr;
+      jack_port_t *input = nullptr;
+      jack_port_t *midiIn = nullptr;
+      jack_port_t *midiOut = nullptr;
     } ports;
+    /// One per tape track, if enabled
+    std::vector<jack_port_t*> direct_outs;
+    /// The inputs after the first
+    std::vector<jack_port_t*> extra_inputs;
+    /// The inputs mixed together, if there is more than one
+    std::vector<float> input_mix;
 
     std::size_t bufferSize;
 
     jack_client_t* client;
     jack_status_t jackStatus;
 
-    util::atomic_swap<std::vector<core::midi::AnyMidiEvent>> midi_bufs;
+    core::midi::EventQueue midi_queue;
+    core::midi::EventBuffer<> midi_in;
+    core::midi::Parser midi_parser;
+    std::size_t midi_overflows = 0;
 
     enum class PortType {
       Audio,
@@ -56,6 +78,7 @@ namespace otto::service::audio {
     bool connectPorts(const std::string& src, const std::string& dest);
     void samplerateCallback(unsigned srate);
     void buffersizeCallback(unsigned buffsize);
+    void latencyCallback(jack_latency_callback_mode_t mode);
     void gatherMidiInput(int nFrames);
     void process(int nframes);
   };
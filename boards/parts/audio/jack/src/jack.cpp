@@ -1,5 +1,7 @@
 #include "board/audio_driver.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
@@ -11,6 +13,7 @@
 #include "util/algorithm.hpp"
 
 #include "core/globals.hpp"
+#include "core/audio/buffer_arena.hpp"
 #include "core/audio/processor.hpp"
 
 #include "services/engines.hpp"
@@ -33,6 +36,14 @@ namespace otto::service::audio {
     {
       LOGI("JACK shut down, exiting");
     }
+
+    const char* env_or(const char* name, const char* fallback)
+    {
+      const char* value = std::getenv(name);
+      return (value != nullptr && *value != '\0') ? value : fallback;
+    }
+
+    constexpr int tape_tracks = 4;
   } // namespace
 
   JackAudioDriver& JackAudioDriver::get() noexcept
@@ -80,9 +91,22 @@ namespace otto::service::audio {
       },
       this);
 
+    jack_set_latency_callback(
+      client,
+      [](jack_latency_callback_mode_t mode, void* arg) {
+        (static_cast<JackAudioDriver*>(arg))->latencyCallback(mode);
+      },
+      this);
+
     jack_on_shutdown(client, jackShutdown, nullptr);
 
     bufferSize = jack_get_buffer_size(client);
+    if (bufferSize > core::audio::max_block_size) {
+      throw global::exception(global::ErrorCode::audio_error,
+                              "The JACK buffer size {} is larger than the maximum of {}",
+                              bufferSize, core::audio::max_block_size);
+    }
+    input_mix.resize(bufferSize);
 
     if (jack_activate(client)) {
       throw global::exception(global::ErrorCode::audio_error,
@@ -90,6 +114,7 @@ namespace otto::service::audio {
     }
 
     setupPorts();
+    latencyCallback(JackCaptureLatency);
 
     LOG_F(INFO, "Initialized JackAudio");
   }
@@ -100,9 +125,9 @@ namespace otto::service::audio {
     jack_client_close(client);
   }
 
-  void JackAudioDriver::send_midi_event(core::midi::AnyMidiEvent evt) noexcept
+  void JackAudioDriver::send_midi_event(core::midi::Event evt) noexcept
   {
-    midi_bufs.outer().emplace_back(std::move(evt));
+    midi_queue.push(evt);
   }
 
   void JackAudioDriver::setupPorts()
@@ -151,6 +176,35 @@ namespace otto::service::audio {
       return;
     }
 
+    int ninputs = std::atoi(env_or("OTTO_JACK_INPUTS", "1"));
+    for (int i = 1; i < ninputs; i++) {
+      auto name = fmt::format("input{}", i + 1);
+      auto* port = jack_port_register(client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE,
+                                      JackPortIsInput, 0);
+      if (port == nullptr) {
+        throw global::exception(global::ErrorCode::audio_error,
+                                "Couldn't register port {}", name);
+      }
+      extra_inputs.push_back(port);
+      if (i < (int) inputs.size()) {
+        s = connectPorts(jack_port_name(port), inputs[i]);
+        LOG_IF_F(ERROR, !s, "Couldn't connect {}", name);
+      }
+    }
+
+    if (std::string(env_or("OTTO_JACK_DIRECT_OUTS", "0")) != "0") {
+      for (int t = 0; t < tape_tracks; t++) {
+        auto name = fmt::format("track{}", t + 1);
+        auto* port = jack_port_register(client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE,
+                                        JackPortIsOutput, 0);
+        if (port == nullptr) {
+          throw global::exception(global::ErrorCode::audio_error,
+                                  "Couldn't register port {}", name);
+        }
+        direct_outs.push_back(port);
+      }
+    }
+
     // Midi ports
     ports.midiIn = jack_port_register(client, "midiIn", JACK_DEFAULT_MIDI_TYPE,
                                       JackPortIsInput, 0);
@@ -216,11 +270,31 @@ namespace otto::service::audio {
   {
     LOG_F(INFO, "Jack changed the buffer size to {}", buffsize);
     bufferSize = buffsize;
+    if (bufferSize > core::audio::max_block_size) {
+      // The engines can not process it, see `process`
+      LOGE("The buffer size is larger than the maximum of {}. Only silence is output until it is "
+           "lowered",
+           core::audio::max_block_size);
+      return;
+    }
+    input_mix.resize(bufferSize);
     audio::events::buffersize_change().fire(buffsize);
   }
 
-  void JackAudioDriver::gatherMidiInput(int nframes) {
-    midi_bufs.swap();
+  void JackAudioDriver::latencyCallback(jack_latency_callback_mode_t)
+  {
+    // The ports are registered after activation
+    if (ports.input == nullptr || ports.outL == nullptr) return;
+    jack_latency_range_t capture, playback;
+    jack_port_get_latency_range(ports.input, JackCaptureLatency, &capture);
+    jack_port_get_latency_range(ports.outL, JackPlaybackLatency, &playback);
+    round_trip_latency = capture.max + playback.max;
+  }
+
+  void JackAudioDriver::gatherMidiInput(int nframes)
+  {
+    midi_in.clear();
+    midi_queue.pop_block(core::midi::EventQueue::clock::now(), nframes, samplerate, midi_in);
 
     // Get new midi events
     void* midiBuf = jack_port_get_buffer(ports.midiIn, nframes);
@@ -228,31 +302,12 @@ namespace otto::service::audio {
 
     jack_midi_event_t event;
     for (int i = 0; i < nevents; i++) {
-      using namespace core::midi;
-
       jack_midi_event_get(&event, midiBuf, i);
-      MidiEvent mEvent;
-
-      mEvent.channel = event.buffer[0] & 0b00001111;
-      std::copy_n(event.buffer + 1, std::min(event.size - 1, mEvent.max_data_size), mEvent.data.begin());
-      mEvent.time    = event.time;
-
-      auto type = MidiEvent::Type(event.buffer[0] >> 4);
-      switch (type) {
-      case MidiEvent::Type::NoteOff:
-        mEvent.type = MidiEvent::Type::NoteOff;
-        midi_bufs.inner().emplace_back(NoteOffEvent(mEvent));
-        break;
-      case MidiEvent::Type::NoteOn:
-        mEvent.type = MidiEvent::Type::NoteOn;
-        midi_bufs.inner().emplace_back(NoteOnEvent(mEvent));
-        break;
-      case MidiEvent::Type::ControlChange:
-        mEvent.type = MidiEvent::Type::ControlChange;
-        midi_bufs.inner().emplace_back(ControlChangeEvent(mEvent));
-        break;
-      }
+      midi_parser.parse({event.buffer, std::ptrdiff_t(event.size)}, event.time, midi_in);
     }
+
+    LOGW_IF(midi_in.overflows() != midi_overflows, "Midi events were dropped");
+    midi_overflows = midi_in.overflows();
   }
 
   void JackAudioDriver::process(int nframes)
@@ -269,25 +324,55 @@ namespace otto::service::audio {
       return;
     }
 
+    if ((size_t) nframes > core::audio::max_block_size) {
+      std::fill_n((float*) jack_port_get_buffer(ports.outL, nframes), nframes, 0.f);
+      std::fill_n((float*) jack_port_get_buffer(ports.outR, nframes), nframes, 0.f);
+      for (auto* port : direct_outs) {
+        std::fill_n((float*) jack_port_get_buffer(port, nframes), nframes, 0.f);
+      }
+      return;
+    }
+
     gatherMidiInput(nframes);
 
     float* outLData = (float*) jack_port_get_buffer(ports.outL, nframes);
     float* outRData = (float*) jack_port_get_buffer(ports.outR, nframes);
     float* inData   = (float*) jack_port_get_buffer(ports.input, nframes);
 
+    if (!extra_inputs.empty()) {
+      // Input port buffers are read only
+      std::copy_n(inData, nframes, input_mix.data());
+      for (auto* port : extra_inputs) {
+        auto* data = (float*) jack_port_get_buffer(port, nframes);
+        for (int i = 0; i < nframes; i++) input_mix[i] += data[i];
+      }
+      inData = input_mix.data();
+    }
+
     auto out_data = engines::process(
       {{reinterpret_cast<util::audio::AudioFrame<1>*>(inData), nframes},
-       {midi_bufs.inner()},
+       midi_in.events(),
        nframes});
 
     audio::process_audio_output(out_data);
 
     LOGW_IF(out_data.nframes != nframes, "Frames went missing!");
 
-    // Separate channels
-    for (int i = 0; i < nframes; i++) {
-      outLData[i] = out_data.audio[i][0];
-      outRData[i] = out_data.audio[i][1];
+    // JACK ports are planar
+    core::audio::deinterleave(out_data, core::audio::PlanarData<2>{{outLData, outRData}, {}, nframes});
+
+    if (!direct_outs.empty()) {
+      core::audio::PlanarData<tape_tracks> track_outs = {{}, {}, nframes};
+      for (int t = 0; t < tape_tracks; t++) {
+        track_outs.audio[t] = (float*) jack_port_get_buffer(direct_outs[t], nframes);
+      }
+      // Straight from the tapedeck's buffer, the only copy is into the ports
+      auto tracks = engines::tape_tracks();
+      if (tracks.nframes == nframes && !tracks.silent) {
+        core::audio::deinterleave(tracks, track_outs);
+      } else {
+        for (auto* out : track_outs.audio) std::fill_n(out, nframes, 0.f);
+      }
     }
   }
 } // namespace otto::audio
@@ -0,0 +1 @@
+# The null driver only needs the standard library
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "core/audio/midi.hpp"
+#include "core/audio/midi_queue.hpp"
+#include "core/audio/midi_script.hpp"
+#include "core/audio/processor.hpp"
+
+#include "util/filesystem.hpp"
+
+namespace otto::service::audio {
+
+  /// An audio driver without an audio device.
+  ///
+  /// Renders the engines offline, as fast as the CPU allows, while playing a
+  /// midi script, and writes the output to a WAV file. When the render is
+  /// done, OTTO exits.
+  ///
+  /// It is configured with environment variables:
+  ///
+  ///  - `OTTO_RENDER_SCRIPT`: The midi script to play. Optional.
+  ///  - `OTTO_RENDER_OUTPUT`: The WAV file to write. Defaults to
+  ///    `data/render.wav`
+  ///  - `OTTO_RENDER_SECONDS`: The length of the render. Defaults to the
+  ///    `end` of the script, or 10 seconds without one
+  ///  - `OTTO_RENDER_BUFFER_SIZE`: Frames per block, at most
+  ///    [core::audio::max_block_size](). Defaults to 256
+  ///  - `OTTO_RENDER_SAMPLERATE`: Defaults to 44100
+  ///
+  /// The midi script is described at [core::midi::Script]().
+  ///
+  /// Select this driver with the `desktop-render` board.
+  struct NullAudioDriver {
+    static NullAudioDriver& get() noexcept;
+
+    void init();
+    void shutdown();
+
+    std::atomic_int samplerate = 44100;
+    /// There is no input, so no latency to compensate
+    std::atomic_int round_trip_latency = 0;
+
+    void send_midi_event(core::midi::Event) noexcept;
+
+  private:
+    NullAudioDriver() = default;
+    ~NullAudioDriver() noexcept = default;
+
+    void main_loop();
+
+    int buffer_size = 256;
+    long length = 0;
+    filesystem::path output_path;
+    core::midi::Script script;
+
+    core::audio::ProcessBuffer<1> in_data;
+    core::midi::EventQueue midi_queue;
+    core::midi::EventBuffer<> midi_in;
+
+    std::thread audio_thread;
+  };
+
+  using AudioDriver = NullAudioDriver;
+} // namespace otto::service::audio
@@ -0,0 +1,138 @@
+#include "board/audio_driver.hpp"
+
+#include <chrono>
+#include <cstdlib>
+
+#include "util/soundfile.hpp"
+#include "util/timer.hpp"
+
+#include "core/audio/buffer_arena.hpp"
+#include "core/globals.hpp"
+
+#include "services/audio.hpp"
+#include "services/engines.hpp"
+#include "services/logger.hpp"
+
+namespace otto::service::audio {
+
+  namespace {
+    const char* env_or(const char* name, const char* fallback)
+    {
+      const char* value = std::getenv(name);
+      return (value != nullptr && *value != '\0') ? value : fallback;
+    }
+  } // namespace
+
+  NullAudioDriver& NullAudioDriver::get() noexcept
+  {
+    static NullAudioDriver instance{};
+    return instance;
+  }
+
+  void NullAudioDriver::init()
+  {
+    samplerate  = std::atoi(env_or("OTTO_RENDER_SAMPLERATE", "44100"));
+    buffer_size = std::atoi(env_or("OTTO_RENDER_BUFFER_SIZE", "256"));
+    output_path = env_or("OTTO_RENDER_OUTPUT", "data/render.wav");
+
+    if (samplerate <= 0 || buffer_size <= 0) {
+      throw global::exception(global::ErrorCode::audio_error,
+                              "Invalid render samplerate or buffer size");
+    }
+    if (buffer_size > int(core::audio::max_block_size)) {
+      throw global::exception(global::ErrorCode::audio_error,
+                              "Render buffer size {} is larger than the maximum of {}", buffer_size,
+                              core::audio::max_block_size);
+    }
+
+    double seconds = 10;
+    if (const char* path = std::getenv("OTTO_RENDER_SCRIPT"); path != nullptr) {
+      script = core::midi::Script::read(path);
+      LOGI("Loaded midi script {} with {} events", path, script.events.size());
+      if (script.end >= 0) {
+        seconds = script.end;
+      } else if (!script.events.empty()) {
+        seconds = script.events.back().time;
+      }
+    }
+    seconds = std::atof(env_or("OTTO_RENDER_SECONDS", std::to_string(seconds).c_str()));
+    length  = long(seconds * samplerate);
+
+    events::buffersize_change().fire(buffer_size);
+    events::samplerate_change().fire(samplerate);
+
+    audio_thread = std::thread([this] { main_loop(); });
+
+    LOGI("Initialized null audio driver");
+  }
+
+  void NullAudioDriver::shutdown()
+  {
+    if (audio_thread.joinable()) audio_thread.join();
+    LOGI("Closed null audio driver");
+  }
+
+  void NullAudioDriver::send_midi_event(core::midi::Event evt) noexcept
+  {
+    midi_queue.push(evt);
+  }
+
+  void NullAudioDriver::main_loop()
+  {
+    // Wait for the engines to be started
+    while (!audio::running() && global::running()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!global::running()) return;
+
+    if (filesystem::exists(output_path)) filesystem::remove(output_path);
+    util::SoundFile file;
+    file.open(output_path);
+    file.info.channels   = 2;
+    file.info.samplerate = samplerate;
+
+    std::fill(in_data.begin(), in_data.end(), std::array<float, 1>{{0}});
+
+    auto next_event = script.events.begin();
+    auto start      = std::chrono::steady_clock::now();
+    long position   = 0;
+
+    while (position < length && global::running()) {
+      TIME_SCOPE("NullAudio::Process");
+
+      int nframes = std::min<long>(buffer_size, length - position);
+
+      midi_in.clear();
+      midi_queue.pop_block(core::midi::EventQueue::clock::now(), nframes, samplerate, midi_in);
+      for (; next_event != script.events.end(); ++next_event) {
+        long frame = long(next_event->time * samplerate);
+        if (frame >= position + nframes) break;
+        auto event = next_event->event;
+        event.time = frame - position;
+        midi_in.push(event);
+      }
+
+      // There is no input, so it is always silent
+      auto out_data =
+        engines::process({{in_data.data(), nframes}, midi_in.events(), nframes, 0, true});
+
+      audio::process_audio_output(out_data);
+
+      LOGW_IF(out_data.nframes != nframes, "Frames went missing!");
+
+      file.write_samples(out_data.audio.data()->data(),
+                         out_data.audio.data()->data() + 2 * out_data.nframes);
+      position += nframes;
+    }
+
+    file.close();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rendered = double(position) / samplerate;
+    LOGI("Rendered {:.2f}s of audio to {} in {:.2f}s ({:.1f}x realtime)", rendered,
+         output_path.c_str(), elapsed.count(),
+         elapsed.count() > 0 ? rendered / elapsed.count() : 0.0);
+
+    global::exit(global::ErrorCode::none);
+  }
+} // namespace otto::service::audio
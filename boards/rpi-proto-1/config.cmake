@@ -1,2 +1,7 @@
 otto_include_board(parts/ui/egl)
 otto_include_board(parts/audio/jack)
+
+# NEON is not enabled by default on 32 bit arm, but the Pi 3 has it
+if (OTTO_SIMD AND CMAKE_SYSTEM_PROCESSOR MATCHES "^arm")
+  target_compile_options(otto PUBLIC -mfpu=neon-vfpv4)
+endif()
@@ -0,0 +1,97 @@
+#include "buffer_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "services/audio.hpp"
+#include "services/logger.hpp"
+
+namespace otto::core::audio {
+
+  namespace {
+    std::size_t align_up(std::size_t bytes) noexcept
+    {
+      return (bytes + BufferArena::alignment - 1) & ~(BufferArena::alignment - 1);
+    }
+  } // namespace
+
+  void* BufferArena::claim(std::size_t bytes)
+  {
+    bytes = align_up(std::max<std::size_t>(bytes, 1));
+    std::unique_lock lock(mutex_);
+
+    auto range = std::find_if(free_.begin(), free_.end(), [&](auto& r) { return r.size >= bytes; });
+    if (range == free_.end()) {
+      // Over-allocate, so the start can be aligned
+      std::size_t size = std::max(chunk_size, bytes);
+      auto storage     = std::make_unique<std::byte[]>(size + alignment);
+      auto address     = reinterpret_cast<std::uintptr_t>(storage.get());
+      auto* begin      = storage.get() + (align_up(address) - address);
+      chunks_.push_back({std::move(storage), begin, size});
+      Range r{begin, size, int(chunks_.size() - 1)};
+      range = free_.insert(std::upper_bound(free_.begin(), free_.end(), r,
+                                            [](auto& a, auto& b) { return a.begin < b.begin; }),
+                           r);
+      LOGI_IF(chunks_.size() > 1, "Allocated audio buffer chunk {}", chunks_.size());
+    }
+
+    auto* res = range->begin;
+    range->begin += bytes;
+    range->size -= bytes;
+    if (range->size == 0) free_.erase(range);
+    claimed_ += bytes;
+
+    std::memset(res, 0, bytes);
+    return res;
+  }
+
+  void BufferArena::release(void* ptr, std::size_t bytes) noexcept
+  {
+    if (ptr == nullptr) return;
+    bytes = align_up(std::max<std::size_t>(bytes, 1));
+    auto* begin = static_cast<std::byte*>(ptr);
+    std::unique_lock lock(mutex_);
+
+    int chunk = 0;
+    while (chunk < int(chunks_.size()) &&
+           !(begin >= chunks_[chunk].begin && begin < chunks_[chunk].begin + chunks_[chunk].size)) {
+      chunk++;
+    }
+
+    auto next = std::upper_bound(free_.begin(), free_.end(), begin,
+                                 [](std::byte* p, auto& r) { return p < r.begin; });
+    auto range = free_.insert(next, Range{begin, bytes, chunk});
+    // Merge with the neighbours in the same chunk
+    if (auto after = range + 1;
+        after != free_.end() && after->chunk == chunk && range->begin + range->size == after->begin) {
+      range->size += after->size;
+      free_.erase(after);
+    }
+    if (range != free_.begin()) {
+      auto before = range - 1;
+      if (before->chunk == chunk && before->begin + before->size == range->begin) {
+        before->size += range->size;
+        free_.erase(range);
+      }
+    }
+    claimed_ -= bytes;
+  }
+
+  void BufferArena::block_size(std::size_t nframes) noexcept
+  {
+    block_size_.store(std::min(nframes, max_block_size), std::memory_order_relaxed);
+  }
+
+  BufferArena& buffer_arena() noexcept
+  {
+    static BufferArena instance;
+    static bool subscribed [[maybe_unused]] = [] {
+      service::audio::events::buffersize_change().subscribe(
+        [](unsigned nframes) { instance.block_size(nframes); });
+      return true;
+    }();
+    return instance;
+  }
+
+} // namespace otto::core::audio
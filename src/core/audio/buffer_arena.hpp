@@ -0,0 +1,94 @@
+/// \file
+/// Preallocated memory for audio buffers.
+///
+/// All [RTBuffer]()s are claimed from one [BufferArena](), sized for the
+/// largest supported block size. Changing the block size then only changes
+/// how much of each buffer is in use, and never allocates.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace otto::core::audio {
+
+  /// The largest number of frames audio can be processed in at once
+  constexpr std::size_t max_block_size = 4096;
+
+  /// Cache aligned storage for audio buffers
+  ///
+  /// Memory is allocated in large contiguous chunks. Normally all buffers fit
+  /// in the first one.
+  struct BufferArena {
+    /// The alignment of all claimed memory
+    static constexpr std::size_t alignment = 64;
+    /// The smallest chunk that is allocated, in bytes
+    static constexpr std::size_t chunk_size = 1 << 20;
+
+    BufferArena() = default;
+    BufferArena(const BufferArena&) = delete;
+
+    /// Claim `bytes` bytes of zeroed memory
+    ///
+    /// Allocates a new chunk if there is no room in the existing ones, so must
+    /// not be called from the audio thread.
+    void* claim(std::size_t bytes);
+
+    /// Give back memory from [claim]()
+    ///
+    /// \requires `bytes` is the size it was claimed with
+    void release(void* ptr, std::size_t bytes) noexcept;
+
+    /// The number of frames in the current block
+    std::size_t block_size() const noexcept
+    {
+      return block_size_.load(std::memory_order_relaxed);
+    }
+
+    /// Set the number of frames in the blocks to come
+    ///
+    /// Does not allocate.
+    ///
+    /// \requires `nframes <= max_block_size`. The drivers never process
+    /// larger blocks, see [service::audio::events::buffersize_change](). Larger
+    /// sizes are clamped, so buffers are not overrun, but would not hold a
+    /// block.
+    void block_size(std::size_t nframes) noexcept;
+
+    /// The number of bytes currently claimed
+    std::size_t claimed() const noexcept
+    {
+      return claimed_;
+    }
+
+  private:
+    struct Range {
+      std::byte* begin;
+      std::size_t size;
+      int chunk;
+    };
+
+    struct Chunk {
+      std::unique_ptr<std::byte[]> storage;
+      /// The aligned start of `storage`
+      std::byte* begin;
+      std::size_t size;
+    };
+
+    std::mutex mutex_;
+    std::vector<Chunk> chunks_;
+    /// Unclaimed ranges, sorted by address
+    std::vector<Range> free_;
+    std::size_t claimed_ = 0;
+    std::atomic<std::size_t> block_size_{max_block_size};
+  };
+
+  /// The arena all [RTBuffer]()s are claimed from.
+  ///
+  /// Its block size follows [service::audio::events::buffersize_change]()
+  BufferArena& buffer_arena() noexcept;
+
+} // namespace otto::core::audio
@@ -0,0 +1,78 @@
+/// \file
+/// Tracking the latency and clock drift of full duplex audio devices.
+
+#pragma once
+
+namespace otto::core::audio {
+
+  /// Tracks the delays of a capture and a playback stream relative to each
+  /// other
+  ///
+  /// When both streams run on the same clock, the playback delay shrinks
+  /// exactly as fast as the capture delay grows, so their sum is constant.
+  /// If the clocks drift apart, so does the sum. The monitor smooths out the
+  /// jitter of the measurements, and asks for a frame of input to be skipped
+  /// or repeated whenever the drift reaches [threshold]() frames, so the input
+  /// keeps lining up with the output.
+  struct DriftMonitor {
+    /// How fast the average follows the measurements, in `(0, 1]`
+    float smoothing = 0.01f;
+    /// The drift, in frames, at which a correction is made
+    float threshold = 1.f;
+
+    /// Add a measurement
+    ///
+    /// \param delay The playback delay plus the capture delay, in frames
+    /// \returns The number of input frames to skip. Negative if frames should
+    /// be repeated.
+    int update(long delay) noexcept
+    {
+      if (measurements_ == 0) average_ = delay;
+      average_ += (delay - average_) * smoothing;
+      // The baseline is taken once the average has settled
+      if (measurements_ < 1 / smoothing) {
+        measurements_++;
+        baseline_ = average_;
+        return 0;
+      }
+      float drift = average_ - baseline_;
+      if (drift >= threshold) {
+        // The capture clock is ahead. Skipping a frame shortens its delay.
+        average_ -= 1;
+        corrections_++;
+        return 1;
+      }
+      if (drift <= -threshold) {
+        average_ += 1;
+        corrections_++;
+        return -1;
+      }
+      return 0;
+    }
+
+    /// Forget the measurements, when the streams are restarted
+    void reset() noexcept
+    {
+      measurements_ = 0;
+    }
+
+    /// The smoothed playback plus capture delay, in frames
+    float delay() const noexcept
+    {
+      return average_;
+    }
+
+    /// The number of frames skipped or repeated so far
+    int corrections() const noexcept
+    {
+      return corrections_;
+    }
+
+  private:
+    int measurements_ = 0;
+    float baseline_ = 0;
+    float average_ = 0;
+    int corrections_ = 0;
+  };
+
+} // namespace otto::core::audio
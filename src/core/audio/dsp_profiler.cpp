@@ -0,0 +1,214 @@
+#include "dsp_profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+namespace otto::core::audio {
+
+  namespace {
+    std::uint32_t saturate(std::uint64_t val) noexcept
+    {
+      return std::uint32_t(std::min<std::uint64_t>(val, std::numeric_limits<std::uint32_t>::max()));
+    }
+
+    float micros(std::uint32_t ns) noexcept
+    {
+      return ns / 1000.f;
+    }
+
+    nlohmann::json to_json(const DspProfiler::Stats& stats)
+    {
+      return {{"p50", stats.p50}, {"p99", stats.p99}, {"max", stats.max}};
+    }
+  } // namespace
+
+  int DspProfiler::slot(std::string_view name)
+  {
+    std::unique_lock lock(mutex_);
+    int n = nslots_.load();
+    for (int i = 0; i < n; i++) {
+      if (names_[i] == name) return i;
+    }
+    if (n == max_nodes) return -1;
+    names_[n] = std::string(name);
+    nslots_   = n + 1;
+    return n;
+  }
+
+  void DspProfiler::record(int slot, std::chrono::nanoseconds duration) noexcept
+  {
+    if (slot < 0) return;
+    auto& s = slots_[slot];
+    auto i  = s.count.load(std::memory_order_relaxed);
+    s.samples[i % window].store(saturate(duration.count()), std::memory_order_relaxed);
+    s.last_block.store(blocks_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    s.count.store(i + 1, std::memory_order_release);
+  }
+
+  int DspProfiler::gauge(std::string_view name)
+  {
+    std::unique_lock lock(mutex_);
+    int n = ngauges_.load();
+    for (int i = 0; i < n; i++) {
+      if (gauge_names_[i] == name) return i;
+    }
+    if (n == max_gauges) return -1;
+    gauge_names_[n] = std::string(name);
+    ngauges_        = n + 1;
+    return n;
+  }
+
+  void DspProfiler::record_gauge(int gauge, float value) noexcept
+  {
+    if (gauge < 0) return;
+    auto& s = gauges_[gauge];
+    auto i  = s.count.load(std::memory_order_relaxed);
+    s.samples[i % window].store(saturate(std::uint64_t(std::max(value, 0.f) * 1000)),
+                                std::memory_order_relaxed);
+    s.count.store(i + 1, std::memory_order_release);
+  }
+
+  void DspProfiler::end_block(std::chrono::nanoseconds wall, long nframes, int samplerate) noexcept
+  {
+    auto block = blocks_.load(std::memory_order_relaxed);
+    auto push  = [](Slot& s, std::uint32_t val) {
+      auto i = s.count.load(std::memory_order_relaxed);
+      s.samples[i % window].store(val, std::memory_order_relaxed);
+      s.count.store(i + 1, std::memory_order_release);
+    };
+
+    std::uint64_t deadline = samplerate > 0 ? nframes * 1'000'000'000ull / samplerate : 0;
+    push(block_slot_, saturate(wall.count()));
+    if (deadline > 0) push(load_slot_, saturate(wall.count() * 10000 / deadline));
+
+    if (deadline > 0 && std::uint64_t(wall.count()) > deadline) {
+      nxruns_.fetch_add(1, std::memory_order_relaxed);
+      XrunEvent evt{block, saturate(wall.count()), saturate(deadline), -1, 0};
+      int n = nslots_.load(std::memory_order_acquire);
+      for (int i = 0; i < n; i++) {
+        auto& s    = slots_[i];
+        auto count = s.count.load(std::memory_order_acquire);
+        if (count == 0 || s.last_block.load(std::memory_order_relaxed) != block) continue;
+        auto time = s.samples[(count - 1) % window].load(std::memory_order_relaxed);
+        if (evt.slot < 0 || time > evt.node_time) {
+          evt.slot      = i;
+          evt.node_time = time;
+        }
+      }
+      // If the log is not being read, the oldest xruns are kept
+      xrun_queue_.try_push(evt);
+    }
+
+    blocks_.store(block + 1, std::memory_order_release);
+  }
+
+  DspProfiler::Stats DspProfiler::stats(std::vector<std::uint32_t>& samples)
+  {
+    if (samples.empty()) return {};
+    auto at = [&](float quantile) {
+      auto nth = samples.begin() + std::size_t(quantile * (samples.size() - 1));
+      std::nth_element(samples.begin(), nth, samples.end());
+      return micros(*nth);
+    };
+    Stats res;
+    res.p50 = at(0.5);
+    res.p99 = at(0.99);
+    res.max = micros(*std::max_element(samples.begin(), samples.end()));
+    return res;
+  }
+
+  std::vector<std::uint32_t> DspProfiler::samples_of(const Slot& slot) const
+  {
+    auto count = slot.count.load(std::memory_order_acquire);
+    auto n     = std::min<std::uint64_t>(count, window);
+    std::vector<std::uint32_t> res;
+    res.reserve(n);
+    for (std::uint64_t i = count - n; i < count; i++) {
+      res.push_back(slot.samples[i % window].load(std::memory_order_relaxed));
+    }
+    return res;
+  }
+
+  DspProfiler::Report DspProfiler::report()
+  {
+    std::unique_lock lock(mutex_);
+    Report res;
+    res.blocks = blocks_.load();
+    res.xruns  = nxruns_.load();
+
+    auto block_samples = samples_of(block_slot_);
+    res.block          = stats(block_samples);
+    auto load_samples  = samples_of(load_slot_);
+    res.load           = stats(load_samples);
+    // Stored in hundredths of a percent, and divided by a thousand in `stats`
+    res.load.p50 *= 10;
+    res.load.p99 *= 10;
+    res.load.max *= 10;
+
+    int n = nslots_.load();
+    for (int i = 0; i < n; i++) {
+      auto samples = samples_of(slots_[i]);
+      res.nodes.emplace_back(names_[i], stats(samples));
+    }
+    // Stored in thousandths, which `stats` reads as nanoseconds
+    int ngauges = ngauges_.load();
+    for (int i = 0; i < ngauges; i++) {
+      auto samples = samples_of(gauges_[i]);
+      res.gauges.emplace_back(gauge_names_[i], stats(samples));
+    }
+
+    XrunEvent evt;
+    while (xrun_queue_.try_pop(evt)) {
+      xrun_log_.push_back({evt.block, micros(evt.wall), micros(evt.deadline),
+                           evt.slot >= 0 ? names_[evt.slot] : "", micros(evt.node_time)});
+      if (xrun_log_.size() > xrun_log_size) xrun_log_.pop_front();
+    }
+    res.xrun_log.assign(xrun_log_.begin(), xrun_log_.end());
+    return res;
+  }
+
+  nlohmann::json DspProfiler::to_json()
+  {
+    auto rep  = report();
+    auto json = nlohmann::json::object();
+    json["blocks"] = rep.blocks;
+    json["xruns"]  = rep.xruns;
+    json["block_us"] = audio::to_json(rep.block);
+    json["load_percent"] = audio::to_json(rep.load);
+    auto nodes = nlohmann::json::object();
+    for (auto&& [name, stats] : rep.nodes) {
+      nodes[name] = audio::to_json(stats);
+    }
+    json["nodes_us"] = nodes;
+    auto gauges = nlohmann::json::object();
+    for (auto&& [name, stats] : rep.gauges) {
+      gauges[name] = audio::to_json(stats);
+    }
+    json["gauges"] = gauges;
+    auto xruns = nlohmann::json::array();
+    for (auto&& x : rep.xrun_log) {
+      xruns.push_back({{"block", x.block},
+                       {"wall_us", x.wall},
+                       {"deadline_us", x.deadline},
+                       {"node", x.node},
+                       {"node_us", x.node_time}});
+    }
+    json["xrun_log"] = xruns;
+    return json;
+  }
+
+  void DspProfiler::save(const filesystem::path& path)
+  {
+    auto f = std::ofstream(path.string(), std::ios::trunc);
+    f << std::setw(2) << to_json() << '\n';
+  }
+
+  DspProfiler& dsp_profiler() noexcept
+  {
+    static DspProfiler instance;
+    return instance;
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,167 @@
+/// \file
+/// Always-on timing of the audio graph.
+///
+/// Unlike the timers in `util/timer.hpp`, which must be compiled in, the
+/// [DspProfiler]() is cheap enough to run in every build. The audio thread
+/// only stores durations in fixed ring buffers, and the statistics are
+/// computed when they are read from another thread.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <json.hpp>
+
+#include "util/filesystem.hpp"
+#include "util/spsc_queue.hpp"
+
+namespace otto::core::audio {
+
+  /// Timing of the nodes of the audio graph, and of whole blocks
+  ///
+  /// Nodes are identified by name, so their history survives rebuilding the
+  /// graph.
+  struct DspProfiler {
+    /// The most nodes that can be tracked
+    static constexpr int max_nodes = 32;
+    /// The most gauges that can be tracked
+    static constexpr int max_gauges = 16;
+    /// The number of blocks the statistics are computed over
+    static constexpr int window = 1 << 10;
+    /// The number of xruns kept in the log
+    static constexpr std::size_t xrun_log_size = 64;
+
+    /// Statistics of a duration over the last [window]() blocks, in
+    /// microseconds
+    struct Stats {
+      float p50 = 0;
+      float p99 = 0;
+      float max = 0;
+    };
+
+    /// A block which took longer to process than its duration
+    struct Xrun {
+      /// Number of blocks processed before this one
+      std::uint64_t block;
+      /// Time spent processing the block, in microseconds
+      float wall;
+      /// The duration of the block, in microseconds
+      float deadline;
+      /// The slowest node in the block
+      std::string node;
+      /// Time spent in `node`, in microseconds
+      float node_time;
+    };
+
+    /// A snapshot of all statistics
+    struct Report {
+      std::uint64_t blocks = 0;
+      std::uint64_t xruns  = 0;
+      /// The time spent processing blocks
+      Stats block;
+      /// Processing time as a percentage of the block duration
+      Stats load;
+      std::vector<std::pair<std::string, Stats>> nodes;
+      /// Statistics of the gauges, in their own units
+      std::vector<std::pair<std::string, Stats>> gauges;
+      /// The most recent xruns, oldest first
+      std::vector<Xrun> xrun_log;
+    };
+
+    /// Get the slot which the node `name` is recorded in
+    ///
+    /// Allocates the first time a name is seen, so must not be called from
+    /// the audio thread.
+    /// \returns `-1` if there are more than [max_nodes]() names
+    int slot(std::string_view name);
+
+    /// Record that the node in `slot` spent `duration` processing the
+    /// current block
+    ///
+    /// Called by the audio threads, at most once per slot and block. Ignored
+    /// if `slot` is negative.
+    void record(int slot, std::chrono::nanoseconds duration) noexcept;
+
+    /// Get the slot of the gauge `name`
+    ///
+    /// Gauges track values which are not durations, like the number of voices
+    /// an engine is running. Like [slot](), this must not be called from the
+    /// audio thread.
+    /// \returns `-1` if there are more than [max_gauges]() names
+    int gauge(std::string_view name);
+
+    /// Record the current value of a gauge
+    ///
+    /// Called by the audio threads. Ignored if `gauge` is negative.
+    void record_gauge(int gauge, float value) noexcept;
+
+    /// Finish the current block
+    ///
+    /// Only call this from the audio thread.
+    /// \param wall The time spent processing the block
+    /// \param nframes The number of frames in the block
+    /// \param samplerate Used to compute the deadline of the block
+    void end_block(std::chrono::nanoseconds wall, long nframes, int samplerate) noexcept;
+
+    /// Compute the statistics
+    ///
+    /// Must not be called from the audio thread.
+    Report report();
+
+    /// The [report]() as json
+    nlohmann::json to_json();
+
+    /// Write [to_json]() to `path`
+    void save(const filesystem::path& path);
+
+  private:
+    struct Slot {
+      std::array<std::atomic<std::uint32_t>, window> samples = {};
+      std::atomic<std::uint64_t> count{0};
+      /// The block the last sample was recorded in
+      std::atomic<std::uint64_t> last_block{0};
+    };
+
+    struct XrunEvent {
+      std::uint64_t block;
+      std::uint32_t wall;
+      std::uint32_t deadline;
+      int slot;
+      std::uint32_t node_time;
+    };
+
+    static Stats stats(std::vector<std::uint32_t>& samples);
+    std::vector<std::uint32_t> samples_of(const Slot& slot) const;
+
+    std::array<Slot, max_nodes> slots_;
+    /// Processing time of whole blocks
+    Slot block_slot_;
+    /// Processing time, in hundredths of a percent of the block duration
+    Slot load_slot_;
+    std::atomic<int> nslots_{0};
+    /// Gauge values, in thousandths
+    std::array<Slot, max_gauges> gauges_;
+    std::atomic<int> ngauges_{0};
+    std::atomic<std::uint64_t> blocks_{0};
+    std::atomic<std::uint64_t> nxruns_{0};
+    util::spsc_queue<XrunEvent, 64> xrun_queue_;
+
+    /// Guards the names and the xrun log
+    std::mutex mutex_;
+    std::array<std::string, max_nodes> names_;
+    std::array<std::string, max_gauges> gauge_names_;
+    std::deque<Xrun> xrun_log_;
+  };
+
+  /// The profiler of the audio graph run by [service::engines::process]()
+  DspProfiler& dsp_profiler() noexcept;
+
+} // namespace otto::core::audio
@@ -143,8 +143,9 @@ namespace otto::core::audio {
   ///
   template<int Cin, int Cout>
   class FaustWrapper {
-    // Needed to convert from faust's deinterleaved data to interleaved
-    audio::RTBuffer<float, std::max(Cin, Cout)> faustbuf;
+    // Faust works on separate channels, so interleaved data is converted
+    audio::PlanarBuffer<Cin> planar_in;
+    audio::PlanarBuffer<Cout> planar_out;
   public:
 
     audio::ProcessBuffer<Cout> proc_buf;
@@ -169,30 +170,30 @@ namespace otto::core::audio {
 
     virtual ~FaustWrapper() {}
 
-    audio::ProcessData<Cout> process(audio::ProcessData<Cin> data)
+    /// Process planar audio, without any conversion
+    audio::PlanarData<Cout> process(audio::PlanarData<Cin> data)
     {
-      // Convert interleaved to deinterleaved and back
-      auto size   = data.nframes;
-      auto raw_pb = reinterpret_cast<float*>(proc_buf.data() + data.offset);
-      std::array<float*, Cin> in_bufs =
-        util::generate_array<Cin>([&](int n) { return raw_pb + n * size; });
-      for (int i = 0; i < Cin; i++) {
-        for (int j = 0; j < size; j++) {
-          in_bufs[i][j] = data.audio[j][i];
-        }
-      }
-      std::array<float*, Cout> out_bufs = util::generate_array<Cout>(
-        [&](int n) { return faustbuf.data() + n * size; });
-
-      fDSP->compute(data.nframes, in_bufs.data(), out_bufs.data());
+      auto out = data.redirect(planar_out);
+      fDSP->compute(data.nframes, data.audio.data(), out.audio.data());
+      return out;
+    }
 
-      for (int i = 0; i < Cout; i++) {
-        for (int j = 0; j < size; j++) {
-          proc_buf[j + data.offset][i] = out_bufs[i][j];
-        }
+    audio::ProcessData<Cout> process(audio::ProcessData<Cin> data)
+    {
+      auto out = data.redirect(proc_buf);
+      if constexpr (Cin <= 1 && Cout <= 1) {
+        // Mono frames are already planar
+        std::array<float*, Cin> in_bufs;
+        if constexpr (Cin == 1) in_bufs[0] = audio::as_planar(data).audio[0];
+        std::array<float*, Cout> out_bufs;
+        if constexpr (Cout == 1) out_bufs[0] = audio::as_planar(out).audio[0];
+        fDSP->compute(data.nframes, in_bufs.data(), out_bufs.data());
+      } else {
+        auto in = audio::redirect_planar(data, planar_in);
+        audio::deinterleave(data, in);
+        audio::interleave(process(in), out);
       }
-
-      return data.redirect(proc_buf);
+      return out;
     }
   };
 
@@ -0,0 +1,364 @@
+#include "graph.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "util/audio_kernels.hpp"
+
+namespace otto::core::audio {
+
+  namespace {
+    bool is_identity(ChannelMap map, int src_channels, int dst_channels)
+    {
+      return map.type == ChannelMap::Type::automatic && src_channels == dst_channels;
+    }
+
+    /// Map `src` onto `dst` according to `map`, either overwriting or adding
+    /// to the contents of `dst`
+    void mix_into(float* dst,
+                  int dst_channels,
+                  const float* src,
+                  int src_channels,
+                  ChannelMap map,
+                  long nframes,
+                  bool accumulate)
+    {
+      if (src == nullptr) {
+        if (!accumulate) std::fill_n(dst, dst_channels * nframes, 0.f);
+        return;
+      }
+      if (is_identity(map, src_channels, dst_channels)) {
+        if (accumulate) {
+          util::audio::accumulate(dst, src, src_channels * nframes);
+        } else {
+          std::copy_n(src, src_channels * nframes, dst);
+        }
+        return;
+      }
+      if (dst_channels == 2 && src_channels <= 8) {
+        // StereoGain defaults to unity, and only the mapped channels are heard
+        std::array<util::audio::StereoGain, 8> gains;
+        gains.fill({0, 0});
+        if (map.type == ChannelMap::Type::select) {
+          gains[map.channel] = {1, 1};
+        } else {
+          gains[0 % src_channels].left  = 1;
+          gains[1 % src_channels].right = 1;
+        }
+        util::audio::mix_to_stereo(src, src_channels, dst, nframes, gains.data(), accumulate);
+        return;
+      }
+      for (long f = 0; f < nframes; f++) {
+        const float* in = src + f * src_channels;
+        float* out      = dst + f * dst_channels;
+        for (int c = 0; c < dst_channels; c++) {
+          float val;
+          if (map.type == ChannelMap::Type::select) {
+            val = in[map.channel];
+          } else if (src_channels == dst_channels) {
+            val = in[c];
+          } else if (dst_channels == 1) {
+            val = 0;
+            for (int i = 0; i < src_channels; i++) val += in[i];
+          } else {
+            val = in[c % src_channels];
+          }
+          out[c] = accumulate ? out[c] + val : val;
+        }
+      }
+    }
+  } // namespace
+
+  // ProcessGraph /////////////////////////////////////////////////////////////
+
+  NodeId ProcessGraph::add_raw_node(std::string name,
+                                    int in_channels,
+                                    int out_channels,
+                                    Flags flags,
+                                    detail::RawProcessor process)
+  {
+    nodes_.push_back({std::move(name), in_channels, out_channels, flags, std::move(process)});
+    return nodes_.size() - 1;
+  }
+
+  void ProcessGraph::connect(NodeId from, NodeId to, ChannelMap map)
+  {
+    if (from < 0 || from >= (int) nodes_.size() || to < 0 || to >= (int) nodes_.size()) {
+      throw exception(ErrorCode::no_such_node, "Cannot connect nodes {} -> {}", from, to);
+    }
+    auto& src = nodes_[from];
+    auto& dst = nodes_[to];
+    if (src.out_channels == 0 || dst.in_channels == 0) {
+      throw exception(ErrorCode::channel_mismatch,
+                      "Cannot route audio from '{}' to '{}'", src.name, dst.name);
+    }
+    if (map.type == ChannelMap::Type::select && map.channel >= src.out_channels) {
+      throw exception(ErrorCode::channel_mismatch, "'{}' has no channel {}", src.name,
+                      map.channel);
+    }
+    edges_.push_back({from, to, map});
+  }
+
+  void ProcessGraph::order(NodeId before, NodeId after)
+  {
+    if (before < 0 || before >= (int) nodes_.size() || after < 0 ||
+        after >= (int) nodes_.size()) {
+      throw exception(ErrorCode::no_such_node, "Cannot order nodes {} -> {}", before, after);
+    }
+    edges_.push_back({before, after, ChannelMap::automatic(), false});
+  }
+
+  void ProcessGraph::output(NodeId node)
+  {
+    if (node < 0 || node >= (int) nodes_.size()) {
+      throw exception(ErrorCode::no_such_node, "No node with id {}", node);
+    }
+    output_ = node;
+  }
+
+  std::unique_ptr<CompiledGraph> ProcessGraph::compile(std::size_t max_frames,
+                                                        DspProfiler* profiler) const
+  {
+    if (output_ < 0) {
+      throw exception(ErrorCode::no_output, "No output node set");
+    }
+
+    const int nnodes = nodes_.size();
+
+    // Topological sort. Among the nodes that are ready, the one added first is
+    // scheduled first, so independent nodes keep their declaration order.
+    std::vector<int> indegree(nnodes, 0);
+    std::vector<int> consumers(nnodes, 0);
+    for (auto&& e : edges_) {
+      indegree[e.to]++;
+      if (e.carries_audio) consumers[e.from]++;
+    }
+
+    std::vector<NodeId> order;
+    std::vector<int> position(nnodes, -1);
+    order.reserve(nnodes);
+    while ((int) order.size() < nnodes) {
+      auto next = std::find_if(indegree.begin(), indegree.end(), [](int d) { return d == 0; });
+      if (next == indegree.end()) {
+        throw exception(ErrorCode::cycle, "The process graph has a cycle");
+      }
+      NodeId id = next - indegree.begin();
+      *next     = -1;
+      position[id] = order.size();
+      order.push_back(id);
+      for (auto&& e : edges_) {
+        if (e.from == id) indegree[e.to]--;
+      }
+    }
+
+    auto res = std::unique_ptr<CompiledGraph>(new CompiledGraph(max_frames));
+    res->steps_.reserve(nnodes);
+    res->outputs_.resize(nnodes, nullptr);
+    res->silent_.resize(nnodes, false);
+
+    // Offsets into the arena, resolved to pointers once it is allocated
+    std::vector<long> offsets(nnodes, -1);
+    long arena_size = 0;
+
+    for (NodeId id : order) {
+      auto& node = nodes_[id];
+      CompiledGraph::Step step{node};
+      step.is_input = id == input_;
+      if (profiler != nullptr && !step.is_input) step.profile_slot = profiler->slot(node.name);
+
+      std::vector<const Edge*> incoming;
+      for (auto&& e : edges_) {
+        if (e.to == id && e.carries_audio) incoming.push_back(&e);
+      }
+
+      bool may_alias = incoming.size() == 1;
+      if (may_alias) {
+        auto& e  = *incoming.front();
+        may_alias = is_identity(e.map, nodes_[e.from].out_channels, node.in_channels);
+        if (node.flags == Flags::in_place && consumers[e.from] > 1) may_alias = false;
+      }
+
+      if (may_alias) {
+        step.alias = position[incoming.front()->from];
+      } else if (node.in_channels > 0) {
+        step.sources_begin = res->sources_.size();
+        for (auto* e : incoming) {
+          res->sources_.push_back({position[e->from], e->map});
+        }
+        step.sources_end       = res->sources_.size();
+        offsets[position[id]] = arena_size;
+        arena_size += node.in_channels * max_frames;
+      }
+      res->steps_.push_back(std::move(step));
+    }
+
+    res->arena_.resize(arena_size);
+    for (int i = 0; i < nnodes; i++) {
+      if (offsets[i] >= 0) res->steps_[i].buffer = res->arena_.data() + offsets[i];
+    }
+    res->output_step_ = position[output_];
+    res->profiler_    = profiler;
+
+    // A step runs one level after the latest step it depends on
+    std::vector<int> level(nnodes, 0);
+    int nlevels = nnodes > 0 ? 1 : 0;
+    for (int i = 0; i < nnodes; i++) {
+      for (auto&& e : edges_) {
+        if (position[e.to] == i) level[i] = std::max(level[i], level[position[e.from]] + 1);
+      }
+      nlevels = std::max(nlevels, level[i] + 1);
+    }
+    res->level_order_.resize(nnodes);
+    for (int i = 0; i < nnodes; i++) res->level_order_[i] = i;
+    std::stable_sort(res->level_order_.begin(), res->level_order_.end(),
+                     [&](int a, int b) { return level[a] < level[b]; });
+    for (int l = 0, i = 0; l < nlevels; l++) {
+      while (i < nnodes && level[res->level_order_[i]] == l) i++;
+      res->level_ends_.push_back(i);
+    }
+    return res;
+  }
+
+  // CompiledGraph ////////////////////////////////////////////////////////////
+
+  float* CompiledGraph::run(float* external_in,
+                            bool external_silent,
+                            ProcessData<0> block,
+                            WorkerPool* pool)
+  {
+    using clock = std::chrono::steady_clock;
+    auto start  = clock::now();
+
+    external_in_            = external_in;
+    external_silent_        = external_silent;
+    block_                  = block;
+    report_.parallel_levels = 0;
+
+    if (pool == nullptr || pool->workers() == 0) {
+      for (std::size_t i = 0; i < steps_.size(); i++) {
+        run_step(i);
+      }
+    } else {
+      level_begin_ = 0;
+      for (int end : level_ends_) {
+        int nsteps = end - level_begin_;
+        if (nsteps == 1) {
+          run_step(level_order_[level_begin_]);
+        } else {
+          report_.parallel_levels++;
+          pool->run(nsteps,
+                    [](void* context, int index) {
+                      auto& self = *static_cast<CompiledGraph*>(context);
+                      self.run_step(self.level_order_[self.level_begin_ + index]);
+                    },
+                    this);
+        }
+        level_begin_ = end;
+      }
+    }
+
+    report_.wall = clock::now() - start;
+    report_.work = {};
+    for (auto&& step : steps_) {
+      report_.work += step.duration;
+    }
+    report_.speedup =
+      report_.wall.count() > 0 ? float(report_.work.count()) / report_.wall.count() : 1.f;
+
+    return outputs_[output_step_];
+  }
+
+  void CompiledGraph::run_step(int index) noexcept
+  {
+    using clock = std::chrono::steady_clock;
+    auto start  = clock::now();
+
+    auto& step         = steps_[index];
+    const long nframes = block_.nframes;
+    if (step.is_input) {
+      outputs_[index] = external_in_;
+      silent_[index]  = external_silent_;
+      step.duration   = {};
+      return;
+    }
+
+    float* in   = nullptr;
+    bool silent = false;
+    if (step.alias >= 0) {
+      in     = outputs_[step.alias];
+      silent = silent_[step.alias];
+    } else if (step.buffer != nullptr) {
+      in     = step.buffer;
+      silent = true;
+      for (int s = step.sources_begin; s < step.sources_end; s++) {
+        auto& src = sources_[s];
+        if (silent_[src.step]) continue;
+        mix_into(in, step.node.in_channels, outputs_[src.step],
+                 steps_[src.step].node.out_channels, src.map, nframes, !silent);
+        silent = false;
+      }
+      if (silent) std::fill_n(in, step.node.in_channels * nframes, 0.f);
+    }
+
+    outputs_[index] = step.node.process(in, silent, block_);
+    silent_[index]  = silent;
+    step.duration   = clock::now() - start;
+    if (profiler_ != nullptr) profiler_->record(step.profile_slot, step.duration);
+  }
+
+  std::vector<std::string> CompiledGraph::schedule() const
+  {
+    std::vector<std::string> res;
+    res.reserve(steps_.size());
+    for (auto&& step : steps_) {
+      res.push_back(step.node.name);
+    }
+    return res;
+  }
+
+  std::vector<std::vector<std::string>> CompiledGraph::levels() const
+  {
+    std::vector<std::vector<std::string>> res;
+    int begin = 0;
+    for (int end : level_ends_) {
+      auto& level = res.emplace_back();
+      for (int i = begin; i < end; i++) {
+        level.push_back(steps_[level_order_[i]].node.name);
+      }
+      begin = end;
+    }
+    return res;
+  }
+
+  // GraphSwap ////////////////////////////////////////////////////////////////
+
+  GraphSwap::~GraphSwap()
+  {
+    delete current_;
+    delete pending_.exchange(nullptr);
+    delete retired_.exchange(nullptr);
+  }
+
+  void GraphSwap::replace(std::unique_ptr<CompiledGraph> graph)
+  {
+    std::unique_lock lock(mutex_);
+    // A graph that was never picked up by the audio thread can be deleted
+    // right away
+    delete pending_.exchange(graph.release());
+    delete retired_.exchange(nullptr);
+  }
+
+  CompiledGraph* GraphSwap::acquire() noexcept
+  {
+    // Only pick up a new graph when the last retired one has been deleted, so
+    // there is never more than one graph waiting for the other side.
+    if (retired_.load() == nullptr) {
+      if (auto* next = pending_.exchange(nullptr); next != nullptr) {
+        retired_.store(current_);
+        current_ = next;
+      }
+    }
+    return current_;
+  }
+
+} // namespace otto::core::audio
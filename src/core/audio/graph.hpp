@@ -0,0 +1,366 @@
+/// \file
+/// The audio routing graph.
+///
+/// Routing is described declaratively with a [ProcessGraph](), where nodes
+/// are audio processors and edges carry the output of one node to the input
+/// of another. The description is compiled once into a [CompiledGraph](),
+/// a flat, topologically sorted schedule with all intermediate buffers
+/// preallocated, which is what runs on the audio thread.
+///
+/// Compilation allocates, so it must happen off the audio thread. The result
+/// is handed to the audio thread through a [GraphSwap](), which never locks
+/// or frees memory on the audio side.
+///
+/// Nodes which do not depend on each other may run concurrently on a
+/// [WorkerPool](). Nodes that share state without sharing audio must be
+/// ordered explicitly with [ProcessGraph::order]().
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/audio/dsp_profiler.hpp"
+#include "core/audio/processor.hpp"
+#include "core/audio/worker_pool.hpp"
+#include "util/dyn-array.hpp"
+#include "util/exception.hpp"
+
+namespace otto::core::audio {
+
+  /// Identifies a node in a [ProcessGraph]()
+  using NodeId = int;
+
+  /// How the channels of an edge are mapped onto the input it connects to
+  struct ChannelMap {
+    enum struct Type {
+      /// Identity if the channel counts match. Mono is copied to all channels,
+      /// anything routed to a mono input is summed, and otherwise channel `i`
+      /// is read from source channel `i % source_channels`
+      automatic,
+      /// Route a single source channel to all input channels
+      select,
+    } type = Type::automatic;
+
+    int channel = 0;
+
+    static ChannelMap automatic() noexcept
+    {
+      return {Type::automatic, 0};
+    }
+
+    static ChannelMap select(int channel) noexcept
+    {
+      return {Type::select, channel};
+    }
+  };
+
+  namespace detail {
+    /// Type erased node processor.
+    ///
+    /// Called with the interleaved input buffer (or `nullptr` for nodes
+    /// without audio input), whether the input is [ProcessData::silent](), and
+    /// a midi-only view of the block. Returns the interleaved output buffer,
+    /// which must stay valid for the rest of the block, and sets `silent` to
+    /// whether the output is.
+    using RawProcessor = std::function<float*(float*, bool& silent, ProcessData<0>)>;
+
+    template<int N>
+    ProcessData<N> as_process_data(float* audio, bool silent, ProcessData<0> block)
+    {
+      if constexpr (N == 0) {
+        return block;
+      } else {
+        return {{reinterpret_cast<std::array<float, N>*>(audio), block.nframes},
+                block.midi,
+                block.nframes,
+                0,
+                silent};
+      }
+    }
+  } // namespace detail
+
+  struct CompiledGraph;
+
+  /// A declarative description of the audio routing.
+  ///
+  /// Nodes have a single audio input with `Nin` channels and produce a single
+  /// output with `Nout` channels, just like the `process` member functions of
+  /// the engines. All nodes receive the midi of the current block.
+  ///
+  /// An input may have any number of incoming edges. With a single edge whose
+  /// channels map directly, the node reads straight from the output buffer of
+  /// the source. Otherwise the edges are mixed into a buffer owned by the
+  /// compiled graph. Sources marked [ProcessData::silent]() are not mixed, and
+  /// an input whose sources are all silent is cleared and marked silent.
+  struct ProcessGraph {
+
+    enum struct ErrorCode {
+      none = 0,
+      no_such_node,
+      channel_mismatch,
+      cycle,
+      no_output,
+    };
+
+    using exception = util::as_exception<ErrorCode>;
+
+    /// Node flags
+    enum struct Flags {
+      none = 0,
+      /// The node may write to its input buffer.
+      ///
+      /// If the source of the input is read by other nodes too, the input is
+      /// copied to a private buffer first.
+      in_place = 1,
+    };
+
+    /// Add a node.
+    ///
+    /// \param process Invocable as `ProcessData<Nout>(ProcessData<Nin>)`.
+    /// It is copied into the compiled graph, and invoked on the audio thread.
+    /// \returns The id of the new node
+    template<int Nin, int Nout, typename Func>
+    NodeId add_node(std::string name, Func&& process, Flags flags = Flags::none)
+    {
+      return add_raw_node(
+        std::move(name), Nin, Nout, flags,
+        [f = std::forward<Func>(process)](float* in, bool& silent,
+                                          ProcessData<0> block) mutable -> float* {
+          auto out = f(detail::as_process_data<Nin>(in, silent, block));
+          silent   = out.silent;
+          if constexpr (Nout == 0) {
+            return nullptr;
+          } else {
+            return reinterpret_cast<float*>(out.audio.data());
+          }
+        });
+    }
+
+    /// Add a node which passes its input through unchanged.
+    ///
+    /// Useful as a summing point for several routes.
+    template<int N>
+    NodeId add_bus(std::string name)
+    {
+      return add_node<N, N>(std::move(name), [](ProcessData<N> data) { return data; });
+    }
+
+    /// Add the node which represents the external input of the graph
+    ///
+    /// Its output is the audio passed to [CompiledGraph::process]()
+    template<int N>
+    NodeId add_input(std::string name)
+    {
+      input_ = add_raw_node(std::move(name), 0, N, Flags::none, nullptr);
+      return input_;
+    }
+
+    /// Route the output of `from` to the input of `to`
+    void connect(NodeId from, NodeId to, ChannelMap map = ChannelMap::automatic());
+
+    /// Run `after` after `before`, without routing any audio between them
+    void order(NodeId before, NodeId after);
+
+    /// Set the node whose output is the output of the graph
+    void output(NodeId node);
+
+    /// Compile the graph into a schedule.
+    ///
+    /// Nodes which do not depend on each other are scheduled in the order they
+    /// were added.
+    ///
+    /// \param max_frames The largest block size the graph will be run with.
+    /// All intermediate buffers are allocated for this size.
+    /// \param profiler If not `nullptr`, the time spent in each node is
+    /// recorded in it, under the name of the node.
+    /// \throws [exception]() if the graph has a cycle, an edge is connected to
+    /// a node without audio input, or no output has been set.
+    std::unique_ptr<CompiledGraph> compile(std::size_t max_frames,
+                                           DspProfiler* profiler = nullptr) const;
+
+  private:
+    friend struct CompiledGraph;
+
+    struct Node {
+      std::string name;
+      int in_channels;
+      int out_channels;
+      Flags flags;
+      detail::RawProcessor process;
+    };
+
+    struct Edge {
+      NodeId from;
+      NodeId to;
+      ChannelMap map;
+      bool carries_audio = true;
+    };
+
+    NodeId add_raw_node(std::string name,
+                        int in_channels,
+                        int out_channels,
+                        Flags flags,
+                        detail::RawProcessor process);
+
+    std::vector<Node> nodes_;
+    std::vector<Edge> edges_;
+    NodeId input_  = -1;
+    NodeId output_ = -1;
+  };
+
+  /// A [ProcessGraph]() compiled into a flat schedule.
+  ///
+  /// Running it does not allocate, lock or branch on the routing, apart from
+  /// walking the precomputed schedule.
+  ///
+  /// The schedule is also split into levels, where all nodes of a level only
+  /// depend on nodes of earlier levels. When run with a [WorkerPool](), the
+  /// nodes of each level are run concurrently, and joined before the next.
+  struct CompiledGraph {
+
+    /// Timing of the last processed block
+    struct Report {
+      /// Wall time of the whole block
+      std::chrono::nanoseconds wall{0};
+      /// Sum of the time spent in each node
+      std::chrono::nanoseconds work{0};
+      /// `work / wall`. Approximately 1 when run serially
+      float speedup = 1;
+      /// Number of levels which had more than one node to run in parallel
+      int parallel_levels = 0;
+    };
+
+    /// Run all nodes in the schedule
+    ///
+    /// \param pool If not `nullptr`, and it has workers, independent nodes are
+    /// run on it concurrently. Otherwise all nodes run serially on the calling
+    /// thread.
+    /// \requires `Nin` is the channel count of the graph input (if any),
+    /// `Nout` is the channel count of the graph output, and
+    /// `external_in.nframes` is at most the `max_frames` the graph was compiled
+    /// with.
+    template<int Nin, int Nout>
+    ProcessData<Nout> process(ProcessData<Nin> external_in, WorkerPool* pool = nullptr)
+    {
+      auto block = external_in.midi_only();
+      float* in  = nullptr;
+      if constexpr (Nin != 0) {
+        in = reinterpret_cast<float*>(external_in.audio.data());
+      }
+      float* out = run(in, external_in.silent, block, pool);
+      return detail::as_process_data<Nout>(out, silent_[output_step_], block);
+    }
+
+    /// The names of the nodes, in the order they are run serially
+    std::vector<std::string> schedule() const;
+
+    /// The names of the nodes, grouped by the levels they run in parallel
+    std::vector<std::vector<std::string>> levels() const;
+
+    /// Timing of the last processed block.
+    ///
+    /// Only valid on the thread calling [process]()
+    const Report& report() const noexcept
+    {
+      return report_;
+    }
+
+    std::size_t max_frames() const noexcept
+    {
+      return max_frames_;
+    }
+
+  private:
+    friend struct ProcessGraph;
+
+    /// An edge into a mixed input
+    struct Source {
+      int step;
+      ChannelMap map;
+    };
+
+    struct Step {
+      ProcessGraph::Node node;
+      /// Index of the step whose output is read directly, or `-1`
+      int alias = -1;
+      /// Range in `sources_` which is mixed into `buffer`
+      int sources_begin = 0;
+      int sources_end   = 0;
+      /// Preallocated input buffer, `nullptr` if the input is aliased
+      float* buffer = nullptr;
+      bool is_input = false;
+      /// Time spent in the node in the last block
+      std::chrono::nanoseconds duration{0};
+      /// The slot of the node in `profiler_`
+      int profile_slot = -1;
+    };
+
+    CompiledGraph(std::size_t max_frames) : max_frames_(max_frames), arena_(0) {}
+
+    float* run(float* external_in, bool external_silent, ProcessData<0> block, WorkerPool* pool);
+    void run_step(int index) noexcept;
+
+    std::size_t max_frames_;
+    std::vector<Step> steps_;
+    std::vector<Source> sources_;
+    /// The output buffers of each step for the current block
+    std::vector<float*> outputs_;
+    /// Whether each output is silent. Not `vector<bool>`, as the steps write
+    /// to it concurrently.
+    std::vector<char> silent_;
+    /// Backing storage of all input buffers
+    util::dyn_array<float> arena_;
+    int output_step_ = -1;
+    DspProfiler* profiler_ = nullptr;
+
+    /// Step indices sorted by level
+    std::vector<int> level_order_;
+    /// End of each level in `level_order_`
+    std::vector<int> level_ends_;
+
+    // State of the current block, for the jobs run on the worker pool
+    float* external_in_ = nullptr;
+    bool external_silent_ = false;
+    ProcessData<0> block_ = {{nullptr, nullptr}, {nullptr, nullptr}, 0};
+    int level_begin_      = 0;
+
+    Report report_;
+  };
+
+  /// Hands [CompiledGraph]()s over to the audio thread.
+  ///
+  /// The audio thread only ever does atomic exchanges. A graph it has
+  /// stopped using is retired, and only deleted by the next call to
+  /// [replace](), or with the `GraphSwap`. Until then it takes its memory,
+  /// which is fine as graphs are only replaced when the routing changes.
+  struct GraphSwap {
+    GraphSwap() = default;
+    GraphSwap(const GraphSwap&) = delete;
+    ~GraphSwap();
+
+    /// Queue `graph` to be picked up at the start of the next block.
+    ///
+    /// Must not be called from the audio thread while it processes a block,
+    /// as it frees memory and may wait for other callers.
+    void replace(std::unique_ptr<CompiledGraph> graph);
+
+    /// Get the graph to run for this block.
+    ///
+    /// Only call this from the audio thread.
+    /// \returns `nullptr` if no graph has been set yet
+    CompiledGraph* acquire() noexcept;
+
+  private:
+    CompiledGraph* current_ = nullptr;
+    std::atomic<CompiledGraph*> pending_{nullptr};
+    std::atomic<CompiledGraph*> retired_{nullptr};
+    std::mutex mutex_;
+  };
+
+} // namespace otto::core::audio
@@ -0,0 +1,81 @@
+#include "latency_tuner.hpp"
+
+namespace otto::core::audio {
+
+  LatencyTuner::Config LatencyTuner::Limits::clamp(Config config) const noexcept
+  {
+    config.period_size = std::clamp(config.period_size, min_period_size, max_period_size);
+    config.periods     = std::clamp(config.periods, min_periods, max_periods);
+    return config;
+  }
+
+  LatencyTuner::LatencyTuner(Config start, Limits limits, int samplerate) noexcept
+    : config_(limits.clamp(start)), limits_(limits), samplerate_(samplerate)
+  {}
+
+  bool LatencyTuner::period(float load) noexcept
+  {
+    float duration = float(config_.period_size) / samplerate_;
+    time_ += duration;
+    elapsed_ += duration;
+    peak_load_ = std::max(peak_load_, load);
+    if (elapsed_ < settle_time) return false;
+
+    if (failed_latency_ > 0 && time_ - failed_at_ > failure_memory) failed_latency_ = 0;
+
+    if (xruns_ == 0) {
+      // Remove a period first, as it is the smallest step. Halving the
+      // period makes the overhead of each block count twice as much, so it
+      // needs more headroom.
+      Config fewer  = {config_.period_size, config_.periods - 1};
+      Config halved = {config_.period_size / 2, config_.periods};
+      for (auto next : {fewer, halved}) {
+        if (next != limits_.clamp(next) || next.latency() <= failed_latency_) continue;
+        if (next.period_size < config_.period_size && peak_load_ >= low_load) continue;
+        change(next);
+        return true;
+      }
+    }
+
+    // Start a new evaluation of the current configuration
+    elapsed_   = 0;
+    xruns_     = 0;
+    peak_load_ = 0;
+    return false;
+  }
+
+  bool LatencyTuner::xrun() noexcept
+  {
+    xruns_++;
+    // A single xrun in a window of 1 / target_xrun_rate minutes is at the
+    // target rate, a second one is above it
+    double since_last = time_ - last_xrun_;
+    last_xrun_        = time_;
+    if (since_last * target_xrun_rate >= 60) return false;
+
+    failed_latency_ = std::max(failed_latency_, config_.latency());
+    failed_at_      = time_;
+    Config doubled  = {config_.period_size * 2, config_.periods};
+    Config more     = {config_.period_size, config_.periods + 1};
+    bool can_double = doubled == limits_.clamp(doubled);
+    bool can_add    = more == limits_.clamp(more);
+    if (can_double && (peak_load_ > high_load || !can_add)) {
+      change(doubled);
+    } else if (can_add) {
+      change(more);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void LatencyTuner::change(Config config) noexcept
+  {
+    config_    = config;
+    last_xrun_ = -std::numeric_limits<double>::infinity();
+    elapsed_   = 0;
+    xruns_     = 0;
+    peak_load_ = 0;
+  }
+
+} // namespace otto::core::audio
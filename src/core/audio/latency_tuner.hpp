@@ -0,0 +1,131 @@
+/// \file
+/// Choosing the period size and count of an audio device at runtime.
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include <json.hpp>
+
+#include "core/audio/buffer_arena.hpp"
+
+namespace otto::core::audio {
+
+  /// Steps the period configuration of an audio device towards the lowest
+  /// latency it can sustain
+  ///
+  /// The driver reports the load of each period it processes, and each xrun.
+  /// When xruns happen more often than [target_xrun_rate](), that is, two of
+  /// them within `1 / target_xrun_rate` minutes, the latency is raised: by
+  /// doubling the period if processing came close to its deadline, as blocks
+  /// take too long, or by adding a period otherwise, as the audio thread was
+  /// woken too late. When a configuration runs for [settle_time]() without
+  /// xruns, the latency is lowered a step, but not to the latency of a
+  /// configuration that had too many xruns in the last [failure_memory]().
+  struct LatencyTuner {
+    /// A period configuration
+    struct Config {
+      /// In frames
+      int period_size = 256;
+      int periods     = 2;
+
+      /// In frames
+      int latency() const noexcept
+      {
+        return period_size * periods;
+      }
+
+      bool operator==(const Config& rhs) const noexcept
+      {
+        return period_size == rhs.period_size && periods == rhs.periods;
+      }
+
+      bool operator!=(const Config& rhs) const noexcept
+      {
+        return !(*this == rhs);
+      }
+    };
+
+    /// The configurations the device, and OTTO, support
+    struct Limits {
+      int min_period_size = 16;
+      int max_period_size = max_block_size;
+      int min_periods     = 2;
+      int max_periods     = 8;
+
+      /// The closest configuration within the limits
+      Config clamp(Config config) const noexcept;
+    };
+
+    LatencyTuner(Config start, Limits limits, int samplerate) noexcept;
+
+    /// Xruns per minute that are tolerated
+    float target_xrun_rate = 0.5f;
+    /// The load above which the period is considered too short
+    float high_load = 0.8f;
+    /// The highest load at which the period may be halved
+    float low_load = 0.4f;
+    /// Seconds a configuration has to run before the latency is lowered
+    float settle_time = 30;
+    /// Seconds after which a latency that had too many xruns may be tried
+    /// again
+    float failure_memory = 600;
+
+    /// Report a processed period
+    ///
+    /// \param load The time it took to process the period, divided by its
+    /// duration
+    /// \returns Whether [config]() changed
+    bool period(float load) noexcept;
+
+    /// Report an xrun
+    ///
+    /// \returns Whether [config]() changed
+    bool xrun() noexcept;
+
+    /// The configuration to use
+    const Config& config() const noexcept
+    {
+      return config_;
+    }
+
+    const Limits& limits() const noexcept
+    {
+      return limits_;
+    }
+
+  private:
+    void change(Config config) noexcept;
+
+    Config config_;
+    Limits limits_;
+    int samplerate_;
+
+    /// Seconds of audio since the start
+    double time_ = 0;
+    /// Seconds of audio since the last change, or the last evaluation
+    float elapsed_ = 0;
+    /// Xruns since the last change, or the last evaluation
+    int xruns_ = 0;
+    float peak_load_ = 0;
+    /// The [time_]() of the last xrun of the current configuration
+    double last_xrun_ = -std::numeric_limits<double>::infinity();
+    /// The highest latency that had too many xruns
+    int failed_latency_ = 0;
+    /// The [time_]() [failed_latency_]() last had too many xruns
+    double failed_at_ = 0;
+  };
+
+  inline void to_json(nlohmann::json& j, const LatencyTuner::Config& config)
+  {
+    j = {{"period_size", config.period_size}, {"periods", config.periods}};
+  }
+
+  inline void from_json(const nlohmann::json& j, LatencyTuner::Config& config)
+  {
+    config.period_size = j.value("period_size", config.period_size);
+    config.periods     = j.value("periods", config.periods);
+  }
+
+} // namespace otto::core::audio
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
 #include <gsl/gsl>
-#include <variant.hpp>
 
 #include "util/algorithm.hpp"
 #include "util/exception.hpp"
@@ -45,75 +48,271 @@ namespace otto::core::midi {
   }
 
 
-  struct MidiEvent {
-    static constexpr std::size_t max_data_size = 2;
-    using byte = unsigned char;
+  /// A midi message, timestamped within a block
+  ///
+  /// Trivially copyable and 8 bytes large, so the events of a block can be
+  /// kept in preallocated buffers, and consumers dispatch on [type]() with a
+  /// plain switch.
+  struct Event {
+    using byte = std::uint8_t;
 
-    enum class Type {
-      NoteOff = 0b1000,
-      NoteOn = 0b1001,
-      ControlChange = 0b1011,
+    /// The status byte of the message, without the channel
+    enum struct Type : byte {
+      None = 0x00,
+
+      // Channel messages
+      NoteOff = 0x80,
+      NoteOn = 0x90,
+      PolyAftertouch = 0xA0,
+      ControlChange = 0xB0,
+      ProgramChange = 0xC0,
+      ChannelAftertouch = 0xD0,
+      PitchBend = 0xE0,
+
+      // System common messages
+      SysEx = 0xF0,
+      TimeCode = 0xF1,
+      SongPosition = 0xF2,
+      SongSelect = 0xF3,
+      TuneRequest = 0xF6,
+
+      // System realtime messages
+      Clock = 0xF8,
+      Start = 0xFA,
+      Continue = 0xFB,
+      Stop = 0xFC,
+      ActiveSensing = 0xFE,
+      Reset = 0xFF,
     };
 
-    Type type;
+    Type type = Type::None;
+    /// The channel of channel messages, in `[0, 16)`
+    byte channel = 0;
+    /// The data bytes. For [Type::SysEx](), the index of the message in
+    /// [EventBuffer::sysex]()
+    std::array<byte, 2> data = {};
+    /// The frame in the current block at which the event occurs
+    std::int32_t time = 0;
 
-    std::array<byte, max_data_size> data;
-    int channel;
-    int time;
-  };
+    /// Whether the message belongs to a channel
+    constexpr bool is_channel_message() const noexcept
+    {
+      return type >= Type::NoteOff && type < Type::SysEx;
+    }
+
+    /// The key of note and polyphonic aftertouch messages
+    constexpr int key() const noexcept
+    {
+      return data[0];
+    }
+
+    /// The velocity of note messages
+    constexpr int velocity() const noexcept
+    {
+      return data[1];
+    }
+
+    constexpr int controller() const noexcept
+    {
+      return data[0];
+    }
+
+    /// The value of control changes
+    constexpr int value() const noexcept
+    {
+      return data[1];
+    }
+
+    constexpr int program() const noexcept
+    {
+      return data[0];
+    }
 
-  struct NoteEvent : MidiEvent {
-    byte key = data[0];
-    byte velocity = data[1];
+    /// The pressure of aftertouch messages
+    constexpr int pressure() const noexcept
+    {
+      return type == Type::PolyAftertouch ? data[1] : data[0];
+    }
+
+    /// The 14 bit value of pitch bends and song positions
+    constexpr int value14() const noexcept
+    {
+      return data[0] | (data[1] << 7);
+    }
+
+    /// The pitch bend, in `[-8192, 8192)`
+    constexpr int bend() const noexcept
+    {
+      return value14() - 8192;
+    }
+
+    constexpr std::size_t sysex_index() const noexcept
+    {
+      return data[0] | (data[1] << 8);
+    }
+  };
 
-    constexpr NoteEvent(const MidiEvent& event) noexcept : MidiEvent(event) {}
+  static_assert(std::is_trivially_copyable_v<Event>);
+  static_assert(sizeof(Event) == 8);
 
+  struct NoteEvent : Event {
     /// Construct a NoteEvent from a type, note as string, and optional velocity
     /// and channels
     ///
-    /// \throws `util::exception` if `note` is not in `detail::note_names`
-    constexpr NoteEvent(MidiEvent::Type type,
+    /// \requires `note` is in `detail::note_names`
+    constexpr NoteEvent(Event::Type type,
                         std::string_view note,
                         float velocity = 1,
                         byte channel = 0)
       : NoteEvent(type, note_number(note), velocity, channel)
     {}
 
-    /// Construct a NoteEvent from a type, note as string, and optional velocity
+    /// Construct a NoteEvent from a type, note number, and optional velocity
     /// and channels
-    ///
-    /// \throws `util::exception` if `note` is not in `detail::note_names`
-    constexpr NoteEvent(MidiEvent::Type type, int note, float velocity = 1, byte channel = 0)
-      : MidiEvent{type, {}, channel, 0},
-        key{gsl::narrow_cast<byte>(note)},
-        velocity{gsl::narrow_cast<byte>(std::min(127.f, velocity * 127))}
+    constexpr NoteEvent(Event::Type type, int note, float velocity = 1, byte channel = 0)
+      : Event{type,
+              channel,
+              {{gsl::narrow_cast<byte>(note),
+                gsl::narrow_cast<byte>(std::min(127.f, velocity * 127))}},
+              0}
     {}
   };
 
   struct NoteOnEvent : NoteEvent {
-    NoteOnEvent(const MidiEvent& event) : NoteEvent(event){};
-
     constexpr NoteOnEvent(int note, float velocity = 1.f, byte channel = 0)
-      : NoteEvent{MidiEvent::Type::NoteOn, note, velocity, channel}
+      : NoteEvent{Event::Type::NoteOn, note, velocity, channel}
     {}
   };
 
   struct NoteOffEvent : NoteEvent {
-    NoteOffEvent(const MidiEvent& event) : NoteEvent(event){};
-
     constexpr NoteOffEvent(int note, float velocity = 1, byte channel = 0)
-      : NoteEvent{MidiEvent::Type::NoteOff, note, velocity, channel}
+      : NoteEvent{Event::Type::NoteOff, note, velocity, channel}
     {}
   };
 
-  struct ControlChangeEvent : public MidiEvent {
-    int controler = data[0];
-    int value = data[1];
-
-    ControlChangeEvent(const MidiEvent& event) : MidiEvent(event){};
+  struct ControlChangeEvent : Event {
+    constexpr ControlChangeEvent(int controller, int value, byte channel = 0)
+      : Event{Event::Type::ControlChange,
+              channel,
+              {{gsl::narrow_cast<byte>(controller), gsl::narrow_cast<byte>(value)}},
+              0}
+    {}
   };
 
-  using AnyMidiEvent = mpark::variant<NoteOnEvent, NoteOffEvent, ControlChangeEvent>;
+  /// The frame in the current block at which the event occurs
+  constexpr int event_time(const Event& event) noexcept
+  {
+    return event.time;
+  }
+
+  /// Preallocated storage for the midi events of a block
+  ///
+  /// Nothing allocates after construction, so it can be filled on the audio
+  /// thread. Events that do not fit are dropped, and counted in
+  /// [overflows]().
+  ///
+  /// \tparam Capacity The maximum number of events
+  /// \tparam SysexCapacity The maximum total size of the system exclusive
+  /// messages, in bytes
+  template<std::size_t Capacity = 256, std::size_t SysexCapacity = 1024>
+  struct EventBuffer {
+    using byte = Event::byte;
+
+    static constexpr std::size_t capacity = Capacity;
+    static constexpr std::size_t sysex_capacity = SysexCapacity;
+
+    /// Append `event`
+    ///
+    /// \returns `false` if the buffer is full, and `event` was dropped
+    bool push(const Event& event) noexcept
+    {
+      if (size_ == Capacity) {
+        overflows_++;
+        return false;
+      }
+      events_[size_++] = event;
+      return true;
+    }
+
+    /// Store a complete system exclusive message, and append its event
+    ///
+    /// \param message The message, from `0xF0` up to and including `0xF7`
+    /// \returns `false` if the buffer is full, and the message was dropped
+    bool push_sysex(gsl::span<const byte> message, int time) noexcept
+    {
+      if (size_ == Capacity || nsysex_ == Capacity ||
+          std::size_t(message.size()) > SysexCapacity - sysex_size_) {
+        overflows_++;
+        return false;
+      }
+      auto index = nsysex_++;
+      sysex_[index] = {sysex_size_, std::size_t(message.size())};
+      std::copy(message.begin(), message.end(), sysex_data_.begin() + sysex_size_);
+      sysex_size_ += message.size();
+      Event event;
+      event.type = Event::Type::SysEx;
+      event.data = {{byte(index & 0xFF), byte(index >> 8)}};
+      event.time = time;
+      events_[size_++] = event;
+      return true;
+    }
+
+    /// The message of a [Event::Type::SysEx]() event in this buffer
+    gsl::span<const byte> sysex(const Event& event) const noexcept
+    {
+      auto [offset, size] = sysex_[event.sysex_index()];
+      return {sysex_data_.data() + offset, std::ptrdiff_t(size)};
+    }
+
+    gsl::span<Event> events() noexcept
+    {
+      return {events_.data(), std::ptrdiff_t(size_)};
+    }
+
+    gsl::span<const Event> events() const noexcept
+    {
+      return {events_.data(), std::ptrdiff_t(size_)};
+    }
+
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+
+    /// Remove all events. The overflow count is kept.
+    void clear() noexcept
+    {
+      size_       = 0;
+      nsysex_     = 0;
+      sysex_size_ = 0;
+    }
+
+    /// The number of events dropped because the buffer was full, since it
+    /// was constructed
+    std::size_t overflows() const noexcept
+    {
+      return overflows_;
+    }
+
+  private:
+    struct SysexRange {
+      std::size_t offset;
+      std::size_t size;
+    };
+
+    std::array<Event, Capacity> events_;
+    std::size_t size_ = 0;
+    std::array<SysexRange, Capacity> sysex_;
+    std::size_t nsysex_ = 0;
+    std::array<byte, SysexCapacity> sysex_data_;
+    std::size_t sysex_size_ = 0;
+    std::size_t overflows_ = 0;
+  };
 
   inline void generateFreqTable(float tuning = 440)
   {
@@ -0,0 +1,151 @@
+#include "midi_parser.hpp"
+
+namespace otto::core::midi {
+
+  namespace {
+    /// The number of data bytes of messages with `status`, or -1 if it is not
+    /// a valid status of a message with data
+    int data_size(Event::byte status) noexcept
+    {
+      switch (status & 0xF0) {
+      case 0x80:
+      case 0x90:
+      case 0xA0:
+      case 0xB0:
+      case 0xE0: return 2;
+      case 0xC0:
+      case 0xD0: return 1;
+      default: break;
+      }
+      switch (status) {
+      case 0xF1:
+      case 0xF3: return 1;
+      case 0xF2: return 2;
+      case 0xF6: return 0;
+      default: return -1;
+      }
+    }
+
+    bool is_realtime(Event::byte b) noexcept
+    {
+      return b >= 0xF8;
+    }
+  } // namespace
+
+  bool Parser::feed(byte b, Event& out) noexcept
+  {
+    if (is_realtime(b)) {
+      // Realtime messages may appear anywhere, even inside other messages,
+      // and do not affect them
+      if (b == 0xF9 || b == 0xFD) return false; // Undefined
+      out      = {};
+      out.type = Event::Type(b);
+      return true;
+    }
+
+    if (b == 0xF7) {
+      if (!in_sysex_) {
+        discarded_++;
+        return false;
+      }
+      in_sysex_ = false;
+      if (sysex_size_ == max_sysex_size) {
+        // The message was too long, and has already been counted
+        discarded_++;
+        return false;
+      }
+      sysex_[sysex_size_++] = b;
+      out      = {};
+      out.type = Event::Type::SysEx;
+      return true;
+    }
+
+    if (b & 0x80) {
+      discard_partial();
+      status_ = 0;
+      if (b == 0xF0) {
+        in_sysex_   = true;
+        sysex_[0]   = b;
+        sysex_size_ = 1;
+        return false;
+      }
+      int size = data_size(b);
+      if (size < 0) {
+        discarded_++;
+        return false;
+      }
+      status_   = b;
+      expected_ = size;
+      ndata_    = 0;
+      if (size > 0) return false;
+      // Tune request has no data
+      out      = {};
+      out.type = Event::Type(b);
+      status_  = 0;
+      return true;
+    }
+
+    // Data byte
+    if (in_sysex_) {
+      if (sysex_size_ < max_sysex_size - 1) {
+        sysex_[sysex_size_++] = b;
+      } else {
+        if (sysex_size_ < max_sysex_size) {
+          // Count the whole message as discarded once it does not fit
+          discarded_ += sysex_size_;
+          sysex_size_ = max_sysex_size;
+        }
+        discarded_++;
+      }
+      return false;
+    }
+    if (status_ == 0) {
+      discarded_++;
+      return false;
+    }
+    data_[ndata_++] = b;
+    if (ndata_ < expected_) return false;
+
+    out      = {};
+    out.data = data_;
+    if (status_ < 0xF0) {
+      out.type    = Event::Type(status_ & 0xF0);
+      out.channel = status_ & 0x0F;
+      if (out.type == Event::Type::NoteOn && out.velocity() == 0) {
+        out.type = Event::Type::NoteOff;
+      }
+    } else {
+      // System common messages do not start a running status
+      out.type = Event::Type(status_);
+      status_  = 0;
+    }
+    if (expected_ == 1) out.data[1] = 0;
+    ndata_ = 0;
+    return true;
+  }
+
+  gsl::span<const Parser::byte> Parser::sysex() const noexcept
+  {
+    return {sysex_.data(), std::ptrdiff_t(sysex_size_)};
+  }
+
+  void Parser::reset() noexcept
+  {
+    status_     = 0;
+    ndata_      = 0;
+    in_sysex_   = false;
+    sysex_size_ = 0;
+  }
+
+  void Parser::discard_partial() noexcept
+  {
+    if (in_sysex_) {
+      // Counted already if it was too long
+      if (sysex_size_ < max_sysex_size) discarded_ += sysex_size_;
+      in_sysex_ = false;
+    }
+    discarded_ += ndata_;
+    ndata_ = 0;
+  }
+
+} // namespace otto::core::midi
@@ -0,0 +1,87 @@
+/// \file
+/// Streaming parser for MIDI 1.0 byte streams.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <gsl/gsl>
+
+#include "core/audio/midi.hpp"
+
+namespace otto::core::midi {
+
+  /// Turns a stream of midi bytes into [Event]()s
+  ///
+  /// Handles running status, system realtime messages interleaved with other
+  /// messages, and system exclusive messages of up to [max_sysex_size]()
+  /// bytes. Messages may be split across any number of calls to [feed]() or
+  /// [parse](). Nothing allocates, so it is safe to use on the audio thread.
+  ///
+  /// Note ons with a velocity of zero are reported as note offs.
+  struct Parser {
+    using byte = Event::byte;
+
+    /// The longest system exclusive message, including `0xF0` and `0xF7`.
+    /// Longer messages are discarded.
+    static constexpr std::size_t max_sysex_size = 256;
+
+    /// Parse one byte
+    ///
+    /// \effects If `b` completes a message, writes it to `out`. The `time` of
+    /// `out` is not set.
+    /// \returns Whether `b` completed a message
+    bool feed(byte b, Event& out) noexcept;
+
+    /// Parse `bytes`, and push the complete messages to `buffer`
+    ///
+    /// \param time The frame the messages are timestamped with
+    template<typename Buffer>
+    void parse(gsl::span<const byte> bytes, int time, Buffer& buffer) noexcept
+    {
+      Event event;
+      for (byte b : bytes) {
+        if (!feed(b, event)) continue;
+        event.time = time;
+        if (event.type == Event::Type::SysEx) {
+          buffer.push_sysex(sysex(), time);
+        } else {
+          buffer.push(event);
+        }
+      }
+    }
+
+    /// The last system exclusive message completed by [feed]()
+    gsl::span<const byte> sysex() const noexcept;
+
+    /// Forget any partial message and the running status
+    void reset() noexcept;
+
+    /// The number of bytes that were not part of a complete message, since
+    /// the parser was constructed
+    ///
+    /// These are data bytes without a status, interrupted messages, and
+    /// system exclusive messages longer than [max_sysex_size]().
+    std::size_t discarded_bytes() const noexcept
+    {
+      return discarded_;
+    }
+
+  private:
+    void discard_partial() noexcept;
+
+    /// The status of the current message, or 0
+    byte status_ = 0;
+    /// The number of data bytes the current message needs
+    int expected_ = 0;
+    std::array<byte, 2> data_ = {};
+    int ndata_ = 0;
+
+    bool in_sysex_ = false;
+    std::array<byte, max_sysex_size> sysex_;
+    std::size_t sysex_size_ = 0;
+
+    std::size_t discarded_ = 0;
+  };
+
+} // namespace otto::core::midi
@@ -0,0 +1,83 @@
+/// \file
+/// Sending midi events from other threads to the audio thread.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "core/audio/midi.hpp"
+#include "util/mpsc_queue.hpp"
+
+namespace otto::core::midi {
+
+  /// Midi events sent to the audio thread from any number of other threads
+  ///
+  /// Events are timestamped when they are pushed, and delivered one block
+  /// period later, at the frame of the block corresponding to the time they
+  /// were sent. So the latency from a key press to its note is the same
+  /// wherever in the block period it happened, instead of depending on how
+  /// long it waited for the next block to start.
+  struct EventQueue {
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t capacity = 1 << 8;
+
+    /// Queue `event`. May be called from any thread.
+    ///
+    /// \returns `false` if the queue was full, and the event was dropped
+    bool push(const Event& event) noexcept
+    {
+      if (queue_.try_push({event, clock::now()})) return true;
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    /// Move the events that are due in a block to `buffer`
+    ///
+    /// An event sent at time `t` is due at `t` plus the duration of the block,
+    /// and is given the corresponding [Event::time](). Events due after the
+    /// block stay in the queue. Events that are late, because the block
+    /// started late, are placed on its first frame.
+    ///
+    /// Only call this from the audio thread, at the start of each block.
+    ///
+    /// \param block_start The time processing of the block started
+    template<typename Buffer>
+    void pop_block(clock::time_point block_start, int nframes, int samplerate, Buffer& buffer) noexcept
+    {
+      using seconds = std::chrono::duration<double>;
+      auto period   = std::chrono::duration_cast<clock::duration>(seconds(double(nframes) / samplerate));
+      while (has_pending_ || queue_.try_pop(pending_)) {
+        has_pending_ = true;
+        auto due     = pending_.sent + period - block_start;
+        if (due >= period) break;
+        long frame = std::max(0l, long(seconds(due).count() * samplerate));
+        auto event = pending_.event;
+        event.time = std::min<long>(frame, nframes - 1);
+        buffer.push(event);
+        has_pending_ = false;
+      }
+    }
+
+    /// The number of events dropped because the queue was full
+    std::size_t overflows() const noexcept
+    {
+      return overflows_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Timed {
+      Event event;
+      clock::time_point sent;
+    };
+
+    util::mpsc_queue<Timed, capacity> queue_;
+    /// Popped from the queue, but due in a later block
+    Timed pending_;
+    bool has_pending_ = false;
+    std::atomic<std::size_t> overflows_{0};
+  };
+
+} // namespace otto::core::midi
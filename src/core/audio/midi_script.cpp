@@ -0,0 +1,91 @@
+#include "midi_script.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <fmt/format.h>
+
+#include "core/globals.hpp"
+
+namespace otto::core::midi {
+
+  namespace {
+    [[noreturn]] void script_error(const std::string& name, int line, const std::string& msg)
+    {
+      throw global::exception(global::ErrorCode::audio_error, "{}:{}: {}", name, line, msg);
+    }
+
+    int parse_key(const std::string& str)
+    {
+      int key = note_number(str);
+      if (key < 0) {
+        char* end;
+        key = std::strtol(str.c_str(), &end, 10);
+        if (*end != '\0' || str.empty()) return -1;
+      }
+      return key;
+    }
+  } // namespace
+
+  Script Script::parse(std::istream& in, const std::string& name)
+  {
+    Script script;
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream words{line};
+
+      double time;
+      std::string type;
+      if (!(words >> time)) {
+        words.clear();
+        if (!(words >> type)) continue; // Blank line
+        script_error(name, lineno, "Expected a time in seconds");
+      }
+      if (time < 0) script_error(name, lineno, "Negative time");
+      if (!(words >> type)) script_error(name, lineno, "Expected an event");
+
+      if (type == "end") {
+        script.end = time;
+      } else if (type == "on" || type == "off") {
+        std::string note;
+        float velocity = 1;
+        words >> note;
+        int key = parse_key(note);
+        if (key < 0 || key > 127) script_error(name, lineno, "Expected a key");
+        if (!(words >> velocity)) velocity = 1;
+        if (type == "on") {
+          script.events.push_back({time, NoteOnEvent(key, velocity)});
+        } else {
+          script.events.push_back({time, NoteOffEvent(key, velocity)});
+        }
+      } else if (type == "cc") {
+        int controller, value;
+        if (!(words >> controller >> value) || controller < 0 || controller > 127 || value < 0 ||
+            value > 127) {
+          script_error(name, lineno, "Expected a controller and a value");
+        }
+        script.events.push_back({time, ControlChangeEvent(controller, value)});
+      } else {
+        script_error(name, lineno, fmt::format("Unknown event '{}'", type));
+      }
+    }
+
+    std::stable_sort(script.events.begin(), script.events.end(),
+                     [](auto& a, auto& b) { return a.time < b.time; });
+    return script;
+  }
+
+  Script Script::read(const filesystem::path& path)
+  {
+    std::ifstream file{path.c_str()};
+    if (!file) {
+      throw global::exception(global::ErrorCode::audio_error, "Could not open midi script {}",
+                              path.c_str());
+    }
+    return parse(file, path.c_str());
+  }
+
+} // namespace otto::core::midi
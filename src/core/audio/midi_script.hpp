@@ -0,0 +1,56 @@
+/// \file
+/// Text scripts of timed midi events, for offline renders.
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "core/audio/midi.hpp"
+#include "util/filesystem.hpp"
+
+namespace otto::core::midi {
+
+  /// A midi event at a point in a render
+  struct ScriptEvent {
+    /// In seconds
+    double time;
+    Event event;
+  };
+
+  /// A parsed midi script
+  ///
+  /// A script is a text file with one event per line. Each line starts with
+  /// the time of the event in seconds, followed by the event:
+  ///
+  /// ```
+  /// # Comments start with '#'
+  /// 0.0  on  C4 0.8   # Note on, with the key and an optional velocity
+  /// 0.5  off C4       # Note off. Keys are names or numbers
+  /// 1.0  cc  7 100    # Control change, with the controller and value
+  /// 4.0  end          # Where the render ends
+  /// ```
+  ///
+  /// Lines do not need to be in order.
+  struct Script {
+    /// Sorted by time. Events with the same time keep the order of their lines
+    std::vector<ScriptEvent> events;
+    /// The time of the `end` line, or a negative number if there is none
+    double end = -1;
+
+    /// Parse a script
+    ///
+    /// \param name Used in error messages
+    /// \throws `global::exception` with `ErrorCode::audio_error` if a line
+    /// cannot be parsed
+    static Script parse(std::istream& in, const std::string& name);
+
+    /// Parse the script at `path`
+    ///
+    /// \throws `global::exception` with `ErrorCode::audio_error` if the file
+    /// cannot be read, or a line cannot be parsed
+    static Script read(const filesystem::path& path);
+  };
+
+} // namespace otto::core::midi
@@ -0,0 +1,71 @@
+#include "param_queue.hpp"
+
+#include <chrono>
+#include <thread>
+
+namespace otto::core::audio {
+
+  namespace {
+    thread_local bool on_audio_thread = false;
+  }
+
+  void register_audio_thread() noexcept
+  {
+    on_audio_thread = true;
+  }
+
+  bool is_audio_thread() noexcept
+  {
+    return on_audio_thread;
+  }
+
+  void ParameterQueue::push(Update update) noexcept
+  {
+    if (direct_ || on_audio_thread) {
+      update.apply(update.target, update.arg);
+      return;
+    }
+    // The audio thread empties the queue every block, so give it a few
+    // blocks to make room
+    for (int i = 0; i < 100; i++) {
+      if (queue_.try_push(update)) return;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    // The audio thread is stuck. Dropping the update would leave it with a
+    // stale value indefinitely, so this is the lesser evil
+    overflows_++;
+    update.apply(update.target, update.arg);
+  }
+
+  void ParameterQueue::apply_all() noexcept
+  {
+    on_audio_thread   = true;
+    std::size_t count = 0;
+    Update update;
+    while (queue_.try_pop(update)) {
+      update.apply(update.target, update.arg);
+      count++;
+    }
+    if (count > max_batch_.load(std::memory_order_relaxed)) {
+      max_batch_.store(count, std::memory_order_relaxed);
+    }
+  }
+
+  void ParameterQueue::set_direct(bool direct) noexcept
+  {
+    if (direct) apply_all();
+    direct_ = direct;
+  }
+
+  ParameterQueue::Stats ParameterQueue::stats() const noexcept
+  {
+    return {queue_.size(), max_batch_.load(), overflows_.load()};
+  }
+
+  ParameterQueue& parameter_queue() noexcept
+  {
+    static ParameterQueue instance;
+    return instance;
+  }
+
+} // namespace otto::core::audio
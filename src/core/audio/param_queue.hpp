@@ -0,0 +1,124 @@
+/// \file
+/// Handing parameter changes from the UI thread to the audio thread.
+///
+/// Values read by audio processors must not be written from other threads
+/// while a block is being processed. Instead, the UI thread queues the
+/// writes in the [ParameterQueue](), and the audio thread applies all of them
+/// at the start of the next block, so every block sees a consistent set of
+/// parameters.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "util/spsc_queue.hpp"
+
+namespace otto::core::audio {
+
+  /// Mark the calling thread as one that runs audio processors.
+  ///
+  /// Parameter changes made on these threads, like the metronome triggering
+  /// its click in the middle of a block, are applied immediately.
+  void register_audio_thread() noexcept;
+
+  /// Whether [register_audio_thread]() has been called on this thread
+  bool is_audio_thread() noexcept;
+
+  /// A lock-free queue of parameter changes, from the UI thread to the audio
+  /// thread.
+  ///
+  /// While the queue is in direct mode, which it is until audio processing
+  /// starts, changes are applied immediately instead. So are changes made on
+  /// audio threads.
+  struct ParameterQueue {
+    /// A queued change
+    struct Update {
+      /// Invoked with `target` and `arg` on the audio thread
+      using Apply = void (*)(void* target, std::uint64_t arg);
+
+      Apply apply       = nullptr;
+      void* target      = nullptr;
+      std::uint64_t arg = 0;
+    };
+
+    static constexpr std::size_t capacity = 1 << 10;
+
+    /// Counters, for debugging
+    struct Stats {
+      /// Updates currently waiting in the queue
+      std::size_t depth;
+      /// The most updates applied in a single block
+      std::size_t max_batch;
+      /// Updates that were applied directly because the queue stayed full
+      std::size_t overflows;
+    };
+
+    /// Queue `target = value`
+    ///
+    /// \requires `T` is trivially copyable and at most 8 bytes large
+    template<typename T>
+    void set(T& target, T value) noexcept
+    {
+      static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(std::uint64_t),
+                    "Only small, trivially copyable values can be queued");
+      std::uint64_t arg = 0;
+      std::memcpy(&arg, &value, sizeof(T));
+      push({[](void* target, std::uint64_t arg) { std::memcpy(target, &arg, sizeof(T)); },
+            &target, arg});
+    }
+
+    /// Queue `func(target)`
+    ///
+    /// `func` is usually a captureless lambda.
+    /// \requires `func` does not allocate, lock or block.
+    template<typename T>
+    void call(T& target, std::common_type_t<void (*)(T&)> func) noexcept
+    {
+      std::uint64_t arg = 0;
+      std::memcpy(&arg, &func, sizeof(func));
+      push({[](void* target, std::uint64_t arg) {
+              void (*func)(T&);
+              std::memcpy(&func, &arg, sizeof(func));
+              func(*static_cast<T*>(target));
+            },
+            &target, arg});
+    }
+
+    /// Queue `apply(target, arg)`
+    ///
+    /// Use this for changes that are more than plain assignments. If the queue
+    /// is full, waits for the audio thread to make room for up to 10ms, and
+    /// then applies the update directly.
+    /// \requires `apply` does not allocate, lock or block.
+    void push(Update update) noexcept;
+
+    /// Apply all queued updates.
+    ///
+    /// Only call this from the audio thread, at the start of a block. Also
+    /// registers the calling thread as an audio thread.
+    void apply_all() noexcept;
+
+    /// Switch direct mode on or off.
+    ///
+    /// Turning it on applies all queued updates first, so must only be done
+    /// while the audio thread is not applying them.
+    void set_direct(bool direct) noexcept;
+
+    Stats stats() const noexcept;
+
+  private:
+    util::spsc_queue<Update, capacity> queue_;
+    std::atomic_bool direct_{true};
+    std::atomic<std::size_t> max_batch_{0};
+    std::atomic<std::size_t> overflows_{0};
+  };
+
+  /// The queue from the UI thread to the audio thread.
+  ///
+  /// Applied at the start of every block by [service::engines::process]()
+  ParameterQueue& parameter_queue() noexcept;
+
+} // namespace otto::core::audio
@@ -17,10 +17,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <exception>
 #include <functional>
 #include <gsl/span>
+#include <type_traits>
+#include <utility>
 
+#include "core/audio/buffer_arena.hpp"
 #include "core/audio/midi.hpp"
 
 #include "util/audio.hpp"
@@ -43,40 +47,95 @@ namespace otto::core::audio {
   };
 
 
-  namespace detail {
-    // No including "core/globals.hpp" in headers
-    void registerAudioBufferResize(std::function<void(int)>);
-  } // namespace detail
-
   /**
-   * A DynArray that resizes to fit the RealTime bufferSize.
+   * A buffer with room for the largest supported block.
    *
    * This is the container used in AudioProcessors, and it should be used
-   * in any place where the realtime data is copied out. It is resized on
-   * the bufferSizeChanged event
+   * in any place where the realtime data is copied out. The memory is claimed
+   * from the [buffer_arena](), so changing the block size never allocates.
+   * Only the first `block_size() * factor` elements are iterated over.
    */
   template<typename T, std::size_t factor = 1>
-  class RTBuffer : public util::dyn_array<T> {
+  class RTBuffer {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "RTBuffers hold plain audio data, and are never constructed element-wise");
+
   public:
-    RTBuffer(std::size_t initial_size = 0)
-      : util::dyn_array<T>(initial_size * factor)
+    /// The number of elements there is room for
+    static constexpr std::size_t capacity = max_block_size * factor;
+
+    RTBuffer() : _data(static_cast<T*>(buffer_arena().claim(capacity * sizeof(T)))) {}
+
+    RTBuffer(const RTBuffer&) = delete;
+    RTBuffer& operator=(const RTBuffer&) = delete;
+
+    RTBuffer(RTBuffer&& rhs) noexcept : _data(std::exchange(rhs._data, nullptr)) {}
+
+    RTBuffer& operator=(RTBuffer&& rhs) noexcept
+    {
+      std::swap(_data, rhs._data);
+      return *this;
+    }
+
+    ~RTBuffer() noexcept
+    {
+      buffer_arena().release(_data, capacity * sizeof(T));
+    }
+
+    T& operator[](std::size_t i) noexcept
     {
-      detail::registerAudioBufferResize(
-        [this](std::size_t newSize) { resize(newSize); });
+      return _data[i];
+    }
+    const T& operator[](std::size_t i) const noexcept
+    {
+      return _data[i];
+    }
+
+    T* data() noexcept
+    {
+      return _data;
+    }
+    const T* data() const noexcept
+    {
+      return _data;
     }
 
-    void resize(std::size_t new_size)
+    T* begin() noexcept
+    {
+      return _data;
+    }
+    T* end() noexcept
     {
-      util::dyn_array<T>::resize(new_size * factor);
+      return _data + size();
     }
+    const T* begin() const noexcept
+    {
+      return _data;
+    }
+    const T* end() const noexcept
+    {
+      return _data + size();
+    }
+
+    /// The number of elements used by the current block size
+    std::size_t size() const noexcept
+    {
+      return buffer_arena().block_size() * factor;
+    }
+
+    /// Fill the elements used by the current block size with default
+    /// initialized values
+    void clear() noexcept
+    {
+      std::fill(begin(), end(), T{});
+    }
+
+  private:
+    T* _data;
   };
 
   /**
-   * A DynArray that resizes to fit the RealTime bufferSize.
-   *
-   * This is the container used in AudioProcessors, and it should be used
-   * in any place where the realtime data is copied out. It is resized on
-   * the bufferSizeChanged event
+   * An [RTBuffer]() of audio frames with `N` channels
    */
   template<int N>
   using ProcessBuffer = RTBuffer<std::array<float, N>, 1>;
@@ -87,28 +146,48 @@ namespace otto::core::audio {
     static constexpr int channels = N;
 
     gsl::span<std::array<float, channels>> audio;
-    gsl::span<midi::AnyMidiEvent> midi;
+    gsl::span<midi::Event> midi;
 
     long nframes;
     long offset = 0;
 
+    /// The audio is known to be all zeros
+    ///
+    /// Set by processors whose output is silent, so the processors reading it
+    /// can skip their work. When it is `false`, the audio may still be silent.
+    bool silent = false;
+
     template<int outN = 0>
     ProcessData<outN> midi_only()
     {
-      return {{nullptr, nullptr}, midi, nframes};
+      return {{nullptr, nullptr}, midi, nframes, offset};
     }
 
     ProcessData audio_only()
     {
-      return {audio, {nullptr, nullptr}, nframes};
+      return {audio, {nullptr, nullptr}, nframes, offset, silent};
     }
 
+    /// Fill the audio with zeros, and mark it [silent]()
+    ProcessData fill_silence() noexcept
+    {
+      if constexpr (channels != 0) {
+        std::fill(audio.begin(), audio.end(), std::array<float, channels>{});
+      }
+      silent = true;
+      return *this;
+    }
+
+    /// Get the same block, with the audio in `buf`.
+    ///
+    /// The audio starts at frame `offset` of `buf`, so for a slice, the result
+    /// is the corresponding slice of `buf`.
     template<typename T>
     auto redirect(T& buf)
     {
       return ProcessData<
         audio_frame_channels<std::decay_t<decltype(buf[0])>>::value>{
-        {buf.data(), nframes}, midi, nframes};
+        {buf.data() + offset, nframes}, midi, nframes, offset};
     }
 
     /// Get only a slice of the audio.
@@ -148,4 +227,190 @@ namespace otto::core::audio {
     }
   };
 
+  /// An [RTBuffer]() with one plane of [max_block_size]() samples per channel
+  template<int N>
+  struct PlanarBuffer : RTBuffer<float, N> {
+    /// The first sample of channel `c`
+    float* channel(int c) noexcept
+    {
+      return this->data() + c * max_block_size;
+    }
+
+    /// Fill the samples of each channel used by the current block size with
+    /// zeros
+    void clear() noexcept
+    {
+      auto nframes = buffer_arena().block_size();
+      for (int c = 0; c < N; c++) std::fill_n(channel(c), nframes, 0.f);
+    }
+  };
+
+  /// Non-owning package of planar audio data passed to audio processors
+  ///
+  /// The same as [ProcessData](), except that each channel is a separate
+  /// array of samples, instead of each frame being an array of channels. This
+  /// is the layout Faust and most DSP code work with.
+  template<int N>
+  struct PlanarData {
+    static constexpr int channels = N;
+
+    /// The first sample of each channel
+    std::array<float*, channels> audio;
+    gsl::span<midi::Event> midi;
+
+    long nframes;
+    long offset = 0;
+
+    /// Get the same block, with the audio in `buf`.
+    ///
+    /// Like [ProcessData::redirect](), the audio starts at frame `offset` of
+    /// each channel of `buf`.
+    template<int M>
+    PlanarData<M> redirect(PlanarBuffer<M>& buf)
+    {
+      return {util::generate_array<M>([&](int c) { return buf.channel(c) + offset; }), midi,
+              nframes, offset};
+    }
+
+    /// Get only a slice of the audio.
+    ///
+    /// \see ProcessData::slice
+    PlanarData slice(int idx, int length = -1)
+    {
+      auto res    = *this;
+      length      = length < 0 ? nframes - idx : length;
+      res.nframes = length;
+      res.offset += idx;
+      for (auto& ch : res.audio) ch += idx;
+      return res;
+    }
+  };
+
+  /// View the planar data of `data`'s block in `buf`
+  template<int M, int N>
+  PlanarData<M> redirect_planar(ProcessData<N> data, PlanarBuffer<M>& buf)
+  {
+    return PlanarData<0>{{}, data.midi, data.nframes, data.offset}.redirect(buf);
+  }
+
+  /// Copy interleaved frames into separate channels
+  ///
+  /// \requires `dst` has room for `src.nframes` frames
+  template<int N>
+  void deinterleave(ProcessData<N> src, PlanarData<N> dst) noexcept
+  {
+    for (int c = 0; c < N; c++) {
+      float* out = dst.audio[c];
+      for (long f = 0; f < src.nframes; f++) {
+        out[f] = src.audio[f][c];
+      }
+    }
+  }
+
+  /// Copy separate channels into interleaved frames
+  ///
+  /// \requires `dst` has room for `src.nframes` frames
+  template<int N>
+  void interleave(PlanarData<N> src, ProcessData<N> dst) noexcept
+  {
+    for (int c = 0; c < N; c++) {
+      const float* in = src.audio[c];
+      for (long f = 0; f < src.nframes; f++) {
+        dst.audio[f][c] = in[f];
+      }
+    }
+  }
+
+  /// View mono audio as planar data
+  ///
+  /// A single channel has the same layout either way, so this does not copy.
+  inline PlanarData<1> as_planar(ProcessData<1> data) noexcept
+  {
+    return {{reinterpret_cast<float*>(data.audio.data())}, data.midi, data.nframes, data.offset};
+  }
+
+  /// View planar mono audio as frames
+  ///
+  /// \see as_planar
+  inline ProcessData<1> as_interleaved(PlanarData<1> data) noexcept
+  {
+    return {{reinterpret_cast<std::array<float, 1>*>(data.audio[0]), std::size_t(data.nframes)},
+            data.midi,
+            data.nframes,
+            data.offset};
+  }
+
+  /// Process a block in slices which begin at its midi events
+  ///
+  /// Each slice is passed to `process` along with the events that occur at
+  /// its first frame, so the events take effect on the exact frame they were
+  /// timestamped with. To bound the overhead of processing many small slices,
+  /// events less than `min_frames` after the start of the current slice are
+  /// moved back to it. Events timestamped outside the block are clamped to it.
+  ///
+  /// The events of `data` are sorted by time, if they are not already.
+  ///
+  /// \param process Invocable as `ProcessData<Nout>(ProcessData<N>)`. It must
+  /// write the audio of each slice at its `offset` in the output buffer, like
+  /// [ProcessData::redirect]() does. If a slice is output to a different
+  /// buffer than the first one, it is copied into the first one.
+  /// \returns The output of the whole block
+  template<int N, typename Func>
+  auto process_midi_slices(ProcessData<N> data, int min_frames, Func&& process)
+  {
+    if (data.nframes == 0) return process(data);
+    min_frames = std::max(min_frames, 1);
+
+    auto& midi     = data.midi;
+    auto time_less = [](auto& a, auto& b) { return midi::event_time(a) < midi::event_time(b); };
+    if (!std::is_sorted(midi.begin(), midi.end(), time_less)) {
+      // Insertion sort, as it does not allocate, and there are few events
+      for (auto it = midi.begin(); it != midi.end(); ++it) {
+        std::rotate(std::upper_bound(midi.begin(), it, *it, time_less), it, it + 1);
+      }
+    }
+
+    auto clamped_time = [&](auto& event) {
+      return std::clamp<long>(midi::event_time(event), 0, data.nframes - 1);
+    };
+
+    using Out = decltype(process(data));
+    Out first;
+    long start    = 0;
+    auto event    = midi.begin();
+    bool is_first = true;
+    bool silent   = true;
+    while (start < data.nframes) {
+      // Events from here up to the start of the next slice go in this slice
+      auto events_begin = event;
+      while (event != midi.end() && clamped_time(*event) < start + min_frames) ++event;
+      long end = event == midi.end() ? data.nframes : clamped_time(*event);
+
+      auto slice = data.slice(start, end - start);
+      slice.midi = {midi.data() + (events_begin - midi.begin()), std::size_t(event - events_begin)};
+      auto res   = process(slice);
+      silent     = silent && res.silent;
+      if (is_first) {
+        first    = res;
+        is_first = false;
+      } else if constexpr (Out::channels != 0) {
+        // Processors may output to another buffer from one slice to the next,
+        // like an engine switch that ends mid-block. The block is returned in
+        // the buffer of the first slice.
+        auto* dst = first.audio.data() + start;
+        if (res.audio.data() != dst) std::copy(res.audio.begin(), res.audio.end(), dst);
+      }
+      start = end;
+    }
+
+    if constexpr (Out::channels != 0) {
+      first.audio = {first.audio.data(), std::size_t(data.nframes)};
+    }
+    first.midi    = data.midi;
+    first.nframes = data.nframes;
+    first.offset  = data.offset;
+    first.silent  = silent;
+    return first;
+  }
+
 } // namespace otto::core::audio
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+#include "util/audio_kernels.hpp"
+
+namespace otto::core::audio {
+
+  /// Detects when a voice or engine has stopped sounding, so it can be skipped
+  ///
+  /// It goes idle when its gate is off, and its output has stayed below
+  /// [threshold]() for [hold_frames]() frames in a row. It stays idle until it
+  /// is woken up by the next trigger.
+  ///
+  /// The hold is counted in frames, so it lasts as long whether the output is
+  /// passed in whole blocks or in midi slices.
+  struct TailDetector {
+    /// -80 dB
+    static constexpr float threshold = 0.0001f;
+    /// Quiet frames needed before going idle. Around 40 ms.
+    static constexpr std::size_t hold_frames = 2048;
+
+    /// Whether processing can be skipped
+    bool idle() const noexcept
+    {
+      return idle_;
+    }
+
+    /// Call when triggered, before processing
+    void wake() noexcept
+    {
+      idle_         = false;
+      quiet_frames_ = 0;
+    }
+
+    /// Call with the output of each processed block or slice
+    ///
+    /// \param n The number of frames in `samples`
+    /// \param gate Whether the voice is held. Held voices never go idle.
+    void update(const float* samples, std::size_t n, bool gate) noexcept
+    {
+      if (gate) {
+        quiet_frames_ = 0;
+        return;
+      }
+      util::audio::Levels levels;
+      util::audio::measure(samples, 1, n, &levels);
+      if (levels.peak >= threshold) {
+        quiet_frames_ = 0;
+      } else if ((quiet_frames_ += n) >= hold_frames) {
+        idle_ = true;
+      }
+    }
+
+  private:
+    bool idle_                = true;
+    std::size_t quiet_frames_ = 0;
+  };
+
+} // namespace otto::core::audio
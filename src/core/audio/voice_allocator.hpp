@@ -0,0 +1,295 @@
+/// \file
+/// Assignment of midi notes to a fixed set of voices.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace otto::core::audio {
+
+  using Voice = int;
+
+  /// Which voice to take from a held note, when all voices are in use
+  enum struct StealPolicy {
+    /// The voice that has been playing the longest
+    oldest,
+    /// The voice with the lowest level, as set by [VoiceAllocator::level]()
+    quietest,
+  };
+
+  namespace detail {
+    /// Doubly linked list of the integers `[0, Size)`, stored in arrays
+    ///
+    /// Each integer can be in the list at most once.
+    template<int Size>
+    struct IndexList {
+      static constexpr int none = -1;
+
+      IndexList() noexcept
+      {
+        prev_.fill(none);
+        next_.fill(none);
+        contains_.fill(false);
+      }
+
+      bool empty() const noexcept
+      {
+        return head_ == none;
+      }
+
+      bool contains(int i) const noexcept
+      {
+        return contains_[i];
+      }
+
+      int front() const noexcept
+      {
+        return head_;
+      }
+
+      int back() const noexcept
+      {
+        return tail_;
+      }
+
+      /// The element after `i`, or [none]()
+      int next(int i) const noexcept
+      {
+        return next_[i];
+      }
+
+      /// \requires `i` is not in the list
+      void push_back(int i) noexcept
+      {
+        prev_[i]     = tail_;
+        next_[i]     = none;
+        contains_[i] = true;
+        if (tail_ == none) {
+          head_ = i;
+        } else {
+          next_[tail_] = i;
+        }
+        tail_ = i;
+      }
+
+      /// Remove `i`, if it is in the list
+      void remove(int i) noexcept
+      {
+        if (!contains_[i]) return;
+        if (prev_[i] == none) {
+          head_ = next_[i];
+        } else {
+          next_[prev_[i]] = next_[i];
+        }
+        if (next_[i] == none) {
+          tail_ = prev_[i];
+        } else {
+          prev_[next_[i]] = prev_[i];
+        }
+        contains_[i] = false;
+      }
+
+    private:
+      int head_ = none;
+      int tail_ = none;
+      std::array<std::int16_t, Size> prev_;
+      std::array<std::int16_t, Size> next_;
+      std::array<bool, Size> contains_;
+    };
+  } // namespace detail
+
+  /// Assigns midi keys to `N` voices
+  ///
+  /// All operations are constant time, apart from stealing by
+  /// [StealPolicy::quietest](), which looks at each of the `N` voices. Nothing
+  /// allocates, so it is safe to use on the audio thread.
+  ///
+  /// Released voices are reused in the order they were released, so their
+  /// release tails get as long as possible. When all voices are held, one is
+  /// stolen according to [steal_policy](). The note it is stolen from is
+  /// remembered, and gets a voice again when one is released while the key is
+  /// still held.
+  template<int N>
+  struct VoiceAllocator {
+    static_assert(N > 0 && N <= 128, "VoiceAllocator supports 1 to 128 voices");
+
+    static constexpr int no_key = -1;
+    static constexpr Voice no_voice = -1;
+
+    /// The outcome of [note_on]()
+    struct Allocation {
+      Voice voice = no_voice;
+      /// The held key `voice` was taken from, or [no_key]()
+      int stolen_from = no_key;
+    };
+
+    /// The outcome of [note_off]()
+    struct Release {
+      /// The voice that stopped playing the key, or [no_voice]()
+      Voice voice = no_voice;
+      /// The held key `voice` was handed back to, or [no_key]()
+      int resumed = no_key;
+    };
+
+    StealPolicy steal_policy = StealPolicy::oldest;
+
+    /// Restart the voice that last played a key, if it is released but not
+    /// yet reused, instead of starting a new voice alongside its release tail
+    bool retrigger_same_note = true;
+
+    VoiceAllocator() noexcept
+    {
+      key_of_.fill(no_key);
+      last_key_of_.fill(no_key);
+      voice_of_.fill(no_voice);
+      last_voice_.fill(no_voice);
+      level_.fill(0);
+      for (Voice v = 0; v < N; v++) free_.push_back(v);
+    }
+
+    /// Assign a voice to `key`
+    ///
+    /// \requires `key` is in `[0, 128)`
+    Allocation note_on(int key) noexcept
+    {
+      Allocation res;
+      stolen_.remove(key);
+      if (Voice v = voice_of_[key]; v != no_voice) {
+        // Pressed again while held
+        active_.remove(v);
+        if (retrigger_same_note) {
+          res.voice = v;
+        } else {
+          free_.push_back(v);
+        }
+      }
+      if (res.voice == no_voice && retrigger_same_note) {
+        if (Voice v = last_voice_of(key); v != no_voice && free_.contains(v)) {
+          free_.remove(v);
+          res.voice = v;
+        }
+      }
+      if (res.voice == no_voice && !free_.empty()) {
+        res.voice = free_.front();
+        free_.remove(res.voice);
+      }
+      if (res.voice == no_voice) {
+        res.voice       = victim();
+        res.stolen_from = key_of_[res.voice];
+        active_.remove(res.voice);
+        voice_of_[res.stolen_from] = no_voice;
+        stolen_.push_back(res.stolen_from);
+      }
+      assign(res.voice, key);
+      return res;
+    }
+
+    /// Release the voice of `key`
+    ///
+    /// \requires `key` is in `[0, 128)`
+    Release note_off(int key) noexcept
+    {
+      Release res;
+      stolen_.remove(key);
+      Voice v = voice_of_[key];
+      if (v == no_voice) return res;
+      res.voice = v;
+      active_.remove(v);
+      voice_of_[key] = no_voice;
+      key_of_[v]     = no_key;
+      if (!stolen_.empty()) {
+        res.resumed = stolen_.back();
+        stolen_.remove(res.resumed);
+        assign(v, res.resumed);
+      } else {
+        free_.push_back(v);
+      }
+      return res;
+    }
+
+    /// Release all voices, and forget all held keys
+    void reset() noexcept
+    {
+      for (int k = 0; k < 128; k++) note_off(k);
+    }
+
+    /// The key `voice` is playing, or [no_key]() if it is released
+    int key_of(Voice voice) const noexcept
+    {
+      return key_of_[voice];
+    }
+
+    /// The voice playing `key`, or [no_voice]()
+    Voice voice_of(int key) const noexcept
+    {
+      return voice_of_[key];
+    }
+
+    /// The voice that last played `key`, or [no_voice]()
+    Voice last_voice_of(int key) const noexcept
+    {
+      Voice v = last_voice_[key];
+      return (v != no_voice && last_key_of_[v] == key) ? v : no_voice;
+    }
+
+    /// Whether any voice is playing a held key
+    bool any_held() const noexcept
+    {
+      return !active_.empty();
+    }
+
+    /// Whether `key` is held, but has had its voice stolen
+    bool is_stolen(int key) const noexcept
+    {
+      return stolen_.contains(key);
+    }
+
+    /// The current level of `voice`, used by [StealPolicy::quietest]()
+    float level(Voice voice) const noexcept
+    {
+      return level_[voice];
+    }
+
+    void level(Voice voice, float level) noexcept
+    {
+      level_[voice] = level;
+    }
+
+  private:
+    void assign(Voice v, int key) noexcept
+    {
+      key_of_[v]       = key;
+      last_key_of_[v]  = key;
+      last_voice_[key] = v;
+      voice_of_[key]   = v;
+      active_.push_back(v);
+    }
+
+    /// The held voice to steal
+    Voice victim() const noexcept
+    {
+      Voice res = active_.front();
+      if (steal_policy == StealPolicy::quietest) {
+        for (Voice v = active_.next(res); v != no_voice; v = active_.next(v)) {
+          if (level_[v] < level_[res]) res = v;
+        }
+      }
+      return res;
+    }
+
+    std::array<int, N> key_of_;
+    std::array<int, N> last_key_of_;
+    std::array<Voice, 128> voice_of_;
+    std::array<Voice, 128> last_voice_;
+    std::array<float, N> level_;
+
+    /// Released voices, in the order they were released
+    detail::IndexList<N> free_;
+    /// Voices playing held keys, in the order they were started
+    detail::IndexList<N> active_;
+    /// Held keys without a voice, in the order they were stolen
+    detail::IndexList<128> stolen_;
+  };
+
+} // namespace otto::core::audio
@@ -1,33 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
-#include <stack>
-#include <queue>
-#include <gsl/gsl_util>
 
 #include "util/utility.hpp"
 #include "util/algorithm.hpp"
 
 #include "core/audio/faust.hpp"
 #include "core/audio/processor.hpp"
+#include "core/audio/voice_allocator.hpp"
 
 #include "core/props/props.hpp"
 #include "core/ui/screen.hpp"
 
-namespace otto::core::audio {
-
-  using Voice = int;
+#include "services/audio.hpp"
 
-  /// A pair of a note and a voice. Kept in the `notes_` stack
-  struct NoteVoicePair {
-    char note;
-    Voice voice;
-
-    bool has_voice() const noexcept
-    {
-      return voice >= 0;
-    }
-  };
+namespace otto::core::audio {
 
   struct VoiceProps : props::Properties<props::no_serialize> {
     struct Midi : props::Properties<props::no_serialize> {
@@ -82,11 +70,7 @@ namespace otto::core::audio {
         envelope_props(&parent, "envelope"),
         envelope_screen_(detail::make_envelope_screen(envelope_props)),
         settings_screen_(detail::make_settings_screen(envelope_props))
-    {
-      for (int i = 0; i < N; ++i){
-        free_voices.push_back(i);
-      }
-    }
+    {}
 
     void process_before(audio::ProcessData<0> data);
     void process_after(audio::ProcessData<0> data);
@@ -100,115 +84,75 @@ namespace otto::core::audio {
       return *settings_screen_;
     }
 
-    // Voice managagement //
+    /// The assignment of keys to voices. Its policies may be changed, but
+    /// only from the audio thread.
+    VoiceAllocator<N>& allocator() noexcept
+    {
+      return allocator_;
+    }
 
   private:
+    void start_voice(Voice v, int key, float velocity);
 
-    auto get_voice() -> Voice;
-    void stop_voice(char key);
+    /// Estimate the envelope level of the held voices, for
+    /// [StealPolicy::quietest]()
+    void update_levels(long nframes);
 
-    std::deque<Voice> free_voices;
-    std::vector<NoteVoicePair> note_stack;
-
-    props::properties_base* currently_linked;
+    VoiceAllocator<N> allocator_;
+    /// Frames since each voice was started
+    std::array<long, N> age_ = {};
+    std::array<float, N> velocity_ = {};
+    /// The velocity each key was last pressed with
+    std::array<float, 128> key_velocity_ = {};
 
     std::unique_ptr<ui::Screen> envelope_screen_;
     std::unique_ptr<ui::Screen> settings_screen_;
   };
 
-  inline std::ostream& operator<<(std::ostream& o, NoteVoicePair nvp)
-  {
-    return o << "{n: " << (int) nvp.note << ", v: " << nvp.voice << "}";
-  }
-
-  template<typename T>
-  std::ostream& operator<<(std::ostream& o, std::vector<T> const& v)
-  {
-    o << "[";
-    for (std::size_t i = 0; i < v.size(); ++i) {
-      o << v[i];
-      if (i != (v.size() - 1)) o << ", ";
-    }
-    return o << "]";
-  }
-
-  template<typename T>
-  std::ostream& operator<<(std::ostream& o, std::deque<T> const& v)
-  {
-    o << "[";
-    for (std::size_t i = 0; i < v.size(); ++i) {
-      o << v[i];
-      if (i != (v.size() - 1)) o << ", ";
-    }
-    return o << "]";
-  }
-
   template<int N>
-  auto VoiceManager<N>::get_voice() -> Voice
+  void VoiceManager<N>::start_voice(Voice v, int key, float velocity)
   {
-    if (free_voices.size() > 0) {
-      auto v = free_voices.front();
-      free_voices.pop_front();
-      return v;
-    } else {
-      auto found =
-        util::find_if(note_stack, [](auto& nvp) { return nvp.has_voice(); });
-      if (found != note_stack.end()) {
-        Voice v = found->voice;
-        found->voice = Voice{-1};
-        voices[v].midi.trigger = false;
-        DLOGI("Stealing voice {} from key {}", v, found->note);
-        return v;
-      } else {
-        LOGE("No voice found. Using voice 0");
-        return Voice{0};
-      }
-    }
+    auto& vp         = voices[v];
+    vp.midi.freq     = midi::note_freq(key);
+    vp.midi.velocity = velocity;
+    vp.midi.trigger  = true;
+    age_[v]          = 0;
+    velocity_[v]     = velocity;
   }
 
   template<int N>
-  void VoiceManager<N>::stop_voice(char key)
+  void VoiceManager<N>::update_levels(long nframes)
   {
-    auto free_voice = [this](Voice v) {
-      auto found = std::find_if(note_stack.rbegin(), note_stack.rend(),
-                                [](auto nvp) { return !nvp.has_voice(); });
-      if (found != note_stack.rend()) {
-        found->voice = v;
-        auto& vp = voices[v];
-        vp.midi.trigger = true;
-        vp.midi.freq    = midi::note_freq(found->note);
+    if (allocator_.steal_policy != StealPolicy::quietest) return;
+    float seconds_per_frame = 1.f / std::max(service::audio::samplerate(), 1);
+    float attack            = envelope_props.attack;
+    float decay             = envelope_props.decay;
+    float sustain           = envelope_props.sustain;
+    for (Voice v = 0; v < N; v++) {
+      if (allocator_.key_of(v) == allocator_.no_key) continue;
+      age_[v] += nframes;
+      float t = age_[v] * seconds_per_frame;
+      float env;
+      if (t < attack) {
+        env = t / attack;
+      } else if (t < attack + decay) {
+        env = 1 - (1 - sustain) * (t - attack) / decay;
       } else {
-        auto& vp = voices[v];
-        free_voices.push_back(v);
-        vp.midi.trigger = false;
-      }
-    };
-    auto it = util::remove_if(note_stack, [key, &free_voice](auto nvp) {
-      if (nvp.note == key) {
-        if (nvp.has_voice()) free_voice(nvp.voice);
-        return true;
+        env = sustain;
       }
-      return false;
-    });
-    note_stack.erase(it, note_stack.end());
+      allocator_.level(v, velocity_[v] * env);
+    }
   }
 
   template<int N>
   void VoiceManager<N>::process_before(audio::ProcessData<0> data)
   {
+    update_levels(data.nframes);
     for (auto&& ev : data.midi) {
-      util::match(ev,
-                  [this](midi::NoteOnEvent& ev) {
-                    stop_voice(gsl::narrow_cast<char>(ev.key));
-                    Voice v = get_voice();
-                    note_stack.push_back({gsl::narrow_cast<char>(ev.key), v});
-                    auto& vp         = voices[v];
-                    vp.midi.freq     = midi::note_freq(ev.key);
-                    vp.midi.velocity = ev.velocity / 127.f;
-                    vp.midi.trigger  = 1;
-                    LOGI("Voice {} begin key {} {}Hz velocity: {}", v, ev.key, vp.midi.freq, vp.midi.velocity);
-                  },
-                  [](auto&&) {});
+      if (ev.type != midi::Event::Type::NoteOn) continue;
+      key_velocity_[ev.key()] = ev.velocity() / 127.f;
+      auto alloc              = allocator_.note_on(ev.key());
+      start_voice(alloc.voice, ev.key(), key_velocity_[ev.key()]);
     }
   }
 
@@ -216,11 +160,14 @@ namespace otto::core::audio {
   void VoiceManager<N>::process_after(audio::ProcessData<0> data)
   {
     for (auto&& ev : data.midi) {
-      util::match(ev,
-                  [this](midi::NoteOffEvent& ev) {
-                    stop_voice(gsl::narrow_cast<char>(ev.key));
-                  },
-                  [](auto&&) {});
+      if (ev.type != midi::Event::Type::NoteOff) continue;
+      auto rel = allocator_.note_off(ev.key());
+      if (rel.voice == allocator_.no_voice) continue;
+      if (rel.resumed != allocator_.no_key) {
+        start_voice(rel.voice, rel.resumed, key_velocity_[rel.resumed]);
+      } else {
+        voices[rel.voice].midi.trigger = false;
+      }
     }
   }
 
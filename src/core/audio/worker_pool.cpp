@@ -0,0 +1,188 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "core/audio/param_queue.hpp"
+#include "services/logger.hpp"
+
+namespace otto::core::audio {
+
+  namespace {
+    inline void cpu_relax() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+      asm volatile("yield");
+#endif
+    }
+
+#ifdef __linux__
+    void futex_wait(std::atomic<int>& word, int expected) noexcept
+    {
+      syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr,
+              nullptr, 0);
+    }
+
+    void futex_wake_all(std::atomic<int>& word) noexcept
+    {
+      syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+              nullptr, 0);
+    }
+#else
+    // Without futexes, sleeping workers poll instead
+    void futex_wait(std::atomic<int>& word, int expected) noexcept
+    {
+      if (word.load() == expected) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    void futex_wake_all(std::atomic<int>&) noexcept {}
+#endif
+
+    std::uint32_t generation_of(std::uint64_t batch) noexcept
+    {
+      return batch >> 32;
+    }
+
+    /// Pin the calling thread to `core`
+    ///
+    /// \returns 0, or the error number
+    int pin_to_core(int core) noexcept
+    {
+#ifdef __linux__
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(core, &cpus);
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+      return 0;
+#endif
+    }
+  } // namespace
+
+  WorkerPool::WorkerPool(int nworkers, int priority, int spin_iterations)
+    : priority_(priority), spin_iterations_(spin_iterations)
+  {
+    threads_.reserve(nworkers);
+    for (int i = 0; i < nworkers; i++) {
+      threads_.emplace_back([this, i] { worker_main(i); });
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    stop_ = true;
+    wake_seq_++;
+    futex_wake_all(wake_seq_);
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  int WorkerPool::default_workers() noexcept
+  {
+    return std::max(0, int(std::thread::hardware_concurrency()) - 1);
+  }
+
+  void WorkerPool::run(int njobs, Job job, void* context) noexcept
+  {
+    if (njobs <= 0) return;
+    if (!caller_pinned_) {
+      // Core 0 is left to the caller. Once, as it is a system call.
+      caller_pinned_ = true;
+      if (std::thread::hardware_concurrency() > 1) {
+        int rc = pin_to_core(0);
+        LOGW_IF(rc != 0, "Could not pin the audio thread: {}", std::strerror(rc));
+      }
+    }
+    if (threads_.empty()) {
+      for (int i = 0; i < njobs; i++) job(context, i);
+      return;
+    }
+
+    job_.store(job, std::memory_order_relaxed);
+    context_.store(context, std::memory_order_relaxed);
+    njobs_.store(njobs, std::memory_order_relaxed);
+    remaining_.store(njobs, std::memory_order_relaxed);
+
+    std::uint32_t generation = generation_of(batch_.load()) + 1;
+    batch_.store(std::uint64_t(generation) << 32);
+
+    wake_seq_++;
+    if (sleeping_.load() > 0) futex_wake_all(wake_seq_);
+
+    work(generation);
+    while (remaining_.load(std::memory_order_acquire) > 0) {
+      cpu_relax();
+    }
+  }
+
+  void WorkerPool::work(std::uint32_t generation) noexcept
+  {
+    auto batch = batch_.load();
+    while (generation_of(batch) == generation) {
+      auto index = std::uint32_t(batch);
+      if (int(index) >= njobs_.load(std::memory_order_relaxed)) return;
+      if (!batch_.compare_exchange_weak(batch, batch + 1)) continue;
+
+      job_.load(std::memory_order_relaxed)(context_.load(std::memory_order_relaxed), index);
+      remaining_.fetch_sub(1, std::memory_order_release);
+      batch = batch_.load();
+    }
+  }
+
+  void WorkerPool::worker_main(int index)
+  {
+    int ncores = std::thread::hardware_concurrency();
+    if (ncores > 1) {
+      // Core 0 is the caller's, see [run]()
+      int rc = pin_to_core(1 + index % (ncores - 1));
+      LOGW_IF(rc != 0, "Could not pin audio worker {}: {}", index, std::strerror(rc));
+    }
+
+    sched_param param = {};
+    param.sched_priority = priority_;
+    int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    LOGW_IF(rc != 0, "Could not make audio worker {} real-time: {}", index, std::strerror(rc));
+
+    register_audio_thread();
+
+    std::uint32_t seen = generation_of(batch_.load());
+    while (true) {
+      std::uint32_t generation = seen;
+      int spins                = 0;
+      while (!stop_) {
+        generation = generation_of(batch_.load());
+        if (generation != seen) break;
+        if (++spins < spin_iterations_) {
+          cpu_relax();
+          continue;
+        }
+        int seq = wake_seq_.load();
+        sleeping_++;
+        if (generation_of(batch_.load()) == seen && !stop_) futex_wait(wake_seq_, seq);
+        sleeping_--;
+        spins = 0;
+      }
+      if (stop_) return;
+      seen = generation;
+      work(generation);
+    }
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,83 @@
+/// \file
+/// A pool of real-time worker threads for the audio callback.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace otto::core::audio {
+
+  /// Runs batches of jobs on real-time threads, joined before returning.
+  ///
+  /// The workers are started and stopped on the thread that constructs and
+  /// destructs the pool, and are pinned to cores 1 and up with `SCHED_FIFO`
+  /// scheduling where the system allows it. The thread calling [run]() is
+  /// pinned to core 0 the first time it calls it. Between batches they spin for a
+  /// while before going to sleep, so a batch issued shortly after the last
+  /// one starts without a wakeup.
+  ///
+  /// [run]() never allocates or locks, and may be called from the audio
+  /// thread. Only one thread may call it at a time.
+  struct WorkerPool {
+    /// A job. Invoked with the context passed to [run]() and the index of the
+    /// job in the batch.
+    using Job = void (*)(void* context, int index);
+
+    /// Start `nworkers` threads.
+    ///
+    /// \param priority The `SCHED_FIFO` priority of the workers. Should be
+    /// close to, but not above, the priority of the audio thread.
+    /// \param spin_iterations How many times to poll for a new batch before
+    /// going to sleep
+    WorkerPool(int nworkers, int priority = 70, int spin_iterations = 1 << 12);
+    WorkerPool(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    /// The number of worker threads, not counting the caller of [run]()
+    int workers() const noexcept
+    {
+      return threads_.size();
+    }
+
+    /// Invoke `job(context, i)` for all `i` in `[0, njobs)`.
+    ///
+    /// The calling thread runs jobs too, and returns when all of them are
+    /// done. The first call pins the calling thread to core 0, which the
+    /// workers leave free for it.
+    void run(int njobs, Job job, void* context) noexcept;
+
+    /// The number of workers to use on this machine
+    ///
+    /// One less than the number of cores, since the audio thread runs
+    /// jobs itself.
+    static int default_workers() noexcept;
+
+  private:
+    void worker_main(int index);
+    /// Run jobs of the batch `generation` until there are none left.
+    void work(std::uint32_t generation) noexcept;
+
+    /// The current batch in the high 32 bits, and the next job to take in the
+    /// low 32 bits
+    std::atomic<std::uint64_t> batch_{0};
+    std::atomic<int> remaining_{0};
+    std::atomic<int> njobs_{0};
+    std::atomic<Job> job_{nullptr};
+    std::atomic<void*> context_{nullptr};
+
+    /// Futex word, bumped for every batch
+    std::atomic<int> wake_seq_{0};
+    std::atomic<int> sleeping_{0};
+    std::atomic_bool stop_{false};
+
+    /// Whether [run]() has pinned its caller
+    bool caller_pinned_ = false;
+    int priority_;
+    int spin_iterations_;
+    std::vector<std::thread> threads_;
+  };
+
+} // namespace otto::core::audio
@@ -1,7 +1,12 @@
 #include "engine_dispatcher.hpp"
 
+#include <chrono>
+
 #include "engine_selector_screen.hpp"
+#include "core/audio/param_queue.hpp"
+#include "services/audio.hpp"
 #include "services/engines.hpp"
+#include "services/logger.hpp"
 #include "services/presets.hpp"
 
 namespace otto::core::engines {
@@ -27,40 +32,57 @@ namespace otto::core::engines {
     _selector_screen = std::make_unique<EngineSelectorScreen>(*this);
   }
 
+  template<EngineType ET>
+  EngineDispatcher<ET>::~EngineDispatcher()
+  {
+    shutdown();
+  }
+
+  template<EngineType ET>
+  void EngineDispatcher<ET>::shutdown()
+  {
+    {
+      std::unique_lock lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_one();
+    if (_prepare_thread.joinable()) _prepare_thread.join();
+  }
+
   template<EngineType ET>
   Engine<ET>& EngineDispatcher<ET>::current() noexcept
   {
-    return *_current;
+    return *_current.load();
   }
 
   template<EngineType ET>
   const Engine<ET>& EngineDispatcher<ET>::current() const noexcept
   {
-    return *_current;
+    return *_current.load();
   }
 
   template<EngineType ET>
   Engine<ET>& EngineDispatcher<ET>::operator*() noexcept
   {
-    return *_current;
+    return *_current.load();
   }
 
   template<EngineType ET>
   const Engine<ET>& EngineDispatcher<ET>::operator*() const noexcept
   {
-    return *_current;
+    return *_current.load();
   }
 
   template<EngineType ET>
   Engine<ET>* EngineDispatcher<ET>::operator->() noexcept
   {
-    return _current;
+    return _current.load();
   }
 
   template<EngineType ET>
   const Engine<ET>* EngineDispatcher<ET>::operator->() const noexcept
   {
-    return _current;
+    return _current.load();
   }
 
   template<EngineType ET>
@@ -79,11 +101,169 @@ namespace otto::core::engines {
   template<EngineType ET>
   Engine<ET>& EngineDispatcher<ET>::select(Engine<ET>* ptr)
   {
-    if (_current == ptr && ptr != nullptr) return *_current;
-    if (_current != nullptr) _current->on_disable();
-    _current = ptr;
-    _current->on_enable();
-    return *_current;
+    if (_selected == ptr) return *ptr;
+    _selected = ptr;
+    request({ptr});
+    return *ptr;
+  }
+
+  template<EngineType ET>
+  void EngineDispatcher<ET>::apply_preset(int idx)
+  {
+    if (_selected == nullptr) return;
+    request({_selected, idx});
+  }
+
+  template<EngineType ET>
+  void EngineDispatcher<ET>::request(Request req)
+  {
+    if (!service::audio::running()) {
+      prepare(req);
+      return;
+    }
+    std::unique_lock lock(_mutex);
+    if (!_prepare_thread.joinable()) {
+      _prepare_thread = std::thread([this] { prepare_loop(); });
+    }
+    // Only the last switch matters, so skip engines that were scrolled past
+    if (req.preset < 0) {
+      _requests.erase(std::remove_if(_requests.begin(), _requests.end(),
+                                     [](const Request& r) { return r.preset < 0; }),
+                      _requests.end());
+    }
+    _requests.push_back(req);
+    _cv.notify_one();
+  }
+
+  template<EngineType ET>
+  void EngineDispatcher<ET>::prepare_loop()
+  {
+    // The engines are not being processed while they are prepared, so
+    // their parameters are set directly rather than queued.
+    audio::register_audio_thread();
+
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [this] { return _stop || !_requests.empty(); });
+      if (_stop) return;
+      auto req = _requests.front();
+      _requests.pop_front();
+      lock.unlock();
+      try {
+        prepare(req);
+      } catch (util::exception& e) {
+        LOGE("Could not prepare engine {}: {}", req.engine->name(), e.what());
+      }
+      lock.lock();
+    }
+  }
+
+  template<EngineType ET>
+  void EngineDispatcher<ET>::prepare(Request req)
+  {
+    auto* engine  = req.engine;
+    auto* current = _current.load();
+    if (req.preset < 0) {
+      if (engine == current) return;
+      engine->on_enable();
+      _current = engine;
+      // Only touch the old engine once the audio thread is done with it
+      if (hand_over(engine) && current != nullptr) current->on_disable();
+    } else if (engine == current) {
+      if (!hand_over(nullptr)) return;
+      service::presets::apply_preset(*engine, req.preset);
+      hand_over(engine);
+    } else {
+      // It is enabled when it is selected
+      service::presets::apply_preset(*engine, req.preset, true);
+    }
+  }
+
+  template<EngineType ET>
+  bool EngineDispatcher<ET>::hand_over(Engine<ET>* engine)
+  {
+    using namespace std::chrono_literals;
+
+    _target.store(engine, std::memory_order_release);
+    // Without an audio thread, it is picked up when processing starts
+    if (!service::audio::running()) return true;
+
+    auto warn_at = std::chrono::steady_clock::now() + 500ms;
+    bool warned  = false;
+    std::unique_lock lock(_mutex);
+    while (_settled.load(std::memory_order_acquire) != engine) {
+      if (_stop) return false;
+      // Nothing is processed anymore
+      if (!service::audio::running()) return true;
+      if (!warned && std::chrono::steady_clock::now() > warn_at) {
+        LOGW("The audio thread has not picked up the engine switch in 500ms");
+        warned = true;
+      }
+      _cv.wait_for(lock, 1ms);
+    }
+    return true;
+  }
+
+  template<EngineType ET>
+  audio::ProcessData<1> EngineDispatcher<ET>::process(
+    audio::ProcessData<in_channels> data) noexcept
+  {
+    if (!_fading) {
+      auto* target = _target.load(std::memory_order_acquire);
+      if (target != _playing) {
+        _fading_out = _playing;
+        _playing    = target;
+        _fading     = true;
+        _fade_pos   = 0;
+      }
+    }
+
+    if (!_fading) {
+      if (_playing != nullptr) return _playing->process(data);
+      if constexpr (in_channels == 1) {
+        return data;
+      } else {
+        return data.redirect(_fade_buf).fill_silence();
+      }
+    }
+
+    // The old engine, or what is played without one, goes in `out`
+    auto out = data.redirect(_fade_buf);
+    if (_fading_out != nullptr) {
+      auto old_in = data;
+      if constexpr (in_channels == 1) {
+        // Effects may process in place, so give each engine its own input
+        old_in = data.redirect(_input_copy);
+        std::copy(data.begin(), data.end(), old_in.begin());
+      }
+      auto old_out = _fading_out->process(old_in);
+      std::copy(old_out.begin(), old_out.end(), out.begin());
+    } else if constexpr (in_channels == 1) {
+      std::copy(data.begin(), data.end(), out.begin());
+    } else {
+      std::fill(out.begin(), out.end(), std::array<float, 1>{{0}});
+    }
+
+    gsl::span<std::array<float, 1>> next;
+    if (_playing != nullptr) {
+      next = _playing->process(data).audio;
+    } else if constexpr (in_channels == 1) {
+      next = data.audio;
+    }
+
+    for (int i = 0; i < data.nframes; i++) {
+      float gain = std::min(1.f, float(_fade_pos + i) / crossfade_frames);
+      float in   = next.empty() ? 0.f : next[i][0];
+      out.audio[i][0] += (in - out.audio[i][0]) * gain;
+    }
+
+    _fade_pos += data.nframes;
+    if (_fade_pos >= crossfade_frames) {
+      _fading     = false;
+      _fading_out = nullptr;
+      _settled.store(_playing, std::memory_order_release);
+    }
+    return out;
   }
 
   template<EngineType ET>
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "core/engines/engine.hpp"
 
 
@@ -9,6 +15,14 @@ namespace otto::core::engines {
   // the bottom.
 
   /// Owns engines of type `ET`, and dispatches to a selected one of them
+  ///
+  /// Switching engines, or applying a preset to the selected one, may load
+  /// samples from disk, so it is done on a background thread. Once the new
+  /// engine is ready, it is handed to the audio thread, which crossfades to it
+  /// over [crossfade_frames](). Neither the UI thread nor the audio thread
+  /// ever waits for the switch.
+  ///
+  /// Before audio processing has started, switches are done synchronously.
   template<EngineType ET>
   struct EngineDispatcher {
     enum struct ErrorCode { none = 0, engine_not_found, type_mismatch };
@@ -17,6 +31,18 @@ namespace otto::core::engines {
 
     static constexpr const EngineType type = ET;
 
+    /// The number of audio channels the engines take as input
+    static constexpr int in_channels = ET == EngineType::effect ? 1 : 0;
+
+    /// The length of the crossfade between the old and the new engine
+    static constexpr int crossfade_frames = 256;
+
+    EngineDispatcher() = default;
+    EngineDispatcher(const EngineDispatcher&) = delete;
+
+    /// \effects [shutdown]()
+    ~EngineDispatcher();
+
     // Initialization
 
     /// Construct all registered engines
@@ -45,12 +71,14 @@ namespace otto::core::engines {
     ///
     /// \requires `ptr >= _engines.begin() && ptr < _engines.end()`
     ///
-    /// \effects If `_current` is not null, `_current->on_disable()`. Then,
-    /// assign `ptr` to `_current`, and invoke `ptr->on_enable()`
+    /// \effects In the background, invoke `ptr->on_enable()`, assign `ptr` to
+    /// `_current`, and crossfade to it on the audio thread. Then invoke
+    /// `on_disable()` on the previous engine.
     ///
-    /// \postconditions `current() == *ptr`
+    /// \postconditions `current() == *ptr` once the background work is done.
+    /// Immediately, if audio processing has not started yet.
     ///
-    /// \returns `current()`
+    /// \returns `*ptr`
     Engine<ET>& select(Engine<ET>* ptr);
 
     /// Select engine
@@ -69,6 +97,25 @@ namespace otto::core::engines {
     /// \throws `util::exception` when no matching engine was found
     Engine<ET>& select(const std::string& name);
 
+    /// Apply a preset to the last selected engine
+    ///
+    /// \effects In the background, fade the engine out if it is playing,
+    /// invoke [presets::apply_preset](), and fade it back in.
+    void apply_preset(int idx);
+
+    /// Process the selected engine
+    ///
+    /// Only call this from the audio thread. Picks up engines handed over by
+    /// the background thread, and crossfades to them. While no engine is
+    /// selected, instruments output silence, and effects pass the input
+    /// through.
+    audio::ProcessData<1> process(audio::ProcessData<in_channels> data) noexcept;
+
+    /// Stop the background thread
+    ///
+    /// Pending switches are dropped.
+    void shutdown();
+
     /// Access the screen used to select engines/presets
     ///
     /// The returned screen has the dynamic type [EngineSelectorScreen]()
@@ -81,9 +128,50 @@ namespace otto::core::engines {
     void from_json(const nlohmann::json&);
 
   private:
+    /// A switch or preset change, carried out by the background thread
+    struct Request {
+      Engine<ET>* engine;
+      /// The preset to apply, or `-1` to select `engine`
+      int preset = -1;
+    };
+
+    void request(Request);
+    void prepare(Request);
+    void prepare_loop();
+    /// Make the audio thread play `engine`, and wait until it is done fading
+    ///
+    /// Waits for as long as it takes, so the caller can safely change the
+    /// engine that was playing once this returns `true`.
+    ///
+    /// \returns `false` if [shutdown]() was called first, in which case the
+    /// old engine may still be playing.
+    bool hand_over(Engine<ET>* engine);
+
     std::vector<std::unique_ptr<Engine<ET>>> _engines;
     std::unique_ptr<ui::Screen> _selector_screen;
-    Engine<ET>* _current;
+    /// The prepared engine. Shown by the UI
+    std::atomic<Engine<ET>*> _current = nullptr;
+    /// The engine most recently passed to `select`
+    Engine<ET>* _selected = nullptr;
+
+    std::thread _prepare_thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Request> _requests;
+    bool _stop = false;
+
+    /// The engine the audio thread should play
+    std::atomic<Engine<ET>*> _target = nullptr;
+    /// The engine the audio thread plays, once it is done fading
+    std::atomic<Engine<ET>*> _settled = nullptr;
+
+    // Only used on the audio thread
+    Engine<ET>* _playing    = nullptr;
+    Engine<ET>* _fading_out = nullptr;
+    bool _fading            = false;
+    int _fade_pos           = 0;
+    audio::ProcessBuffer<1> _fade_buf;
+    audio::ProcessBuffer<1> _input_copy;
   };
 
 } // namespace otto::core::engines
@@ -23,12 +23,10 @@ namespace otto::core::engines {
   }
 
   SelectorWidget::Options EngineSelectorScreen::prst_opts(
-    std::function<AnyEngine&()>&& cur_eg) noexcept
+    std::function<void(int)>&& apply_preset) noexcept
   {
         SelectorWidget::Options opts;
-        opts.on_select = [cur_eg = std::move(cur_eg)](int idx) {
-            service::presets::apply_preset(cur_eg(), idx);
-          };
+        opts.on_select = std::move(apply_preset);
         opts.item_colour = Colours::Green;
         opts.size = {120, vg::HEIGHT};
         return opts;
@@ -27,7 +27,7 @@ namespace otto::core::engines {
     ui::SelectorWidget preset_wid;
 
     ui::SelectorWidget::Options eng_opts(std::function<AnyEngine&(int)>&&) noexcept;
-    ui::SelectorWidget::Options prst_opts(std::function<AnyEngine&()>&&) noexcept;
+    ui::SelectorWidget::Options prst_opts(std::function<void(int)>&&) noexcept;
   };
 
   // Constructor implementation
@@ -38,7 +38,7 @@ namespace otto::core::engines {
     : engine_wid(engine_names, eng_opts([&ed](int idx) -> AnyEngine& {
                    return ed.select(static_cast<std::size_t>(idx));
                  })),
-      preset_wid(preset_names, prst_opts([&ed]() -> AnyEngine& { return ed.current(); }))
+      preset_wid(preset_names, prst_opts([&ed](int idx) { ed.apply_preset(idx); }))
   {
     engine_names.reserve(ed.engines().size());
     util::transform(ed.engines(), std::back_inserter(engine_names),
@@ -9,6 +9,10 @@ namespace otto::core::props {
   struct common {
     struct hooks {
       struct on_set : mixin::hook<mixin::value_type> {};
+      /// Run once the property has been constructed with its initial value
+      struct on_init : mixin::hook<mixin::value_type> {};
+      /// Run after [set]() has stored the new value. Should only read it.
+      struct on_changed : mixin::hook<mixin::value_type> {};
     };
   };
 
@@ -60,6 +64,7 @@ namespace otto::core::props {
         static_cast<inherits_from_mixins_t<T, tag_list>&>(*this) = {
           std::forward<Args>(args)...};
       }
+      run_hook<common::hooks::on_init>(value_);
     }
 
     template<typename Tag>
@@ -109,6 +114,7 @@ namespace otto::core::props {
     void set(const value_type& v)
     {
       value_ = run_hook<common::hooks::on_set>(v);
+      run_hook<common::hooks::on_changed>(value_);
     }
 
     PropertyImpl& operator=(const value_type& rhs)
@@ -2,6 +2,7 @@
 
 #include "faust_link.hpp"
 #include "has_limits.hpp"
+#include "observable.hpp"
 #include "serializable.hpp"
 #include "steppable.hpp"
 #include "wrap.hpp"
@@ -7,6 +7,7 @@
 #include "../internal/mixin_macros.hpp"
 #include "../internal/property.hpp"
 
+#include "core/audio/param_queue.hpp"
 #include "services/logger.hpp"
 #include "util/algorithm.hpp"
 
@@ -95,20 +96,40 @@ namespace otto::core::props {
       faust_links_.clear();
     }
 
+    void on_hook(hook<common::hooks::on_init, HookOrder::After> & hook)
+    {
+      audio_value_ = hook.value();
+    }
+
+    /// Changes are handed to the audio thread through the
+    /// [audio::ParameterQueue](), so Faust and [audio_value]() are only
+    /// updated between blocks.
     void on_hook(hook<common::hooks::on_set, HookOrder::After> & hook)
     {
+      auto& queue = audio::parameter_queue();
+      queue.set(audio_value_, hook.value());
       if (type_ == FaustLink::Type::ToFaust) {
         for (auto&& fl : faust_links_) {
-          *fl = hook.value();
+          queue.set(*fl, float(hook.value()));
         }
       }
     }
 
+    /// The value as seen by the audio thread.
+    ///
+    /// Audio processors should read this instead of the property itself. It
+    /// does not change during a block.
+    const value_type& audio_value() const noexcept
+    {
+      return audio_value_;
+    }
+
     const FaustLink::Type& type = type_;
 
   private:
     FaustLink::Type type_ = FaustLink::Type::ToFaust;
     std::vector<float*> faust_links_;
+    value_type audio_value_ = {};
   };
 
 } // namespace otto::core::props
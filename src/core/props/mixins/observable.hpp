@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../internal/property.hpp"
+#include "../internal/mixin_macros.hpp"
+
+#include "util/event.hpp"
+
+namespace otto::core::props {
+
+  OTTO_PROPS_MIXIN(observable);
+
+  /// Lets code outside the property react when it is set
+  OTTO_PROPS_MIXIN_LEAF(observable) {
+    OTTO_PROPS_MIXIN_DECLS(observable);
+
+    /// Fired with the new value after every [set](), once the property holds
+    /// it
+    util::Event<value_type>& on_change()
+    {
+      return on_change_;
+    }
+
+    void on_hook(hook<common::hooks::on_changed, HookOrder::After>& hook)
+    {
+      on_change_.fire(hook.value());
+    }
+
+  private:
+    util::Event<value_type> on_change_;
+  };
+} // namespace otto::core::props
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 
+#include "core/audio/dsp_profiler.hpp"
 #include "core/globals.hpp"
 #include "core/ui/waveform_widget.hpp"
 #include "core/ui/canvas.hpp"
@@ -31,7 +32,8 @@ namespace otto::engines {
         props,
         std::make_unique<DrumSampleScreen>(this)),
       maxSampleSize(16 * service::audio::samplerate()),
-      sampleData(maxSampleSize)
+      sampleData(maxSampleSize),
+      voices_gauge_(audio::dsp_profiler().gauge("Drum Sampler voices"))
   {
     service::audio::events::samplerate_change().subscribe([this](int sr) {
       maxSampleSize = 16 * sr;
@@ -56,27 +58,32 @@ namespace otto::engines {
   }
 
   audio::ProcessData<1> DrumSampler::process(audio::ProcessData<0> data) {
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent, [&] (midi::NoteOnEvent& e) {
-          currentVoiceIdx = e.key % nVoices;
-          auto &&voice = props.voiceData[currentVoiceIdx];
-          voice.playProgress = (voice.fwd()) ? 0 : voice.length() - 1;
-          voice.trigger = true;
-        }, [] (auto&&) {});
+    for (auto &&e : data.midi) {
+      if (e.type != midi::Event::Type::NoteOn) continue;
+      currentVoiceIdx = e.key() % nVoices;
+      auto &&voice = props.voiceData[currentVoiceIdx];
+      voice.playProgress = (voice.fwd()) ? 0 : voice.length() - 1;
+      voice.trigger = true;
     }
 
-    proc_buf.clear();
+    // Only touch the frames of this slice of the block
+    auto out = data.redirect(proc_buf);
+    std::fill(out.begin(), out.end(), std::array<float, 1>{{0}});
 
+    int active = 0;
     for (auto &&voice : props.voiceData) {
+      // Voices are idle until their next trigger
+      if (voice.playProgress < 0) continue;
+      active++;
 
       float playSpeed = voice.pitch.pow_2() * sampleSpeed;
 
       // Process audio
-      if (voice.playProgress >= 0 && playSpeed > 0) {
+      if (playSpeed > 0) {
         if (voice.fwd()) {
           if (voice.loop() && voice.trigger) {
             for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
+              out.audio[i][0] += sampleData[voice.in + voice.playProgress];
               voice.playProgress += playSpeed;
               if (voice.playProgress >= voice.length()) {
                 voice.playProgress = 0;
@@ -84,7 +91,7 @@ namespace otto::engines {
             }
           } else {
             for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
+              out.audio[i][0] += sampleData[voice.in + voice.playProgress];
               voice.playProgress += playSpeed;
               if (voice.playProgress >= voice.length()) {
                 voice.playProgress = -1;
@@ -95,7 +102,7 @@ namespace otto::engines {
         } else {
           if (voice.loop() && voice.trigger) {
             for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
+              out.audio[i][0] += sampleData[voice.in + voice.playProgress];
               voice.playProgress -= playSpeed;
               if (voice.playProgress < 0) {
                 voice.playProgress = voice.length() -1;
@@ -103,7 +110,7 @@ namespace otto::engines {
             }
           } else {
             for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
+              out.audio[i][0] += sampleData[voice.in + voice.playProgress];
               voice.playProgress -= playSpeed;
               if (voice.playProgress < 0) break;
             }
@@ -111,21 +118,20 @@ namespace otto::engines {
         }
       }
     }
+    audio::dsp_profiler().record_gauge(voices_gauge_, active);
+    out.silent = active == 0;
+
+    for (auto &&e : data.midi) {
+      if (e.type == midi::Event::Type::NoteOff && e.channel == 1) {
+        auto &&voice = props.voiceData[e.key() % nVoices];
+        voice.trigger = false;
+        if (voice.stop()) {
+          voice.playProgress = -1;
+        }
+      }
+    }
 
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent,
-        [&] (midi::NoteOffEvent& e) {
-          if (e.channel == 1) {
-            auto &&voice = props.voiceData[e.key % nVoices];
-            voice.trigger = false;
-            if (voice.stop()) {
-              voice.playProgress = -1;
-            }
-          }
-        }, [] (auto&&) {});
-    };
-
-    return data.redirect(proc_buf);
+    return out;
   }
 
   void DrumSampler::load() {
@@ -99,6 +99,8 @@ namespace otto::engines {
 
   private:
     audio::ProcessBuffer<1> proc_buf;
+    /// The number of playing voices, in the dsp profile
+    int voices_gauge_ = -1;
   };
 
 }  // namespace otto::engines
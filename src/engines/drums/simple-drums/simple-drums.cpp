@@ -1,6 +1,9 @@
 #include "simple-drums.hpp"
 #include "simple-drums.faust.hpp"
 
+#include "util/audio_kernels.hpp"
+
+#include "core/audio/dsp_profiler.hpp"
 #include "core/ui/vector_graphics.hpp"
 #include "core/globals.hpp"
 #include "services/ui.hpp"
@@ -27,38 +30,40 @@ namespace otto::engines {
   SimpleDrumsEngine::SimpleDrumsEngine()
     : DrumsEngine("Simple drums",
         props,
-        std::make_unique<SimpleDrumsScreen>(this))
+        std::make_unique<SimpleDrumsScreen>(this)),
+      voices_gauge_(audio::dsp_profiler().gauge("Simple drums voices"))
   {}
 
   SimpleDrumsEngine::~SimpleDrumsEngine() {}
 
   audio::ProcessData<1> SimpleDrumsEngine::process(audio::ProcessData<0> data)
   {
-    for (auto&& nEvent : data.midi) {
-      util::match(nEvent,
-        [&](midi::NoteOnEvent& e) {
-          currentVoiceIdx                       = e.key % 24;
-          voices[currentVoiceIdx].props.trigger = true;
-          voices[currentVoiceIdx].props.envelope.sustain =
-            float(e.velocity) / 128.f;
-        },
-        [](auto&&) {});
+    for (auto&& e : data.midi) {
+      if (e.type != midi::Event::Type::NoteOn) continue;
+      currentVoiceIdx                       = e.key() % 24;
+      voices[currentVoiceIdx].props.trigger = true;
+      voices[currentVoiceIdx].tail.wake();
+      voices[currentVoiceIdx].props.envelope.sustain = float(e.velocity()) / 128.f;
     }
-    proc_buf.clear();
-    voice_buf.clear();
+    // Only touch the frames of this slice of the block
+    auto out = data.redirect(proc_buf);
+    std::fill(out.begin(), out.end(), std::array<float, 1>{{0}});
+    int active = 0;
     for (auto&& voice : voices) {
+      if (voice.tail.idle()) continue;
+      active++;
       auto voice_data = voice.process(data.midi_only());
-      for (auto[vb, pb] : util::zip(voice_data, proc_buf)) {
-        util::audio::add_all(pb, vb);
-      }
+      util::audio::accumulate(out.audio.data()->data(), voice_data.audio.data()->data(),
+                              out.nframes);
+      voice.tail.update(voice_data.audio.data()->data(), voice_data.nframes,
+                        voice.props.trigger);
+    }
+    audio::dsp_profiler().record_gauge(voices_gauge_, active);
+    out.silent = active == 0;
+    for (auto&& e : data.midi) {
+      if (e.type == midi::Event::Type::NoteOff) voices[e.key() % 24].props.trigger = false;
     }
-    for (auto&& nEvent : data.midi) {
-      util::match(nEvent,
-        [&](
-          midi::NoteOffEvent& e) { voices[e.key % 24].props.trigger = false; },
-        [](auto&&) {});
-    };
-    return data.redirect(proc_buf);
+    return out;
   }
 
   nlohmann::json SimpleDrumsEngine::Props::to_json() const
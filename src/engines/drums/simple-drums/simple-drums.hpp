@@ -4,6 +4,7 @@
 
 #include "core/engines/engine.hpp"
 #include "core/audio/faust.hpp"
+#include "core/audio/tail_detector.hpp"
 #include "core/ui/canvas.hpp"
 
 namespace otto::engines {
@@ -35,6 +36,9 @@ namespace otto::engines {
     } props;
 
     SimpleDrumVoice();
+
+    /// Skips the voice once it has decayed
+    audio::TailDetector tail;
   };
 
   struct SimpleDrumsEngine : DrumsEngine {
@@ -58,7 +62,8 @@ namespace otto::engines {
 
   private:
     audio::ProcessBuffer<1> proc_buf;
-    audio::ProcessBuffer<1> voice_buf;
+    /// The number of voices that are not idle, in the dsp profile
+    int voices_gauge_ = -1;
   };
 
 }
@@ -16,11 +16,13 @@ namespace otto::engines {
       MasterFB = 3
     };
 
+    /// Both change the routing of the engine graph, which is rebuilt when they
+    /// do
     struct Props : Properties<> {
-      Property<std::underlying_type_t<Selection>, wrap> input = {
+      Property<std::underlying_type_t<Selection>, wrap, observable> input = {
         this, "input", 0,
         has_limits::init(0, 3)};
-      Property<int, wrap> track {this, "track", 0, has_limits::init(0, 3)};
+      Property<int, wrap, observable> track {this, "track", 0, has_limits::init(0, 3)};
 
       using Properties::Properties;
     } props;
@@ -29,6 +31,17 @@ namespace otto::engines {
       : Engine ("InputSelector", props, nullptr)
     {}
 
+    /// The frames the audio of `selection` is late by when it is recorded,
+    /// compared to the tape it was played along to
+    ///
+    /// Only external input makes the round trip through the audio device. The
+    /// internal sources and the feedback are processed in the same block as
+    /// the tape.
+    static constexpr int record_latency(Selection selection, int round_trip_latency) noexcept
+    {
+      return selection == Selection::External ? round_trip_latency : 0;
+    }
+
   };
 
 }
@@ -31,7 +31,14 @@ namespace otto::engines {
   audio::ProcessData<1> Metronome::process(audio::ProcessData<0> data) {
     TIME_SCOPE("Metronome::process");
 
-    float BPsample = props.bpm / 60.0 / (float) service::audio::samplerate();
+    bool on = props.gain.audio_value() > 0;
+    if (on) tail_.wake();
+    if (tail_.idle()) {
+      graph.add(0, data.nframes);
+      return data.redirect(faust_.proc_buf).fill_silence();
+    }
+
+    float BPsample = props.bpm.audio_value() / 60.0 / (float) service::audio::samplerate();
     float beat = service::engines::tape_state::position() * BPsample;
     int framesTillNext = std::fmod(beat, 1)/BPsample * service::engines::tape_state::playSpeed();
 
@@ -50,7 +57,9 @@ namespace otto::engines {
       graph.add(frm[0]);
     }
 
-    return data.redirect(faust_.proc_buf);
+    auto out = data.redirect(faust_.proc_buf);
+    tail_.update(out.audio.data()->data(), out.nframes, on);
+    return out;
   }
 
   // Bars
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstdint>
+
 #include "core/engines/engine.hpp"
 #include "core/ui/screen.hpp"
 #include "core/ui/vector_graphics.hpp"
 #include "core/audio/faust.hpp"
+#include "core/audio/tail_detector.hpp"
 #include "util/audio.hpp"
 #include "util/iterator.hpp"
 
@@ -14,7 +17,7 @@ namespace otto::engines {
   using namespace props;
 
   using BeatPos = int;
-  using TapeTime = int;
+  using TapeTime = std::int64_t;
 
   struct Metronome : Engine<EngineType::studio>
   {
@@ -48,5 +51,7 @@ namespace otto::engines {
     std::size_t time_for_bar(float bar) const;
   private:
     audio::FaustWrapper<0, 1> faust_;
+    /// Skips the dsp while the metronome is off and its last click has faded
+    audio::TailDetector tail_;
   };
 }
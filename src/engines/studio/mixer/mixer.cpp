@@ -1,5 +1,6 @@
 #include "mixer.hpp"
 
+#include "util/audio_kernels.hpp"
 #include "util/timer.hpp"
 
 #include "core/ui/vector_graphics.hpp"
@@ -34,36 +35,31 @@ namespace otto::engines {
 
   audio::ProcessData<2> Mixer::process_tracks(audio::ProcessData<4> data)
   {
-    auto level = util::generate_array<4>(
-      [this] (int n) { return props.tracks[n].level.get(); });
-    auto pan = util::generate_array<4>(
-      [this] (int n) { return props.tracks[n].pan.get(); });
-    auto muted = util::generate_array<4>(
-      [this] (int n) { return props.tracks[n].muted.get(); });
-
-    for (auto&& [in, out] : util::zip(data.audio, proc_buf)) {
-        float lMix = 0, rMix = 0;
-        for (int t = 0; t < 4 ; t++) {
-          float audio = in[t] * level[t];
-          if (!muted[t]) {
-            lMix += audio * (1-pan[t]);
-            rMix += audio * (1+pan[t]);
-          }
-          graphs[t].add(audio);
-        }
-        out = {{lMix, rMix}};
-  };
+    if (data.silent) {
+      for (auto& graph : graphs) graph.add(0, data.nframes);
+      return data.redirect(proc_buf).fill_silence();
+    }
 
-    return data.redirect(proc_buf);
-  }
+    std::array<util::audio::StereoGain, 4> gains;
+    std::array<util::audio::Levels, 4> levels = {};
+    for (int t = 0; t < 4; t++) {
+      auto& track = props.tracks[t];
+      gains[t]    = track.muted.audio_value()
+                   ? util::audio::StereoGain{0, 0}
+                   : util::audio::pan_gains(track.level.audio_value(), track.pan.audio_value());
+    }
 
-  audio::ProcessData<2> Mixer::process_engine(audio::ProcessData<1> data)
-  {
-    for (auto&& [in, out] : util::zip(data.audio, proc_buf)) {
-      out[0] += in[0];
-      out[1] += in[0];
+    auto out = data.redirect(proc_buf);
+    util::audio::mix_to_stereo(data.audio.data()->data(), 4, out.audio.data()->data(),
+                               data.nframes, gains.data());
+
+    // The meters show the level before muting
+    util::audio::measure(data.audio.data()->data(), 4, data.nframes, levels.data());
+    for (int t = 0; t < 4; t++) {
+      graphs[t].add(levels[t].sum_abs * props.tracks[t].level.audio_value(), levels[t].nsamples);
     }
-    return data.redirect(proc_buf);
+
+    return out;
   }
 
   /**************************************************/
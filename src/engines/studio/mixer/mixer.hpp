@@ -18,7 +18,6 @@ namespace otto::engines {
     Mixer();
 
     audio::ProcessData<2> process_tracks(audio::ProcessData<4>);
-    audio::ProcessData<2> process_engine(audio::ProcessData<1>);
 
     struct Props : public Properties<> {
       struct TrackInfo : public Properties<> {
@@ -1,130 +1,585 @@
 #include "tapebuffer.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <vector>
 
+#include "util/mapped_file.hpp"
+#include "util/tape_codec.hpp"
 #include "util/tapefile.hpp"
+#include "util/uring_file.hpp"
 #include "util/timer.hpp"
+#include "util/wakeup.hpp"
 #include "core/globals.hpp"
 #include "services/logger.hpp"
 
 namespace otto::engines {
 
   using value_type = tape_buffer::value_type;
+  using Position   = tape_buffer::Position;
+  using TapeSection = util::audio::Section<Position>;
   constexpr int buffer_size = tape_buffer::buffer_size;
 
-  constexpr int wrap(std::size_t position)
+  static_assert(tape_buffer::max_length <= util::TapeFile::max_frames,
+                "The tape file is too short for the tape");
+
+  constexpr int wrap(Position position)
   {
-    return position % buffer_size;
+    return std::size_t(position) % buffer_size;
+  }
+
+  /// Whether two sections of the tape use any of the same buffer slots
+  inline bool share_slots(TapeSection a, TapeSection b)
+  {
+    auto distance = [](Position from, Position to) { return ((to - from) % buffer_size + buffer_size) % buffer_size; };
+    return a.size() > 0 && b.size() > 0 &&
+           (distance(a.in, b.in) < a.size() || distance(b.in, a.in) < b.size());
   }
 
   /// Handles all interactions with the tapefile. Works on its own thread
+  ///
+  /// It sleeps until the audio thread sees the buffer fall below
+  /// [tape_buffer::wake_threshold](), and then reads and writes as much as it
+  /// can. No locks are shared with the audio thread.
+  ///
+  /// The file is accessed through one of these, chosen by the environment
+  /// variable `OTTO_TAPE_IO`:
+  ///
+  ///  - `uring` (the default): Reads and writes are queued to io_uring in
+  ///    chunks of [request_size](), so the write-back and the reads at both
+  ///    ends are in flight at once, and a slow request on one of them does not
+  ///    hold up the others. The end the tape is moving towards is read first,
+  ///    and made available as soon as it is done.
+  ///  - `mmap`: The audio of the file is memory mapped, so moving it to and
+  ///    from the buffer are memory copies. The pages beyond the loaded section
+  ///    are read ahead, and recorded pages are synced in batches.
+  ///  - `stream`: Blocking reads and writes through the [util::TapeFile]().
+  ///
+  /// If io_uring is not available, the file is memory mapped. If that fails,
+  /// it is accessed through the stream.
+  ///
+  /// A new tape file is compressed if `OTTO_TAPE_CODEC` is `lossless`, which
+  /// takes less disk bandwidth for some CPU time on this thread. An existing
+  /// file keeps its encoding. A compressed file is not memory mapped, and
+  /// through io_uring, each request is for a whole block, which is encoded or
+  /// decoded in a [Staged]() block.
+  ///
+  /// Whichever is used, the parts of the tape that were never recorded are
+  /// filled with silence without touching the file, and a chunk of the file is
+  /// only allocated when it is first written to.
   struct Producer {
 
-    /// The desired distance from the playpoint to the head, and vice versa for
-    /// the tail
-    const int goal_length = tape_buffer::buffer_size / 2 - 2;
+    const int goal_length = tape_buffer::goal_length;
+
+    /// The minimum number of samples to read from, or write to, file. The same
+    /// as the threshold the producer is woken at.
+    const int min_read_size = tape_buffer::wake_threshold;
+    const int min_write_size = tape_buffer::wake_threshold;
 
-    /// The minimum number of samples to read from file
-    const int min_read_size = tape_buffer::buffer_size >> 8;
-    const int min_write_size = tape_buffer::buffer_size >> 8;
+    /// Recorded frames are synced to disk once this many have been written
+    const int sync_size = tape_buffer::buffer_size;
+    static constexpr std::size_t frame_bytes = sizeof(value_type);
 
-    const fs::path path = global::data_dir / "tape.wav";
+    const fs::path path = global::data_dir / "tape.otto";
     util::TapeFile file;
-    std::thread thread;
+    /// The tape file, unless stream access was asked for
+    util::MappedFile mapped;
+    /// The bytes of `mapped` that were written, and not synced yet
+    util::audio::Section<std::int64_t> unsynced = {0, 0};
+    /// The number of frames written to `unsynced`
+    Position unsynced_frames = 0;
+
+    /// The sections popped from [tape_buffer::write_queue](), and not written
+    /// yet
+    TapeSection dirty = {0, 0};
+    /// The frames that were queued in `dirty`
+    Position dirty_frames = 0;
+    /// A popped section apart from `dirty`. It is written after `dirty`,
+    /// instead of writing everything between them.
+    TapeSection held = {0, 0};
+
+    /// The tape file, if io_uring is used
+    std::unique_ptr<util::UringFile> uring;
+    /// The requests `uring` has room for
+    static constexpr unsigned uring_depth = 32;
+    /// The frames in each request to `uring`. The requests are aligned to
+    /// multiples of this on the tape, so none of them spans two chunks.
+    static constexpr int request_size = 1 << 12;
+    static_assert(util::TapeFile::chunk_frames % request_size == 0);
+    static_assert(util::TapeFile::block_frames % request_size == 0);
+    /// What an io_uring request is for
+    enum Side { head_side, tail_side, write_side, sides };
+    /// Requests in flight, per side
+    std::array<int, sides> pending = {};
+    /// The values to commit when the requests of a side are done
+    std::array<TapeSection, sides> planned;
+    /// The position the last cycle started from, to tell the direction
+    Position last_index = 0;
+
+    /// A block of a compressed tape, on its way to or from `uring`
+    struct Staged {
+      /// The frames of the buffer the request is for
+      Position position = 0;
+      int n = 0;
+      Side side = head_side;
+      /// The bytes written
+      std::size_t size = 0;
+      bool in_use = false;
+      /// The whole block, decoded
+      std::vector<value_type> frames = std::vector<value_type>(util::TapeFile::block_frames);
+      /// The whole block, as in the file
+      std::vector<std::byte> encoded = std::vector<std::byte>(util::TapeCodec::max_encoded_size);
+    };
+    /// Set in the tags of the requests for `staged` blocks
+    static constexpr std::uint64_t staged_tag = std::uint64_t(1) << 63;
+    /// Only allocated for a compressed tape, through io_uring
+    std::vector<Staged> staged;
+    util::TapeCodec codec;
+
     tape_buffer& owner;
-    std::mutex global_lock;
-    std::condition_variable waiting;
+    util::wakeup waiting;
     std::atomic_bool keepRunning {true};
+    /// Declared last, so everything it uses is constructed before it starts
+    std::thread thread;
+
+    /// How long to sleep without a notification, in case a change of the
+    /// buffer did not notify
+    static constexpr std::chrono::milliseconds poll_interval {100};
 
     Producer(tape_buffer& owner)
-      : thread {&Producer::main_routine, this},
-	owner {owner}
+      : owner {owner},
+	thread {&Producer::main_routine, this}
     {}
 
     ~Producer()
     {
       keepRunning = false;
-      {
-        std::unique_lock lock {global_lock};
-        waiting.notify_all();
-      }
+      waiting.notify();
       thread.join();
     }
 
     void main_routine()
     {
       service::logger::set_thread_name("Tape Buffer");
-      file.open(path);
+      open_tape();
       read_slices();
+      open_file();
 
+      bool notified = false;
       while (keepRunning) {
-        std::unique_lock lock {global_lock};
+        bool did_work;
         {
           TIME_SCOPE("TapeBuffer read cycle");
-          std::size_t index = owner.current_position;
-
-          write_from_buffer();
-          fill_buffer(index);
+          Position index = owner.current_position;
+          follow_jump(index);
+
+          if (uring) {
+            did_work = cycle_async(index);
+          } else {
+            did_work = write_from_buffer();
+            did_work |= fill_buffer(index);
+          }
+        }
+        if (notified) {
+          owner.dbg.wakeups++;
+          if (!did_work) owner.dbg.wasted_wakeups++;
         }
-        waiting.wait(lock);
+        notified = waiting.wait_for(poll_interval);
       }
 
       // Make sure everything is written
-      write_from_buffer<true>();
+      do {
+        if (uring) {
+          cycle_async<true>(owner.current_position);
+        } else {
+          write_from_buffer<true>();
+        }
+      } while (dirty.size() > 0 || held.size() > 0 || !owner.write_queue.empty() ||
+               owner.unqueued.size() > 0);
+      if (uring) {
+        log_latencies();
+        owner.dbg.uring = nullptr;
+        uring.reset();
+      }
+      mapped.close();
       write_slices();
+      LOGI("Tape producer: {} wakeups, {} wasted", owner.dbg.wakeups, owner.dbg.wasted_wakeups);
 
       file.close();
     }
 
-    /// Write everything in `owner.write_sect`
+    /// Write everything the consumer has recorded
+    ///
+    /// Near the head or the tail, it is written right away, as the next read
+    /// may reuse that part of the buffer.
+    ///
+    /// \returns whether anything was written
+    template<bool unconditionally = false>
+    bool write_from_buffer()
+    {
+      auto write_sect = section_to_write<unconditionally>();
+      if (write_sect.size() == 0) return false;
+      write_wrapped(write_sect.in, write_sect.size());
+      commit_write(write_sect);
+      return true;
+    }
+
+    /// The section of the tape to write now. Empty if it can wait.
+    ///
+    /// Collects the sections queued by the consumer in `dirty` first. Writing
+    /// `unconditionally` also collects the one the consumer could not queue,
+    /// so the consumer must have stopped.
     template<bool unconditionally = false>
-    void write_from_buffer()
+    TapeSection section_to_write()
     {
-      auto write_sect = owner.write_sect.load();
+      if (held.size() > 0 && merge_dirty(held)) held = {0, 0};
+      TapeSection sect;
+      while (held.size() == 0 && owner.write_queue.try_pop(sect)) {
+        if (!merge_dirty(sect)) held = sect;
+      }
+      if (unconditionally && held.size() == 0 && owner.write_queue.empty() &&
+          owner.unqueued.size() > 0) {
+        // What did not fit in the queue
+        if (merge_dirty(owner.unqueued)) {
+          owner.unwritten += owner.unqueued.size();
+          owner.unqueued = {0, 0};
+        }
+      }
+      if (dirty.size() == 0) return {0, 0};
       if (unconditionally
-        || write_sect.size() > min_write_size
-        || (write_sect.in - owner.tail)  <= min_read_size * 2
-        || (owner.head - write_sect.out) <= min_read_size * 2)
+        || held.size() > 0
+        || dirty.size() > min_write_size
+        || (dirty.in - owner.tail)  <= tape_buffer::wake_threshold * 2
+        || (owner.head - dirty.out) <= tape_buffer::wake_threshold * 2)
       {
-        write_wrapped(write_sect.in, write_sect.size());
+        return dirty;
+      }
+      return {0, 0};
+    }
+
+    /// Add `sect` to `dirty`, unless they are far apart
+    ///
+    /// Close sections are written together, with the loaded frames between
+    /// them.
+    bool merge_dirty(TapeSection sect)
+    {
+      Position gap = std::max(sect.in - dirty.out, dirty.in - sect.out);
+      if (dirty.size() > 0 && gap > tape_buffer::wake_threshold) return false;
+      dirty = dirty.size() == 0 ? sect : dirty + sect;
+      dirty_frames += sect.size();
+      return true;
+    }
 
-        // Atomically update `write_sect`
-        util::audio::Section<int> new_sect;
-        auto expected_sect = owner.write_sect.load();
-        do {
-          new_sect = expected_sect - write_sect;
-        } while (!owner.write_sect.compare_exchange_weak(
-            expected_sect, new_sect));
+    /// Remove `written` from `dirty`, once it is in the file
+    void commit_write(TapeSection written)
+    {
+      dirty -= written;
+      if (dirty.size() == 0) {
+        owner.unwritten -= dirty_frames;
+        dirty_frames = 0;
       }
     }
 
     /// Fill the buffer as needed, assuming `index` is the current position.
     /// This is the only function that can modify `owner.head` & `owner.tail`!
-    void fill_buffer(int index)
+    ///
+    /// \returns whether anything was read
+    bool fill_buffer(Position index)
     {
-      if (auto diff = goal_length - (owner.head - index);
-        diff > min_read_size)
-      {
-        read_wrapped(owner.head, diff);
-        owner.head = std::clamp(owner.head + diff, 0, (int) tape_buffer::max_length);
-        if (auto dst = owner.head - owner.tail; dst > buffer_size) {
-          // Get rid of overlap
-          owner.tail += std::max(0, dst - buffer_size + 2);
+      auto head_read = head_to_read(index);
+      if (head_read.size() > 0) {
+        read_wrapped(head_read.in, head_read.size());
+        commit_head(head_read);
+      }
+      auto tail_read = tail_to_read(index);
+      if (tail_read.size() > 0) {
+        read_wrapped(tail_read.in, tail_read.size());
+        commit_tail(tail_read);
+      }
+      return head_read.size() > 0 || tail_read.size() > 0;
+    }
+
+    /// Load the buffer around `index`, if it is outside the loaded section
+    ///
+    /// After a jump, the frames between the old and the new position are
+    /// never played, and reading them could take long on a long tape.
+    void follow_jump(Position index)
+    {
+      if (index < owner.tail || index > owner.head) {
+        owner.tail = index;
+        owner.head = index;
+      }
+    }
+
+    /// The section to read after the head. Empty if it is close enough.
+    ///
+    /// Also empty if the buffer was invalidated since `index` was read, as
+    /// the section would be as long as the jump. The next cycle follows it.
+    TapeSection head_to_read(Position index) const
+    {
+      Position head = owner.head, tail = owner.tail;
+      if (index < tail || index > head) return {0, 0};
+      if (auto diff = goal_length - (head - index); diff > min_read_size) {
+        return {head, std::min(head + diff, tape_buffer::max_length)};
+      }
+      return {0, 0};
+    }
+
+    /// The section to read before the tail. Empty if it is close enough, or
+    /// the buffer was invalidated since `index` was read.
+    TapeSection tail_to_read(Position index) const
+    {
+      Position head = owner.head, tail = owner.tail;
+      if (index < tail || index > head) return {0, 0};
+      if (auto diff = goal_length - (index - tail); diff > min_read_size) {
+        // Only up to the tail. At the start of the tape, the rest of the
+        // buffer may hold frames that are not written yet.
+        Position read_pos = std::clamp<Position>(tail - diff, 0, tape_buffer::max_length);
+        if (read_pos < tail) return {read_pos, tail};
+      }
+      return {0, 0};
+    }
+
+    /// Move the head past `read`, which is in the buffer
+    void commit_head(TapeSection read)
+    {
+      owner.head = std::clamp<Position>(read.out, 0, tape_buffer::max_length);
+      read_ahead(owner.head, min_read_size);
+      if (auto dst = owner.head - owner.tail; dst > buffer_size) {
+        // Get rid of overlap
+        owner.tail += std::max<Position>(0, dst - buffer_size + 2);
+      }
+    }
+
+    /// Move the tail to the start of `read`, which is in the buffer
+    void commit_tail(TapeSection read)
+    {
+      owner.tail = read.in;
+      read_ahead(owner.tail - min_read_size, min_read_size);
+      if (auto dst = owner.head - owner.tail; dst > buffer_size) {
+        // Get rid of overlap
+        owner.head -= std::max<Position>(0, dst - buffer_size + 2);
+      }
+    }
+
+    /// Write and fill the buffer through io_uring
+    ///
+    /// The write-back and the reads at both ends are queued together, unless
+    /// a read would overwrite buffer slots that are still being written, or
+    /// read by the other end.
+    ///
+    /// \returns whether anything was read or written
+    template<bool unconditionally = false>
+    bool cycle_async(Position index)
+    {
+      bool forwards = index >= last_index;
+      last_index    = index;
+
+      planned[write_side] = section_to_write<unconditionally>();
+      submit(util::UringFile::Op::write, planned[write_side], write_side);
+
+      // The end the tape is moving towards goes first. If both ends use the
+      // same slots, the tail goes last, as in [fill_buffer]()
+      planned[head_side] = head_to_read(index);
+      planned[tail_side] = tail_to_read(index);
+      bool overlap = share_slots(planned[head_side], planned[tail_side]);
+      std::array<Side, 2> order = {head_side, tail_side};
+      if (!forwards && !overlap) order = {tail_side, head_side};
+      for (auto side : order) {
+        if (share_slots(planned[side], planned[write_side])) drain(write_side);
+        submit(util::UringFile::Op::read, planned[side], side);
+        if (overlap) drain(side);
+      }
+      for (auto side : order) drain(side);
+      drain(write_side);
+
+      return planned[head_side].size() > 0 || planned[tail_side].size() > 0 ||
+             planned[write_side].size() > 0;
+    }
+
+    /// Queue the requests to read or write `sect`, for `side`
+    ///
+    /// Reads of chunks that were never written are filled with silence
+    /// instead. If nothing was queued, the side is committed right away.
+    void submit(util::UringFile::Op op, TapeSection sect, Side side)
+    {
+      if (sect.size() <= 0) return;
+      // Held until everything is queued, so the side is not committed by a
+      // reap in between
+      pending[side]++;
+      for (Position position = sect.in; position < sect.out;) {
+        int wrap_pos = wrap(position);
+        int n        = std::min<Position>({sect.out - position, buffer_size - wrap_pos,
+                                    request_size - position % request_size});
+        auto* data   = owner.buffer.data() + wrap_pos;
+        position += n;
+        if (file.encoding() == util::TapeFile::Encoding::lossless) {
+          if (submit_block(op, position - n, n, side)) pending[side]++;
+          continue;
         }
+        auto offset = op == util::UringFile::Op::read ? file.offset(position - n)
+                                                      : allocate(position - n);
+        if (offset < 0) {
+          if (op == util::UringFile::Op::read) std::fill(data, data + n, value_type{});
+          continue;
+        }
+        // Enough to zero the rest of a short read
+        std::uint64_t tag = (std::uint64_t(side) << 56) | (std::uint64_t(wrap_pos) << 24) | n;
+        auto bytes  = n * frame_bytes;
+        while (op == util::UringFile::Op::read ? !uring->read(offset, data, bytes, tag)
+                                               : !uring->write(offset, data, bytes, tag)) {
+          reap(1);
+        }
+        pending[side]++;
       }
-      if (auto diff = goal_length - (index - owner.tail);
-        diff > min_read_size)
-      {
-        int read_pos = std::clamp(owner.tail - diff, 0, (int) tape_buffer::max_length);
-        read_wrapped(read_pos, diff);
-        owner.tail = read_pos;
-        if (auto dst = owner.head - owner.tail; dst > buffer_size) {
-          // Get rid of overlap
-          owner.head -= std::max(0, dst - buffer_size + 2);
+      if (--pending[side] == 0) commit(side);
+    }
+
+    /// Queue the request for the block with the `n` frames from `position`,
+    /// in a compressed file
+    ///
+    /// A block is always written whole. If the frames are only part of it,
+    /// the rest is read first.
+    ///
+    /// \returns whether a request was queued
+    bool submit_block(util::UringFile::Op op, Position position, int n, Side side)
+    {
+      auto* data     = owner.buffer.data() + wrap(position);
+      Position in    = position % util::TapeFile::block_frames;
+      Position block = position - in;
+      if (op == util::UringFile::Op::read) {
+        // Its slot may be rewritten right now
+        auto is_written = [&](const Staged& s) {
+          return s.in_use && s.side == write_side &&
+                 s.position / util::TapeFile::block_frames == block / util::TapeFile::block_frames;
+        };
+        if (std::any_of(staged.begin(), staged.end(), is_written)) drain(write_side);
+        if (file.block_size(block) == 0) {
+          std::fill(data, data + n, value_type{});
+          return false;
         }
       }
+
+      auto& slot    = free_slot();
+      slot.position = position;
+      slot.n        = n;
+      slot.side     = side;
+      slot.size     = 0;
+      slot.in_use   = true;
+      std::uint64_t tag =
+        staged_tag | (std::uint64_t(side) << 56) | std::uint64_t(&slot - staged.data());
+
+      if (op == util::UringFile::Op::read) {
+        auto offset = file.block_offset(block);
+        while (!uring->read(offset, slot.encoded.data(), file.block_size(block), tag)) {
+          reap(1);
+        }
+        return true;
+      }
+
+      try {
+        if (n < util::TapeFile::block_frames) file.read_block(block, slot.frames.data()->data());
+        std::copy(data, data + n, slot.frames.begin() + in);
+        slot.size   = codec.encode(slot.frames.data()->data(), slot.encoded.data());
+        auto offset = file.allocate_block(block);
+        while (!uring->write(offset, slot.encoded.data(), slot.size, tag)) {
+          reap(1);
+        }
+        return true;
+      } catch (util::exception& e) {
+        LOGE("{}", e.what());
+        slot.in_use = false;
+        return false;
+      }
+    }
+
+    /// A [Staged]() block that is not in use, waiting for one if needed
+    Staged& free_slot()
+    {
+      if (staged.empty()) staged.resize(uring_depth);
+      while (true) {
+        for (auto& slot : staged) {
+          if (!slot.in_use) return slot;
+        }
+        reap(1);
+      }
+    }
+
+    /// Finish the request for the staged block `slot`
+    void complete_staged(Staged& slot, const util::UringFile::Completion& c)
+    {
+      slot.in_use = false;
+      if (c.op == util::UringFile::Op::write) {
+        if (std::size_t(c.result) != slot.size) return;
+        try {
+          file.block_written(slot.position, slot.size);
+        } catch (util::exception& e) {
+          LOGE("{}", e.what());
+        }
+        return;
+      }
+      auto* frames = slot.frames.data()->data();
+      if (!codec.decode(slot.encoded.data(), std::max(0, c.result), frames)) {
+        LOGW("Block {} of the tape file is corrupt, and is read as silence",
+             slot.position / util::TapeFile::block_frames);
+      }
+      auto in = slot.frames.begin() + slot.position % util::TapeFile::block_frames;
+      std::copy(in, in + slot.n, owner.buffer.data() + wrap(slot.position));
+    }
+
+    /// Wait until the requests of `side` are done
+    void drain(Side side)
+    {
+      while (pending[side] > 0) reap(1);
+    }
+
+    /// Wait for at least `min` requests, and commit the sides that are done
+    void reap(int min)
+    {
+      uring->reap(min, [&](const util::UringFile::Completion& c) {
+        auto side     = Side((c.tag >> 56) & 0x7F);
+        auto* data    = owner.buffer.data() + ((c.tag >> 24) & 0xFFFFFFFF);
+        std::size_t n = c.tag & 0xFFFFFF;
+        if (c.result < 0) {
+          LOGE("Tape {} failed: {}", c.op == util::UringFile::Op::read ? "read" : "write",
+               std::strerror(-c.result));
+        }
+        if (c.tag & staged_tag) {
+          complete_staged(staged[c.tag & 0xFFFFFF], c);
+        } else if (c.op == util::UringFile::Op::read) {
+          // Past the end of the file
+          std::size_t frames = std::max(0, c.result) / frame_bytes;
+          std::fill(data + std::min(frames, n), data + n, value_type{});
+        }
+        if (--pending[side] == 0) commit(side);
+      });
+    }
+
+    /// Commit the `planned` section of `side`, once its requests are done
+    void commit(Side side)
+    {
+      switch (side) {
+      case head_side: commit_head(planned[side]); break;
+      case tail_side: commit_tail(planned[side]); break;
+      case write_side: commit_write(planned[side]); break;
+      default: break;
+      }
+    }
+
+    void log_latencies()
+    {
+      for (auto op : {util::UringFile::Op::read, util::UringFile::Op::write}) {
+        auto& h = uring->latency(op);
+        LOGI("Tape {}s: {}, p50 < {}us, p99 < {}us, max < {}us",
+             op == util::UringFile::Op::read ? "read" : "write", h.total(), h.percentile(0.5),
+             h.percentile(0.99), h.percentile(1));
+      }
     }
 
     /// Read `n` samples to `position`, splitting the operation into two reads if
@@ -133,15 +588,14 @@ namespace otto::engines {
     /// This could have been done just using the wrapping array iterators, but
     /// performance tests (see `test/util/bytefile.t.cpp`) say the pointer
     /// optimization is around 50 times faster
-    void read_wrapped(int position, int n)
+    void read_wrapped(Position position, int n)
     {
       // We dont have to worry about thread safety in here, everything is thread local
       int wrap_pos = wrap(position);
       int overflow = std::max(0, wrap_pos + n - buffer_size);
-      file.seek(4 * position);
-      file.read_samples((owner.buffer.data() + wrap_pos)->data(), 4 * (n - overflow));
+      read_frames(position, owner.buffer.data() + wrap_pos, n - overflow);
       if (overflow > 0) {
-        file.read_samples(owner.buffer.data()->data(), 4 * overflow);
+        read_frames(position + n - overflow, owner.buffer.data(), overflow);
       }
     }
 
@@ -151,15 +605,169 @@ namespace otto::engines {
     /// This could have been done just using the wrapping array iterators, but
     /// performance tests (see `test/util/bytefile.t.cpp`) say the pointer
     /// optimization is around 50 times faster
-    void write_wrapped(int position, int n)
+    void write_wrapped(Position position, int n)
     {
       // We dont have to worry about thread safety in here, everything is thread local
       int wrap_pos = wrap(position);
       int overflow = std::max(0, wrap_pos + n - buffer_size);
-      file.seek(4 * position);
-      file.write_samples((owner.buffer.data() + wrap_pos)->data(), 4 * (n - overflow));
+      write_frames(position, owner.buffer.data() + wrap_pos, n - overflow);
       if (overflow > 0) {
-        file.write_samples(owner.buffer.data()->data(), 4 * overflow);
+        write_frames(position + n - overflow, owner.buffer.data(), overflow);
+      }
+    }
+
+    /// The encoding for a new tape file, asked for by `OTTO_TAPE_CODEC`
+    static util::TapeFile::Encoding encoding()
+    {
+      const char* codec_env = std::getenv("OTTO_TAPE_CODEC");
+      std::string codec     = codec_env != nullptr ? codec_env : "raw";
+      if (codec == "lossless") return util::TapeFile::Encoding::lossless;
+      if (codec != "raw") LOGW("Unknown tape codec '{}', recording raw", codec);
+      return util::TapeFile::Encoding::raw;
+    }
+
+    /// Set up the access to the file asked for by `OTTO_TAPE_IO`, or the
+    /// closest one that is available
+    void open_file()
+    {
+      const char* io_env = std::getenv("OTTO_TAPE_IO");
+      std::string io     = io_env != nullptr ? io_env : "uring";
+      if (io == "uring") {
+        try {
+          uring = std::make_unique<util::UringFile>(path, uring_depth);
+          owner.dbg.uring = uring.get();
+          LOGI("Accessing the tape file through io_uring");
+          return;
+        } catch (util::exception& e) {
+          LOGW("{}", e.what());
+        }
+        io = "mmap";
+      }
+      if (io == "mmap" && file.encoding() != util::TapeFile::Encoding::raw) {
+        LOGI("A compressed tape file can not be memory mapped");
+      } else if (io == "mmap") {
+        try {
+          // Only the allocated chunks are backed by the file, the rest of the
+          // mapping is address space
+          if (file.capacity() > std::numeric_limits<std::size_t>::max()) {
+            throw util::exception("The tape file is too large to map");
+          }
+          mapped = util::MappedFile(path, file.capacity());
+          LOGI("Accessing the tape file through a memory map");
+          return;
+        } catch (util::exception& e) {
+          LOGW("{}", e.what());
+        }
+      }
+      LOGI("Accessing the tape file through a stream");
+    }
+
+    /// The byte offset of frame `position` in the file, allocating its chunk
+    /// if needed. `-1` if it could not be allocated.
+    std::int64_t allocate(Position position)
+    {
+      try {
+        auto offset = file.allocate(position);
+        if (mapped.is_open() && std::size_t(file.size()) > mapped.size()) {
+          mapped.resize(file.size());
+        }
+        return offset;
+      } catch (util::exception& e) {
+        LOGE("{}", e.what());
+        return -1;
+      }
+    }
+
+    /// Read `n` frames from file position `position` to `dst`. Frames that
+    /// were never recorded are silent.
+    void read_frames(Position position, value_type* dst, int n)
+    {
+      if (!mapped.is_open()) {
+        try {
+          file.read_frames(position, dst->data(), n);
+        } catch (util::exception& e) {
+          LOGE("{}", e.what());
+        }
+        return;
+      }
+      util::TapeFile::for_each_chunk(position, n, [&](Position p, Position m) {
+        auto* chunk_dst = dst + (p - position);
+        if (auto offset = file.offset(p); offset >= 0) {
+          std::memcpy(chunk_dst, mapped.data() + offset, m * frame_bytes);
+        } else {
+          std::fill(chunk_dst, chunk_dst + m, value_type{});
+        }
+      });
+    }
+
+    /// Write `n` frames from `src` to file position `position`
+    void write_frames(Position position, value_type* src, int n)
+    {
+      if (!mapped.is_open()) {
+        try {
+          file.write_frames(position, src->data(), n);
+        } catch (util::exception& e) {
+          LOGE("{}", e.what());
+        }
+        return;
+      }
+      util::TapeFile::for_each_chunk(position, n, [&](Position p, Position m) {
+        auto offset = allocate(p);
+        if (offset < 0) return;
+        std::memcpy(mapped.data() + offset, src + (p - position), m * frame_bytes);
+
+        util::audio::Section<std::int64_t> written = {offset, offset + std::int64_t(m * frame_bytes)};
+        unsynced = unsynced.size() == 0 ? written : unsynced + written;
+        unsynced_frames += m;
+      });
+      if (unsynced_frames >= sync_size) {
+        mapped.sync(unsynced.in, unsynced.size());
+        unsynced        = {0, 0};
+        unsynced_frames = 0;
+      }
+    }
+
+    /// Start loading the `n` frames from `position`, which are read next
+    void read_ahead(Position position, int n)
+    {
+      if (!mapped.is_open()) return;
+      position = std::max<Position>(position, 0);
+      util::TapeFile::for_each_chunk(position, n, [&](Position p, Position m) {
+        if (auto offset = file.offset(p); offset >= 0) mapped.will_need(offset, m * frame_bytes);
+      });
+    }
+
+    /// Open the tape file, importing the tape from the WAV file it used to be
+    /// stored in, the first time
+    ///
+    /// A file that can not be opened is moved aside, and a new tape is started.
+    void open_tape()
+    {
+      const fs::path wav_path = global::data_dir / "tape.wav";
+      bool import = !fs::exists(path) && fs::exists(wav_path);
+      try {
+        file.open(path, encoding());
+      } catch (util::exception& e) {
+        LOGE("{}", e.what());
+        fs::path bad_path = path;
+        bad_path += ".bad";
+        std::error_code ec;
+        fs::rename(path, bad_path, ec);
+        if (ec) {
+          // Opening it again fails too, and is thrown
+          LOGE("Could not move {} to {}: {}", path.c_str(), bad_path.c_str(), ec.message());
+        } else {
+          LOGW("Moved the tape file to {}, and started a new tape", bad_path.c_str());
+        }
+        file.open(path, encoding());
+      }
+      if (!import) return;
+      try {
+        file.import_wav(wav_path);
+        LOGI("Imported the tape from {}", wav_path.c_str());
+      } catch (util::exception& e) {
+        LOGE("{}", e.what());
+        LOGE("The tape in {} was not imported", wav_path.c_str());
       }
     }
 
@@ -173,9 +781,7 @@ namespace otto::engines {
         owner_slices.clear();
         std::transform(std::begin(file_slices.array), std::begin(file_slices.array) + n,
           std::back_inserter(owner_slices.slices), [] (auto&& slice) {
-            return util::audio::Section<int>{
-              gsl::narrow_cast<int>(slice.in),
-              gsl::narrow_cast<int>(slice.out)};
+            return tape_buffer::TapeSlice{slice.in, slice.out};
           });
       }
     }
@@ -193,9 +799,7 @@ namespace otto::engines {
           std::begin(owner_slices) + n,
           std::begin(file_slices.array),
           [] (auto&& slice) {
-            return util::TapeFile::SliceData{
-              gsl::narrow_cast<std::uint32_t>(slice.in),
-              gsl::narrow_cast<std::uint32_t>(slice.out)};
+            return util::TapeFile::SliceData{slice.in, slice.out};
           });
       }
     }
@@ -203,20 +807,26 @@ namespace otto::engines {
 
   void tape_buffer::advance(int n)
   {
-    current_position = std::clamp(current_position + n, 0, (int) max_length);
+    current_position = std::clamp<Position>(current_position + n, 0, max_length);
     notify_update();
   }
 
   void tape_buffer::notify_update()
   {
-    producer->waiting.notify_all();
+    Position position = current_position;
+    // The ends of the tape stop the head and tail
+    if ((head < max_length && goal_length - (head - position) > wake_threshold) ||
+        (tail > 0 && goal_length - (position - tail) > wake_threshold) ||
+        unwritten > wake_threshold) {
+      producer->waiting.notify();
+    }
   }
 
   void tape_buffer::invalidate()
   {
     tail.exchange(current_position);
     head.exchange(current_position);
-    notify_update();
+    producer->waiting.notify();
   }
 
   value_type& tape_buffer::cur_value()
@@ -224,10 +834,10 @@ namespace otto::engines {
     return buffer[current_position];
   }
 
-  void tape_buffer::jump_to(std::size_t position)
+  void tape_buffer::jump_to(Position position)
   {
     current_position = position;
-    producer->waiting.notify_all();
+    producer->waiting.notify();
   }
 
   tape_buffer::tape_buffer()
@@ -243,6 +853,24 @@ namespace otto::engines {
 #if OTTO_DEBUG_UI
     ImGui::Begin("Tape buffer");
     read_size_graph.plot("Read size");
+    auto now = std::chrono::steady_clock::now();
+    if (float secs = std::chrono::duration<float>(now - last_draw).count(); secs >= 1) {
+      wakeups_per_second = (wakeups - last_wakeups) / secs;
+      last_wakeups       = wakeups;
+      last_draw          = now;
+    }
+    ImGui::Text("Producer wakeups: %.1f/s", wakeups_per_second);
+    ImGui::Text("Wasted wakeups: %llu of %llu", (unsigned long long) wasted_wakeups,
+                (unsigned long long) wakeups.load());
+    if (auto* file = uring.load(); file != nullptr) {
+      for (auto op : {util::UringFile::Op::read, util::UringFile::Op::write}) {
+        auto& h = file->latency(op);
+        ImGui::Text("%s latency: p50 < %lldus, p99 < %lldus, max < %lldus",
+                    op == util::UringFile::Op::read ? "Read" : "Write",
+                    (long long) h.percentile(0.5), (long long) h.percentile(0.99),
+                    (long long) h.percentile(1));
+      }
+    }
     ImGui::End();
 #endif
   }
@@ -261,12 +889,12 @@ namespace otto::engines {
     return xs;
   }
 
-  bool tape_buffer::TapeSliceSet::in_slice(int time) const {
+  bool tape_buffer::TapeSliceSet::in_slice(Position time) const {
     return std::any_of(std::begin(slices), std::end(slices),
       [time] (auto&& slice) { return slice.contains(time); });
   }
 
-  tape_buffer::TapeSlice tape_buffer::TapeSliceSet::current(int time) const {
+  tape_buffer::TapeSlice tape_buffer::TapeSliceSet::current(Position time) const {
     for (auto&& slice : slices) {
       if (slice.contains(time)) return slice;
     }
@@ -287,7 +915,7 @@ namespace otto::engines {
     slices.push_back(slice);
   }
 
-  void tape_buffer::TapeSliceSet::cut(int time) {
+  void tape_buffer::TapeSliceSet::cut(Position time) {
     if (!in_slice(time)) return;
     TapeSlice slice = current(time);
     add({slice.in, time});
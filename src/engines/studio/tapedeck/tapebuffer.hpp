@@ -3,6 +3,8 @@
 #include <array>
 #include <cmath>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <set>
 
@@ -11,6 +13,7 @@
 #include "util/math.hpp"
 #include "util/audio.hpp"
 #include "util/ringbuffer.hpp"
+#include "util/spsc_queue.hpp"
 
 #include "services/debug_ui.hpp"
 
@@ -18,6 +21,13 @@ namespace otto::engines {
 
   // FDCL - Defined in tapebuffer.cpp
   struct Producer;
+}
+
+namespace otto::util {
+  class UringFile;
+}
+
+namespace otto::engines {
 
 
   /// The buffer used for the tapedeck
@@ -28,22 +38,24 @@ namespace otto::engines {
     using Value = std::array<float, 4>;
   public:
 
-    using TapeSlice = util::audio::Section<int>;
+    /// A frame count from the start of the tape
+    using Position = std::int64_t;
+    using TapeSlice = util::audio::Section<Position>;
 
     struct TapeSliceSet {
       std::vector<TapeSlice> slices;
 
       TapeSliceSet() {}
 
-      std::vector<TapeSlice> overlapping_slices(util::audio::Section<int> area) const;
+      std::vector<TapeSlice> overlapping_slices(TapeSlice area) const;
 
-      bool in_slice(int time) const;
-      TapeSlice current(int time) const;
+      bool in_slice(Position time) const;
+      TapeSlice current(Position time) const;
 
       void add(TapeSlice slice);
       void erase(TapeSlice slice);
 
-      void cut(int time);
+      void cut(Position time);
       void glue(TapeSlice s1, TapeSlice s2);
 
       // Iteration
@@ -59,7 +71,17 @@ namespace otto::engines {
     /* Constants */
 
     static constexpr std::size_t buffer_size = 1 << 18;
-    static constexpr std::size_t max_length = 8 * 60 * 44100;
+    /// The length of the tape. Over 24 hours at 48 kHz. Only the parts that
+    /// are recorded take space in the file.
+    static constexpr Position max_length = Position(1) << 32;
+
+    /// The desired distance from the playpoint to the head, and vice versa for
+    /// the tail
+    static constexpr int goal_length = buffer_size / 2 - 2;
+    /// The producer is woken when this many frames are missing on either side
+    /// of the playpoint, or are waiting to be written. Big enough that the
+    /// file is accessed in large chunks, a few times per second at most.
+    static constexpr int wake_threshold = buffer_size >> 4;
 
     using value_type = Value;
     /// Tape slices for each of the 4 tracks
@@ -75,13 +97,17 @@ namespace otto::engines {
 
     /* Member functions */
 
-    std::size_t position() const
+    Position position() const
     {
       return current_position;
     }
 
     /// Move the point `n` forward. `n` can be negative
     void advance(int n = 1);
+    /// Wake the producer, if it has enough to do
+    ///
+    /// Safe to call from the audio thread. It never blocks, and wakeups
+    /// coalesce until the producer runs.
     void notify_update();
     void invalidate();
 
@@ -99,25 +125,19 @@ namespace otto::engines {
     /// the first frame in the range will be positioned at `cursor + 1`.
     /// If `speed` is `0`, nothing will be written
     ///
+    /// \param latency The frames since the input was played along to the
+    /// tape. It is written where the tape was at that time.
+    ///
     /// \returns the section of tape that was just written
     template<typename Iter, typename BinaryFunc>
-    util::audio::Section<int> write_n(Iter iter, int n, float speed,
-      BinaryFunc&& func = [] (auto&& in, auto& tape) { tape = in; })
+    TapeSlice write_n(Iter iter, int n, float speed,
+      BinaryFunc&& func = [] (auto&& in, auto& tape) { tape = in; },
+      int latency = 0)
     {
-      util::audio::Section<int> written {0,0};
-      int write_n = 0;
-      float inpt_speed;
-      if (speed > 0) {
-        write_n = n * speed;
-        written = {current_position - write_n, current_position};
-        inpt_speed = 1.f / speed;
-      } else if (speed < 0) {
-        write_n = n * -speed;
-        written = {current_position + 1, current_position + write_n + 1};
-        inpt_speed = 1.f / -speed;
-      } else {
-        return written;
-      }
+      auto written = section_written(n, speed, latency);
+      if (written.size() == 0) return written;
+      int write_n = written.size();
+      float inpt_speed = 1.f / std::abs(speed);
 
       auto tape = buffer.iter(written.in);
       auto inpt = util::float_step(std::move(iter), inpt_speed);
@@ -125,20 +145,31 @@ namespace otto::engines {
         func(*inpt, *tape);
       }
 
-      // Atomically update `write_sect`
-      util::audio::Section<int> new_sect;
-      auto expected_sect = write_sect.load();
-      do {
-        new_sect = written;
-        if (expected_sect.size() != 0) {
-          new_sect += expected_sect;
-        }
-      } while (!write_sect.compare_exchange_weak(expected_sect, new_sect));
+      // If the queue is full, the section is queued with the next one
+      unqueued = unqueued.size() == 0 ? written : unqueued + written;
+      if (write_queue.try_push(unqueued)) {
+        unwritten += unqueued.size();
+        unqueued = {0, 0};
+      }
       notify_update();
 
       return written;
     }
 
+    /// The section of tape [write_n]() would write `n` frames to, at `speed`
+    TapeSlice section_written(int n, float speed, int latency = 0) const
+    {
+      Position position = current_position - Position(latency * speed);
+      if (speed > 0) {
+        int write_n = n * speed;
+        return {position - write_n, position};
+      } else if (speed < 0) {
+        int write_n = n * -speed;
+        return {position + 1, position + write_n + 1};
+      }
+      return {0, 0};
+    }
+
     template<typename Iter>
     void read_n(int n, float speed, Iter dst)
     {
@@ -150,7 +181,7 @@ namespace otto::engines {
     }
 
     template<typename Iter>
-    std::size_t read_until(std::size_t pos, float speed, Iter dst,
+    std::size_t read_until(Position pos, float speed, Iter dst,
       std::size_t max_n = std::numeric_limits<std::size_t>::max())
     {
       auto first = util::float_step(buffer.citer(current_position), speed);
@@ -168,7 +199,7 @@ namespace otto::engines {
     /// Jumps the tape to absolute position `p`
     ///
     /// Use sparingly - a jump clears the entire buffer
-    void jump_to(std::size_t p);
+    void jump_to(Position p);
 
     /* Member variables */
 
@@ -177,14 +208,22 @@ namespace otto::engines {
     /// The current file position
     /// This variable should only be modified by the consumer - to everyone else
     /// it is read only!
-    std::atomic_int current_position {0};
+    std::atomic<Position> current_position {0};
 
     // Beginning/end of loaded section. File position, *not* buffer index
     // These variables should only be modified by the producer
-    std::atomic_int head {0};
-    std::atomic_int tail {0};
-
-    std::atomic<util::audio::Section<int>> write_sect;
+    std::atomic<Position> head {0};
+    std::atomic<Position> tail {0};
+
+    /// The sections [write_n]() has written to the buffer, for the producer to
+    /// write to the file. Pushed by the consumer, popped by the producer.
+    util::spsc_queue<TapeSlice, 1024> write_queue;
+    /// The frames in the sections in `write_queue`, and the ones the producer
+    /// has popped and not written yet
+    std::atomic<Position> unwritten {0};
+    /// Written by the consumer, and not queued yet, as the queue was full.
+    /// Only used by the consumer.
+    TapeSlice unqueued = {0, 0};
 
     buffer_type buffer;
 
@@ -201,8 +240,18 @@ namespace otto::engines {
 
       void draw() override;
 
+      /// Times the producer was woken by a notification
+      std::atomic<std::uint64_t> wakeups {0};
+      /// Wakeups after which the producer had nothing to read or write
+      std::atomic<std::uint64_t> wasted_wakeups {0};
+      /// The file the producer reads and writes, if it uses io_uring
+      std::atomic<const util::UringFile*> uring {nullptr};
+
     private:
       service::debug_ui::graph<1 << 10> read_size_graph;
+      std::uint64_t last_wakeups = 0;
+      std::chrono::steady_clock::time_point last_draw;
+      float wakeups_per_second = 0;
     } dbg;
   };
 }
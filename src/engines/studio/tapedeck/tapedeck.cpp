@@ -185,7 +185,7 @@ namespace otto::engines {
       tapeBuffer->jump_to(metronome_state::bar_time_rel(bars));
   }
 
-  int Tapedeck::timeUntil(int tt)
+  int Tapedeck::timeUntil(tape_buffer::Position tt)
   {
     return 0;
     auto ttUntil = state.fwd() ? tt - position() : position() - tt;
@@ -253,16 +253,18 @@ namespace otto::engines {
     // Start recording by pressing a key
     if (!state.recording() && state.doStartRec() && state.readyToRec) {
       for (auto&& e : data.midi) {
-        if (mpark::holds_alternative<midi::NoteOnEvent>(e)) state.play();
+        if (e.type == midi::Event::Type::NoteOn) state.play();
       }
     }
 
-    float realSpeed = props.baseSpeed * state.playSpeed;
+    float realSpeed = props.baseSpeed.audio_value() * state.playSpeed;
 
-    proc_buf.clear();
+    auto out = data.redirect(proc_buf);
+    if (!state.doPlayAudio()) return out.fill_silence();
+    std::fill(out.begin(), out.end(), std::array<float, 4>{});
 
     // Read audio
-    if (state.doPlayAudio()) {
+    {
       if (state.looping) {
         auto jmp = realSpeed > 0 ? loopSect.out : loopSect.in;
         long n   = tapeBuffer->read_until(
@@ -276,14 +278,14 @@ namespace otto::engines {
       }
     }
 
-    return data.redirect(proc_buf);
+    return out;
   }
 
-  audio::ProcessData<0> Tapedeck::process_record(audio::ProcessData<1> data)
+  audio::ProcessData<0> Tapedeck::process_record(audio::ProcessData<1> data, int latency)
   {
     TIME_SCOPE("Tapedeck::process_record");
-    float realSpeed = props.baseSpeed * state.playSpeed;
-    auto pos        = position();
+    float realSpeed = props.baseSpeed.audio_value() * state.playSpeed;
+    auto pos        = position() - tape_buffer::Position(latency * realSpeed);
 
     // Just started recording
     if (state.recording() && !state.recLast) {
@@ -291,12 +293,17 @@ namespace otto::engines {
     }
 
     if (state.recording()) {
-      // Write audio
-      auto sect = tapeBuffer->write_n(std::begin(data.audio), data.nframes,
-        realSpeed, [&, track = state.track] (auto&& src, auto& dst) {
-            dst[track] += src[0]; // * props.gain;
-        });
-      recSect += sect;
+      if (data.silent) {
+        // Overdubbing silence leaves the tape as it is
+        recSect += tapeBuffer->section_written(data.nframes, realSpeed, latency);
+      } else {
+        // Write audio
+        auto sect = tapeBuffer->write_n(std::begin(data.audio), data.nframes,
+          realSpeed, [&, track = state.track] (auto&& src, auto& dst) {
+              dst[track] += src[0]; // * props.gain;
+          }, latency);
+        recSect += sect;
+      }
     }
 
     // Just stopped recording
@@ -311,8 +318,12 @@ namespace otto::engines {
     // Graph
 
     procGraph.clear();
-    for (auto&& smpl : data.audio) {
-      procGraph.add(smpl[0]); // * props.gain);
+    if (data.silent) {
+      procGraph.add(0, data.nframes);
+    } else {
+      for (auto&& smpl : data.audio) {
+        procGraph.add(smpl[0]); // * props.gain);
+      }
     }
 
     return data.midi_only();
@@ -23,19 +23,26 @@ namespace otto::engines {
     void on_enable() override;
     void on_disable() override;
 
-    util::audio::Section<int> loopSect;
-    util::audio::Section<int> recSect;
+    tape_buffer::TapeSlice loopSect;
+    tape_buffer::TapeSlice recSect;
 
     int overruns = 0;
 
     audio::ProcessData<4> process_playback(audio::ProcessData<0>);
-    audio::ProcessData<0> process_record(audio::ProcessData<1>);
+    /// Record the input, if recording
+    ///
+    /// \param latency The frames the input is late by, compared to the tape
+    /// it was played along to. It is recorded this much earlier on the tape.
+    audio::ProcessData<0> process_record(audio::ProcessData<1>, int latency = 0);
 
-    int position() const
+    tape_buffer::Position position() const
     {
       return tapeBuffer->position();
     }
 
+    // These change the loop and the tape position, which the audio thread
+    // uses. Call them on the audio thread, through audio::parameter_queue()
+
     void loopInHere();
     void loopOutHere();
     void goToLoopIn();
@@ -44,7 +51,7 @@ namespace otto::engines {
     void goToBar(int bar);
     void goToBarRel(int bars);
 
-    int timeUntil(int tt);
+    int timeUntil(tape_buffer::Position tt);
 
     struct State {
       enum PlayType { STOPPED = 0, PLAYING, SPOOLING } playType;
@@ -30,44 +30,47 @@ namespace otto::engines {
 
     bool keypress(Key key) override
     {
-      bool shift = service::ui::is_pressed(ui::Key::shift);
+      bool shift  = service::ui::is_pressed(ui::Key::shift);
+      auto& queue = audio::parameter_queue();
       switch (key) {
-      case Key::rec: engine.state.startRecord(); return true;
+      case Key::rec:
+        queue.call(engine.state, [](Tapedeck::State& s) { s.startRecord(); });
+        return true;
       case Key::play:
         if (service::ui::is_pressed(ui::Key::rec)) {
           stopRecOnRelease = false;
         }
         return false;
-      case Key::track_1: engine.state.track = 0; return true;
-      case Key::track_2: engine.state.track = 1; return true;
-      case Key::track_3: engine.state.track = 2; return true;
-      case Key::track_4: engine.state.track = 3; return true;
+      case Key::track_1: queue.set(engine.state.track, 0); return true;
+      case Key::track_2: queue.set(engine.state.track, 1); return true;
+      case Key::track_3: queue.set(engine.state.track, 2); return true;
+      case Key::track_4: queue.set(engine.state.track, 3); return true;
       case Key::left:
         if (shift)
-          engine.goToBarRel(-1);
+          queue.call(engine, [](Tapedeck& t) { t.goToBarRel(-1); });
         else
-          engine.state.spool(-5);
+          queue.call(engine.state, [](Tapedeck::State& s) { s.spool(-5); });
         return true;
       case Key::right:
         if (shift)
-          engine.goToBarRel(1);
+          queue.call(engine, [](Tapedeck& t) { t.goToBarRel(1); });
         else
-          engine.state.spool(5);
+          queue.call(engine.state, [](Tapedeck::State& s) { s.spool(5); });
         return true;
       case Key::loop:
-        engine.state.looping = !engine.state.looping;
+        queue.call(engine.state, [](Tapedeck::State& s) { s.looping = !s.looping; });
         return true;
       case Key::loop_in:
         if (shift)
-          engine.loopInHere();
+          queue.call(engine, [](Tapedeck& t) { t.loopInHere(); });
         else
-          engine.goToLoopIn();
+          queue.call(engine, [](Tapedeck& t) { t.goToLoopIn(); });
         return true;
       case Key::loop_out:
         if (shift)
-          engine.loopOutHere();
+          queue.call(engine, [](Tapedeck& t) { t.loopOutHere(); });
         else
-          engine.goToLoopOut();
+          queue.call(engine, [](Tapedeck& t) { t.goToLoopOut(); });
         return true;
       case Key::cut:
         if (engine.state.doTapeOps()) {
@@ -105,17 +108,20 @@ namespace otto::engines {
 
     bool keyrelease(Key key) override
     {
+      auto& queue = audio::parameter_queue();
       switch (key) {
       case Key::rec:
         if (stopRecOnRelease) {
-          engine.state.stopRecord();
+          queue.call(engine.state, [](Tapedeck::State& s) { s.stopRecord(); });
           return true;
         } else {
           stopRecOnRelease = true;
           return true;
         }
       case Key::left:
-      case Key::right: engine.state.stop(); return true;
+      case Key::right:
+        queue.call(engine.state, [](Tapedeck::State& s) { s.stop(); });
+        return true;
       default: return false;
       }
     }
@@ -125,7 +131,7 @@ namespace otto::engines {
       return timeStr(engine.position());
     }
 
-    std::string timeStr(std::size_t position) const
+    std::string timeStr(tape_buffer::Position position) const
     {
       double seconds = position / (1.0 * service::audio::samplerate());
       double minutes = seconds / 60.0;
@@ -409,16 +415,16 @@ namespace otto::engines {
       // TODO: Animate this?
       int timeline_time = 5 * service::audio::samplerate();
 
-      util::audio::Section<int> view_time{
-        (int) engine.position() - timeline_time / 2,
-        (int) engine.position() + timeline_time / 2};
+      tape_buffer::TapeSlice view_time{
+        engine.position() - timeline_time / 2,
+        engine.position() + timeline_time / 2};
 
       float left_edge      = 23.2;
       float right_edge     = 296.2;
       float timeline_width = right_edge - left_edge;
 
       float length_pr_time = timeline_width / timeline_time;
-      auto time_to_coord   = [&](int time) {
+      auto time_to_coord   = [&](tape_buffer::Position time) {
         time -= view_time.in;
         return left_edge + time * length_pr_time;
       };
@@ -800,7 +806,9 @@ namespace otto::engines {
 
       float min_r      = 26;
       float max_r      = 42;
-      float pos_amount = (engine.position() / float(tape_buffer::max_length));
+      // The reels are full after an hour, though the tape is longer
+      float reel_length = 60 * 60 * float(service::audio::samplerate());
+      float pos_amount  = std::min(1.f, engine.position() / reel_length);
       float l_radius   = min_r + pos_amount * (max_r - min_r);
       float r_radius   = min_r + (1 - pos_amount) * (max_r - min_r);
       draw_tape_half(ctx, colour, {37, 160}, l_center, l_radius);
@@ -1,5 +1,6 @@
 #include "nuke.hpp"
 
+#include "core/audio/dsp_profiler.hpp"
 #include "core/globals.hpp"
 #include "core/ui/vector_graphics.hpp"
 
@@ -37,14 +38,26 @@ namespace otto::engines {
   NukeSynth::NukeSynth()
     : SynthEngine("Nuke", props, std::make_unique<NukeSynthScreen>(this)),
       voice_mgr_(props),
-      faust_(std::make_unique<FAUSTCLASS>(), props)
+      faust_(std::make_unique<FAUSTCLASS>(), props),
+      running_gauge_(audio::dsp_profiler().gauge("Nuke running"))
   {}
 
   audio::ProcessData<1> NukeSynth::process(audio::ProcessData<0> data)
   {
     voice_mgr_.process_before(data);
+    if (voice_mgr_.allocator().any_held()) tail_.wake();
+    // A note may be released in the same slice it is played, and still ring
+    for (auto&& e : data.midi) {
+      if (e.type == midi::Event::Type::NoteOn) tail_.wake();
+    }
+    audio::dsp_profiler().record_gauge(running_gauge_, tail_.idle() ? 0 : 1);
+    if (tail_.idle()) {
+      voice_mgr_.process_after(data);
+      return data.redirect(silence_).fill_silence();
+    }
     auto res = faust_.process(data);
     voice_mgr_.process_after(data);
+    tail_.update(res.audio.data()->data(), res.nframes, voice_mgr_.allocator().any_held());
     return res;
   }
 
@@ -3,6 +3,7 @@
 #include "core/engines/engine.hpp"
 
 #include "core/audio/faust.hpp"
+#include "core/audio/tail_detector.hpp"
 #include "core/audio/voice_manager.hpp"
 
 namespace otto::engines {
@@ -37,5 +38,11 @@ namespace otto::engines {
   private:
     audio::VoiceManager<6> voice_mgr_;
     audio::FaustWrapper<0, 1> faust_;
+    /// Skips the dsp while no voice is sounding
+    audio::TailDetector tail_;
+    /// Output while skipped
+    audio::ProcessBuffer<1> silence_;
+    /// Whether the dsp ran, in the dsp profile
+    int running_gauge_ = -1;
   };
 } // namespace otto::engines
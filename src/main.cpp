@@ -2,6 +2,7 @@
 
 #include "util/timer.hpp"
 
+#include "core/audio/dsp_profiler.hpp"
 #include "core/audio/midi.hpp"
 #include "core/globals.hpp"
 
@@ -84,4 +85,5 @@ void cleanup()
   service::state::save();
 
   util::timer::save_data();
+  core::audio::dsp_profiler().save(global::data_dir / "dsp_profile.json");
 }
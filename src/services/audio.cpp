@@ -1,9 +1,13 @@
 #include "audio.hpp"
 
+#include "core/audio/param_queue.hpp"
 #include "util/algorithm.hpp"
+#include "util/audio_kernels.hpp"
 
 #include "board/audio_driver.hpp"
 
+#include "services/logger.hpp"
+
 namespace otto::service::audio {
 
   /**
@@ -18,6 +22,7 @@ namespace otto::service::audio {
    *   void shutdown();
    *
    *   std::atomic_int samplerate;
+   *   std::atomic_int round_trip_latency;
    *
    * };
    * ```
@@ -35,6 +40,10 @@ namespace otto::service::audio {
         ImGui::Begin("Audio");
         audio_graph.plot("Audio graph", -1, 1);
         ImGui::Text("Buffers lost: %d", buffers_lost);
+        auto params = core::audio::parameter_queue().stats();
+        ImGui::Text("Parameter queue depth: %zu", params.depth);
+        ImGui::Text("Parameter queue max batch: %zu", params.max_batch);
+        ImGui::Text("Parameter queue overflows: %zu", params.overflows);
         ImGui::End();
 #endif
       }
@@ -64,22 +73,29 @@ namespace otto::service::audio {
     return AudioDriver::get().samplerate;
   }
 
+  int round_trip_latency() noexcept {
+    return AudioDriver::get().round_trip_latency;
+  }
+
   void init()
   {
     events::pre_init().fire();
 
     core::midi::generateFreqTable(440);
+    LOGI("Audio kernels use {}", util::audio::to_string(util::audio::simd_level()));
     AudioDriver::get().init();
   }
 
   void start() noexcept
   {
+    core::audio::parameter_queue().set_direct(false);
     _running = true;
   }
 
   void shutdown()
   {
     AudioDriver::get().shutdown();
+    core::audio::parameter_queue().set_direct(true);
   }
 
   bool running() noexcept
@@ -105,7 +121,7 @@ namespace otto::service::audio {
 #endif
   }
 
-  void send_midi_event(core::midi::AnyMidiEvent evt) noexcept
+  void send_midi_event(core::midi::Event evt) noexcept
   {
     AudioDriver::get().send_midi_event(std::move(evt));
   }
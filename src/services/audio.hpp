@@ -12,6 +12,10 @@ namespace otto::service::audio {
 
   namespace events {
     util::Event<>& pre_init();
+    /// Fired by the driver with the number of frames in the blocks to come
+    ///
+    /// Never above [core::audio::max_block_size](). Drivers reject larger
+    /// blocks rather than pass them to [engines::process]().
     util::Event<unsigned>& buffersize_change();
     util::Event<unsigned>& samplerate_change();
   }
@@ -19,6 +23,12 @@ namespace otto::service::audio {
   /// Get the current samplerate
   int samplerate() noexcept;
 
+  /// Get the frames from a sample being output, to a sample captured when it
+  /// is heard arriving as input
+  ///
+  /// Recordings of input played along to the output are this late.
+  int round_trip_latency() noexcept;
+
   /// Process the final output
   ///
   /// Currently only used for debugging
@@ -46,7 +56,12 @@ namespace otto::service::audio {
   bool running() noexcept;
 
   /// Send a midi event into the system.
-  /// 
+  ///
+  /// Safe to call from any thread, without blocking. The event is played one
+  /// block period after it was sent, so its latency does not depend on where
+  /// in the current block it happened. If too many events are waiting, it is
+  /// dropped.
+  ///
   /// The `core::midi` namespace has some nice utils for constructing events.
-  void send_midi_event(core::midi::AnyMidiEvent) noexcept;
+  void send_midi_event(core::midi::Event) noexcept;
 }
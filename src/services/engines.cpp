@@ -1,9 +1,14 @@
 #include "engines.hpp"
 
+#include <atomic>
 #include <map>
+#include <mutex>
 
+#include "core/audio/graph.hpp"
 #include "core/globals.hpp"
 
+#include "util/audio_kernels.hpp"
+
 #include "engines/drums/drum-sampler/drum-sampler.hpp"
 #include "engines/drums/simple-drums/simple-drums.hpp"
 #include "engines/studio/input_selector/input_selector.hpp"
@@ -12,6 +17,8 @@
 #include "engines/studio/tapedeck/tapedeck.hpp"
 #include "engines/synths/nuke/nuke.hpp"
 
+#include "services/audio.hpp"
+#include "services/debug_ui.hpp"
 #include "services/state.hpp"
 #include "services/ui.hpp"
 
@@ -37,7 +44,65 @@ namespace otto::service::engines {
 
   namespace {
     std::map<std::string, std::function<AnyEngine*()>> engineGetters;
-    core::audio::ProcessBuffer<1> _audiobuf1;
+    core::audio::GraphSwap graph;
+    /// Set by the audio driver, possibly on the audio thread
+    std::atomic<std::size_t> max_frames = 0;
+    /// Serialises [rebuild_graph](), so the last graph to be replaced is
+    /// always built with the latest routing and `max_frames`
+    std::mutex rebuild_mutex;
+    /// Output until the first graph has been picked up
+    core::audio::ProcessBuffer<2> silence;
+    /// The output of the tape playback node in the current block
+    core::audio::ProcessData<4> tape_tracks_out = {{}, {}, 0};
+    /// Runs independent engines in parallel. `nullptr` to run serially
+    std::unique_ptr<core::audio::WorkerPool> pool;
+
+    struct DebugInfo : service::debug_ui::Info {
+      service::debug_ui::graph<1 << 10> speedup_graph;
+      int workers         = 0;
+      int parallel_levels = 0;
+
+      void draw() override
+      {
+#if OTTO_DEBUG_UI
+        ImGui::Begin("Engines");
+        ImGui::Text("Workers: %d", workers);
+        ImGui::Text("Parallel levels: %d", parallel_levels);
+        speedup_graph.plot("Parallel speedup", 0, workers + 1);
+
+        auto& profiler = core::audio::dsp_profiler();
+        auto report    = profiler.report();
+        ImGui::Separator();
+        ImGui::Text("DSP load: %.1f%% (p99 %.1f%%, max %.1f%%)", report.load.p50, report.load.p99,
+                    report.load.max);
+        ImGui::Text("Xruns: %llu in %llu blocks", (unsigned long long) report.xruns,
+                    (unsigned long long) report.blocks);
+        ImGui::Text("%-20s %8s %8s %8s", "Node (us)", "p50", "p99", "max");
+        for (auto&& [name, stats] : report.nodes) {
+          ImGui::Text("%-20s %8.1f %8.1f %8.1f", name.c_str(), stats.p50, stats.p99, stats.max);
+        }
+        if (!report.gauges.empty()) {
+          ImGui::Text("%-20s %8s %8s %8s", "Gauge", "p50", "p99", "max");
+        }
+        for (auto&& [name, stats] : report.gauges) {
+          ImGui::Text("%-20s %8.1f %8.1f %8.1f", name.c_str(), stats.p50, stats.p99, stats.max);
+        }
+        if (!report.xrun_log.empty()) {
+          ImGui::Separator();
+          ImGui::Text("Recent xruns:");
+          for (auto&& x : report.xrun_log) {
+            ImGui::Text("Block %llu: %.0f/%.0f us, slowest: %s (%.0f us)",
+                        (unsigned long long) x.block, x.wall, x.deadline, x.node.c_str(),
+                        x.node_time);
+          }
+        }
+        if (ImGui::Button("Save profile")) {
+          profiler.save(global::data_dir / "dsp_profile.json");
+        }
+        ImGui::End();
+#endif
+      }
+    } debug_info;
 
     EngineDispatcher<EngineType::synth> synth;
     EngineDispatcher<EngineType::drums> drums;
@@ -48,8 +113,105 @@ namespace otto::service::engines {
     otto::engines::InputSelector selector;
 
     SynthOrDrums current_sound_source = SynthOrDrums::synth;
+
+    /// The shortest sub-block the instruments are split into at midi events.
+    ///
+    /// An event is applied at the start of the slice it falls in, so up to
+    /// `min_slice_frames - 1` frames early, and a block is split into no more
+    /// than `nframes / min_slice_frames` slices.
+    constexpr int min_slice_frames = 16;
+
+    /// The input gain at the end of the last block. Changes are ramped over a
+    /// block, so turning the knob does not click.
+    float input_gain = 0;
+
+    core::audio::ProcessGraph build_graph()
+    {
+      using namespace core::audio;
+      using otto::engines::InputSelector;
+      using Selection = InputSelector::Selection;
+
+      auto selection = Selection{selector.props.input.get()};
+
+      ProcessGraph g;
+      auto input    = g.add_input<1>("External in");
+      auto playback = g.add_node<0, 4>(
+        "TapeDeck playback",
+        [](ProcessData<0> data) { return tape_tracks_out = tapedeck.process_playback(data); });
+      auto tracks = g.add_node<4, 2>(
+        "Mixer tracks", [](ProcessData<4> data) { return mixer.process_tracks(data); });
+      auto master = g.add_bus<2>("Master");
+      auto record = g.add_node<1, 0>("TapeDeck record", [selection](ProcessData<1> data) {
+        int latency =
+          InputSelector::record_latency(selection, service::audio::round_trip_latency());
+        return tapedeck.process_record(data, latency);
+      });
+      auto metronome_node = g.add_node<0, 1>(
+        "Metronome", [](ProcessData<0> data) { return metronome.process(data); });
+
+      g.connect(playback, tracks);
+      g.connect(tracks, master);
+      g.connect(metronome_node, master);
+      // The metronome reads the tape position
+      g.order(record, metronome_node);
+      g.output(master);
+
+      if (selection == Selection::MasterFB) {
+        g.connect(tracks, record);
+        return g;
+      }
+
+      auto gain = g.add_node<1, 1>("Input gain",
+                                   [](ProcessData<1> data) {
+                                     if (data.silent) return data;
+                                     float gain = tapedeck.props.gain.audio_value();
+                                     util::audio::gain_ramp(data.audio.data()->data(),
+                                                            data.nframes, input_gain, gain);
+                                     input_gain = gain;
+                                     return data;
+                                   },
+                                   ProcessGraph::Flags::in_place);
+
+      switch (selection) {
+      case Selection::Internal: {
+        auto source =
+          current_sound_source == SynthOrDrums::synth
+            ? g.add_node<0, 1>("Synth",
+                               [](ProcessData<0> data) {
+                                 return process_midi_slices(data, min_slice_frames, [](auto slice) {
+                                   return synth.process(slice);
+                                 });
+                               })
+            : g.add_node<0, 1>("Drums", [](ProcessData<0> data) {
+                return process_midi_slices(data, min_slice_frames,
+                                           [](auto slice) { return drums.process(slice); });
+              });
+        g.connect(source, gain);
+      } break;
+      case Selection::External: {
+        auto fx = g.add_node<1, 1>("Effect",
+                                   [](ProcessData<1> data) { return effect.process(data); });
+        g.connect(input, fx);
+        g.connect(fx, gain);
+      } break;
+      case Selection::TrackFB:
+        g.connect(playback, gain, ChannelMap::select(selector.props.track.get()));
+        break;
+      case Selection::MasterFB: break;
+      }
+
+      g.connect(gain, master);
+      g.connect(gain, record);
+      return g;
+    }
   } // namespace
 
+  void rebuild_graph()
+  {
+    std::unique_lock lock(rebuild_mutex);
+    graph.replace(build_graph().compile(max_frames, &core::audio::dsp_profiler()));
+  }
+
   void init()
   {
     engineGetters = {{"TapeDeck", [&]() { return (AnyEngine*) &tapedeck; }},
@@ -78,6 +240,7 @@ namespace otto::service::engines {
         service::ui::select_engine("Synth");
       }
       current_sound_source = SynthOrDrums::synth;
+      rebuild_graph();
     });
     service::ui::register_key_handler(core::ui::Key::drums, [](core::ui::Key k) {
       if (service::ui::is_pressed(core::ui::Key::shift)) {
@@ -86,6 +249,7 @@ namespace otto::service::engines {
         service::ui::select_engine("Drums");
       }
       current_sound_source = SynthOrDrums::drums;
+      rebuild_graph();
     });
 
     service::ui::register_key_handler(core::ui::Key::envelope, [](core::ui::Key k) {
@@ -101,11 +265,13 @@ namespace otto::service::engines {
     });
 
     service::ui::register_key_handler(core::ui::Key::play, [](core::ui::Key key) {
-      if (tapedeck.state.playing()) {
-        tapedeck.state.stop();
-      } else {
-        tapedeck.state.play();
-      }
+      core::audio::parameter_queue().call(tapedeck.state, [](otto::engines::Tapedeck::State& s) {
+        if (s.playing()) {
+          s.stop();
+        } else {
+          s.play();
+        }
+      });
     });
 
 
@@ -128,6 +294,17 @@ namespace otto::service::engines {
     };
 
     service::state::attach("Engines", load, save);
+
+    // Fired between blocks, which for some drivers is on the audio thread. The
+    // graph is rebuilt right away, as the next block may be larger than the
+    // buffers of the current one.
+    service::audio::events::buffersize_change().subscribe([](unsigned nframes) {
+      max_frames = nframes;
+      rebuild_graph();
+    });
+    // The selected input and feedback track are routed by the graph
+    selector.props.input.on_change().subscribe([](int) { rebuild_graph(); });
+    selector.props.track.on_change().subscribe([](int) { rebuild_graph(); });
   }
 
   void start()
@@ -137,70 +314,42 @@ namespace otto::service::engines {
     mixer.on_enable();
     synth.select(std::size_t(0));
     drums.select(std::size_t(0));
+    rebuild_graph();
+#if OTTO_PARALLEL_ENGINES
+    if (int nworkers = core::audio::WorkerPool::default_workers(); nworkers > 0) {
+      pool = std::make_unique<core::audio::WorkerPool>(nworkers);
+      debug_info.workers = nworkers;
+    }
+#endif
   }
 
   void shutdown()
   {
+    synth.shutdown();
+    drums.shutdown();
+    effect.shutdown();
     mixer.on_disable();
     tapedeck.on_disable();
   }
 
   core::audio::ProcessData<2> process(core::audio::ProcessData<1> external_in)
   {
-    using Selection = otto::engines::InputSelector::Selection;
-
-    // Main processor function
-    auto midi_in      = external_in.midi_only();
-    auto playback_out = tapedeck.process_playback(midi_in);
-    auto mixer_out    = mixer.process_tracks(playback_out);
-
-    auto record_in = [&]() {
-      switch (Selection{selector.props.input.get()}) {
-      case Selection::Internal: {
-        if (current_sound_source == SynthOrDrums::synth) {
-          return synth->process(midi_in);
-        } else {
-          return drums->process(midi_in);
-        }
-      }
-      case Selection::External: return effect->process(external_in);
-      case Selection::TrackFB:
-        util::transform(playback_out, _audiobuf1.begin(),
-                        [track = selector.props.track.get()](auto&& a) {
-                          return std::array<float, 1>{{a[track]}};
-                        });
-        return external_in.redirect(_audiobuf1);
-      case Selection::MasterFB: break;
-      }
-      return core::audio::ProcessData<1>{{nullptr}, {nullptr}};
-    }();
-
-    for (auto& frm : record_in) {
-      for (auto& smpl : frm) {
-        smpl *= tapedeck.props.gain;
-      }
-    }
-
-    if (Selection{selector.props.input.get()} != Selection::MasterFB) {
-      mixer.process_engine(record_in);
-    }
-
-    if (Selection{selector.props.input.get()} == Selection::MasterFB) {
-      util::transform(mixer_out, _audiobuf1.begin(), [](auto&& a) {
-          return std::array<float, 1>{{a[0] + a[1]}};
-      });
-      record_in = {{_audiobuf1.data(), external_in.nframes}, external_in.midi};
-    }
-
-    tapedeck.process_record(record_in);
-
-    auto mtrnm_out = metronome.process(midi_in);
-
-    for (auto&& [mix, mtrn] : util::zip(mixer_out, mtrnm_out)) {
-      util::audio::add_all(mix, mtrn);
-    }
+    auto start = std::chrono::steady_clock::now();
+    core::audio::parameter_queue().apply_all();
+    tape_tracks_out = {{}, {}, 0};
+    auto* g = graph.acquire();
+    if (g == nullptr) return external_in.redirect(silence).fill_silence();
+    auto out = g->process<1, 2>(external_in, pool.get());
+    debug_info.speedup_graph.push(g->report().speedup);
+    debug_info.parallel_levels = g->report().parallel_levels;
+    core::audio::dsp_profiler().end_block(std::chrono::steady_clock::now() - start,
+                                          external_in.nframes, service::audio::samplerate());
+    return out;
+  }
 
-    return mixer_out;
+  core::audio::ProcessData<4> tape_tracks() noexcept
+  {
+    return tape_tracks_out;
   }
 
   AnyEngine* const by_name(const std::string& name) noexcept
@@ -212,7 +361,7 @@ namespace otto::service::engines {
   }
 
   namespace tape_state {
-    int position()
+    TapeTime position()
     {
       return tapedeck.position();
     }
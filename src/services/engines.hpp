@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "core/engines/engine.hpp"
 #include "core/engines/engine_dispatcher.hpp"
 
@@ -10,7 +12,7 @@
 namespace otto::service::engines {
 
   /// Type used to identify position on tape
-  using TapeTime = int;
+  using TapeTime = std::int64_t;
   /// Type used to identify time by bars
   using BeatPos = int;
 
@@ -23,7 +25,7 @@ namespace otto::service::engines {
   using exception = util::as_exception<ErrorCode>;
 
   namespace tape_state {
-    int position();
+    TapeTime position();
     float playSpeed();
     bool playing();
   } // namespace tape_state
@@ -54,12 +56,39 @@ namespace otto::service::engines {
 
   /// Destruct engines
   ///
-  /// \effects Invoke [AnyEngine::on_disable]() for all enabled engines
+  /// \effects
+  ///  - Stop preparing engine switches in the background
+  ///  - Invoke [AnyEngine::on_disable]() for all enabled engines
   void shutdown();
 
+  /// Rebuild the audio routing graph
+  ///
+  /// Must be called whenever the routing changes. Changes of the input
+  /// selection, its feedback track and the current sound source call it
+  /// already. The graph is compiled on the calling thread, and picked up by
+  /// the audio thread at the start of the next block. Calls from several
+  /// threads are serialised.
+  ///
+  /// \requires Not called from the audio thread while it is processing. A
+  /// change of the buffer size calls it between blocks, as the next block
+  /// needs the new buffers.
+  void rebuild_graph();
+
   /// Process the engine audio chain
+  ///
+  /// Runs the graph built by [rebuild_graph](). Outputs silence until the
+  /// first graph has been built.
   core::audio::ProcessData<2> process(core::audio::ProcessData<1> external_in);
 
+  /// The tape tracks played back in the last call to [process]()
+  ///
+  /// The audio is the tapedeck's own output buffer, before the tracks are
+  /// mixed down, so it is only valid until the next call to [process]().
+  /// Empty if the tracks were not played.
+  ///
+  /// \requires Only called from the audio thread
+  core::audio::ProcessData<4> tape_tracks() noexcept;
+
   /// Get an engine by name
   ///
   /// \returns `nullptr` if no such engine was found
@@ -54,6 +54,13 @@ namespace otto::util::audio {
       average = nsamples == 0 ? 0 : sum/nsamples;
     }
 
+    /// Add `n` samples, whose absolute values sum to `sum_abs`
+    void add(float sum_abs, int n) {
+      nsamples += n;
+      sum += sum_abs;
+      average = nsamples == 0 ? 0 : sum/nsamples;
+    }
+
     /// Clear the values, starting a new average
     void clear() {
       int scale = 64;
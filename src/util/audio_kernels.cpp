@@ -0,0 +1,379 @@
+#include "audio_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if OTTO_SIMD && defined(__AVX__)
+#define OTTO_KERNELS_AVX 1
+#include <immintrin.h>
+#elif OTTO_SIMD && defined(__SSE__)
+#define OTTO_KERNELS_SSE 1
+#include <xmmintrin.h>
+#elif OTTO_SIMD && defined(__ARM_NEON)
+#define OTTO_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace otto::util::audio {
+
+  namespace {
+
+    // The few vector operations the kernels are written in ////////////////
+
+#if OTTO_KERNELS_AVX
+
+    using Vec                = __m256;
+    constexpr int width      = 8;
+    constexpr auto simd_used = SimdLevel::avx;
+
+    Vec load(const float* p) noexcept { return _mm256_loadu_ps(p); }
+    void store(float* p, Vec v) noexcept { _mm256_storeu_ps(p, v); }
+    Vec splat(float f) noexcept { return _mm256_set1_ps(f); }
+    Vec add(Vec a, Vec b) noexcept { return _mm256_add_ps(a, b); }
+    Vec mul(Vec a, Vec b) noexcept { return _mm256_mul_ps(a, b); }
+    Vec max(Vec a, Vec b) noexcept { return _mm256_max_ps(a, b); }
+    Vec abs(Vec a) noexcept { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+
+#elif OTTO_KERNELS_SSE
+
+    using Vec                = __m128;
+    constexpr int width      = 4;
+    constexpr auto simd_used = SimdLevel::sse;
+
+    Vec load(const float* p) noexcept { return _mm_loadu_ps(p); }
+    void store(float* p, Vec v) noexcept { _mm_storeu_ps(p, v); }
+    Vec splat(float f) noexcept { return _mm_set1_ps(f); }
+    Vec add(Vec a, Vec b) noexcept { return _mm_add_ps(a, b); }
+    Vec mul(Vec a, Vec b) noexcept { return _mm_mul_ps(a, b); }
+    Vec max(Vec a, Vec b) noexcept { return _mm_max_ps(a, b); }
+    Vec abs(Vec a) noexcept { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+
+#elif OTTO_KERNELS_NEON
+
+    using Vec                = float32x4_t;
+    constexpr int width      = 4;
+    constexpr auto simd_used = SimdLevel::neon;
+
+    Vec load(const float* p) noexcept { return vld1q_f32(p); }
+    void store(float* p, Vec v) noexcept { vst1q_f32(p, v); }
+    Vec splat(float f) noexcept { return vdupq_n_f32(f); }
+    Vec add(Vec a, Vec b) noexcept { return vaddq_f32(a, b); }
+    Vec mul(Vec a, Vec b) noexcept { return vmulq_f32(a, b); }
+    Vec max(Vec a, Vec b) noexcept { return vmaxq_f32(a, b); }
+    Vec abs(Vec a) noexcept { return vabsq_f32(a); }
+
+#else
+
+    struct Vec {
+      float f;
+    };
+    constexpr int width      = 1;
+    constexpr auto simd_used = SimdLevel::scalar;
+
+    Vec load(const float* p) noexcept { return {*p}; }
+    void store(float* p, Vec v) noexcept { *p = v.f; }
+    Vec splat(float f) noexcept { return {f}; }
+    Vec add(Vec a, Vec b) noexcept { return {a.f + b.f}; }
+    Vec mul(Vec a, Vec b) noexcept { return {a.f * b.f}; }
+    Vec max(Vec a, Vec b) noexcept { return {std::max(a.f, b.f)}; }
+    Vec abs(Vec a) noexcept { return {std::abs(a.f)}; }
+
+#endif
+
+    /// `{0, 1, 2, ...}`, for ramps
+    constexpr float lane_index[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+    /// The part of `n` samples that fits in whole vectors
+    std::size_t vector_part(std::size_t n) noexcept
+    {
+      return n - n % width;
+    }
+
+    // Mixing ////////////////////////////////////////////////////////////////
+
+    /// Mix `nframes` frames of `C` channels with plain loops
+    template<int C>
+    void mix_frames(const float* in,
+                    float* out,
+                    std::size_t nframes,
+                    const StereoGain* gains,
+                    bool accumulate) noexcept
+    {
+      for (std::size_t f = 0; f < nframes; f++, in += C, out += 2) {
+        float left = accumulate ? out[0] : 0;
+        float right = accumulate ? out[1] : 0;
+        for (int c = 0; c < C; c++) {
+          left += in[c] * gains[c].left;
+          right += in[c] * gains[c].right;
+        }
+        out[0] = left;
+        out[1] = right;
+      }
+    }
+
+    /// Mix frames of `channels` channels, when that is not a compile time constant
+    void mix_frames(const float* in,
+                    int channels,
+                    float* out,
+                    std::size_t nframes,
+                    const StereoGain* gains,
+                    bool accumulate) noexcept
+    {
+      for (std::size_t f = 0; f < nframes; f++, in += channels, out += 2) {
+        float left = accumulate ? out[0] : 0;
+        float right = accumulate ? out[1] : 0;
+        for (int c = 0; c < channels; c++) {
+          left += in[c] * gains[c].left;
+          right += in[c] * gains[c].right;
+        }
+        out[0] = left;
+        out[1] = right;
+      }
+    }
+
+#if OTTO_KERNELS_AVX || OTTO_KERNELS_SSE
+
+    /// Mix 4 frames of `C` channels at a time
+    ///
+    /// AVX builds use this too. Splitting the channels apart is done in 128
+    /// bit lanes anyway.
+    template<int C>
+    void mix_vectors(const float* in,
+                     float* out,
+                     std::size_t nframes,
+                     const StereoGain* gains,
+                     bool accumulate) noexcept
+    {
+      __m128 lgain[C], rgain[C];
+      for (int c = 0; c < C; c++) {
+        lgain[c] = _mm_set1_ps(gains[c].left);
+        rgain[c] = _mm_set1_ps(gains[c].right);
+      }
+      for (std::size_t f = 0; f + 4 <= nframes; f += 4, in += 4 * C, out += 8) {
+        // One vector per channel, with the samples of 4 frames
+        __m128 ch[C];
+        if constexpr (C == 1) {
+          ch[0] = _mm_loadu_ps(in);
+        } else if constexpr (C == 2) {
+          __m128 a = _mm_loadu_ps(in);
+          __m128 b = _mm_loadu_ps(in + 4);
+          ch[0]    = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+          ch[1]    = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        } else {
+          for (int c = 0; c < 4; c++) ch[c] = _mm_loadu_ps(in + 4 * c);
+          _MM_TRANSPOSE4_PS(ch[0], ch[1], ch[2], ch[3]);
+        }
+        __m128 left  = _mm_mul_ps(ch[0], lgain[0]);
+        __m128 right = _mm_mul_ps(ch[0], rgain[0]);
+        for (int c = 1; c < C; c++) {
+          left  = _mm_add_ps(left, _mm_mul_ps(ch[c], lgain[c]));
+          right = _mm_add_ps(right, _mm_mul_ps(ch[c], rgain[c]));
+        }
+        __m128 lo = _mm_unpacklo_ps(left, right);
+        __m128 hi = _mm_unpackhi_ps(left, right);
+        if (accumulate) {
+          lo = _mm_add_ps(lo, _mm_loadu_ps(out));
+          hi = _mm_add_ps(hi, _mm_loadu_ps(out + 4));
+        }
+        _mm_storeu_ps(out, lo);
+        _mm_storeu_ps(out + 4, hi);
+      }
+    }
+
+#elif OTTO_KERNELS_NEON
+
+    /// Mix 4 frames of `C` channels at a time
+    template<int C>
+    void mix_vectors(const float* in,
+                     float* out,
+                     std::size_t nframes,
+                     const StereoGain* gains,
+                     bool accumulate) noexcept
+    {
+      for (std::size_t f = 0; f + 4 <= nframes; f += 4, in += 4 * C, out += 8) {
+        // One vector per channel, with the samples of 4 frames
+        float32x4_t ch[C];
+        if constexpr (C == 1) {
+          ch[0] = vld1q_f32(in);
+        } else if constexpr (C == 2) {
+          auto v = vld2q_f32(in);
+          ch[0]  = v.val[0];
+          ch[1]  = v.val[1];
+        } else {
+          auto v = vld4q_f32(in);
+          for (int c = 0; c < 4; c++) ch[c] = v.val[c];
+        }
+        float32x4x2_t res;
+        if (accumulate) {
+          res = vld2q_f32(out);
+        } else {
+          res.val[0] = res.val[1] = vdupq_n_f32(0);
+        }
+        for (int c = 0; c < C; c++) {
+          res.val[0] = vmlaq_n_f32(res.val[0], ch[c], gains[c].left);
+          res.val[1] = vmlaq_n_f32(res.val[1], ch[c], gains[c].right);
+        }
+        vst2q_f32(out, res);
+      }
+    }
+
+#else
+
+    template<int C>
+    void mix_vectors(const float* in,
+                     float* out,
+                     std::size_t nframes,
+                     const StereoGain* gains,
+                     bool accumulate) noexcept
+    {
+      mix_frames<C>(in, out, nframes - nframes % 4, gains, accumulate);
+    }
+
+#endif
+
+    template<int C>
+    void mix(const float* in,
+             float* out,
+             std::size_t nframes,
+             const StereoGain* gains,
+             bool accumulate) noexcept
+    {
+      std::size_t head = nframes - nframes % 4;
+      mix_vectors<C>(in, out, head, gains, accumulate);
+      mix_frames<C>(in + head * C, out + head * 2, nframes - head, gains, accumulate);
+    }
+
+  } // namespace
+
+  SimdLevel simd_level() noexcept
+  {
+    return simd_used;
+  }
+
+  const char* to_string(SimdLevel level) noexcept
+  {
+    switch (level) {
+    case SimdLevel::scalar: return "scalar";
+    case SimdLevel::sse: return "SSE";
+    case SimdLevel::avx: return "AVX";
+    case SimdLevel::neon: return "NEON";
+    }
+    return "unknown";
+  }
+
+  void gain(float* data, std::size_t n, float gain) noexcept
+  {
+    auto g = splat(gain);
+    std::size_t i = 0;
+    for (; i < vector_part(n); i += width) {
+      store(data + i, mul(load(data + i), g));
+    }
+    for (; i < n; i++) data[i] *= gain;
+  }
+
+  void gain_ramp(float* data, std::size_t n, float from, float to) noexcept
+  {
+    if (n == 0) return;
+    float step = (to - from) / n;
+    // Computed from the index each time, so rounding errors do not add up
+    auto lane_steps = mul(load(lane_index), splat(step));
+    std::size_t i   = 0;
+    for (; i < vector_part(n); i += width) {
+      auto g = add(splat(from + step * i), lane_steps);
+      store(data + i, mul(load(data + i), g));
+    }
+    for (; i < n; i++) data[i] *= from + step * i;
+  }
+
+  void accumulate(float* dst, const float* src, std::size_t n, float gain) noexcept
+  {
+    auto g = splat(gain);
+    std::size_t i = 0;
+    if (gain == 1) {
+      for (; i < vector_part(n); i += width) {
+        store(dst + i, add(load(dst + i), load(src + i)));
+      }
+    } else {
+      for (; i < vector_part(n); i += width) {
+        store(dst + i, add(load(dst + i), mul(load(src + i), g)));
+      }
+    }
+    for (; i < n; i++) dst[i] += src[i] * gain;
+  }
+
+  StereoGain pan_gains(float level, float pan, PanLaw law) noexcept
+  {
+    switch (law) {
+    case PanLaw::constant_power: {
+      float angle = (pan + 1) * float(M_PI) / 4;
+      return {level * std::cos(angle), level * std::sin(angle)};
+    }
+    case PanLaw::linear: break;
+    }
+    return {level * (1 - pan), level * (1 + pan)};
+  }
+
+  void mix_to_stereo(const float* in,
+                     int channels,
+                     float* out,
+                     std::size_t nframes,
+                     const StereoGain* gains,
+                     bool accumulate) noexcept
+  {
+    switch (channels) {
+    case 1: mix<1>(in, out, nframes, gains, accumulate); break;
+    case 2: mix<2>(in, out, nframes, gains, accumulate); break;
+    case 4: mix<4>(in, out, nframes, gains, accumulate); break;
+    default: mix_frames(in, channels, out, nframes, gains, accumulate); break;
+    }
+  }
+
+  float Levels::mean() const noexcept
+  {
+    return nsamples == 0 ? 0 : sum_abs / nsamples;
+  }
+
+  float Levels::rms() const noexcept
+  {
+    return nsamples == 0 ? 0 : std::sqrt(sum_squares / nsamples);
+  }
+
+  void measure(const float* in, int channels, std::size_t nframes, Levels* levels) noexcept
+  {
+    std::size_t n = nframes * channels;
+    std::size_t i = 0;
+    // When the channels divide the vector width, each lane always holds the
+    // same channel, and the lanes are only folded together at the end
+    if (width > 1 && width % channels == 0) {
+      auto peak = splat(0);
+      auto sum  = splat(0);
+      auto sq   = splat(0);
+      for (; i < vector_part(n); i += width) {
+        auto v = load(in + i);
+        auto a = abs(v);
+        peak   = max(peak, a);
+        sum    = add(sum, a);
+        sq     = add(sq, mul(v, v));
+      }
+      float lanes[3][width];
+      store(lanes[0], peak);
+      store(lanes[1], sum);
+      store(lanes[2], sq);
+      for (int l = 0; l < width; l++) {
+        auto& lvl       = levels[l % channels];
+        lvl.peak        = std::max(lvl.peak, lanes[0][l]);
+        lvl.sum_abs     += lanes[1][l];
+        lvl.sum_squares += lanes[2][l];
+      }
+    }
+    for (; i < n; i++) {
+      auto& lvl       = levels[i % channels];
+      float a         = std::abs(in[i]);
+      lvl.peak        = std::max(lvl.peak, a);
+      lvl.sum_abs     += a;
+      lvl.sum_squares += in[i] * in[i];
+    }
+    for (int c = 0; c < channels; c++) levels[c].nsamples += nframes;
+  }
+
+} // namespace otto::util::audio
@@ -0,0 +1,84 @@
+/// \file
+/// Vectorized inner loops for audio processing.
+///
+/// The kernels operate on raw, contiguous float samples, so they work on
+/// interleaved [ProcessData]() as well as on single channel planes. They are
+/// implemented with AVX, SSE or NEON, depending on what the target is compiled
+/// for, and fall back to plain loops when `OTTO_SIMD` is disabled.
+
+#pragma once
+
+#include <cstddef>
+
+namespace otto::util::audio {
+
+  /// The instruction set the kernels were compiled for
+  enum struct SimdLevel { scalar, sse, avx, neon };
+
+  /// The instruction set used by the kernels in this build
+  SimdLevel simd_level() noexcept;
+
+  /// The name of `level`, for logging
+  const char* to_string(SimdLevel level) noexcept;
+
+  /// Multiply `n` samples by `gain`
+  void gain(float* data, std::size_t n, float gain) noexcept;
+
+  /// Multiply `n` samples by a gain moving linearly from `from` towards `to`
+  ///
+  /// Sample `i` is multiplied by `from + (to - from) * i / n`, so a following
+  /// block starting at `to` continues the ramp without a step.
+  void gain_ramp(float* data, std::size_t n, float from, float to) noexcept;
+
+  /// Add `n` samples of `src`, multiplied by `gain`, to `dst`
+  void accumulate(float* dst, const float* src, std::size_t n, float gain = 1) noexcept;
+
+  /// Gains of a channel in the left and right outputs
+  struct StereoGain {
+    float left  = 1;
+    float right = 1;
+  };
+
+  enum struct PanLaw {
+    /// Gains of `1 -+ pan`. Centered signals keep their level in each side.
+    linear,
+    /// Constant total power, and -3dB in each side when centered.
+    constant_power,
+  };
+
+  /// The gains of a channel with `level` at `pan` in `[-1, 1]`
+  StereoGain pan_gains(float level, float pan, PanLaw law = PanLaw::linear) noexcept;
+
+  /// Mix `nframes` frames of `channels` interleaved channels to interleaved stereo
+  ///
+  /// Channel `c` of `in` is added to the left output with gain `gains[c].left`,
+  /// and to the right with `gains[c].right`. Muting a channel is a gain of zero.
+  ///
+  /// \param accumulate Add to the contents of `out` instead of overwriting it
+  /// \requires `out` does not overlap `in`
+  void mix_to_stereo(const float* in,
+                     int channels,
+                     float* out,
+                     std::size_t nframes,
+                     const StereoGain* gains,
+                     bool accumulate = false) noexcept;
+
+  /// Level statistics, accumulated over any number of blocks
+  struct Levels {
+    float peak        = 0;
+    float sum_abs     = 0;
+    float sum_squares = 0;
+    std::size_t nsamples = 0;
+
+    /// The average absolute value
+    float mean() const noexcept;
+
+    float rms() const noexcept;
+  };
+
+  /// Add the levels of each channel of `nframes` interleaved frames to `levels`
+  ///
+  /// \param levels An array with one entry per channel
+  void measure(const float* in, int channels, std::size_t nframes, Levels* levels) noexcept;
+
+} // namespace otto::util::audio
@@ -0,0 +1,112 @@
+#include "util/mapped_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace otto::util {
+
+  namespace {
+    std::size_t page_size() noexcept
+    {
+      static const std::size_t size = sysconf(_SC_PAGESIZE);
+      return size;
+    }
+
+    /// `madvise` and `msync` take page aligned addresses
+    std::pair<std::byte*, std::size_t> page_range(std::byte* data,
+                                                  std::size_t offset,
+                                                  std::size_t length) noexcept
+    {
+      std::size_t first = offset / page_size() * page_size();
+      return {data + first, length + offset - first};
+    }
+  } // namespace
+
+  MappedFile::MappedFile(const filesystem::path& path, std::size_t capacity)
+  {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw util::exception("Could not open {}: {}", path.c_str(), std::strerror(errno));
+    }
+    struct stat st;
+    ::fstat(fd_, &st);
+    size_ = st.st_size;
+
+    void* data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+      auto err = errno;
+      ::close(fd_);
+      fd_ = -1;
+      throw util::exception("Could not map {}: {}", path.c_str(), std::strerror(err));
+    }
+    data_     = static_cast<std::byte*>(data);
+    capacity_ = capacity;
+  }
+
+  MappedFile::MappedFile(MappedFile&& rhs) noexcept
+  {
+    swap(*this, rhs);
+  }
+
+  MappedFile& MappedFile::operator=(MappedFile rhs) noexcept
+  {
+    swap(*this, rhs);
+    return *this;
+  }
+
+  MappedFile::~MappedFile()
+  {
+    close();
+  }
+
+  void swap(MappedFile& a, MappedFile& b) noexcept
+  {
+    using std::swap;
+    swap(a.fd_, b.fd_);
+    swap(a.data_, b.data_);
+    swap(a.capacity_, b.capacity_);
+    swap(a.size_, b.size_);
+  }
+
+  void MappedFile::close() noexcept
+  {
+    if (!is_open()) return;
+    sync(0, size_, true);
+    ::munmap(data_, capacity_);
+    ::close(fd_);
+    data_     = nullptr;
+    fd_       = -1;
+    capacity_ = 0;
+    size_     = 0;
+  }
+
+  void MappedFile::resize(std::size_t size)
+  {
+    if (::ftruncate(fd_, size) != 0) {
+      throw util::exception("Could not resize mapped file: {}", std::strerror(errno));
+    }
+    size_ = size;
+  }
+
+  void MappedFile::will_need(std::size_t offset, std::size_t length) noexcept
+  {
+    if (offset >= size_) return;
+    auto [addr, len] = page_range(data_, offset, std::min(length, size_ - offset));
+    ::madvise(addr, len, MADV_WILLNEED);
+  }
+
+  void MappedFile::sync(std::size_t offset, std::size_t length, bool wait) noexcept
+  {
+    if (offset >= size_) return;
+    auto [addr, len] = page_range(data_, offset, std::min(length, size_ - offset));
+    ::msync(addr, len, wait ? MS_SYNC : MS_ASYNC);
+  }
+
+} // namespace otto::util
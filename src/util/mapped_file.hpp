@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+
+#include "util/filesystem.hpp"
+#include "util/exception.hpp"
+
+namespace otto::util {
+
+  /// A file mapped into memory, so reading and writing it are memory copies
+  ///
+  /// The mapping is made [capacity]() bytes long up front, so it never moves,
+  /// but only the first [size]() bytes are backed by the file. Accessing the
+  /// rest of the mapping is an error, until the file is grown with
+  /// [resize]().
+  ///
+  /// Pages are loaded when they are first touched, and written back by the
+  /// kernel when it sees fit. [will_need]() and [sync]() start these early, so
+  /// they do not stall the next access, or pile up.
+  class MappedFile {
+  public:
+    MappedFile() = default;
+
+    /// Map the first `capacity` bytes of the file at `path`
+    ///
+    /// The file is created if it does not exist.
+    /// \throws [util::exception]() if the file could not be opened or mapped
+    MappedFile(const filesystem::path& path, std::size_t capacity);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) noexcept;
+    MappedFile& operator=(MappedFile) noexcept;
+    ~MappedFile();
+
+    friend void swap(MappedFile&, MappedFile&) noexcept;
+
+    bool is_open() const noexcept
+    {
+      return data_ != nullptr;
+    }
+
+    /// Sync everything, and unmap the file
+    void close() noexcept;
+
+    /// The first byte of the file
+    std::byte* data() noexcept
+    {
+      return data_;
+    }
+
+    /// The length of the mapping, in bytes
+    std::size_t capacity() const noexcept
+    {
+      return capacity_;
+    }
+
+    /// The length of the file, in bytes
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+
+    /// Set the length of the file. New bytes are zero.
+    ///
+    /// \requires `size <= capacity()`
+    void resize(std::size_t size);
+
+    /// Start reading a range of the file into memory, in the background
+    void will_need(std::size_t offset, std::size_t length) noexcept;
+
+    /// Write the changes to a range of the file back to disk
+    ///
+    /// \param wait Whether to wait until they are written, or to only start
+    /// writing them
+    void sync(std::size_t offset, std::size_t length, bool wait = false) noexcept;
+
+  private:
+    int fd_ = -1;
+    std::byte* data_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t size_ = 0;
+  };
+
+} // namespace otto::util
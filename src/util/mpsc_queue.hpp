@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace otto::util {
+
+  /// A bounded, lock-free multiple producer, single consumer queue.
+  ///
+  /// Any number of threads may push concurrently, while one thread pops.
+  /// Neither side ever blocks or allocates. Each slot has a sequence number,
+  /// which tells whether it is free for the producers, or holds a value for
+  /// the consumer.
+  ///
+  /// A producer that is preempted between claiming a slot and writing it
+  /// holds back the values pushed after it, until it is done.
+  ///
+  /// \tparam N The capacity. Must be a power of two
+  template<typename T, std::size_t N>
+  struct mpsc_queue {
+    static_assert((N & (N - 1)) == 0, "The capacity of an mpsc_queue must be a power of two");
+
+    static constexpr std::size_t capacity = N;
+
+    using value_type = T;
+
+    mpsc_queue() noexcept
+    {
+      for (std::size_t i = 0; i < capacity; i++) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    /// Push a value to the back of the queue
+    ///
+    /// May be called from any thread.
+    /// \returns `false` if the queue was full, and nothing was pushed
+    bool try_push(const value_type& val) noexcept
+    {
+      auto head = head_.load(std::memory_order_relaxed);
+      Cell* cell;
+      while (true) {
+        cell      = &cells_[head & (capacity - 1)];
+        auto seq  = cell->sequence.load(std::memory_order_acquire);
+        auto diff = std::intptr_t(seq) - std::intptr_t(head);
+        if (diff == 0) {
+          // The slot is free. Claim it, unless another producer got there first
+          if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+          // The slot still holds the value from the previous lap
+          return false;
+        } else {
+          head = head_.load(std::memory_order_relaxed);
+        }
+      }
+      cell->value = val;
+      cell->sequence.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// Pop a value from the front of the queue
+    ///
+    /// Only call this from the consumer thread.
+    /// \returns `false` if the queue was empty, and `out` was not changed
+    bool try_pop(value_type& out) noexcept
+    {
+      auto tail = tail_.load(std::memory_order_relaxed);
+      auto& cell = cells_[tail & (capacity - 1)];
+      if (cell.sequence.load(std::memory_order_acquire) != tail + 1) return false;
+      out = cell.value;
+      cell.sequence.store(tail + capacity, std::memory_order_release);
+      tail_.store(tail + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    /// The number of elements in the queue.
+    ///
+    /// Only an estimate while other threads are pushing or popping.
+    std::size_t size() const noexcept
+    {
+      auto head = head_.load(std::memory_order_acquire);
+      auto tail = tail_.load(std::memory_order_acquire);
+      return head > tail ? head - tail : 0;
+    }
+
+    bool empty() const noexcept
+    {
+      return size() == 0;
+    }
+
+  private:
+    struct Cell {
+      std::atomic<std::size_t> sequence;
+      value_type value;
+    };
+
+    std::array<Cell, capacity> cells_;
+    // Keep the indices on separate cache lines, so producers and the consumer
+    // do not invalidate each others caches on every operation
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+  };
+
+} // namespace otto::util
@@ -48,6 +48,12 @@ namespace otto::util {
     Position position();
     Position length();
 
+    /// The byte offset of the first sample in the file
+    ByteFile::Position audio_offset() const
+    {
+      return audioOffset;
+    }
+
     template<typename OutIter,
       typename = std::enable_if<
         is_iterator_v<OutIter, Sample, std::output_iterator_tag>>>
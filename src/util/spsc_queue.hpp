@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace otto::util {
+
+  /// A bounded, lock-free single producer, single consumer queue.
+  ///
+  /// One thread may push, and another may pop, concurrently. Neither side
+  /// ever blocks or allocates.
+  ///
+  /// \tparam N The capacity. Must be a power of two
+  template<typename T, std::size_t N>
+  struct spsc_queue {
+    static_assert((N & (N - 1)) == 0, "The capacity of an spsc_queue must be a power of two");
+
+    static constexpr std::size_t capacity = N;
+
+    using value_type = T;
+
+    /// Push a value to the back of the queue
+    ///
+    /// Only call this from the producer thread.
+    /// \returns `false` if the queue was full, and nothing was pushed
+    bool try_push(const value_type& val) noexcept
+    {
+      auto head = head_.load(std::memory_order_relaxed);
+      if (head - tail_.load(std::memory_order_acquire) == capacity) return false;
+      storage_[head & (capacity - 1)] = val;
+      head_.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// Pop a value from the front of the queue
+    ///
+    /// Only call this from the consumer thread.
+    /// \returns `false` if the queue was empty, and `out` was not changed
+    bool try_pop(value_type& out) noexcept
+    {
+      auto tail = tail_.load(std::memory_order_relaxed);
+      if (head_.load(std::memory_order_acquire) == tail) return false;
+      out = storage_[tail & (capacity - 1)];
+      tail_.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// The number of elements in the queue.
+    ///
+    /// Exact when called from the producer or the consumer thread while the
+    /// other is idle, and an estimate otherwise.
+    std::size_t size() const noexcept
+    {
+      return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const noexcept
+    {
+      return size() == 0;
+    }
+
+  private:
+    std::array<value_type, capacity> storage_;
+    // Keep the indices on separate cache lines, so the two threads do not
+    // invalidate each others caches on every operation
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+  };
+
+} // namespace otto::util
@@ -0,0 +1,489 @@
+#include "tape_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if OTTO_SIMD && defined(__SSE2__)
+#define OTTO_CODEC_SSE2 1
+#include <emmintrin.h>
+#elif OTTO_SIMD && defined(__ARM_NEON)
+#define OTTO_CODEC_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace otto::util {
+
+  namespace {
+
+    // The lane operations the transforms are written in ////////////////////
+
+    // One lane per channel of a frame
+    static_assert(TapeCodec::channels == 4);
+
+#if OTTO_CODEC_SSE2
+
+    using Lanes = __m128i;
+
+    Lanes load(const void* p) noexcept { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+    void store(void* p, Lanes v) noexcept { _mm_storeu_si128(static_cast<__m128i*>(p), v); }
+    Lanes splat(std::uint32_t v) noexcept { return _mm_set1_epi32(v); }
+    Lanes add(Lanes a, Lanes b) noexcept { return _mm_add_epi32(a, b); }
+    Lanes sub(Lanes a, Lanes b) noexcept { return _mm_sub_epi32(a, b); }
+    Lanes bit_and(Lanes a, Lanes b) noexcept { return _mm_and_si128(a, b); }
+    Lanes bit_xor(Lanes a, Lanes b) noexcept { return _mm_xor_si128(a, b); }
+    /// All ones in the negative lanes
+    Lanes sign(Lanes a) noexcept { return _mm_srai_epi32(a, 31); }
+    Lanes shift_left1(Lanes a) noexcept { return _mm_slli_epi32(a, 1); }
+    Lanes shift_right1(Lanes a) noexcept { return _mm_srli_epi32(a, 1); }
+    Lanes equal(Lanes a, Lanes b) noexcept { return _mm_cmpeq_epi32(a, b); }
+    /// `a` in the lanes set in `mask`, and `b` in the others
+    Lanes select(Lanes mask, Lanes a, Lanes b) noexcept
+    {
+      return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    /// 64 bit sums of each lane
+    struct Sums {
+      __m128i low = _mm_setzero_si128();
+      __m128i high = _mm_setzero_si128();
+
+      void add(Lanes v) noexcept
+      {
+        low  = _mm_add_epi64(low, _mm_unpacklo_epi32(v, _mm_setzero_si128()));
+        high = _mm_add_epi64(high, _mm_unpackhi_epi32(v, _mm_setzero_si128()));
+      }
+
+      void store(std::uint64_t* p) const noexcept
+      {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 2), high);
+      }
+    };
+
+#elif OTTO_CODEC_NEON
+
+    using Lanes = uint32x4_t;
+
+    Lanes load(const void* p) noexcept { return vld1q_u32(static_cast<const std::uint32_t*>(p)); }
+    void store(void* p, Lanes v) noexcept { vst1q_u32(static_cast<std::uint32_t*>(p), v); }
+    Lanes splat(std::uint32_t v) noexcept { return vdupq_n_u32(v); }
+    Lanes add(Lanes a, Lanes b) noexcept { return vaddq_u32(a, b); }
+    Lanes sub(Lanes a, Lanes b) noexcept { return vsubq_u32(a, b); }
+    Lanes bit_and(Lanes a, Lanes b) noexcept { return vandq_u32(a, b); }
+    Lanes bit_xor(Lanes a, Lanes b) noexcept { return veorq_u32(a, b); }
+    /// All ones in the negative lanes
+    Lanes sign(Lanes a) noexcept
+    {
+      return vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(a), 31));
+    }
+    Lanes shift_left1(Lanes a) noexcept { return vshlq_n_u32(a, 1); }
+    Lanes shift_right1(Lanes a) noexcept { return vshrq_n_u32(a, 1); }
+    Lanes equal(Lanes a, Lanes b) noexcept { return vceqq_u32(a, b); }
+    /// `a` in the lanes set in `mask`, and `b` in the others
+    Lanes select(Lanes mask, Lanes a, Lanes b) noexcept { return vbslq_u32(mask, a, b); }
+
+    /// 64 bit sums of each lane
+    struct Sums {
+      uint64x2_t low = vdupq_n_u64(0);
+      uint64x2_t high = vdupq_n_u64(0);
+
+      void add(Lanes v) noexcept
+      {
+        low  = vaddw_u32(low, vget_low_u32(v));
+        high = vaddw_u32(high, vget_high_u32(v));
+      }
+
+      void store(std::uint64_t* p) const noexcept
+      {
+        vst1q_u64(p, low);
+        vst1q_u64(p + 2, high);
+      }
+    };
+
+#else
+
+    struct Lanes {
+      std::uint32_t v[4];
+    };
+
+    template<typename F>
+    Lanes each(F&& f) noexcept
+    {
+      return {{f(0), f(1), f(2), f(3)}};
+    }
+
+    Lanes load(const void* p) noexcept
+    {
+      Lanes res;
+      std::memcpy(res.v, p, sizeof(res.v));
+      return res;
+    }
+    void store(void* p, Lanes v) noexcept { std::memcpy(p, v.v, sizeof(v.v)); }
+    Lanes splat(std::uint32_t v) noexcept { return {{v, v, v, v}}; }
+    Lanes add(Lanes a, Lanes b) noexcept { return each([&](int i) { return a.v[i] + b.v[i]; }); }
+    Lanes sub(Lanes a, Lanes b) noexcept { return each([&](int i) { return a.v[i] - b.v[i]; }); }
+    Lanes bit_and(Lanes a, Lanes b) noexcept
+    {
+      return each([&](int i) { return a.v[i] & b.v[i]; });
+    }
+    Lanes bit_xor(Lanes a, Lanes b) noexcept
+    {
+      return each([&](int i) { return a.v[i] ^ b.v[i]; });
+    }
+    /// All ones in the negative lanes
+    Lanes sign(Lanes a) noexcept
+    {
+      return each([&](int i) { return a.v[i] >> 31 ? 0xFFFFFFFFu : 0u; });
+    }
+    Lanes shift_left1(Lanes a) noexcept { return each([&](int i) { return a.v[i] << 1; }); }
+    Lanes shift_right1(Lanes a) noexcept { return each([&](int i) { return a.v[i] >> 1; }); }
+    Lanes equal(Lanes a, Lanes b) noexcept
+    {
+      return each([&](int i) { return a.v[i] == b.v[i] ? 0xFFFFFFFFu : 0u; });
+    }
+    /// `a` in the lanes set in `mask`, and `b` in the others
+    Lanes select(Lanes mask, Lanes a, Lanes b) noexcept
+    {
+      return each([&](int i) { return (mask.v[i] & a.v[i]) | (~mask.v[i] & b.v[i]); });
+    }
+
+    /// 64 bit sums of each lane
+    struct Sums {
+      std::uint64_t v[4] = {};
+
+      void add(Lanes l) noexcept
+      {
+        for (int i = 0; i < 4; i++) v[i] += l.v[i];
+      }
+
+      void store(std::uint64_t* p) const noexcept { std::memcpy(p, v, sizeof(v)); }
+    };
+
+#endif
+
+    /// Map the bits of floats to integers that grow with the floats, and back
+    ///
+    /// Flips the magnitude of the negative floats. It is its own inverse.
+    Lanes map_bits(Lanes bits) noexcept
+    {
+      return bit_xor(bits, bit_and(sign(bits), splat(0x7FFFFFFF)));
+    }
+
+    /// Interleave negative and positive residuals, so small ones of either
+    /// sign are small
+    Lanes zigzag(Lanes r) noexcept
+    {
+      return bit_xor(shift_left1(r), sign(r));
+    }
+
+    Lanes unzigzag(Lanes z) noexcept
+    {
+      return bit_xor(shift_right1(z), sub(splat(0), bit_and(z, splat(1))));
+    }
+
+    // Rice coding ///////////////////////////////////////////////////////////
+
+    /// Quotients this large are written as an escape, and the value in full
+    constexpr std::uint32_t escape = 32;
+
+    /// The Rice parameter for values summing to `sum`
+    int rice_parameter(std::uint64_t sum) noexcept
+    {
+      std::uint64_t mean = sum / TapeCodec::partition_frames;
+      int k = 0;
+      while (k < 31 && (mean >> (k + 1)) > 0) k++;
+      return k;
+    }
+
+    /// The approximate number of bits to code values summing to `sum`
+    std::uint64_t rice_bits(std::uint64_t sum) noexcept
+    {
+      int k = rice_parameter(sum);
+      return 5 + (k + 1) * TapeCodec::partition_frames + (sum >> k);
+    }
+
+    /// Writes bits, the most significant first
+    struct BitWriter {
+      std::byte* out;
+      std::uint64_t acc = 0;
+      int bits = 0;
+
+      /// Write the `n` lowest bits of `value`. `n` is at most 32.
+      void put(std::uint32_t value, int n) noexcept
+      {
+        acc = (acc << n) | (value & ((std::uint64_t(1) << n) - 1));
+        bits += n;
+        while (bits >= 8) {
+          bits -= 8;
+          *out++ = std::byte(acc >> bits);
+        }
+      }
+
+      void put_rice(std::uint32_t value, int k) noexcept
+      {
+        std::uint32_t q = value >> k;
+        if (q >= escape) {
+          put(0xFFFFFFFF, 32);
+          put(value, 32);
+          return;
+        }
+        // `q` ones and a zero
+        put(((std::uint32_t(1) << q) - 1) << 1, q + 1);
+        if (k > 0) put(value, k);
+      }
+
+      /// Write the bits that are left, padded to a byte
+      void flush() noexcept
+      {
+        if (bits > 0) *out++ = std::byte(acc << (8 - bits));
+        bits = 0;
+      }
+    };
+
+    /// Reads bits, the most significant first
+    struct BitReader {
+      const std::byte* in;
+      const std::byte* end;
+      std::uint64_t acc = 0;
+      int bits = 0;
+      /// Bytes past the end, which are read as zeros
+      int overrun = 0;
+
+      void refill() noexcept
+      {
+        while (bits <= 56) {
+          std::uint64_t byte = 0;
+          if (in < end) {
+            byte = std::uint64_t(*in++);
+          } else {
+            overrun++;
+          }
+          acc = (acc << 8) | byte;
+          bits += 8;
+        }
+      }
+
+      /// The next 32 bits, without reading them
+      std::uint32_t peek32() noexcept
+      {
+        if (bits < 32) refill();
+        return acc >> (bits - 32);
+      }
+
+      std::uint32_t get(int n) noexcept
+      {
+        if (n == 0) return 0;
+        if (bits < n) refill();
+        bits -= n;
+        return (acc >> bits) & ((std::uint64_t(1) << n) - 1);
+      }
+
+      std::uint32_t get_rice(int k) noexcept
+      {
+        std::uint32_t window = peek32();
+        if (window == 0xFFFFFFFF) {
+          bits -= 32;
+          return get(32);
+        }
+        auto q = std::uint32_t(__builtin_clz(~window));
+        bits -= q + 1;
+        return (q << k) | get(k);
+      }
+
+      /// Whether more bits were read than there are
+      bool overran() const noexcept
+      {
+        return overrun * 8 > bits;
+      }
+    };
+
+    enum Mode : std::uint8_t { silent = 0, raw = 1, predicted = 2 };
+
+    /// The raw size of a channel of a block
+    constexpr std::size_t raw_size = TapeCodec::block_frames * sizeof(float);
+
+  } // namespace
+
+  TapeCodec::TapeCodec()
+    : residuals_(orders * block_frames * channels),
+      sums_(orders * partitions * channels),
+      // A partition of escapes, on top of the raw size, before giving up
+      scratch_(raw_size + partition_frames * 8 + 16)
+  {}
+
+  std::size_t TapeCodec::encode(const float* frames, std::byte* out) noexcept
+  {
+    // The residuals of every order, for all channels at once
+    Lanes prev1 = splat(0), prev2 = splat(0);
+    auto* r0 = residuals_.data();
+    auto* r1 = r0 + block_frames * channels;
+    auto* r2 = r1 + block_frames * channels;
+    for (int p = 0; p < partitions; p++) {
+      Sums s0, s1, s2;
+      for (int f = p * partition_frames; f < (p + 1) * partition_frames; f++) {
+        Lanes x = map_bits(load(frames + f * channels));
+        Lanes d1 = sub(x, prev1);
+        Lanes d2 = sub(d1, sub(prev1, prev2));
+        Lanes z0 = zigzag(x), z1 = zigzag(d1), z2 = zigzag(d2);
+        store(r0 + f * channels, z0);
+        store(r1 + f * channels, z1);
+        store(r2 + f * channels, z2);
+        s0.add(z0);
+        s1.add(z1);
+        s2.add(z2);
+        prev2 = prev1;
+        prev1 = x;
+      }
+      s0.store(&sums_[(0 * partitions + p) * channels]);
+      s1.store(&sums_[(1 * partitions + p) * channels]);
+      s2.store(&sums_[(2 * partitions + p) * channels]);
+    }
+
+    std::byte* start = out;
+    for (int c = 0; c < channels; c++) {
+      out += encode_channel(c, out);
+    }
+    return out - start;
+  }
+
+  std::size_t TapeCodec::encode_channel(int c, std::byte* out) noexcept
+  {
+    // The order that is cheapest to code
+    std::uint64_t best_bits = ~std::uint64_t(0);
+    bool is_silent = true;
+    for (int order = 0; order < orders; order++) {
+      std::uint64_t bits = 0;
+      for (int p = 0; p < partitions; p++) {
+        auto sum = sums_[(order * partitions + p) * channels + c];
+        if (order == 0 && sum != 0) is_silent = false;
+        bits += rice_bits(sum);
+      }
+      if (bits < best_bits) {
+        best_bits = bits;
+        order_[c] = order;
+      }
+    }
+    if (is_silent) {
+      out[0] = std::byte(silent);
+      return 1;
+    }
+
+    auto* residuals = residuals_.data() + order_[c] * block_frames * channels + c;
+    BitWriter writer {scratch_.data()};
+    // Stops once it is larger than raw
+    for (int p = 0; p < partitions && std::size_t(writer.out - scratch_.data()) < raw_size; p++) {
+      int k = rice_parameter(sums_[(order_[c] * partitions + p) * channels + c]);
+      writer.put(k, 5);
+      for (int f = p * partition_frames; f < (p + 1) * partition_frames; f++) {
+        writer.put_rice(residuals[f * channels], k);
+      }
+    }
+    writer.flush();
+
+    std::uint32_t size = writer.out - scratch_.data();
+    if (size + sizeof(size) < raw_size) {
+      out[0] = std::byte(predicted + order_[c]);
+      std::memcpy(out + 1, &size, sizeof(size));
+      std::memcpy(out + 1 + sizeof(size), scratch_.data(), size);
+      return 1 + sizeof(size) + size;
+    }
+
+    // Noise, that does not get smaller
+    out[0] = std::byte(raw);
+    auto* src = residuals_.data() + c;
+    for (int f = 0; f < block_frames; f++) {
+      // Order 0 residuals are the zigzagged bits
+      auto z     = src[f * channels];
+      auto mapped = (z >> 1) ^ (0 - (z & 1));
+      auto bits   = mapped ^ ((0 - (mapped >> 31)) & 0x7FFFFFFF);
+      std::memcpy(out + 1 + f * sizeof(bits), &bits, sizeof(bits));
+    }
+    return 1 + raw_size;
+  }
+
+  bool TapeCodec::decode(const std::byte* in, std::size_t size, float* frames) noexcept
+  {
+    const std::byte* end = in + size;
+    bool ok = true;
+    for (int c = 0; c < channels && ok; c++) {
+      if (in >= end) {
+        ok = false;
+        break;
+      }
+      auto mode = std::uint8_t(*in++);
+      if (mode == silent) {
+        ok = decode_channel(c, 0, nullptr, 0);
+      } else if (mode == raw) {
+        if (std::size_t(end - in) < raw_size) {
+          ok = false;
+          break;
+        }
+        auto* dst = residuals_.data() + c;
+        for (int f = 0; f < block_frames; f++) {
+          std::uint32_t bits;
+          std::memcpy(&bits, in + f * sizeof(bits), sizeof(bits));
+          auto mapped = bits ^ ((0 - (bits >> 31)) & 0x7FFFFFFF);
+          dst[f * channels] = (mapped << 1) ^ (0 - (mapped >> 31));
+        }
+        order_[c] = 0;
+        in += raw_size;
+      } else if (mode < predicted + orders) {
+        std::uint32_t length;
+        if (std::size_t(end - in) < sizeof(length)) {
+          ok = false;
+          break;
+        }
+        std::memcpy(&length, in, sizeof(length));
+        in += sizeof(length);
+        if (std::size_t(end - in) < length) {
+          ok = false;
+          break;
+        }
+        ok = decode_channel(c, mode - predicted, in, length);
+        in += length;
+      } else {
+        ok = false;
+      }
+    }
+    if (!ok) {
+      std::fill(frames, frames + block_frames * channels, 0.f);
+      return false;
+    }
+
+    // Undo the prediction, for all channels at once
+    std::uint32_t orders[channels];
+    for (int c = 0; c < channels; c++) orders[c] = order_[c];
+    Lanes order1 = equal(load(orders), splat(1));
+    Lanes order2 = equal(load(orders), splat(2));
+    Lanes prev1 = splat(0), prev2 = splat(0);
+    auto* residuals = residuals_.data();
+    for (int f = 0; f < block_frames; f++) {
+      Lanes prediction = select(order2, add(prev1, sub(prev1, prev2)),
+                                select(order1, prev1, splat(0)));
+      Lanes x = add(prediction, unzigzag(load(residuals + f * channels)));
+      store(frames + f * channels, map_bits(x));
+      prev2 = prev1;
+      prev1 = x;
+    }
+    return true;
+  }
+
+  bool TapeCodec::decode_channel(int c, int order, const std::byte* in, std::size_t size) noexcept
+  {
+    order_[c] = order;
+    auto* dst = residuals_.data() + c;
+    if (in == nullptr) {
+      for (int f = 0; f < block_frames; f++) dst[f * channels] = 0;
+      return true;
+    }
+    BitReader reader {in, in + size};
+    for (int p = 0; p < partitions; p++) {
+      int k = reader.get(5);
+      for (int f = p * partition_frames; f < (p + 1) * partition_frames; f++) {
+        dst[f * channels] = reader.get_rice(k);
+      }
+    }
+    return !reader.overran();
+  }
+
+} // namespace otto::util
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace otto::util {
+
+  /// Lossless compression of blocks of 4 channel float audio, for the tape
+  /// file
+  ///
+  /// Each channel of a block is stored as one of these, whichever is smallest:
+  ///
+  ///  - Silence: Only zeros, and no data.
+  ///  - Predicted: The bits of each sample are read as an integer, which grows
+  ///    with the value of the float, and is predicted from the samples before
+  ///    it by a polynomial of order 0, 1 or 2. The residuals are Rice coded,
+  ///    with a parameter for each [partition_frames]() samples.
+  ///  - Raw: The bits of the floats.
+  ///
+  /// The integer arithmetic wraps, so every float, including NaNs and
+  /// denormals, is decoded bit for bit. The mapping and the prediction work on
+  /// the four channels of a frame at once, with SSE2 or NEON when `OTTO_SIMD`
+  /// is enabled.
+  class TapeCodec {
+  public:
+    static constexpr int channels = 4;
+    /// The frames in a block
+    static constexpr int block_frames = 1 << 12;
+    /// The frames that share a Rice parameter
+    static constexpr int partition_frames = 1 << 8;
+    /// The size of the largest encoded block
+    static constexpr std::size_t max_encoded_size = channels * (1 + block_frames * sizeof(float));
+
+    TapeCodec();
+
+    /// Encode a block of [block_frames]() interleaved frames
+    ///
+    /// \param out Room for [max_encoded_size]() bytes
+    /// \returns The number of bytes written to `out`
+    std::size_t encode(const float* frames, std::byte* out) noexcept;
+
+    /// Decode a block of `size` bytes to [block_frames]() interleaved frames
+    ///
+    /// \returns `false` if the block is corrupt, in which case `frames` is
+    /// silent
+    bool decode(const std::byte* in, std::size_t size, float* frames) noexcept;
+
+  private:
+    static constexpr int orders = 3;
+    static constexpr int partitions = block_frames / partition_frames;
+
+    std::size_t encode_channel(int channel, std::byte* out) noexcept;
+    bool decode_channel(int channel, int order, const std::byte* in, std::size_t size) noexcept;
+
+    /// The zigzagged residuals of each order, interleaved like the frames
+    std::vector<std::uint32_t> residuals_;
+    /// The sum of the residuals of each order, partition and channel
+    std::vector<std::uint64_t> sums_;
+    /// The order each channel is predicted with
+    int order_[channels] = {};
+    /// A channel is coded here first, to see if it is smaller than raw
+    std::vector<std::byte> scratch_;
+  };
+
+} // namespace otto::util
@@ -1,61 +1,388 @@
 #include "tapefile.hpp"
 
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "services/logger.hpp"
+
 namespace otto::util {
 
-  using Chunk = ByteFile::Chunk;
-  using SliceData = TapeFile::SliceData;
+  namespace {
+    /// The start of the header
+    struct Header {
+      std::array<char, 8> magic = {'O', 'T', 'T', 'O', 'T', 'A', 'P', 'E'};
+      std::uint32_t version = 2;
+      std::uint32_t channels = TapeFile::channels;
+      std::uint32_t chunk_frames = TapeFile::chunk_frames;
+      std::uint32_t max_chunks = TapeFile::max_chunks;
+      /// Zero in the files from before there was a choice
+      TapeFile::Encoding encoding = TapeFile::Encoding::raw;
 
-  struct TRCKChunk : Chunk {
-    uint16_t index = 0;
-    TRCKChunk(uint16_t idx) : Chunk("TRCK"), index (idx) {}
-    TRCKChunk(const Chunk& c) : Chunk(c) {}
+      /// Whether the audio is laid out the same, in any encoding
+      bool operator==(const Header& rhs) const
+      {
+        return magic == rhs.magic && version == rhs.version && channels == rhs.channels &&
+               chunk_frames == rhs.chunk_frames && max_chunks == rhs.max_chunks;
+      }
+    };
+  } // namespace
 
-    void write_fields(ByteFile& f) override {
-      auto& tf = dynamic_cast<TapeFile&>(f);
-      f.write_bytes(bytes<2>::from_u(index));
-      f.write_bytes(bytes<2>::from_u(tf.slices[index].count));
-      f.write_bytes((std::byte*) tf.slices[index].array.data(),
-        2048 * sizeof(SliceData));
+  TapeFile::~TapeFile()
+  {
+    try {
+      close();
+    } catch (util::exception& e) {
+      LOGE("{}", e.what());
     }
+  }
 
-    void read_fields(ByteFile& f) override {
-      auto& tf = dynamic_cast<TapeFile&>(f);
-      bytes<2> temp;
-      f.read_bytes(temp).unwrap_ok();
-      index = temp.as_u();
-      f.read_bytes(temp).unwrap_ok();
-      tf.slices[index].count = temp.as_u();
-      f.read_bytes((std::byte*) tf.slices[index].array.data(),
-        2048 * sizeof(SliceData)).unwrap_ok();
+  void TapeFile::open(const filesystem::path& path, Encoding encoding)
+  {
+    close();
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw util::exception("Could not open {}: {}", path.c_str(), std::strerror(errno));
     }
-  };
+    struct stat st;
+    ::fstat(fd_, &st);
+    size_ = st.st_size;
+    index_.assign(max_chunks, 0);
+    for (auto& track : slices) track.count = 0;
 
-  struct TAPEChunk : Chunk {
-    TAPEChunk(const Chunk& c) : Chunk(c) {}
-    TAPEChunk() : Chunk("TAPE") {}
-    bytes<4> version = {1,0,0,0};
+    Header header;
+    if (size_ == 0) {
+      // A new tape. The tables start out as zeros, which the file is filled
+      // with.
+      header.encoding = encoding;
+      write_at(0, &header, sizeof(Header));
+    } else {
+      read_at(0, &header, sizeof(Header));
+      if (!(header == Header{}) || header.encoding > Encoding::lossless) {
+        ::close(fd_);
+        fd_ = -1;
+        throw util::exception("{} is not a tape file of this version", path.c_str());
+      }
+    }
+    encoding_ = header.encoding;
+    if (encoding_ == Encoding::lossless) {
+      data_offset_ = page_aligned(block_table_offset + max_blocks * sizeof(std::uint32_t));
+      block_sizes_.assign(max_blocks, 0);
+      block_.resize(block_frames * channels);
+      encoded_.resize(TapeCodec::max_encoded_size);
+    } else {
+      data_offset_ = page_aligned(block_table_offset);
+      block_sizes_.clear();
+    }
 
-    TRCKChunk tracks[4] = {{0}, {1}, {2}, {3}};
+    if (size_ == 0) {
+      if (::ftruncate(fd_, data_offset_) != 0) {
+        throw util::exception("Could not resize {}: {}", path.c_str(), std::strerror(errno));
+      }
+      size_ = data_offset_;
+      return;
+    }
 
-    void write_fields(ByteFile& f) override {
-      f.write_bytes(version);
-      for (auto&& trck : tracks) {
-        trck.write(f);
+    read_at(index_offset, index_.data(), max_chunks * sizeof(std::int64_t));
+    for (std::size_t i = 0; i < max_chunks; i++) {
+      auto& chunk = index_[i];
+      if (chunk == 0) continue;
+      if (chunk < std::int64_t(data_offset_) || chunk + std::int64_t(chunk_bytes()) > size_) {
+        LOGW("Chunk at {} is outside {}, and is read as silence", chunk, path.c_str());
+        chunk = 0;
+        continue;
+      }
+      if (encoding_ == Encoding::lossless) {
+        // Only the chunks that were written have blocks
+        constexpr std::size_t blocks = chunk_frames / block_frames;
+        auto* sizes = block_sizes_.data() + i * blocks;
+        read_at(block_table_offset + i * blocks * sizeof(std::uint32_t), sizes,
+                blocks * sizeof(std::uint32_t));
+        for (std::size_t b = 0; b < blocks; b++) {
+          if (sizes[b] > TapeCodec::max_encoded_size) {
+            LOGW("Block {} of {} is too large, and is read as silence", i * blocks + b,
+                 path.c_str());
+            sizes[b] = 0;
+          }
+        }
       }
     }
+    for (std::size_t track = 0; track < slices.size(); track++) {
+      auto offset = slices_offset + track * track_slices_size;
+      read_at(offset, &slices[track].count, sizeof(uint16_t));
+      slices[track].count = std::min<uint16_t>(slices[track].count, slices[track].array.size());
+      read_at(offset + 8, slices[track].array.data(), sizeof(slices[track].array));
+    }
+  }
 
-    void read_fields(ByteFile& f) override {
-      f.read_bytes(version).unwrap_ok();
-      for (auto&& trck : tracks) {
-        trck.read(f);
+  void TapeFile::close()
+  {
+    if (!is_open()) return;
+    try {
+      for (std::size_t track = 0; track < slices.size(); track++) {
+        auto offset = slices_offset + track * track_slices_size;
+        write_at(offset, &slices[track].count, sizeof(uint16_t));
+        write_at(offset + 8, slices[track].array.data(), sizeof(slices[track].array));
       }
+    } catch (util::exception&) {
+      ::close(fd_);
+      fd_ = -1;
+      throw;
     }
-  };
+    ::close(fd_);
+    fd_ = -1;
+  }
 
-  void TapeFile::add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v) {
+  std::int64_t TapeFile::allocate_chunk(Position position)
+  {
+    auto& chunk = index_[position / chunk_frames];
+    if (chunk == 0) {
+      // Appended, aligned to the chunks before it
+      std::int64_t bytes = chunk_bytes();
+      std::int64_t used  = size_ - data_offset_;
+      std::int64_t at    = data_offset_ + (used + bytes - 1) / bytes * bytes;
+      if (::ftruncate(fd_, at + bytes) != 0) {
+        throw util::exception("Could not grow the tape file: {}", std::strerror(errno));
+      }
+      size_ = at + bytes;
+      // The chunk is in the file before the index points to it
+      write_at(index_offset + (position / chunk_frames) * sizeof(std::int64_t), &at, sizeof(at));
+      chunk = at;
+    }
+    return chunk;
+  }
+
+  std::int64_t TapeFile::allocate(Position position)
+  {
+    allocate_chunk(position);
+    return offset(position);
+  }
+
+  std::int64_t TapeFile::allocate_block(Position position)
+  {
+    allocate_chunk(position);
+    return block_offset(position);
+  }
+
+  void TapeFile::block_written(Position position, std::size_t size)
+  {
+    auto block = position / block_frames;
+    block_sizes_[block] = size;
+    write_at(block_table_offset + block * sizeof(std::uint32_t), &block_sizes_[block],
+             sizeof(std::uint32_t));
+  }
+
+  void TapeFile::read_block(Position position, float* dst)
+  {
+    auto size = block_size(position);
+    if (size == 0) {
+      std::fill(dst, dst + block_frames * channels, 0.f);
+      return;
+    }
+    read_at(block_offset(position), encoded_.data(), size);
+    if (!codec_.decode(encoded_.data(), size, dst)) {
+      LOGW("Block {} of the tape file is corrupt, and is read as silence", position / block_frames);
+    }
+  }
+
+  void TapeFile::write_block(Position position, const float* src)
+  {
+    auto size = codec_.encode(src, encoded_.data());
+    write_at(allocate_block(position), encoded_.data(), size);
+    block_written(position, size);
+  }
+
+  void TapeFile::read_frames(Position position, float* dst, Position n)
+  {
+    if (encoding_ == Encoding::lossless) {
+      for_each_block(position, n, [&](Position p, Position m) {
+        auto* block_dst = dst + (p - position) * channels;
+        if (m == block_frames) {
+          read_block(p, block_dst);
+          return;
+        }
+        read_block(p, block_.data());
+        auto* src = block_.data() + (p % block_frames) * channels;
+        std::copy(src, src + m * channels, block_dst);
+      });
+      return;
+    }
+    for_each_chunk(position, n, [&](Position p, Position m) {
+      auto* chunk_dst = dst + (p - position) * channels;
+      if (auto at = offset(p); at >= 0) {
+        read_at(at, chunk_dst, m * frame_bytes);
+      } else {
+        std::fill(chunk_dst, chunk_dst + m * channels, 0.f);
+      }
+    });
+  }
+
+  void TapeFile::write_frames(Position position, const float* src, Position n)
+  {
+    if (encoding_ == Encoding::lossless) {
+      for_each_block(position, n, [&](Position p, Position m) {
+        auto* block_src = src + (p - position) * channels;
+        if (m == block_frames) {
+          write_block(p, block_src);
+          return;
+        }
+        // The rest of the block is kept
+        read_block(p, block_.data());
+        auto* dst = block_.data() + (p % block_frames) * channels;
+        std::copy(block_src, block_src + m * channels, dst);
+        write_block(p, block_.data());
+      });
+      return;
+    }
+    for_each_chunk(position, n, [&](Position p, Position m) {
+      write_at(allocate(p), src + (p - position) * channels, m * frame_bytes);
+    });
+  }
+
+  void TapeFile::import_wav(const filesystem::path& path)
+  {
+    LegacyTapeFile wav;
+    try {
+      wav.open(path);
+      if (wav.info.channels != channels) {
+        throw util::exception("{} has {} channels, not {}", path.c_str(), wav.info.channels,
+                              channels);
+      }
+      for (std::size_t track = 0; track < slices.size(); track++) {
+        auto& from = wav.slices[track];
+        auto& to   = slices[track];
+        to.count   = std::min<uint16_t>(from.count, to.array.size());
+        for (std::size_t i = 0; i < to.count; i++) {
+          to.array[i] = {from.array[i].in, from.array[i].out};
+        }
+      }
+
+      Position length = std::min<Position>(wav.length() / channels, max_frames);
+      std::vector<float> block(block_frames * channels);
+      wav.seek(0);
+      for (Position p = 0; p < length; p += block_frames) {
+        auto n = std::min(block_frames, length - p);
+        wav.read_samples(block.data(), n * channels);
+        std::fill(block.begin() + n * channels, block.end(), 0.f);
+        // Silence is left out, so it takes no room
+        if (std::all_of(block.begin(), block.end(), [](float f) { return f == 0.f; })) continue;
+        if (encoding_ == Encoding::lossless) {
+          write_block(p, block.data());
+        } else {
+          write_frames(p, block.data(), n);
+        }
+      }
+      // Not closed, as that writes the header back. The destructor of ByteFile
+      // only closes the stream.
+    } catch (util::exception&) {
+      throw;
+    } catch (std::exception& e) {
+      throw util::exception("Could not import {}: {}", path.c_str(), e.what());
+    } catch (const char* e) {
+      throw util::exception("Could not import {}: {}", path.c_str(), e);
+    }
+  }
+
+  void TapeFile::read_at(std::int64_t offset, void* data, std::size_t length)
+  {
+    auto* dst = static_cast<char*>(data);
+    while (length > 0) {
+      auto n = ::pread(fd_, dst, length, offset);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) throw util::exception("Could not read the tape file: {}", std::strerror(errno));
+      if (n == 0) {
+        // Past the end of the file
+        std::memset(dst, 0, length);
+        return;
+      }
+      dst += n;
+      offset += n;
+      length -= n;
+    }
+  }
+
+  void TapeFile::write_at(std::int64_t offset, const void* data, std::size_t length)
+  {
+    auto* src = static_cast<const char*>(data);
+    while (length > 0) {
+      auto n = ::pwrite(fd_, src, length, offset);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) throw util::exception("Could not write the tape file: {}", std::strerror(errno));
+      src += n;
+      offset += n;
+      length -= n;
+    }
+  }
+
+  namespace {
+    using Chunk = ByteFile::Chunk;
+
+    /// The slices of a track of a [LegacyTapeFile]()
+    struct TRCKChunk : Chunk {
+      uint16_t index = 0;
+      TRCKChunk(uint16_t idx) : Chunk("TRCK"), index(idx) {}
+      TRCKChunk(const Chunk& c) : Chunk(c) {}
+
+      void write_fields(ByteFile& f) override
+      {
+        auto& tf = dynamic_cast<LegacyTapeFile&>(f);
+        f.write_bytes(bytes<2>::from_u(index));
+        f.write_bytes(bytes<2>::from_u(tf.slices[index].count));
+        f.write_bytes((std::byte*) tf.slices[index].array.data(),
+                      sizeof(tf.slices[index].array));
+      }
+
+      void read_fields(ByteFile& f) override
+      {
+        auto& tf = dynamic_cast<LegacyTapeFile&>(f);
+        bytes<2> temp;
+        f.read_bytes(temp).unwrap_ok();
+        index = temp.as_u();
+        if (index >= tf.slices.size()) throw util::exception("Track {} of the tape", index);
+        f.read_bytes(temp).unwrap_ok();
+        tf.slices[index].count = temp.as_u();
+        f.read_bytes((std::byte*) tf.slices[index].array.data(), sizeof(tf.slices[index].array))
+          .unwrap_ok();
+      }
+    };
+
+    /// The slices of a [LegacyTapeFile]()
+    struct TAPEChunk : Chunk {
+      TAPEChunk(const Chunk& c) : Chunk(c) {}
+      TAPEChunk() : Chunk("TAPE") {}
+      bytes<4> version = {1, 0, 0, 0};
+
+      TRCKChunk tracks[4] = {{0}, {1}, {2}, {3}};
+
+      void write_fields(ByteFile& f) override
+      {
+        f.write_bytes(version);
+        for (auto&& trck : tracks) {
+          trck.write(f);
+        }
+      }
+
+      void read_fields(ByteFile& f) override
+      {
+        f.read_bytes(version).unwrap_ok();
+        for (auto&& trck : tracks) {
+          trck.read(f);
+        }
+      }
+    };
+  } // namespace
+
+  void LegacyTapeFile::add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v)
+  {
     v.push_back(std::make_unique<TAPEChunk>());
   }
-  void TapeFile::replace_custom_chunk(std::unique_ptr<Chunk>& ptr) {
+
+  void LegacyTapeFile::replace_custom_chunk(std::unique_ptr<Chunk>& ptr)
+  {
     if (ptr->id == "TAPE") ptr = std::make_unique<TAPEChunk>(*ptr);
   }
-}
+
+} // namespace otto::util
@@ -1,14 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "util/filesystem.hpp"
+#include "util/exception.hpp"
 #include "util/soundfile.hpp"
+#include "util/tape_codec.hpp"
 
 namespace otto::util {
 
-  class TapeFile : public SoundFile {
+  /// The file the tapedeck records to
+  ///
+  /// The tape is 4 channels of float audio, stored in chunks of
+  /// [chunk_frames]() frames. A chunk only gets room in the file the first time
+  /// it is written, so the parts of the tape that were never recorded take no
+  /// disk space, and read back as silence without any I/O.
+  ///
+  /// The file starts with a header, an index of where each chunk is stored,
+  /// and the slices. The chunks follow, in the order they were first written.
+  ///
+  /// A file can be [Encoding::lossless](), in which case each block of
+  /// [block_frames]() frames is compressed by a [TapeCodec](), and stored in a
+  /// slot of its own. The slots are large enough for any block, so each block
+  /// can be found and rewritten without moving the others, and only the
+  /// encoded bytes are read and written. The size of each block is stored in a
+  /// table after the slices.
+  class TapeFile {
   public:
-    using SoundFile::Info;
+    /// A frame count from the start of the tape
+    using Position = std::int64_t;
+
+    /// How the audio is stored
+    enum struct Encoding : std::uint32_t {
+      /// Interleaved floats
+      raw = 0,
+      /// Blocks compressed by a [TapeCodec]()
+      lossless = 1,
+    };
 
     struct SliceData {
-      uint32_t in = 0;
-      uint32_t out = 0;
+      std::int64_t in = 0;
+      std::int64_t out = 0;
     };
 
     struct SliceArray {
@@ -18,18 +54,218 @@ namespace otto::util {
 
     std::array<SliceArray, 4> slices;
 
-    TapeFile()
+    static constexpr int channels = 4;
+    static constexpr std::size_t frame_bytes = channels * sizeof(float);
+    /// The frames in a chunk. A power of two.
+    static constexpr Position chunk_frames = 1 << 16;
+    static constexpr std::size_t max_chunks = 1 << 16;
+    /// The length of the longest tape. Over 24 hours at 48 kHz.
+    static constexpr Position max_frames = chunk_frames * max_chunks;
+    /// The frames in a block of a lossless file
+    static constexpr Position block_frames = TapeCodec::block_frames;
+    static_assert(chunk_frames % block_frames == 0);
+    /// The room for each block of a lossless file. Whole pages.
+    static constexpr std::size_t block_slot = (TapeCodec::max_encoded_size + 4095) / 4096 * 4096;
+
+    TapeFile() = default;
+    ~TapeFile();
+
+    TapeFile(const TapeFile&) = delete;
+    TapeFile& operator=(const TapeFile&) = delete;
+
+    /// Open the file at `path`, creating it if it does not exist
+    ///
+    /// A new file is created with `encoding`. An existing file keeps the
+    /// encoding it was created with.
+    ///
+    /// \throws [util::exception]() if it could not be opened, or is not a tape
+    /// file
+    void open(const filesystem::path& path, Encoding encoding = Encoding::raw);
+    /// Write the slices, and close the file
+    void close();
+
+    bool is_open() const noexcept
     {
-      info.channels = 4;
+      return fd_ >= 0;
     }
 
-    virtual ~TapeFile() = default;
+    Encoding encoding() const noexcept
+    {
+      return encoding_;
+    }
 
-  protected:
+    /// The bytes of a chunk in the file
+    std::size_t chunk_bytes() const noexcept
+    {
+      if (encoding_ == Encoding::lossless) return chunk_frames / block_frames * block_slot;
+      return chunk_frames * frame_bytes;
+    }
+
+    /// The byte offset of frame `position` in a raw file, or `-1` if its chunk
+    /// was never written
+    std::int64_t offset(Position position) const noexcept
+    {
+      auto chunk = index_[position / chunk_frames];
+      if (chunk == 0) return -1;
+      return chunk + (position % chunk_frames) * Position(frame_bytes);
+    }
+
+    /// The byte offset of frame `position` in a raw file, giving its chunk
+    /// room first if needed
+    ///
+    /// \throws [util::exception]() if the file could not be grown
+    std::int64_t allocate(Position position);
 
+    /// The byte offset of the slot of the block `position` is in, in a
+    /// lossless file, or `-1` if its chunk was never written
+    std::int64_t block_offset(Position position) const noexcept
+    {
+      auto chunk = index_[position / chunk_frames];
+      if (chunk == 0) return -1;
+      return chunk + (position % chunk_frames) / block_frames * Position(block_slot);
+    }
+
+    /// The encoded size of the block `position` is in, in a lossless file.
+    /// `0` if it was never written, and is silent.
+    std::size_t block_size(Position position) const noexcept
+    {
+      return block_sizes_[position / block_frames];
+    }
+
+    /// The byte offset of the slot of the block `position` is in, in a
+    /// lossless file, giving its chunk room first if needed
+    ///
+    /// \throws [util::exception]() if the file could not be grown
+    std::int64_t allocate_block(Position position);
+
+    /// Store the size of the block `position` is in, once `size` encoded
+    /// bytes are written to its slot
+    ///
+    /// \throws [util::exception]() if the size could not be written
+    void block_written(Position position, std::size_t size);
+
+    /// The size of the file with every chunk allocated. What to map to
+    /// access the whole tape.
+    std::uint64_t capacity() const noexcept
+    {
+      return data_offset_ + std::uint64_t(max_chunks) * chunk_bytes();
+    }
+
+    /// The size of the file
+    std::int64_t size() const noexcept
+    {
+      return size_;
+    }
+
+    /// Call `f(position, n)` for each part of the `n` frames from `position`
+    /// that lies in a single chunk
+    template<typename F>
+    static void for_each_chunk(Position position, Position n, F&& f)
+    {
+      for (Position end = position + n; position < end;) {
+        Position m = std::min(end - position, chunk_frames - position % chunk_frames);
+        f(position, m);
+        position += m;
+      }
+    }
+
+    /// Call `f(position, n)` for each part of the `n` frames from `position`
+    /// that lies in a single block
+    template<typename F>
+    static void for_each_block(Position position, Position n, F&& f)
+    {
+      for (Position end = position + n; position < end;) {
+        Position m = std::min(end - position, block_frames - position % block_frames);
+        f(position, m);
+        position += m;
+      }
+    }
+
+    /// Read `n` frames from `position` into `dst`, blocking
+    void read_frames(Position position, float* dst, Position n);
+    /// Write `n` frames from `src` to `position`, blocking
+    void write_frames(Position position, const float* src, Position n);
+
+    /// Read and decode the block `position` is in, to `dst`, blocking
+    ///
+    /// A corrupt block is logged, and read as silence.
+    void read_block(Position position, float* dst);
+    /// Encode `src` to the block `position` is in, and write it, blocking
+    void write_block(Position position, const float* src);
+
+    /// Copy the audio and slices of a [LegacyTapeFile]() into this file
+    ///
+    /// Blocks of silence are skipped, so they take no room. The WAV file is
+    /// left as it is.
+    ///
+    /// \throws [util::exception]() if it could not be read, or this file
+    /// could not be written
+    void import_wav(const filesystem::path& path);
+
+  private:
+    static constexpr std::size_t header_size = 4096;
+    static constexpr std::size_t index_offset = header_size;
+    static constexpr std::size_t slices_offset = index_offset + max_chunks * sizeof(std::int64_t);
+    static constexpr std::size_t track_slices_size = 8 + 2048 * sizeof(SliceData);
+    /// The size of each block of a lossless file, after the slices
+    static constexpr std::size_t block_table_offset = slices_offset + 4 * track_slices_size;
+    static constexpr std::size_t max_blocks = max_frames / block_frames;
+
+    /// The chunks are aligned to pages, after the tables
+    static constexpr std::size_t page_aligned(std::size_t offset)
+    {
+      return (offset + header_size - 1) / header_size * header_size;
+    }
+
+    /// The byte offset of the chunk `position` is in, giving it room first if
+    /// needed
+    std::int64_t allocate_chunk(Position position);
+
+    void read_at(std::int64_t offset, void* data, std::size_t length);
+    void write_at(std::int64_t offset, const void* data, std::size_t length);
+
+    int fd_ = -1;
+    std::int64_t size_ = 0;
+    Encoding encoding_ = Encoding::raw;
+    std::size_t data_offset_ = page_aligned(block_table_offset);
+    /// The byte offset of each chunk, or 0 if it was never written
+    std::vector<std::int64_t> index_;
+
+    /// The encoded size of each block, in a lossless file
+    std::vector<std::uint32_t> block_sizes_;
+    TapeCodec codec_;
+    /// A decoded block, for the frames that only fill part of one
+    std::vector<float> block_;
+    /// An encoded block
+    std::vector<std::byte> encoded_;
+  };
+
+  /// The WAV file the tape was stored in before [TapeFile]()
+  ///
+  /// Positions are 32 bit, and the slices are stored in a `TAPE` chunk. Only
+  /// used to import it with [TapeFile::import_wav]().
+  class LegacyTapeFile : public SoundFile {
+  public:
+    struct SliceData {
+      std::uint32_t in = 0;
+      std::uint32_t out = 0;
+    };
+
+    struct SliceArray {
+      std::array<SliceData, 2048> array;
+      uint16_t count = 0;
+    };
+
+    std::array<SliceArray, 4> slices;
+
+    LegacyTapeFile()
+    {
+      info.channels = TapeFile::channels;
+    }
+
+  protected:
     void add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v) override;
     void replace_custom_chunk(std::unique_ptr<Chunk>& ptr) override;
-
   };
 
-}
+} // namespace otto::util
@@ -0,0 +1,268 @@
+#include "util/uring_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "services/logger.hpp"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// IORING_OP_READ and IORING_OP_WRITE came with the same kernel as this flag
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(SYS_io_uring_setup)
+#define OTTO_HAS_URING 1
+#else
+#define OTTO_HAS_URING 0
+#endif
+
+namespace otto::util {
+
+  /*
+   * LatencyHistogram
+   */
+
+  void LatencyHistogram::add(std::chrono::microseconds latency) noexcept
+  {
+    int bucket = 0;
+    for (auto us = latency.count(); us > 1 && bucket < buckets - 1; us >>= 1) bucket++;
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t LatencyHistogram::total() const noexcept
+  {
+    std::uint64_t sum = 0;
+    for (auto& c : counts_) sum += c.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+  std::int64_t LatencyHistogram::percentile(float p) const noexcept
+  {
+    if (total() == 0) return 0;
+    auto target = std::uint64_t(p * total());
+    std::uint64_t sum = 0;
+    for (int i = 0; i < buckets; i++) {
+      sum += count(i);
+      if (sum > target || sum == total()) return std::int64_t(1) << (i + 1);
+    }
+    return 0;
+  }
+
+  /*
+   * UringFile
+   */
+
+  bool UringFile::supported() noexcept
+  {
+    return OTTO_HAS_URING;
+  }
+
+#if OTTO_HAS_URING
+
+  namespace {
+    template<typename T>
+    T* at(void* base, unsigned offset) noexcept
+    {
+      return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    unsigned load_acquire(const unsigned* p) noexcept
+    {
+      return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    void store_release(unsigned* p, unsigned v) noexcept
+    {
+      __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+  } // namespace
+
+  UringFile::UringFile(const filesystem::path& path, unsigned depth) : depth_(depth)
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd_ = syscall(SYS_io_uring_setup, depth, &params);
+    if (ring_fd_ < 0) {
+      throw util::exception("io_uring is not available: {}", std::strerror(errno));
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto map = [&](std::size_t size, off_t offset) {
+      void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                       offset);
+      if (p == MAP_FAILED) {
+        auto err = errno;
+        release();
+        throw util::exception("Could not map the io_uring: {}", std::strerror(err));
+      }
+      return p;
+    };
+    sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_    = map(sqes_size_, IORING_OFF_SQES);
+
+    sq_head_  = at<unsigned>(sq_ring_, params.sq_off.head);
+    sq_tail_  = at<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_  = at<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, params.sq_off.array);
+    cq_head_  = at<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_  = at<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_  = at<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_     = at<void>(cq_ring_, params.cq_off.cqes);
+
+    requests_.resize(depth_);
+    for (unsigned i = depth_; i > 0; i--) free_requests_.push_back(i - 1);
+
+    file_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file_fd_ < 0) {
+      auto err = errno;
+      release();
+      throw util::exception("Could not open {}: {}", path.c_str(), std::strerror(err));
+    }
+
+    // Kernels with io_uring, but without IORING_OP_READ, reject it
+    char byte;
+    read(0, &byte, 0, 0);
+    int result = 0;
+    try {
+      reap(1, [&](const Completion& c) { result = c.result; });
+    } catch (util::exception&) {
+      release();
+      throw;
+    }
+    if (result == -EINVAL) {
+      release();
+      throw util::exception("io_uring does not support IORING_OP_READ");
+    }
+  }
+
+  UringFile::~UringFile()
+  {
+    // Wait for the requests in flight, so their buffers are not written
+    // after they are freed
+    try {
+      while (in_flight_ > 0) reap(1, [](auto&&) {});
+    } catch (util::exception& e) {
+      LOGE("{}", e.what());
+    }
+    release();
+  }
+
+  void UringFile::release() noexcept
+  {
+    if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr) ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0) ::close(ring_fd_);
+    if (file_fd_ >= 0) ::close(file_fd_);
+    sqes_ = cq_ring_ = sq_ring_ = nullptr;
+    ring_fd_ = file_fd_ = -1;
+  }
+
+  bool UringFile::queue(Op op,
+                        std::size_t offset,
+                        void* data,
+                        std::size_t length,
+                        std::uint64_t tag) noexcept
+  {
+    if (free_requests_.empty()) return false;
+    unsigned id = free_requests_.back();
+    free_requests_.pop_back();
+    requests_[id] = {op, tag, std::chrono::steady_clock::now()};
+
+    unsigned tail  = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    auto& sqe      = static_cast<io_uring_sqe*>(sqes_)[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode    = op == Op::read ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe.fd        = file_fd_;
+    sqe.off       = offset;
+    sqe.addr      = reinterpret_cast<std::uint64_t>(data);
+    sqe.len       = length;
+    sqe.user_data = id;
+    sq_array_[index] = index;
+    store_release(sq_tail_, tail + 1);
+
+    to_submit_++;
+    in_flight_++;
+    return true;
+  }
+
+  void UringFile::enter(int min)
+  {
+    min = std::min(min, in_flight_);
+    if (to_submit_ == 0 && min == 0) return;
+    int rc = syscall(SYS_io_uring_enter, ring_fd_, to_submit_, min,
+                     min > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (rc >= 0) {
+      to_submit_ -= rc;
+    } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      throw util::exception("io_uring_enter failed: {}", std::strerror(errno));
+    }
+  }
+
+  bool UringFile::pop_completion(Completion& c) noexcept
+  {
+    unsigned head = *cq_head_;
+    if (head == load_acquire(cq_tail_)) return false;
+    auto& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+    auto& req = requests_[cqe.user_data];
+    c         = {req.op, req.tag, cqe.res};
+    auto latency = std::chrono::steady_clock::now() - req.submitted;
+    (req.op == Op::read ? read_latency_ : write_latency_)
+      .add(std::chrono::duration_cast<std::chrono::microseconds>(latency));
+    free_requests_.push_back(cqe.user_data);
+    in_flight_--;
+    store_release(cq_head_, head + 1);
+    return true;
+  }
+
+#else
+
+  UringFile::UringFile(const filesystem::path&, unsigned)
+  {
+    throw util::exception("io_uring support was not compiled in");
+  }
+
+  UringFile::~UringFile() {}
+
+  void UringFile::release() noexcept {}
+
+  bool UringFile::queue(Op, std::size_t, void*, std::size_t, std::uint64_t) noexcept
+  {
+    return false;
+  }
+
+  void UringFile::enter(int) {}
+
+  bool UringFile::pop_completion(Completion&) noexcept
+  {
+    return false;
+  }
+
+#endif
+
+  bool UringFile::read(std::size_t offset, void* data, std::size_t length, std::uint64_t tag) noexcept
+  {
+    return queue(Op::read, offset, data, length, tag);
+  }
+
+  bool UringFile::write(std::size_t offset,
+                        const void* data,
+                        std::size_t length,
+                        std::uint64_t tag) noexcept
+  {
+    return queue(Op::write, offset, const_cast<void*>(data), length, tag);
+  }
+
+} // namespace otto::util
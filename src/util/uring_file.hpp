@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "util/filesystem.hpp"
+#include "util/exception.hpp"
+
+namespace otto::util {
+
+  /// Counts of latencies, in power of two buckets
+  struct LatencyHistogram {
+    /// Bucket `i` counts latencies in `[2^i, 2^(i+1))` microseconds. The last
+    /// bucket counts everything longer.
+    static constexpr int buckets = 20;
+
+    void add(std::chrono::microseconds latency) noexcept;
+
+    std::uint64_t count(int bucket) const noexcept
+    {
+      return counts_[bucket].load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t total() const noexcept;
+
+    /// The upper bound of the bucket containing the `p`th percentile, in
+    /// microseconds. `p` is in `[0, 1]`. Zero if nothing was counted.
+    std::int64_t percentile(float p) const noexcept;
+
+  private:
+    std::array<std::atomic<std::uint64_t>, buckets> counts_ = {};
+  };
+
+  /// Reads and writes a file asynchronously, through io_uring
+  ///
+  /// Requests are queued with [read]() and [write](), and handed to the kernel
+  /// together by [reap](), which also collects the finished ones. Any number of
+  /// requests, up to the queue depth, are in flight at once, so one slow
+  /// request does not hold up the others.
+  ///
+  /// Only one thread may use a `UringFile`.
+  class UringFile {
+  public:
+    enum struct Op { read, write };
+
+    struct Completion {
+      Op op;
+      /// The tag given when the request was queued
+      std::uint64_t tag;
+      /// The number of bytes transferred, or a negative `errno`
+      int result;
+    };
+
+    /// Open the file at `path`, and set up a ring with room for `depth`
+    /// requests
+    ///
+    /// \throws [util::exception]() if the file could not be opened, or if
+    /// io_uring is not available, in which case the caller should use
+    /// blocking I/O instead.
+    UringFile(const filesystem::path& path, unsigned depth = 32);
+    ~UringFile();
+
+    UringFile(const UringFile&) = delete;
+    UringFile& operator=(const UringFile&) = delete;
+
+    /// Whether io_uring support was compiled in
+    static bool supported() noexcept;
+
+    /// Queue a read of `length` bytes at `offset` into `data`
+    ///
+    /// \returns `false` if the queue is full. [reap]() some requests first.
+    bool read(std::size_t offset, void* data, std::size_t length, std::uint64_t tag) noexcept;
+
+    /// Queue a write of `length` bytes from `data` to `offset`
+    ///
+    /// \returns `false` if the queue is full. [reap]() some requests first.
+    bool write(std::size_t offset, const void* data, std::size_t length, std::uint64_t tag) noexcept;
+
+    /// Submit the queued requests, and wait for at least `min` of the
+    /// requests in flight to finish
+    ///
+    /// \param on_complete Called with the [Completion]() of each finished request
+    /// \returns The number of requests that finished
+    template<typename F>
+    int reap(int min, F&& on_complete)
+    {
+      enter(min);
+      Completion c;
+      int n = 0;
+      while (pop_completion(c)) {
+        on_complete(c);
+        n++;
+      }
+      return n;
+    }
+
+    /// The number of requests queued or in flight
+    int in_flight() const noexcept
+    {
+      return in_flight_;
+    }
+
+    const LatencyHistogram& latency(Op op) const noexcept
+    {
+      return op == Op::read ? read_latency_ : write_latency_;
+    }
+
+  private:
+    struct Request {
+      Op op;
+      std::uint64_t tag;
+      std::chrono::steady_clock::time_point submitted;
+    };
+
+    bool queue(Op op, std::size_t offset, void* data, std::size_t length, std::uint64_t tag) noexcept;
+    void enter(int min);
+    /// Unmap the rings, and close the files
+    void release() noexcept;
+    bool pop_completion(Completion& c) noexcept;
+
+    int file_fd_ = -1;
+    int ring_fd_ = -1;
+    unsigned depth_ = 0;
+    int in_flight_ = 0;
+    unsigned to_submit_ = 0;
+
+    /// The mapped submission and completion rings
+    void* sq_ring_ = nullptr;
+    std::size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    std::size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    void* cqes_ = nullptr;
+
+    std::vector<Request> requests_;
+    std::vector<unsigned> free_requests_;
+
+    LatencyHistogram read_latency_;
+    LatencyHistogram write_latency_;
+  };
+
+} // namespace otto::util
@@ -0,0 +1,48 @@
+#include "wakeup.hpp"
+
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace otto::util {
+
+  bool wakeup::notify() noexcept
+  {
+    int previous = state_.exchange(pending, std::memory_order_release);
+#ifdef __linux__
+    if (previous == sleeping) {
+      syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAKE_PRIVATE, 1, nullptr,
+              nullptr, 0);
+    }
+#endif
+    return previous != pending;
+  }
+
+  bool wakeup::wait_for(std::chrono::microseconds timeout) noexcept
+  {
+    int expected = idle;
+    // If a notification is pending, the state is not idle, and this returns
+    // without sleeping
+    if (state_.compare_exchange_strong(expected, sleeping, std::memory_order_acquire)) {
+#ifdef __linux__
+      auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      timespec ts = {time_t(secs.count()), long((timeout - secs).count() * 1000)};
+      // Returns at once if a notification came after the state was set
+      syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAIT_PRIVATE, int(sleeping), &ts,
+              nullptr, 0);
+#else
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (state_.load(std::memory_order_acquire) == sleeping &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+#endif
+    }
+    return state_.exchange(idle, std::memory_order_acquire) == pending;
+  }
+
+} // namespace otto::util
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+namespace otto::util {
+
+  /// Wakes a single waiting thread, from any thread, without locking
+  ///
+  /// Notifications coalesce: any number of [notify]() calls before the waiter
+  /// gets to run wake it once. Notifying takes no lock, and only makes a
+  /// system call if the waiter is actually asleep, so it is safe to call from
+  /// the audio thread every block.
+  ///
+  /// On Linux, the waiter sleeps on a futex. Elsewhere, it polls.
+  struct wakeup {
+    /// Wake the waiter, or make its next [wait_for]() return immediately
+    ///
+    /// \returns `false` if a notification was already pending, so this one
+    /// was coalesced with it
+    bool notify() noexcept;
+
+    /// Sleep until notified, or until `timeout` has passed
+    ///
+    /// Only one thread may wait at a time.
+    /// \returns `true` if woken by a notification, `false` on timeout
+    bool wait_for(std::chrono::microseconds timeout) noexcept;
+
+  private:
+    enum State : int { idle, pending, sleeping };
+    std::atomic<int> state_{idle};
+  };
+
+} // namespace otto::util
@@ -0,0 +1,78 @@
+#include "testing.t.hpp"
+
+#include <cstdint>
+
+#include "core/audio/buffer_arena.hpp"
+#include "core/audio/processor.hpp"
+
+namespace otto::core::audio {
+
+  TEST_CASE("BufferArena", "[audio]") {
+
+    BufferArena arena;
+
+    SECTION("Claimed memory is aligned and zeroed") {
+      auto* a = static_cast<float*>(arena.claim(100 * sizeof(float)));
+      auto* b = static_cast<float*>(arena.claim(3));
+      REQUIRE(reinterpret_cast<std::uintptr_t>(a) % BufferArena::alignment == 0);
+      REQUIRE(reinterpret_cast<std::uintptr_t>(b) % BufferArena::alignment == 0);
+      REQUIRE(std::all_of(a, a + 100, [](float f) { return f == 0; }));
+      REQUIRE(arena.claimed() == 448 + 64);
+    }
+
+    SECTION("Released memory is reused") {
+      auto* a = arena.claim(1000);
+      auto* b = arena.claim(1000);
+      std::fill_n(static_cast<char*>(a), 1000, 1);
+      arena.release(a, 1000);
+      arena.release(b, 1000);
+      REQUIRE(arena.claimed() == 0);
+      // The two ranges are merged again
+      auto* c = arena.claim(2000);
+      REQUIRE(c == a);
+      REQUIRE(static_cast<char*>(c)[0] == 0);
+    }
+
+    SECTION("Claims larger than a chunk get their own") {
+      auto* a = arena.claim(BufferArena::chunk_size * 2);
+      auto* b = arena.claim(64);
+      REQUIRE(a != nullptr);
+      REQUIRE(b != nullptr);
+      arena.release(a, BufferArena::chunk_size * 2);
+      REQUIRE(arena.claimed() == 64);
+    }
+
+    SECTION("The block size is clamped") {
+      arena.block_size(256);
+      REQUIRE(arena.block_size() == 256);
+      arena.block_size(max_block_size * 2);
+      REQUIRE(arena.block_size() == max_block_size);
+    }
+  }
+
+  TEST_CASE("RTBuffer::clear", "[audio]") {
+    auto old_size = buffer_arena().block_size();
+    buffer_arena().block_size(64);
+
+    SECTION("Only the current block is cleared") {
+      RTBuffer<float, 2> buf;
+      std::fill_n(buf.data(), buf.capacity, 1.f);
+      buf.clear();
+      REQUIRE(std::all_of(buf.begin(), buf.end(), [](float f) { return f == 0; }));
+      REQUIRE(buf[128] == 1.f);
+    }
+
+    SECTION("Planar buffers clear the block of each channel") {
+      PlanarBuffer<2> buf;
+      std::fill_n(buf.data(), buf.capacity, 1.f);
+      buf.clear();
+      for (int c = 0; c < 2; c++) {
+        REQUIRE(std::all_of(buf.channel(c), buf.channel(c) + 64, [](float f) { return f == 0; }));
+        REQUIRE(buf.channel(c)[64] == 1.f);
+      }
+    }
+
+    buffer_arena().block_size(old_size);
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,48 @@
+#include "testing.t.hpp"
+
+#include "core/audio/drift_monitor.hpp"
+
+namespace otto::core::audio {
+
+  TEST_CASE("DriftMonitor", "[audio]") {
+
+    DriftMonitor monitor;
+
+    SECTION("Jitter is not corrected") {
+      for (int i = 0; i < 10000; i++) {
+        REQUIRE(monitor.update(512 + (i % 3) - 1) == 0);
+      }
+      REQUIRE(monitor.delay() == Approx(512).margin(0.5));
+    }
+
+    SECTION("Slow drift is corrected a frame at a time") {
+      // The capture clock runs 100 ppm fast, and the input is skipped as
+      // the driver is told to
+      double skipped = 0;
+      int skips      = 0;
+      for (int i = 0; i < 100000; i++) {
+        double delay = 512 + i * 256 * 1e-4 - skipped;
+        int res      = monitor.update(long(delay));
+        REQUIRE(res >= 0);
+        skipped += res;
+        skips += res;
+      }
+      // 2560 frames of drift in total
+      REQUIRE(skips == Approx(2560).margin(10));
+      REQUIRE(monitor.corrections() == skips);
+    }
+
+    SECTION("A slow capture clock repeats frames") {
+      int res = 0;
+      for (int i = 0; i < 2000 && res == 0; i++) res = monitor.update(i == 0 ? 512 : 500);
+      REQUIRE(res == -1);
+    }
+
+    SECTION("Reset starts a new baseline") {
+      monitor.update(512);
+      monitor.reset();
+      for (int i = 0; i < 1000; i++) REQUIRE(monitor.update(1024) == 0);
+    }
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,71 @@
+#include "testing.t.hpp"
+
+#include "core/audio/dsp_profiler.hpp"
+
+namespace otto::core::audio {
+
+  using namespace std::chrono_literals;
+
+  TEST_CASE("DspProfiler", "[audio] [profiler]") {
+
+    DspProfiler profiler;
+    int synth = profiler.slot("Synth");
+    int mixer = profiler.slot("Mixer");
+
+    SECTION("Slots are looked up by name") {
+      REQUIRE(synth != mixer);
+      REQUIRE(profiler.slot("Synth") == synth);
+    }
+
+    SECTION("Statistics over the recorded blocks") {
+      for (int i = 1; i <= 100; i++) {
+        profiler.record(synth, std::chrono::microseconds(i));
+        profiler.record(mixer, 10us);
+        // 64 frames at 64 kHz is a deadline of 1 ms
+        profiler.end_block(500us, 64, 64000);
+      }
+      auto report = profiler.report();
+      REQUIRE(report.blocks == 100);
+      REQUIRE(report.xruns == 0);
+      REQUIRE(report.load.p50 == Approx(50));
+      REQUIRE(report.nodes.size() == 2);
+      REQUIRE(report.nodes[0].first == "Synth");
+      REQUIRE(report.nodes[0].second.p50 == Approx(50));
+      REQUIRE(report.nodes[0].second.p99 == Approx(99));
+      REQUIRE(report.nodes[0].second.max == Approx(100));
+      REQUIRE(report.nodes[1].second.max == Approx(10));
+    }
+
+    SECTION("Blocks over the deadline are logged with the slowest node") {
+      profiler.record(synth, 100us);
+      profiler.record(mixer, 10us);
+      profiler.end_block(500us, 64, 64000);
+
+      profiler.record(synth, 100us);
+      profiler.record(mixer, 1200us);
+      profiler.end_block(1300us, 64, 64000);
+
+      auto report = profiler.report();
+      REQUIRE(report.xruns == 1);
+      REQUIRE(report.xrun_log.size() == 1);
+      REQUIRE(report.xrun_log[0].block == 1);
+      REQUIRE(report.xrun_log[0].node == "Mixer");
+      REQUIRE(report.xrun_log[0].node_time == Approx(1200));
+      REQUIRE(report.xrun_log[0].deadline == Approx(1000));
+    }
+
+    SECTION("Gauges are reported in their own units") {
+      int voices = profiler.gauge("Voices");
+      REQUIRE(profiler.gauge("Voices") == voices);
+      for (int i = 0; i <= 24; i++) {
+        profiler.record_gauge(voices, i);
+      }
+      auto report = profiler.report();
+      REQUIRE(report.gauges.size() == 1);
+      REQUIRE(report.gauges[0].first == "Voices");
+      REQUIRE(report.gauges[0].second.p50 == Approx(12));
+      REQUIRE(report.gauges[0].second.max == Approx(24));
+    }
+  }
+
+} // namespace otto::core::audio
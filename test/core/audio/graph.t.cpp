@@ -0,0 +1,393 @@
+#include "testing.t.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/audio/graph.hpp"
+
+namespace otto::core::audio {
+
+  namespace {
+    constexpr long nframes = 16;
+
+    /// Frame `f` of channel `c` is `100 * c + f`, plus `offset`
+    template<int N>
+    std::vector<std::array<float, N>> ramp(float offset = 0)
+    {
+      std::vector<std::array<float, N>> res(nframes);
+      for (long f = 0; f < nframes; f++) {
+        for (int c = 0; c < N; c++) res[f][c] = offset + 100 * c + f;
+      }
+      return res;
+    }
+
+    template<std::size_t N>
+    ProcessData<N> data_of(std::vector<std::array<float, N>>& buf, bool silent = false)
+    {
+      return {{buf.data(), nframes}, {nullptr, nullptr}, nframes, 0, silent};
+    }
+
+    using Mono = std::vector<std::array<float, 1>>;
+
+    /// Add a node without input, which outputs `value` in every frame
+    ///
+    /// If `output` is not `nullptr`, it is set to the output buffer.
+    NodeId add_constant(ProcessGraph& graph,
+                        std::string name,
+                        float value,
+                        bool silent    = false,
+                        float** output = nullptr)
+    {
+      return graph.add_node<0, 1>(
+        std::move(name),
+        [value, silent, output, buf = Mono(nframes)](ProcessData<0> data) mutable {
+          auto out = data.redirect(buf);
+          for (auto& frm : out) frm[0] = value;
+          out.silent = silent;
+          if (output != nullptr) *output = out.audio.data()->data();
+          return out;
+        });
+    }
+
+    ProcessData<0> midi_block()
+    {
+      return {{nullptr, nullptr}, {nullptr, nullptr}, nframes};
+    }
+  } // namespace
+
+  TEST_CASE("ProcessGraph scheduling", "[audio] [graph]") {
+    ProcessGraph graph;
+
+    SECTION("Nodes run after their sources, and otherwise in the order they were added") {
+      auto out = graph.add_bus<1>("out");
+      auto b   = graph.add_bus<1>("b");
+      auto a   = add_constant(graph, "a", 1);
+      auto c   = add_constant(graph, "c", 2);
+      graph.connect(a, b);
+      graph.connect(b, out);
+      graph.connect(c, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      REQUIRE(compiled->schedule() == std::vector<std::string>{"a", "b", "c", "out"});
+      REQUIRE(compiled->levels() ==
+              std::vector<std::vector<std::string>>{{"a", "c"}, {"b"}, {"out"}});
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(res.audio[0][0] == 3);
+    }
+
+    SECTION("order() runs nodes in order, without routing audio between them") {
+      auto a   = add_constant(graph, "a", 1);
+      auto b   = add_constant(graph, "b", 10);
+      auto out = graph.add_bus<1>("out");
+      graph.connect(a, out);
+      graph.connect(b, out);
+      graph.order(b, a);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      REQUIRE(compiled->schedule() == std::vector<std::string>{"b", "a", "out"});
+      REQUIRE(compiled->levels() == std::vector<std::vector<std::string>>{{"b"}, {"a"}, {"out"}});
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(res.audio[0][0] == 11);
+    }
+
+    SECTION("Cycles are rejected") {
+      auto a = graph.add_bus<1>("a");
+      auto b = graph.add_bus<1>("b");
+      graph.connect(a, b);
+      graph.order(b, a);
+      graph.output(b);
+      try {
+        graph.compile(nframes);
+        FAIL("No exception was thrown");
+      } catch (ProcessGraph::exception& e) {
+        REQUIRE(e.data() == ProcessGraph::ErrorCode::cycle);
+      }
+    }
+
+    SECTION("Edges from nodes without audio output are rejected") {
+      auto a = graph.add_bus<1>("a");
+      auto b = graph.add_node<1, 0>("b", [](ProcessData<1> data) { return data.midi_only(); });
+      REQUIRE_THROWS_AS(graph.connect(b, a), ProcessGraph::exception);
+      REQUIRE_THROWS_AS(graph.connect(a, b, ChannelMap::select(1)), ProcessGraph::exception);
+    }
+  }
+
+  TEST_CASE("ProcessGraph buffers", "[audio] [graph]") {
+    ProcessGraph graph;
+    float* src_out = nullptr;
+    auto src       = add_constant(graph, "src", 1, false, &src_out);
+    float* seen    = nullptr;
+    auto doubler = graph.add_node<1, 1>(
+      "doubler",
+      [&seen](ProcessData<1> data) {
+        seen = data.audio.data()->data();
+        for (auto& frm : data) frm[0] *= 2;
+        return data;
+      },
+      ProcessGraph::Flags::in_place);
+    graph.connect(src, doubler);
+
+    SECTION("An in-place node with the only edge from its source reads the source directly") {
+      graph.output(doubler);
+      auto compiled = graph.compile(nframes);
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(res.audio[0][0] == 2);
+      REQUIRE(seen == src_out);
+    }
+
+    SECTION("An in-place node gets a copy of a source that is read by other nodes too") {
+      auto reader = graph.add_bus<1>("reader");
+      auto out    = graph.add_bus<1>("out");
+      graph.connect(src, reader);
+      graph.connect(doubler, out);
+      graph.connect(reader, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+      REQUIRE(compiled->schedule() == std::vector<std::string>{"src", "doubler", "reader", "out"});
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(seen != src_out);
+      // The reader saw the source before it was doubled
+      REQUIRE(res.audio[0][0] == 3);
+      REQUIRE(res.audio[nframes - 1][0] == 3);
+    }
+
+    SECTION("Several sources are mixed, and summed into a mono input") {
+      auto stereo = graph.add_node<0, 2>(
+        "stereo", [buf = std::vector<std::array<float, 2>>(nframes)](ProcessData<0> data) mutable {
+          auto out = data.redirect(buf);
+          for (auto& frm : out) frm = {10, 100};
+          return out;
+        });
+      auto out = graph.add_bus<1>("out");
+      graph.connect(doubler, out);
+      graph.connect(stereo, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+      auto res = compiled->process<0, 1>(midi_block());
+      for (long f = 0; f < nframes; f++) REQUIRE(res.audio[f][0] == 112);
+    }
+  }
+
+  TEST_CASE("ProcessGraph silence", "[audio] [graph]") {
+    ProcessGraph graph;
+    // Outputs garbage, but marks it silent
+    auto quiet = add_constant(graph, "quiet", 5, true);
+    auto out   = graph.add_bus<1>("out");
+    graph.connect(quiet, out);
+    graph.output(out);
+
+    SECTION("Silent sources are not mixed") {
+      auto loud = add_constant(graph, "loud", 1);
+      graph.connect(loud, out);
+      auto compiled = graph.compile(nframes);
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE_FALSE(res.silent);
+      for (long f = 0; f < nframes; f++) REQUIRE(res.audio[f][0] == 1);
+    }
+
+    SECTION("An input whose sources are all silent is cleared, and marked silent") {
+      auto quieter = add_constant(graph, "quieter", 7, true);
+      graph.connect(quieter, out);
+      auto compiled = graph.compile(nframes);
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(res.silent);
+      for (long f = 0; f < nframes; f++) REQUIRE(res.audio[f][0] == 0);
+    }
+
+    SECTION("Silence is passed on through a direct read") {
+      auto compiled = graph.compile(nframes);
+      auto res = compiled->process<0, 1>(midi_block());
+      REQUIRE(res.silent);
+    }
+
+    SECTION("The external input is silent if the caller says so") {
+      ProcessGraph g;
+      auto in = g.add_input<1>("in");
+      auto o  = g.add_bus<1>("out");
+      g.connect(in, o);
+      g.output(o);
+      auto compiled = g.compile(nframes);
+      Mono buf(nframes);
+      REQUIRE(compiled->process<1, 1>(data_of(buf, true)).silent);
+      REQUIRE_FALSE(compiled->process<1, 1>(data_of(buf, false)).silent);
+    }
+  }
+
+  TEST_CASE("CompiledGraph on a WorkerPool", "[audio] [graph]") {
+    static constexpr int nsources = 6;
+    static constexpr int blocks   = 200;
+    std::array<std::atomic<int>, 2 * nsources + 1> runs = {};
+
+    // Three levels, of `nsources` sources, a node transforming each of them,
+    // and the output they are mixed into
+    auto build = [&] {
+      ProcessGraph graph;
+      auto out = graph.add_node<1, 1>("out", [&runs](ProcessData<1> data) {
+        runs[2 * nsources]++;
+        return data;
+      });
+      for (int i = 0; i < nsources; i++) {
+        auto src = graph.add_node<0, 1>(
+          "src" + std::to_string(i),
+          [i, &runs, buf = Mono(nframes)](ProcessData<0> data) mutable {
+            runs[i]++;
+            auto out = data.redirect(buf);
+            for (long f = 0; f < data.nframes; f++) out.audio[f][0] = std::sin(0.1f * (i + 1) * f);
+            return out;
+          });
+        auto shape = graph.add_node<1, 1>(
+          "shape" + std::to_string(i),
+          [i, &runs, buf = Mono(nframes)](ProcessData<1> data) mutable {
+            runs[nsources + i]++;
+            auto out = data.redirect(buf);
+            for (long f = 0; f < data.nframes; f++) {
+              out.audio[f][0] = data.audio[f][0] * data.audio[f][0] * (i + 1);
+            }
+            return out;
+          });
+        graph.connect(src, shape);
+        graph.connect(shape, out);
+      }
+      graph.output(out);
+      return graph.compile(nframes);
+    };
+
+    auto run = [&](WorkerPool* pool) {
+      for (auto& r : runs) r = 0;
+      auto compiled = build();
+      REQUIRE(compiled->levels().size() == 3);
+      Mono res(nframes);
+      for (int b = 0; b < blocks; b++) {
+        auto out = compiled->process<0, 1>(midi_block(), pool);
+        std::copy(out.begin(), out.end(), res.begin());
+        REQUIRE(compiled->report().parallel_levels == (pool != nullptr ? 2 : 0));
+      }
+      // Every step ran exactly once per block
+      for (auto& r : runs) REQUIRE(r == blocks);
+      return res;
+    };
+
+    auto serial = run(nullptr);
+    WorkerPool pool(3, 0);
+    auto pooled = run(&pool);
+    REQUIRE(pooled == serial);
+  }
+
+  TEST_CASE("GraphSwap", "[audio] [graph]") {
+    GraphSwap swap;
+    // The token is owned by the nodes of the graph, to tell when it is deleted
+    auto compile_with = [](std::shared_ptr<int> token) {
+      ProcessGraph graph;
+      auto node = graph.add_node<0, 0>(
+        "node", [token](ProcessData<0> data) { return data; });
+      graph.output(node);
+      return graph.compile(nframes);
+    };
+    auto first  = std::make_shared<int>(1);
+    auto second = std::make_shared<int>(2);
+
+    REQUIRE(swap.acquire() == nullptr);
+
+    auto graph = compile_with(first);
+    auto* g1   = graph.get();
+    swap.replace(std::move(graph));
+    // Picked up at the start of the next block, and kept after that
+    REQUIRE(swap.acquire() == g1);
+    REQUIRE(swap.acquire() == g1);
+
+    graph    = compile_with(second);
+    auto* g2 = graph.get();
+    swap.replace(std::move(graph));
+    REQUIRE(swap.acquire() == g2);
+    // The first graph is retired, and only deleted by the next replace
+    REQUIRE(first.use_count() == 2);
+
+    SECTION("A graph that was never picked up is deleted when replaced") {
+      auto third = std::make_shared<int>(3);
+      swap.replace(compile_with(third));
+      REQUIRE(first.use_count() == 1);
+      REQUIRE(third.use_count() == 2);
+      auto graph = compile_with(std::make_shared<int>(4));
+      auto* g4   = graph.get();
+      swap.replace(std::move(graph));
+      REQUIRE(third.use_count() == 1);
+      REQUIRE(swap.acquire() == g4);
+      REQUIRE(second.use_count() == 2);
+    }
+  }
+
+  TEST_CASE("ProcessGraph channel mapping into a stereo input", "[audio] [graph]") {
+    ProcessGraph graph;
+
+    SECTION("Automatic 4 -> 2 takes the first two channels") {
+      auto in  = graph.add_input<4>("in");
+      auto out = graph.add_bus<2>("out");
+      graph.connect(in, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      auto buf = ramp<4>();
+      auto res = compiled->process<4, 2>(data_of(buf));
+      for (long f = 0; f < nframes; f++) {
+        REQUIRE(res.audio[f][0] == buf[f][0]);
+        REQUIRE(res.audio[f][1] == buf[f][1]);
+      }
+    }
+
+    SECTION("Automatic 1 -> 2 copies the channel to both sides") {
+      auto in  = graph.add_input<1>("in");
+      auto out = graph.add_bus<2>("out");
+      graph.connect(in, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      auto buf = ramp<1>();
+      auto res = compiled->process<1, 2>(data_of(buf));
+      for (long f = 0; f < nframes; f++) {
+        REQUIRE(res.audio[f][0] == buf[f][0]);
+        REQUIRE(res.audio[f][1] == buf[f][0]);
+      }
+    }
+
+    SECTION("Selecting a channel of 4 routes only that channel") {
+      auto in  = graph.add_input<4>("in");
+      auto out = graph.add_bus<2>("out");
+      graph.connect(in, out, ChannelMap::select(2));
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      auto buf = ramp<4>();
+      auto res = compiled->process<4, 2>(data_of(buf));
+      for (long f = 0; f < nframes; f++) {
+        REQUIRE(res.audio[f][0] == buf[f][2]);
+        REQUIRE(res.audio[f][1] == buf[f][2]);
+      }
+    }
+
+    SECTION("Mapped sources are summed") {
+      auto in    = graph.add_input<4>("in");
+      auto left  = graph.add_bus<4>("left");
+      auto right = graph.add_bus<4>("right");
+      auto out   = graph.add_bus<2>("out");
+      graph.connect(in, left);
+      graph.connect(in, right);
+      graph.connect(left, out, ChannelMap::select(3));
+      graph.connect(right, out);
+      graph.output(out);
+      auto compiled = graph.compile(nframes);
+
+      auto buf = ramp<4>();
+      auto res = compiled->process<4, 2>(data_of(buf));
+      for (long f = 0; f < nframes; f++) {
+        REQUIRE(res.audio[f][0] == buf[f][3] + buf[f][0]);
+        REQUIRE(res.audio[f][1] == buf[f][3] + buf[f][1]);
+      }
+    }
+  }
+
+} // namespace otto::core::audio
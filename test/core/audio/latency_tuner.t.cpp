@@ -0,0 +1,102 @@
+#include "testing.t.hpp"
+
+#include "core/audio/latency_tuner.hpp"
+
+namespace otto::core::audio {
+
+  using Config = LatencyTuner::Config;
+
+  TEST_CASE("LatencyTuner", "[audio]") {
+
+    constexpr int samplerate = 48000;
+    LatencyTuner::Limits limits;
+    limits.min_period_size = 64;
+    limits.max_period_size = 1024;
+    limits.max_periods     = 4;
+    LatencyTuner tuner({128, 2}, limits, samplerate);
+
+    // Process periods for `seconds`, returning the number of changes
+    auto run = [&](float seconds, float load) {
+      int changes = 0;
+      for (float t = 0; t < seconds; t += float(tuner.config().period_size) / samplerate) {
+        changes += tuner.period(load);
+      }
+      return changes;
+    };
+
+    SECTION("The start is clamped to the limits") {
+      LatencyTuner clamped({8, 16}, limits, samplerate);
+      REQUIRE(clamped.config() == Config{64, 4});
+    }
+
+    SECTION("Xruns under a light load add a period") {
+      run(1, 0.2f);
+      REQUIRE_FALSE(tuner.xrun());
+      REQUIRE(tuner.xrun());
+      REQUIRE(tuner.config() == Config{128, 3});
+    }
+
+    SECTION("Xruns under a heavy load double the period") {
+      run(1, 0.9f);
+      REQUIRE_FALSE(tuner.xrun());
+      REQUIRE(tuner.xrun());
+      REQUIRE(tuner.config() == Config{256, 2});
+    }
+
+    SECTION("Rare xruns are tolerated") {
+      run(tuner.settle_time - 1, 0.2f);
+      tuner.settle_time = 1000;
+      run(200, 0.2f);
+      REQUIRE_FALSE(tuner.xrun());
+      REQUIRE(tuner.config() == Config{128, 2});
+    }
+
+    SECTION("The latency is lowered after running without xruns") {
+      LatencyTuner high({256, 3}, limits, samplerate);
+      tuner = high;
+      REQUIRE(run(tuner.settle_time + 1, 0.2f) == 1);
+      REQUIRE(tuner.config() == Config{256, 2});
+      REQUIRE(run(tuner.settle_time + 1, 0.2f) == 1);
+      REQUIRE(tuner.config() == Config{128, 2});
+    }
+
+    SECTION("The period is not halved without headroom") {
+      REQUIRE(run(2 * tuner.settle_time, 0.6f) == 0);
+      REQUIRE(tuner.config() == Config{128, 2});
+    }
+
+    SECTION("Sparse xruns below the target rate change nothing") {
+      // One xrun every 2.5 minutes, below the target of one every 2
+      for (int i = 0; i < 10; i++) {
+        run(150, 0.6f);
+        REQUIRE_FALSE(tuner.xrun());
+      }
+      REQUIRE(tuner.config() == Config{128, 2});
+    }
+
+    SECTION("A latency that had xruns is not returned to") {
+      run(1, 0.2f);
+      tuner.xrun();
+      tuner.xrun();
+      REQUIRE(tuner.config() == Config{128, 3});
+      REQUIRE(run(3 * tuner.settle_time, 0.2f) == 0);
+      REQUIRE(tuner.config() == Config{128, 3});
+    }
+
+    SECTION("Until the failure has been forgotten") {
+      run(1, 0.2f);
+      tuner.xrun();
+      tuner.xrun();
+      // Too much load to halve the period after that
+      REQUIRE(run(tuner.failure_memory - tuner.settle_time, 0.6f) == 0);
+      REQUIRE(run(2 * tuner.settle_time, 0.6f) == 1);
+      REQUIRE(tuner.config() == Config{128, 2});
+    }
+
+    SECTION("Configurations are stored as json") {
+      nlohmann::json j = Config{512, 3};
+      REQUIRE(j.get<Config>() == Config{512, 3});
+    }
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,159 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/audio/midi_parser.hpp"
+
+namespace otto::core::midi {
+
+  using Type = Event::Type;
+
+  static std::vector<Event> parse_all(Parser& parser, std::vector<Event::byte> bytes)
+  {
+    std::vector<Event> res;
+    Event ev;
+    for (auto b : bytes) {
+      if (parser.feed(b, ev)) res.push_back(ev);
+    }
+    return res;
+  }
+
+  TEST_CASE("midi::Parser", "[audio] [midi]") {
+
+    Parser parser;
+
+    SECTION("Channel messages") {
+      auto events = parse_all(parser, {0x91, 60, 100, 0xB2, 7, 127, 0xC3, 5, 0xD4, 80, 0xA5, 61,
+                                       30, 0xE6, 0x00, 0x40, 0x80, 60, 0});
+      REQUIRE(events.size() == 7);
+      REQUIRE(events[0].type == Type::NoteOn);
+      REQUIRE(events[0].channel == 1);
+      REQUIRE(events[0].key() == 60);
+      REQUIRE(events[0].velocity() == 100);
+      REQUIRE(events[1].type == Type::ControlChange);
+      REQUIRE(events[1].controller() == 7);
+      REQUIRE(events[1].value() == 127);
+      REQUIRE(events[2].type == Type::ProgramChange);
+      REQUIRE(events[2].program() == 5);
+      REQUIRE(events[3].type == Type::ChannelAftertouch);
+      REQUIRE(events[3].pressure() == 80);
+      REQUIRE(events[4].type == Type::PolyAftertouch);
+      REQUIRE(events[4].key() == 61);
+      REQUIRE(events[4].pressure() == 30);
+      REQUIRE(events[5].type == Type::PitchBend);
+      REQUIRE(events[5].channel == 6);
+      REQUIRE(events[5].bend() == 0);
+      REQUIRE(events[6].type == Type::NoteOff);
+      REQUIRE(parser.discarded_bytes() == 0);
+    }
+
+    SECTION("Running status, and note ons with zero velocity") {
+      auto events = parse_all(parser, {0x90, 60, 100, 62, 100, 60, 0, 0xE0, 0x7F, 0x7F, 0, 0});
+      REQUIRE(events.size() == 5);
+      REQUIRE(events[1].type == Type::NoteOn);
+      REQUIRE(events[1].key() == 62);
+      REQUIRE(events[2].type == Type::NoteOff);
+      REQUIRE(events[2].key() == 60);
+      REQUIRE(events[3].bend() == 8191);
+      REQUIRE(events[4].bend() == -8192);
+    }
+
+    SECTION("Realtime messages inside other messages") {
+      auto events = parse_all(parser, {0x90, 60, 0xF8, 100, 0xFA, 0xFC});
+      REQUIRE(events.size() == 4);
+      REQUIRE(events[0].type == Type::Clock);
+      REQUIRE(events[1].type == Type::NoteOn);
+      REQUIRE(events[1].velocity() == 100);
+      REQUIRE(events[2].type == Type::Start);
+      REQUIRE(events[3].type == Type::Stop);
+    }
+
+    SECTION("System common messages end the running status") {
+      auto events = parse_all(parser, {0x90, 60, 100, 0xF2, 0x10, 0x01, 60, 100});
+      REQUIRE(events.size() == 2);
+      REQUIRE(events[1].type == Type::SongPosition);
+      REQUIRE(events[1].value14() == 0x90);
+      REQUIRE(parser.discarded_bytes() == 2);
+    }
+
+    SECTION("System exclusive") {
+      auto events = parse_all(parser, {0xF0, 0x7E, 0x01, 0xF8, 0x02, 0xF7});
+      REQUIRE(events.size() == 2);
+      REQUIRE(events[0].type == Type::Clock);
+      REQUIRE(events[1].type == Type::SysEx);
+      std::vector<Event::byte> expected = {0xF0, 0x7E, 0x01, 0x02, 0xF7};
+      REQUIRE(std::vector<Event::byte>(parser.sysex().begin(), parser.sysex().end()) == expected);
+    }
+
+    SECTION("Interrupted and oversized system exclusives are discarded") {
+      auto events = parse_all(parser, {0xF0, 1, 2, 0x90, 60, 100});
+      REQUIRE(events.size() == 1);
+      REQUIRE(events[0].type == Type::NoteOn);
+      REQUIRE(parser.discarded_bytes() == 3);
+
+      std::vector<Event::byte> long_sysex(Parser::max_sysex_size + 10, 0x11);
+      long_sysex.front() = 0xF0;
+      long_sysex.back()  = 0xF7;
+      REQUIRE(parse_all(parser, long_sysex).empty());
+      REQUIRE(parser.discarded_bytes() == 3 + long_sysex.size());
+    }
+
+    SECTION("Messages split across calls") {
+      EventBuffer<> buffer;
+      std::array<Event::byte, 2> first  = {{0x90, 60}};
+      std::array<Event::byte, 4> second = {{100, 0xF0, 0x42, 0xF7}};
+      parser.parse(first, 3, buffer);
+      REQUIRE(buffer.empty());
+      parser.parse(second, 7, buffer);
+      REQUIRE(buffer.size() == 2);
+      REQUIRE(buffer.events()[0].type == Type::NoteOn);
+      REQUIRE(buffer.events()[0].time == 7);
+      REQUIRE(buffer.events()[1].type == Type::SysEx);
+      REQUIRE(buffer.sysex(buffer.events()[1]).size() == 3);
+      REQUIRE(buffer.sysex(buffer.events()[1])[1] == 0x42);
+    }
+  }
+
+  TEST_CASE("midi::EventBuffer", "[audio] [midi]") {
+
+    EventBuffer<4, 8> buffer;
+
+    SECTION("Events that do not fit are counted") {
+      for (int i = 0; i < 6; i++) buffer.push(NoteOnEvent{i});
+      REQUIRE(buffer.size() == 4);
+      REQUIRE(buffer.overflows() == 2);
+      REQUIRE(buffer.events()[3].key() == 3);
+
+      buffer.clear();
+      REQUIRE(buffer.empty());
+      REQUIRE(buffer.overflows() == 2);
+    }
+
+    SECTION("System exclusives share the byte storage") {
+      std::array<Event::byte, 5> msg = {{0xF0, 1, 2, 3, 0xF7}};
+      REQUIRE(buffer.push_sysex(msg, 0));
+      REQUIRE_FALSE(buffer.push_sysex(msg, 1));
+      REQUIRE(buffer.overflows() == 1);
+      REQUIRE(buffer.sysex(buffer.events()[0])[3] == 3);
+    }
+  }
+
+  TEST_CASE("Parsing a dense midi stream", "[.] [benchmark] [midi]") {
+    std::vector<Event::byte> stream;
+    for (int i = 0; i < (1 << 18); i++) {
+      int key = Random::get(24, 100);
+      stream.insert(stream.end(), {0x90, Event::byte(key), 100, Event::byte(key), 0, 0xF8});
+    }
+
+    Parser parser;
+    EventBuffer<1024> buffer;
+    BENCHMARK("Parser::parse")
+    {
+      for (std::size_t i = 0; i < stream.size(); i += 1024) {
+        buffer.clear();
+        parser.parse({stream.data() + i, 1024}, 0, buffer);
+      }
+    }
+  }
+
+} // namespace otto::core::midi
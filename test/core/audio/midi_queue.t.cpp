@@ -0,0 +1,50 @@
+#include "testing.t.hpp"
+
+#include "core/audio/midi_queue.hpp"
+
+namespace otto::core::midi {
+
+  TEST_CASE("midi::EventQueue", "[audio] [midi]") {
+
+    using namespace std::chrono_literals;
+    using clock = EventQueue::clock;
+
+    EventQueue queue;
+    EventBuffer<> buffer;
+    // 100 frames of 1 ms
+    constexpr int nframes    = 100;
+    constexpr int samplerate = 1000;
+
+    SECTION("Events are delivered one block period after they were sent") {
+      auto sent = clock::now();
+      queue.push(NoteOnEvent{60});
+
+      // Not due before the block period has passed
+      queue.pop_block(sent - 10ms, nframes, samplerate, buffer);
+      REQUIRE(buffer.empty());
+
+      queue.pop_block(sent + 50ms, nframes, samplerate, buffer);
+      REQUIRE(buffer.size() == 1);
+      REQUIRE(buffer.events()[0].key() == 60);
+      REQUIRE(buffer.events()[0].time >= 50);
+      REQUIRE(buffer.events()[0].time <= 55);
+    }
+
+    SECTION("Late events go on the first frame") {
+      auto sent = clock::now();
+      queue.push(NoteOnEvent{60});
+      queue.push(NoteOffEvent{60});
+      queue.pop_block(sent + 1s, nframes, samplerate, buffer);
+      REQUIRE(buffer.size() == 2);
+      REQUIRE(buffer.events()[0].time == 0);
+      REQUIRE(buffer.events()[1].type == Event::Type::NoteOff);
+    }
+
+    SECTION("Overflows are counted") {
+      for (std::size_t i = 0; i < EventQueue::capacity; i++) REQUIRE(queue.push(NoteOnEvent{1}));
+      REQUIRE_FALSE(queue.push(NoteOnEvent{1}));
+      REQUIRE(queue.overflows() == 1);
+    }
+  }
+
+} // namespace otto::core::midi
@@ -0,0 +1,84 @@
+#include "testing.t.hpp"
+
+#include <sstream>
+
+#include "core/audio/midi_script.hpp"
+#include "core/globals.hpp"
+
+namespace otto::core::midi {
+
+  using Type = Event::Type;
+
+  static Script parse(const std::string& text)
+  {
+    std::istringstream in{text};
+    return Script::parse(in, "test.midi");
+  }
+
+  TEST_CASE("midi::Script", "[midi]") {
+
+    SECTION("Events, comments and blank lines") {
+      auto script = parse(R"(
+# A comment
+0.0  on  C4 0.5   # Trailing comment
+0.5  off 60
+
+  1.0  cc 7 100
+0.75 on  61
+4.0  end
+)");
+      REQUIRE(script.end == 4.0);
+      REQUIRE(script.events.size() == 4);
+
+      REQUIRE(script.events[0].time == 0.0);
+      REQUIRE(script.events[0].event.type == Type::NoteOn);
+      REQUIRE(script.events[0].event.key() == note_number("C4"));
+      REQUIRE(script.events[0].event.velocity() == 63);
+
+      REQUIRE(script.events[1].event.type == Type::NoteOff);
+      REQUIRE(script.events[1].event.key() == 60);
+      REQUIRE(script.events[1].event.velocity() == 127);
+
+      REQUIRE(script.events[3].event.type == Type::ControlChange);
+      REQUIRE(script.events[3].event.controller() == 7);
+      REQUIRE(script.events[3].event.value() == 100);
+    }
+
+    SECTION("Unsorted lines are sorted by time, keeping the order of equal times") {
+      auto script = parse("2 on 62\n1 on 61\n2 off 62\n0 on 60\n");
+      REQUIRE(script.end < 0);
+      std::vector<double> times;
+      for (auto& e : script.events) times.push_back(e.time);
+      REQUIRE(times == std::vector<double>{0, 1, 2, 2});
+      REQUIRE(script.events[2].event.type == Type::NoteOn);
+      REQUIRE(script.events[3].event.type == Type::NoteOff);
+    }
+
+    SECTION("Malformed lines throw, naming the line") {
+      auto throws = [](const std::string& text) {
+        try {
+          parse(text);
+        } catch (global::exception& e) {
+          REQUIRE(e.data() == global::ErrorCode::audio_error);
+          return std::string(e.what());
+        }
+        FAIL("No exception for '" << text << "'");
+        return std::string();
+      };
+      REQUIRE_THAT(throws("0 on 60\non 60\n"), Catch::Contains("test.midi:2"));
+      REQUIRE_THAT(throws("-1 on 60"), Catch::Contains("Negative time"));
+      REQUIRE_THAT(throws("1"), Catch::Contains("Expected an event"));
+      REQUIRE_THAT(throws("1 on"), Catch::Contains("Expected a key"));
+      REQUIRE_THAT(throws("1 on 128"), Catch::Contains("Expected a key"));
+      REQUIRE_THAT(throws("1 off H4"), Catch::Contains("Expected a key"));
+      REQUIRE_THAT(throws("1 cc 7"), Catch::Contains("Expected a controller"));
+      REQUIRE_THAT(throws("1 cc 7 128"), Catch::Contains("Expected a controller"));
+      REQUIRE_THAT(throws("1 pitch 7"), Catch::Contains("Unknown event 'pitch'"));
+    }
+
+    SECTION("Missing files throw") {
+      REQUIRE_THROWS_AS(Script::read("/nonexistent/script.midi"), global::exception);
+    }
+  }
+
+} // namespace otto::core::midi
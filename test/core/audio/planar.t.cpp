@@ -0,0 +1,91 @@
+#include "testing.t.hpp"
+
+#include "core/audio/processor.hpp"
+
+namespace otto::core::audio {
+
+  TEST_CASE("Planar audio data", "[audio]") {
+
+    ProcessBuffer<2> frames;
+    PlanarBuffer<2> planes;
+    for (int f = 0; f < 64; f++) {
+      frames[f] = {{float(f), float(-f)}};
+    }
+    ProcessData<2> data = {{frames.data(), 64}, {}, 64};
+
+    SECTION("deinterleave and interleave are inverses") {
+      auto planar = redirect_planar(data, planes);
+      deinterleave(data, planar);
+      REQUIRE(planar.audio[0][10] == 10);
+      REQUIRE(planar.audio[1][10] == -10);
+
+      ProcessBuffer<2> out;
+      auto back = data.redirect(out);
+      interleave(planar, back);
+      REQUIRE(std::equal(data.begin(), data.end(), back.begin()));
+    }
+
+    SECTION("Slices keep the offset into planar buffers") {
+      auto slice = redirect_planar(data.slice(16, 8), planes);
+      REQUIRE(slice.offset == 16);
+      REQUIRE(slice.audio[1] == planes.channel(1) + 16);
+      auto sub = redirect_planar(data, planes).slice(16, 8);
+      REQUIRE(sub.audio == slice.audio);
+      REQUIRE(sub.nframes == 8);
+    }
+
+    SECTION("Mono audio is viewed without copying") {
+      ProcessBuffer<1> mono;
+      ProcessData<1> m = {{mono.data(), 32}, {}, 32};
+      auto planar = as_planar(m);
+      planar.audio[0][3] = 5;
+      REQUIRE(mono[3][0] == 5);
+      REQUIRE(as_interleaved(planar).audio.data() == mono.data());
+    }
+  }
+
+  namespace {
+    /// Stands in for a Faust dsp with two channels
+    void compute(long nframes, float** in, float** out)
+    {
+      for (int c = 0; c < 2; c++) {
+        for (long f = 0; f < nframes; f++) {
+          out[c][f] = in[c][f] * 0.5f + in[1 - c][f] * 0.25f;
+        }
+      }
+    }
+  } // namespace
+
+  TEST_CASE("Interleaved vs planar layout", "[.] [benchmark] [audio]") {
+    constexpr int iterations = 10000;
+
+    ProcessBuffer<2> in_frames;
+    ProcessBuffer<2> out_frames;
+    PlanarBuffer<2> in_planes;
+    PlanarBuffer<2> out_planes;
+
+    for (long nframes : {64, 256, 1024}) {
+      ProcessData<2> in = {{in_frames.data(), std::size_t(nframes)}, {}, nframes};
+      ProcessData<2> out = {{out_frames.data(), std::size_t(nframes)}, {}, nframes};
+      auto planar_in  = redirect_planar(in, in_planes);
+      auto planar_out = redirect_planar(in, out_planes);
+
+      BENCHMARK(fmt::format("Interleaved, converted for each block: {} frames", nframes))
+      {
+        for (int i = 0; i < iterations; i++) {
+          deinterleave(in, planar_in);
+          compute(nframes, planar_in.audio.data(), planar_out.audio.data());
+          interleave(planar_out, out);
+        }
+      }
+
+      BENCHMARK(fmt::format("Planar: {} frames", nframes))
+      {
+        for (int i = 0; i < iterations; i++) {
+          compute(nframes, planar_in.audio.data(), planar_out.audio.data());
+        }
+      }
+    }
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,121 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/audio/processor.hpp"
+
+namespace otto::core::audio {
+
+  static midi::Event note_on_at(int key, int time)
+  {
+    midi::Event ev = midi::NoteOnEvent{key};
+    ev.time = time;
+    return ev;
+  }
+
+  TEST_CASE("process_midi_slices", "[audio] [midi]") {
+
+    std::array<std::array<float, 1>, 64> buf = {};
+    std::vector<std::pair<long, long>> slices;
+    std::vector<std::vector<int>> slice_events;
+
+    auto process = [&](ProcessData<0> slice) {
+      slices.emplace_back(slice.offset, slice.nframes);
+      auto& events = slice_events.emplace_back();
+      for (auto& ev : slice.midi) events.push_back(midi::event_time(ev));
+      auto out = slice.redirect(buf);
+      for (auto& frm : out) frm[0] = slice.offset;
+      return out;
+    };
+
+    SECTION("Without events, the block is processed whole") {
+      ProcessData<0> data{{nullptr, nullptr}, {nullptr, nullptr}, 64};
+      auto res = process_midi_slices(data, 4, process);
+      REQUIRE(slices.size() == 1);
+      REQUIRE(slices[0] == std::pair<long, long>{0, 64});
+      REQUIRE(res.nframes == 64);
+      REQUIRE(res.audio.data() == buf.data());
+    }
+
+    SECTION("Events start new slices on their exact frame") {
+      std::array<midi::Event, 3> events = {note_on_at(1, 0), note_on_at(2, 10), note_on_at(3, 40)};
+      ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, 64};
+      auto res = process_midi_slices(data, 4, process);
+      REQUIRE(slices.size() == 3);
+      REQUIRE(slices[0] == std::pair<long, long>{0, 10});
+      REQUIRE(slices[1] == std::pair<long, long>{10, 30});
+      REQUIRE(slices[2] == std::pair<long, long>{40, 24});
+      REQUIRE(slice_events[1] == std::vector<int>{10});
+      REQUIRE(res.audio.size() == 64);
+      REQUIRE(res.audio[9][0] == 0);
+      REQUIRE(res.audio[10][0] == 10);
+      REQUIRE(res.audio[63][0] == 40);
+    }
+
+    SECTION("Events closer than the minimum slice size are moved back") {
+      std::array<midi::Event, 3> events = {note_on_at(1, 5), note_on_at(2, 7), note_on_at(3, 100)};
+      ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, 64};
+      process_midi_slices(data, 4, process);
+      REQUIRE(slices.size() == 3);
+      REQUIRE(slices[1] == std::pair<long, long>{5, 58});
+      REQUIRE(slice_events[1] == std::vector<int>{5, 7});
+      // Clamped to the last frame
+      REQUIRE(slices[2] == std::pair<long, long>{63, 1});
+    }
+
+    SECTION("Unsorted events are sorted") {
+      std::array<midi::Event, 2> events = {note_on_at(1, 30), note_on_at(2, 20)};
+      ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, 64};
+      process_midi_slices(data, 4, process);
+      REQUIRE(slices.size() == 3);
+      REQUIRE(slices[1] == std::pair<long, long>{20, 10});
+      REQUIRE(slice_events[2] == std::vector<int>{30});
+    }
+
+    SECTION("The block is silent only if all slices are") {
+      std::array<midi::Event, 1> events = {note_on_at(1, 30)};
+      ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, 64};
+      auto silent_until = [&](long frame) {
+        return [&, frame](ProcessData<0> slice) {
+          auto out   = process(slice);
+          out.silent = slice.offset < frame;
+          return out;
+        };
+      };
+      REQUIRE(process_midi_slices(data, 4, silent_until(64)).silent);
+      REQUIRE_FALSE(process_midi_slices(data, 4, silent_until(30)).silent);
+    }
+  }
+
+  TEST_CASE("process_midi_slices with changing output buffers", "[audio] [midi]") {
+    std::array<std::array<float, 1>, 64> buf_a = {};
+    std::array<std::array<float, 1>, 64> buf_b = {};
+    std::array<midi::Event, 1> events = {note_on_at(1, 20)};
+    ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, 64};
+
+    // The second slice is output to another buffer
+    auto res = process_midi_slices(data, 4, [&](ProcessData<0> slice) {
+      auto out = slice.offset == 0 ? slice.redirect(buf_a) : slice.redirect(buf_b);
+      for (auto& frm : out) frm[0] = slice.offset == 0 ? 1 : 2;
+      return out;
+    });
+    REQUIRE(res.audio.data() == buf_a.data());
+    REQUIRE(res.audio[19][0] == 1);
+    REQUIRE(res.audio[20][0] == 2);
+    REQUIRE(res.audio[63][0] == 2);
+  }
+
+  TEST_CASE("ProcessData::fill_silence", "[audio]") {
+    std::array<std::array<float, 2>, 8> buf;
+    for (auto& frm : buf) frm = {{1, 1}};
+    ProcessData<2> data{{buf.data(), buf.size()}, {nullptr, nullptr}, 8};
+    REQUIRE_FALSE(data.silent);
+    auto res = data.slice(4).fill_silence();
+    REQUIRE(res.silent);
+    REQUIRE(res.slice(2).silent);
+    REQUIRE(buf[3][1] == 1);
+    REQUIRE(buf[4][0] == 0);
+    REQUIRE(buf[7][1] == 0);
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,68 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/audio/tail_detector.hpp"
+
+namespace otto::core::audio {
+
+  TEST_CASE("TailDetector", "[audio]") {
+    TailDetector tail;
+    std::vector<float> loud(256, 0.5f);
+    std::vector<float> quiet(TailDetector::hold_frames, TailDetector::threshold / 2);
+    const std::size_t block = 256;
+
+    SECTION("It starts out idle") {
+      REQUIRE(tail.idle());
+    }
+
+    SECTION("Idle, woken, decaying and idle again") {
+      tail.wake();
+      REQUIRE_FALSE(tail.idle());
+
+      // Held, it never goes idle, even when quiet
+      for (int i = 0; i < 100; i++) tail.update(quiet.data(), block, true);
+      REQUIRE_FALSE(tail.idle());
+
+      // Released, and decaying
+      for (int i = 0; i < 10; i++) tail.update(loud.data(), loud.size(), false);
+      REQUIRE_FALSE(tail.idle());
+
+      for (std::size_t frames = block; frames < TailDetector::hold_frames; frames += block) {
+        tail.update(quiet.data(), block, false);
+        REQUIRE_FALSE(tail.idle());
+      }
+      tail.update(quiet.data(), block, false);
+      REQUIRE(tail.idle());
+
+      // Until the next trigger
+      tail.wake();
+      REQUIRE_FALSE(tail.idle());
+    }
+
+    SECTION("A sound restarts the hold") {
+      tail.wake();
+      tail.update(quiet.data(), TailDetector::hold_frames - 1, false);
+      tail.update(loud.data(), 1, false);
+      tail.update(quiet.data(), TailDetector::hold_frames - 1, false);
+      REQUIRE_FALSE(tail.idle());
+      tail.update(quiet.data(), 1, false);
+      REQUIRE(tail.idle());
+    }
+
+    SECTION("The hold lasts as long, whatever the size of the slices") {
+      for (std::size_t slice : {16, 100, 256}) {
+        TailDetector detector;
+        detector.wake();
+        std::size_t frames = 0;
+        for (; frames + slice < TailDetector::hold_frames; frames += slice) {
+          detector.update(quiet.data(), slice, false);
+        }
+        REQUIRE_FALSE(detector.idle());
+        detector.update(quiet.data(), slice, false);
+        REQUIRE(detector.idle());
+      }
+    }
+  }
+
+} // namespace otto::core::audio
@@ -0,0 +1,116 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/audio/voice_allocator.hpp"
+
+namespace otto::core::audio {
+
+  TEST_CASE("VoiceAllocator", "[audio] [voices]") {
+
+    VoiceAllocator<4> alloc;
+    constexpr auto no_key = VoiceAllocator<4>::no_key;
+
+    SECTION("Each key gets its own voice") {
+      std::vector<Voice> voices;
+      for (int key = 60; key < 64; key++) {
+        auto res = alloc.note_on(key);
+        REQUIRE(res.stolen_from == no_key);
+        REQUIRE(alloc.voice_of(key) == res.voice);
+        REQUIRE(alloc.key_of(res.voice) == key);
+        REQUIRE(std::find(voices.begin(), voices.end(), res.voice) == voices.end());
+        voices.push_back(res.voice);
+      }
+    }
+
+    SECTION("Released voices are reused in the order they were released") {
+      for (int key = 60; key < 64; key++) alloc.note_on(key);
+      auto second = alloc.voice_of(61);
+      auto first  = alloc.voice_of(63);
+      alloc.note_off(63);
+      alloc.note_off(61);
+      REQUIRE(alloc.key_of(first) == no_key);
+      REQUIRE(alloc.note_on(70).voice == first);
+      REQUIRE(alloc.note_on(71).voice == second);
+    }
+
+    SECTION("The same note retriggers its released voice") {
+      for (int key = 60; key < 64; key++) alloc.note_on(key);
+      auto voice = alloc.voice_of(61);
+      alloc.note_off(60);
+      alloc.note_off(61);
+      REQUIRE(alloc.note_on(61).voice == voice);
+
+      alloc.retrigger_same_note = false;
+      alloc.note_off(61);
+      alloc.note_off(62);
+      REQUIRE(alloc.note_on(62).voice != voice);
+    }
+
+    SECTION("The oldest voice is stolen, and handed back on release") {
+      for (int key = 60; key < 64; key++) alloc.note_on(key);
+      auto voice = alloc.voice_of(60);
+      auto res   = alloc.note_on(64);
+      REQUIRE(res.voice == voice);
+      REQUIRE(res.stolen_from == 60);
+      REQUIRE(alloc.is_stolen(60));
+      REQUIRE(alloc.voice_of(60) == VoiceAllocator<4>::no_voice);
+
+      auto rel = alloc.note_off(62);
+      REQUIRE(rel.resumed == 60);
+      REQUIRE(alloc.voice_of(60) == rel.voice);
+      REQUIRE_FALSE(alloc.is_stolen(60));
+    }
+
+    SECTION("Releasing a stolen key forgets it") {
+      for (int key = 60; key < 65; key++) alloc.note_on(key);
+      REQUIRE(alloc.note_off(60).voice == VoiceAllocator<4>::no_voice);
+      REQUIRE_FALSE(alloc.is_stolen(60));
+      REQUIRE(alloc.note_off(61).resumed == no_key);
+    }
+
+    SECTION("The quietest voice is stolen") {
+      alloc.steal_policy = StealPolicy::quietest;
+      for (int key = 60; key < 64; key++) {
+        auto v = alloc.note_on(key).voice;
+        alloc.level(v, key == 62 ? 0.1f : 0.5f);
+      }
+      REQUIRE(alloc.note_on(64).stolen_from == 62);
+    }
+  }
+
+  TEST_CASE("VoiceAllocator under a dense midi stream", "[.] [benchmark] [voices]") {
+    constexpr int events = 1 << 20;
+
+    std::vector<std::pair<bool, int>> stream;
+    std::vector<int> held;
+    for (int i = 0; i < events; i++) {
+      if (held.size() < 10 && (held.empty() || Random::get<bool>(0.6))) {
+        int key = Random::get(24, 100);
+        held.push_back(key);
+        stream.push_back({true, key});
+      } else {
+        auto it = held.begin() + Random::get<std::size_t>(0, held.size() - 1);
+        stream.push_back({false, *it});
+        held.erase(it);
+      }
+    }
+
+    for (auto policy : {StealPolicy::oldest, StealPolicy::quietest}) {
+      VoiceAllocator<6> alloc;
+      alloc.steal_policy = policy;
+      BENCHMARK(policy == StealPolicy::oldest ? "Oldest" : "Quietest")
+      {
+        for (auto [on, key] : stream) {
+          if (on) {
+            auto v = alloc.note_on(key).voice;
+            alloc.level(v, key / 127.f);
+          } else {
+            alloc.note_off(key);
+          }
+        }
+      }
+    }
+  }
+
+} // namespace otto::core::audio
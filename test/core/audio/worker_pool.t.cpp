@@ -0,0 +1,55 @@
+#include "testing.t.hpp"
+
+#include <array>
+#include <atomic>
+
+#include "core/audio/worker_pool.hpp"
+
+namespace otto::core::audio {
+
+  namespace {
+    struct Counters {
+      std::array<std::atomic<int>, 64> runs = {};
+      std::atomic<int> bad_index{0};
+    };
+
+    void count(void* context, int index)
+    {
+      auto& counters = *static_cast<Counters*>(context);
+      if (index < 0 || index >= (int) counters.runs.size()) {
+        counters.bad_index++;
+        return;
+      }
+      counters.runs[index]++;
+    }
+  } // namespace
+
+  TEST_CASE("WorkerPool", "[audio] [graph]") {
+    // Spinning workers pick batches up right away, the others go to sleep
+    // between them
+    for (int spin_iterations : {1 << 12, 1}) {
+      WorkerPool pool(3, 0, spin_iterations);
+      REQUIRE(pool.workers() == 3);
+
+      Counters counters;
+      for (int batch = 0; batch < 500; batch++) {
+        int njobs = batch % 40;
+        pool.run(njobs, count, &counters);
+        for (int i = 0; i < (int) counters.runs.size(); i++) {
+          REQUIRE(counters.runs[i] == (i < njobs ? 1 : 0));
+          counters.runs[i] = 0;
+        }
+      }
+      REQUIRE(counters.bad_index == 0);
+    }
+  }
+
+  TEST_CASE("WorkerPool without workers runs the jobs on the caller", "[audio] [graph]") {
+    WorkerPool pool(0);
+    REQUIRE(pool.workers() == 0);
+    Counters counters;
+    pool.run(10, count, &counters);
+    for (int i = 0; i < 10; i++) REQUIRE(counters.runs[i] == 1);
+  }
+
+} // namespace otto::core::audio
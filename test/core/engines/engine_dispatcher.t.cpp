@@ -0,0 +1,84 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/engines/engine_dispatcher.hpp"
+
+namespace otto::core::engines {
+
+  namespace {
+    /// Outputs a constant to its own buffer
+    struct ConstantSynth final : SynthEngine {
+      struct Props : props::Properties<> {
+        using Properties::Properties;
+      } props;
+
+      ConstantSynth(float value) : SynthEngine("Constant", props, nullptr), value(value) {}
+
+      audio::ProcessData<1> process(audio::ProcessData<0> data) override
+      {
+        auto out = data.redirect(buf);
+        for (auto& frm : out) frm[0] = value;
+        return out;
+      }
+
+      float value;
+      audio::ProcessBuffer<1> buf;
+    };
+  } // namespace
+
+  TEST_CASE("EngineDispatcher", "[engines]") {
+    constexpr int nframes = 1024;
+    constexpr int fade    = EngineDispatcher<EngineType::synth>::crossfade_frames;
+    auto old_size         = audio::buffer_arena().block_size();
+    audio::buffer_arena().block_size(nframes);
+
+    EngineDispatcher<EngineType::synth> dispatcher;
+    ConstantSynth a(1), b(2);
+
+    // Audio is not running, so switches are done synchronously
+    dispatcher.select(&a);
+
+    std::array<midi::Event, 1> events;
+    events[0]      = midi::NoteOnEvent(60);
+    events[0].time = 600;
+    auto block     = [&](auto&& on_slice) {
+      audio::ProcessData<0> data{{nullptr, nullptr}, {events.data(), events.size()}, nframes};
+      auto out = audio::process_midi_slices(data, 16, [&](audio::ProcessData<0> slice) {
+        auto res = dispatcher.process(slice);
+        on_slice(slice);
+        return res;
+      });
+      std::vector<float> res;
+      for (auto& frm : out) res.push_back(frm[0]);
+      return res;
+    };
+
+    SECTION("A fade that ends mid-block is followed by the new engine") {
+      auto out = block([](auto) {});
+      REQUIRE(out[0] == 0);
+      REQUIRE(out[fade / 2] == Approx(0.5));
+      REQUIRE(out[599] == 1);
+      REQUIRE(out[600] == 1);
+      REQUIRE(out[nframes - 1] == 1);
+    }
+
+    SECTION("A switch picked up mid-block fades from the slice it starts in") {
+      block([](auto) {});
+      auto out = block([&](auto slice) {
+        if (slice.offset == 0) dispatcher.select(&b);
+      });
+      REQUIRE(out[599] == 1);
+      REQUIRE(out[600] == 1);
+      REQUIRE(out[600 + fade / 2] == Approx(1.5));
+      REQUIRE(out[600 + fade] == 2);
+      REQUIRE(out[nframes - 1] == 2);
+      // The fade is done, and not continued in the next block
+      out = block([](auto) {});
+      REQUIRE(out[0] == 2);
+    }
+
+    audio::buffer_arena().block_size(old_size);
+  }
+
+} // namespace otto::core::engines
@@ -1,6 +1,7 @@
 #include "testing.t.hpp"
 
 #include <functional>
+#include <vector>
 
 #include "core/props/props.hpp"
 #include "core/props/mixins/all.hpp"
@@ -133,4 +134,20 @@ namespace otto::core::props {
     prop.set(-3);
     REQUIRE(prop == 2);
   }
+
+  TEST_CASE("observable", "[props]") {
+
+    Property<int, wrap, observable> prop = {nullptr, "prop", 0, has_limits::init(-2, 2)};
+
+    std::vector<int> seen;
+    prop.on_change().subscribe([&](int value) {
+      // The property already holds the value
+      REQUIRE(prop.get() == value);
+      seen.push_back(value);
+    });
+
+    prop.set(1);
+    prop.set(3);
+    REQUIRE(seen == std::vector<int>{1, -2});
+  }
 }
@@ -0,0 +1,23 @@
+#include "testing.t.hpp"
+
+#include "engines/studio/input_selector/input_selector.hpp"
+
+namespace otto::engines {
+
+  using Selection = InputSelector::Selection;
+
+  TEST_CASE("InputSelector::record_latency", "[engines] [tapedeck]") {
+    constexpr int round_trip = 256;
+
+    SECTION("External input is recorded the round trip earlier") {
+      REQUIRE(InputSelector::record_latency(Selection::External, round_trip) == round_trip);
+    }
+
+    SECTION("Internal sources and feedback are not shifted") {
+      REQUIRE(InputSelector::record_latency(Selection::Internal, round_trip) == 0);
+      REQUIRE(InputSelector::record_latency(Selection::TrackFB, round_trip) == 0);
+      REQUIRE(InputSelector::record_latency(Selection::MasterFB, round_trip) == 0);
+    }
+  }
+
+} // namespace otto::engines
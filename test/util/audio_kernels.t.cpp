@@ -0,0 +1,153 @@
+#include "testing.t.hpp"
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "util/audio_kernels.hpp"
+
+namespace otto::util::audio {
+
+  namespace {
+    /// Odd sizes, so the scalar tails are tested as well
+    constexpr std::size_t nframes = 67;
+
+    std::vector<float> signal(std::size_t n, float seed = 1)
+    {
+      std::vector<float> res(n);
+      for (std::size_t i = 0; i < n; i++) res[i] = std::sin(seed * (i + 1)) * 0.9f;
+      return res;
+    }
+  } // namespace
+
+  TEST_CASE("Audio kernels", "[audio] [util]") {
+
+    SECTION("gain") {
+      auto data = signal(nframes);
+      auto expected = data;
+      for (auto& f : expected) f *= 0.3f;
+      gain(data.data(), data.size(), 0.3f);
+      for (std::size_t i = 0; i < nframes; i++) REQUIRE(data[i] == Approx(expected[i]));
+    }
+
+    SECTION("gain_ramp continues across blocks") {
+      std::vector<float> data(2 * nframes, 1.f);
+      gain_ramp(data.data(), nframes, 0, 1);
+      gain_ramp(data.data() + nframes, nframes, 1, 0);
+      REQUIRE(data[0] == 0);
+      REQUIRE(data[nframes] == 1);
+      for (std::size_t i = 1; i < 2 * nframes; i++) {
+        REQUIRE(std::abs(data[i] - data[i - 1]) == Approx(1.f / nframes));
+      }
+    }
+
+    SECTION("accumulate") {
+      auto dst = signal(nframes, 1);
+      auto src = signal(nframes, 2);
+      auto expected = dst;
+      for (std::size_t i = 0; i < nframes; i++) expected[i] += src[i] * 0.5f;
+      accumulate(dst.data(), src.data(), nframes, 0.5f);
+      for (std::size_t i = 0; i < nframes; i++) REQUIRE(dst[i] == Approx(expected[i]));
+    }
+
+    SECTION("pan_gains") {
+      auto center = pan_gains(1, 0, PanLaw::constant_power);
+      REQUIRE(center.left == Approx(std::sqrt(0.5f)));
+      REQUIRE(center.right == Approx(std::sqrt(0.5f)));
+      auto left = pan_gains(0.5, -1);
+      REQUIRE(left.left == Approx(1));
+      REQUIRE(left.right == Approx(0));
+    }
+
+    SECTION("mix_to_stereo") {
+      for (int channels : {1, 2, 3, 4}) {
+        auto in = signal(nframes * channels);
+        std::vector<StereoGain> gains;
+        for (int c = 0; c < channels; c++) gains.push_back(pan_gains(0.5f + c, c * 0.3f - 0.5f));
+        gains[0] = {0, 0};
+
+        std::vector<float> out(2 * nframes, 0.25f);
+        std::vector<float> expected(2 * nframes);
+        for (std::size_t f = 0; f < nframes; f++) {
+          float l = 0.25f, r = 0.25f;
+          for (int c = 0; c < channels; c++) {
+            l += in[f * channels + c] * gains[c].left;
+            r += in[f * channels + c] * gains[c].right;
+          }
+          expected[2 * f]     = l;
+          expected[2 * f + 1] = r;
+        }
+        mix_to_stereo(in.data(), channels, out.data(), nframes, gains.data(), true);
+        for (std::size_t i = 0; i < 2 * nframes; i++) REQUIRE(out[i] == Approx(expected[i]));
+
+        mix_to_stereo(in.data(), channels, out.data(), nframes, gains.data());
+        for (std::size_t i = 0; i < 2 * nframes; i++) {
+          REQUIRE(out[i] == Approx(expected[i] - 0.25f).margin(1e-6));
+        }
+      }
+    }
+
+    SECTION("measure") {
+      for (int channels : {1, 2, 3, 4}) {
+        auto in = signal(nframes * channels);
+        std::vector<Levels> levels(channels);
+        std::vector<Levels> expected(channels);
+        for (std::size_t i = 0; i < in.size(); i++) {
+          auto& e = expected[i % channels];
+          e.peak  = std::max(e.peak, std::abs(in[i]));
+          e.sum_abs += std::abs(in[i]);
+          e.sum_squares += in[i] * in[i];
+          e.nsamples++;
+        }
+        measure(in.data(), channels, nframes, levels.data());
+        for (int c = 0; c < channels; c++) {
+          REQUIRE(levels[c].nsamples == nframes);
+          REQUIRE(levels[c].peak == Approx(expected[c].peak));
+          REQUIRE(levels[c].mean() == Approx(expected[c].mean()));
+          REQUIRE(levels[c].rms() == Approx(expected[c].rms()));
+        }
+      }
+    }
+  }
+
+  TEST_CASE("Mixing 4 tracks to stereo", "[.] [benchmark] [audio]") {
+    constexpr int iterations = 10000;
+    constexpr std::size_t block = 256;
+
+    auto in = signal(block * 4);
+    std::vector<float> out(block * 2);
+    std::array<float, 4> level = {{0.5, 0.6, 0.7, 0.8}};
+    std::array<float, 4> pan = {{-0.5, 0, 0.2, 1}};
+    std::array<bool, 4> muted = {{false, true, false, false}};
+
+    BENCHMARK("Per sample, branching on mute")
+    {
+      for (int i = 0; i < iterations; i++) {
+        for (std::size_t f = 0; f < block; f++) {
+          float l = 0, r = 0;
+          for (int t = 0; t < 4; t++) {
+            float audio = in[f * 4 + t] * level[t];
+            if (!muted[t]) {
+              l += audio * (1 - pan[t]);
+              r += audio * (1 + pan[t]);
+            }
+          }
+          out[2 * f]     = l;
+          out[2 * f + 1] = r;
+        }
+      }
+    }
+
+    BENCHMARK("mix_to_stereo")
+    {
+      for (int i = 0; i < iterations; i++) {
+        std::array<StereoGain, 4> gains;
+        for (int t = 0; t < 4; t++) {
+          gains[t] = muted[t] ? StereoGain{0, 0} : pan_gains(level[t], pan[t]);
+        }
+        mix_to_stereo(in.data(), 4, out.data(), block, gains.data());
+      }
+    }
+  }
+
+} // namespace otto::util::audio
@@ -0,0 +1,118 @@
+#include "testing.t.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include "util/mapped_file.hpp"
+#include "util/soundfile.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("MappedFile", "[util] [MappedFile]") {
+
+    fs::path path = test::dir / "mapped.bytes";
+    fs::create_directories(test::dir);
+    fs::remove(path);
+    constexpr std::size_t capacity = 1 << 20;
+
+    SECTION("A new file is empty") {
+      MappedFile f {path, capacity};
+      REQUIRE(f.is_open());
+      REQUIRE(f.size() == 0);
+      REQUIRE(f.capacity() == capacity);
+    }
+
+    SECTION("Resizing fills with zeros") {
+      MappedFile f {path, capacity};
+      f.resize(4096);
+      REQUIRE(f.size() == 4096);
+      REQUIRE(std::all_of(f.data(), f.data() + 4096, [](std::byte b) { return b == std::byte{0}; }));
+    }
+
+    SECTION("Writes reach the file") {
+      std::vector<std::byte> data(10000);
+      std::generate(data.begin(), data.end(),
+                    [] { return std::byte(Random::get<unsigned char>()); });
+      {
+        MappedFile f {path, capacity};
+        f.resize(20000);
+        std::memcpy(f.data() + 5000, data.data(), data.size());
+        f.sync(5000, data.size());
+      }
+      REQUIRE(fs::file_size(path) == 20000);
+
+      ByteFile bf;
+      bf.open(path);
+      std::vector<std::byte> got(data.size());
+      bf.seek(5000);
+      REQUIRE(bf.read_bytes(got.data(), got.size()).is_ok());
+      REQUIRE(got == data);
+    }
+
+    SECTION("Moving transfers the mapping") {
+      MappedFile f {path, capacity};
+      auto* data = f.data();
+      MappedFile g = std::move(f);
+      REQUIRE_FALSE(f.is_open());
+      REQUIRE(g.data() == data);
+    }
+  }
+
+  TEST_CASE("MappedFile vs SoundFile", "[.] [benchmark] [MappedFile]") {
+
+    fs::path path = test::dir / "mapped_bench.wav";
+    fs::create_directories(test::dir);
+    fs::remove(path);
+
+    constexpr int channels = 4;
+    constexpr int frames   = 1 << 20;
+    constexpr int chunk    = 1 << 14;
+    std::vector<float> buffer(chunk * channels);
+    std::generate(buffer.begin(), buffer.end(), [] { return Random::get<float>(-1, 1); });
+
+    SoundFile sf;
+    sf.info.channels = channels;
+    sf.open(path);
+    std::size_t offset = sf.audio_offset();
+    std::size_t bytes  = offset + std::size_t(frames) * channels * sizeof(float);
+
+    auto stream_write = test::measure::execution([&] {
+      for (int pos = 0; pos < frames; pos += chunk) {
+        sf.seek(pos * channels);
+        sf.write_samples(buffer.data(), chunk * channels);
+      }
+      sf.flush();
+    });
+    auto stream_read = test::measure::execution([&] {
+      for (int pos = 0; pos < frames; pos += chunk) {
+        sf.seek(pos * channels);
+        sf.read_samples(buffer.data(), chunk * channels);
+      }
+    });
+    sf.close();
+
+    MappedFile mf {path, bytes};
+    auto mapped_write = test::measure::execution([&] {
+      for (int pos = 0; pos < frames; pos += chunk) {
+        auto* dst = mf.data() + offset + std::size_t(pos) * channels * sizeof(float);
+        std::memcpy(dst, buffer.data(), buffer.size() * sizeof(float));
+      }
+      mf.sync(offset, bytes - offset);
+    });
+    auto mapped_read = test::measure::execution([&] {
+      for (int pos = 0; pos < frames; pos += chunk) {
+        mf.will_need(offset + std::size_t(pos + chunk) * channels * sizeof(float),
+                     buffer.size() * sizeof(float));
+        auto* src = mf.data() + offset + std::size_t(pos) * channels * sizeof(float);
+        std::memcpy(buffer.data(), src, buffer.size() * sizeof(float));
+      }
+    });
+
+    LOGI("Stream write: {}us, read: {}us", stream_write.count() / 1000,
+         stream_read.count() / 1000);
+    LOGI("Mapped write: {}us, read: {}us", mapped_write.count() / 1000,
+         mapped_read.count() / 1000);
+    LOGI("Mapped reads are {} times faster", double(stream_read.count()) / mapped_read.count());
+  }
+
+} // namespace otto::util
@@ -0,0 +1,89 @@
+#include "testing.t.hpp"
+
+#include <thread>
+#include <vector>
+
+#include "util/mpsc_queue.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("mpsc_queue", "[mpsc_queue] [util]") {
+
+    mpsc_queue<int, 8> queue;
+
+    SECTION("A new queue is empty") {
+      int out = -1;
+      REQUIRE(queue.empty());
+      REQUIRE_FALSE(queue.try_pop(out));
+      REQUIRE(out == -1);
+    }
+
+    SECTION("Values are popped in the order they were pushed") {
+      for (int i = 0; i < 5; i++) {
+        REQUIRE(queue.try_push(i));
+      }
+      REQUIRE(queue.size() == 5);
+      for (int i = 0; i < 5; i++) {
+        int out;
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i);
+      }
+      REQUIRE(queue.empty());
+    }
+
+    SECTION("Pushing to a full queue fails") {
+      for (int i = 0; i < 8; i++) {
+        REQUIRE(queue.try_push(i));
+      }
+      REQUIRE_FALSE(queue.try_push(8));
+
+      int out;
+      REQUIRE(queue.try_pop(out));
+      REQUIRE(out == 0);
+      REQUIRE(queue.try_push(8));
+    }
+
+    SECTION("Wrapping around many times") {
+      for (int i = 0; i < 100; i++) {
+        int out;
+        REQUIRE(queue.try_push(i));
+        REQUIRE(queue.try_push(i + 1000));
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i);
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i + 1000);
+      }
+    }
+
+    SECTION("Concurrent producers") {
+      constexpr int producers = 4;
+      constexpr int count     = 50000;
+      std::vector<std::thread> threads;
+      for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+          for (int i = 0; i < count; i++) {
+            while (!queue.try_push(p * count + i)) std::this_thread::yield();
+          }
+        });
+      }
+
+      // The values of each producer arrive in the order it pushed them
+      std::vector<int> next(producers, 0);
+      bool in_order = true;
+      for (int received = 0; received < producers * count;) {
+        int out;
+        if (queue.try_pop(out)) {
+          int p    = out / count;
+          in_order = in_order && out % count == next[p];
+          next[p]++;
+          received++;
+        }
+      }
+      for (auto& t : threads) t.join();
+
+      REQUIRE(in_order);
+      REQUIRE(queue.empty());
+    }
+  }
+
+} // namespace otto::util
@@ -0,0 +1,80 @@
+#include "testing.t.hpp"
+
+#include <thread>
+
+#include "util/spsc_queue.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("spsc_queue", "[spsc_queue] [util]") {
+
+    spsc_queue<int, 8> queue;
+
+    SECTION("A new queue is empty") {
+      int out = -1;
+      REQUIRE(queue.empty());
+      REQUIRE_FALSE(queue.try_pop(out));
+      REQUIRE(out == -1);
+    }
+
+    SECTION("Values are popped in the order they were pushed") {
+      for (int i = 0; i < 5; i++) {
+        REQUIRE(queue.try_push(i));
+      }
+      REQUIRE(queue.size() == 5);
+      for (int i = 0; i < 5; i++) {
+        int out;
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i);
+      }
+      REQUIRE(queue.empty());
+    }
+
+    SECTION("Pushing to a full queue fails") {
+      for (int i = 0; i < 8; i++) {
+        REQUIRE(queue.try_push(i));
+      }
+      REQUIRE_FALSE(queue.try_push(8));
+
+      int out;
+      REQUIRE(queue.try_pop(out));
+      REQUIRE(out == 0);
+      REQUIRE(queue.try_push(8));
+    }
+
+    SECTION("Wrapping around many times") {
+      for (int i = 0; i < 100; i++) {
+        int out;
+        REQUIRE(queue.try_push(i));
+        REQUIRE(queue.try_push(i + 1000));
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i);
+        REQUIRE(queue.try_pop(out));
+        REQUIRE(out == i + 1000);
+      }
+    }
+
+    SECTION("Concurrent producer and consumer") {
+      constexpr int count = 100000;
+      std::thread producer([&] {
+        for (int i = 0; i < count; i++) {
+          while (!queue.try_push(i)) std::this_thread::yield();
+        }
+      });
+
+      bool in_order = true;
+      for (int expected = 0; expected < count;) {
+        int out;
+        if (queue.try_pop(out)) {
+          in_order = in_order && out == expected;
+          expected++;
+        }
+      }
+      producer.join();
+
+      REQUIRE(in_order);
+      REQUIRE(queue.empty());
+    }
+  }
+
+} // namespace otto::util
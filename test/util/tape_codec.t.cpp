@@ -0,0 +1,153 @@
+#include "testing.t.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "util/tape_codec.hpp"
+
+namespace otto::util {
+
+  namespace {
+    constexpr int channels = TapeCodec::channels;
+    constexpr int frames   = TapeCodec::block_frames;
+
+    /// What a recording looks like: Each track a few tones and a bit of noise,
+    /// from a 24 bit converter. The last track is silent.
+    std::vector<float> recording(int blocks = 1)
+    {
+      std::vector<float> res(blocks * frames * channels);
+      for (int f = 0; f < blocks * frames; f++) {
+        for (int c = 0; c < channels - 1; c++) {
+          float tone = 0.3f * std::sin(0.01f * (c + 1) * f) + 0.1f * std::sin(0.13f * f + c) +
+                       0.001f * Random::get<float>(-1, 1);
+          res[f * channels + c] = std::round(tone * (1 << 23)) / (1 << 23);
+        }
+      }
+      return res;
+    }
+
+    bool bit_equal(const std::vector<float>& a, const std::vector<float>& b)
+    {
+      return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+    }
+  } // namespace
+
+  TEST_CASE("TapeCodec", "[util] [TapeCodec]") {
+
+    TapeCodec codec;
+    std::vector<std::byte> encoded(TapeCodec::max_encoded_size);
+    std::vector<float> decoded(frames * channels);
+
+    auto round_trip = [&](const std::vector<float>& block) {
+      auto size = codec.encode(block.data(), encoded.data());
+      REQUIRE(size <= TapeCodec::max_encoded_size);
+      std::fill(decoded.begin(), decoded.end(), 1.f);
+      REQUIRE(codec.decode(encoded.data(), size, decoded.data()));
+      REQUIRE(bit_equal(block, decoded));
+      return size;
+    };
+
+    SECTION("Silence takes a byte per channel") {
+      std::vector<float> block(frames * channels, 0.f);
+      REQUIRE(round_trip(block) == channels);
+    }
+
+    SECTION("Recordings are smaller") {
+      auto block = recording();
+      REQUIRE(round_trip(block) < block.size() * sizeof(float) * 3 / 4);
+    }
+
+    SECTION("Signed zeros, steps and full scale") {
+      std::vector<float> block(frames * channels);
+      for (int f = 0; f < frames; f++) {
+        block[f * channels + 0] = f % 2 ? -0.f : 0.f;
+        block[f * channels + 1] = f < frames / 2 ? -1.f : 1.f;
+        block[f * channels + 2] = f % 3 - 1.f;
+        block[f * channels + 3] = std::numeric_limits<float>::max() * (f % 2 ? -1 : 1);
+      }
+      round_trip(block);
+    }
+
+    SECTION("Noise is stored raw") {
+      std::vector<float> block(frames * channels);
+      std::generate(block.begin(), block.end(), [] { return Random::get<float>(-1, 1); });
+      REQUIRE(round_trip(block) <= TapeCodec::max_encoded_size);
+    }
+
+    SECTION("Any bits, including NaNs and denormals") {
+      std::vector<float> block(frames * channels);
+      for (auto& s : block) {
+        auto bits = Random::get<std::uint32_t>();
+        std::memcpy(&s, &bits, sizeof(s));
+      }
+      block[0] = std::numeric_limits<float>::quiet_NaN();
+      block[1] = std::numeric_limits<float>::denorm_min();
+      block[2] = -std::numeric_limits<float>::infinity();
+      round_trip(block);
+    }
+
+    SECTION("A different mode for each channel") {
+      auto block = recording();
+      for (int f = 0; f < frames; f++) {
+        block[f * channels + 1] = Random::get<float>(-1, 1);
+        block[f * channels + 2] = 0.5f;
+      }
+      round_trip(block);
+    }
+
+    SECTION("Corrupt blocks decode as silence") {
+      auto block = recording();
+      auto size  = codec.encode(block.data(), encoded.data());
+      std::fill(decoded.begin(), decoded.end(), 1.f);
+      REQUIRE_FALSE(codec.decode(encoded.data(), size / 2, decoded.data()));
+      REQUIRE(std::all_of(decoded.begin(), decoded.end(), [](float f) { return f == 0; }));
+
+      encoded[0] = std::byte(0xFF);
+      REQUIRE_FALSE(codec.decode(encoded.data(), size, decoded.data()));
+    }
+  }
+
+  TEST_CASE("TapeCodec vs raw tape", "[.] [benchmark] [TapeCodec]") {
+    constexpr int samplerate = 44100;
+    constexpr int blocks     = 64;
+    auto audio               = recording(blocks);
+    std::vector<float> decoded(audio.size());
+    std::vector<std::byte> encoded(blocks * TapeCodec::max_encoded_size);
+    std::vector<std::size_t> sizes(blocks);
+    TapeCodec codec;
+
+    // What the raw tape costs, other than the I/O
+    auto copy_time =
+      test::measure::execution([&] { std::copy(audio.begin(), audio.end(), decoded.begin()); });
+
+    std::size_t encoded_bytes = 0;
+    auto encode_time          = test::measure::execution([&] {
+      encoded_bytes = 0;
+      for (int b = 0; b < blocks; b++) {
+        sizes[b] = codec.encode(audio.data() + b * frames * channels,
+                                encoded.data() + b * TapeCodec::max_encoded_size);
+        encoded_bytes += sizes[b];
+      }
+    });
+    auto decode_time = test::measure::execution([&] {
+      for (int b = 0; b < blocks; b++) {
+        codec.decode(encoded.data() + b * TapeCodec::max_encoded_size, sizes[b],
+                     decoded.data() + b * frames * channels);
+      }
+    });
+    REQUIRE(bit_equal(audio, decoded));
+
+    // Per second of audio
+    double seconds = double(blocks * frames) / samplerate;
+    double raw_bytes = audio.size() * sizeof(float);
+    LOGI("Raw:      {:.0f} kB/s of I/O, {:.0f}us/s to copy", raw_bytes / seconds / 1000,
+         copy_time.count() / 1000 / seconds);
+    LOGI("Lossless: {:.0f} kB/s of I/O, {:.0f}us/s to encode, {:.0f}us/s to decode",
+         encoded_bytes / seconds / 1000, encode_time.count() / 1000 / seconds,
+         decode_time.count() / 1000 / seconds);
+    LOGI("Lossless is {:.2f} of the raw size", encoded_bytes / raw_bytes);
+  }
+
+} // namespace otto::util
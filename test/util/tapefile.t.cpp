@@ -1,5 +1,9 @@
 #include "../testing.t.hpp"
 
+#include <cmath>
+#include <fstream>
+#include <vector>
+
 #include "util/tapefile.hpp"
 
 namespace otto::util {
@@ -23,7 +27,8 @@ namespace otto::util {
     std::array<TapeFile::SliceData, 128> testData;
     std::generate(std::begin(testData), std::end(testData),
       [] () -> TapeFile::SliceData {
-        return {Random::get<uint32_t>(), Random::get<uint32_t>()};
+        return {Random::get<std::int64_t>(0, TapeFile::max_frames),
+                Random::get<std::int64_t>(0, TapeFile::max_frames)};
       });
 
     std::copy(std::begin(testData), std::end(testData),
@@ -35,5 +40,174 @@ namespace otto::util {
 
     REQUIRE(std::equal(std::begin(testData), std::end(testData),
         std::begin(f.slices[0].array)));
+
+    f.close();
+  }
+
+  TEST_CASE("Sparse chunks", "[TapeFile] [util]") {
+    fs::path path = test::dir / "sparse.tape";
+    fs::create_directories(test::dir);
+    fs::remove(path);
+
+    constexpr int n = 1000;
+    std::vector<float> data(n * TapeFile::channels);
+    std::generate(data.begin(), data.end(), [] { return Random::get<float>(-1, 1); });
+    // Spans two chunks, an hour into the tape
+    TapeFile::Position hour = 60 * 60 * 48000;
+    TapeFile::Position position = (hour / TapeFile::chunk_frames + 1) * TapeFile::chunk_frames - n / 2;
+
+    {
+      TapeFile tf;
+      tf.open(path);
+      auto empty_size = fs::file_size(path);
+      REQUIRE(tf.offset(0) == -1);
+      REQUIRE(tf.offset(position) == -1);
+      tf.write_frames(position, data.data(), n);
+      REQUIRE(tf.offset(position) >= 0);
+      REQUIRE(tf.offset(position + n) >= 0);
+      REQUIRE(tf.offset(0) == -1);
+      REQUIRE(fs::file_size(path) == empty_size + 2 * tf.chunk_bytes());
+    }
+
+    TapeFile tf;
+    tf.open(path);
+    std::vector<float> got(data.size());
+    tf.read_frames(position, got.data(), n);
+    REQUIRE(got == data);
+
+    // Never recorded, and read as silence
+    std::fill(got.begin(), got.end(), 1.f);
+    tf.read_frames(0, got.data(), n);
+    REQUIRE(std::all_of(got.begin(), got.end(), [](float f) { return f == 0; }));
+
+    // Around the recording
+    std::vector<float> around((n + 2 * TapeFile::chunk_frames) * TapeFile::channels, 1.f);
+    tf.read_frames(position - TapeFile::chunk_frames, around.data(), n + 2 * TapeFile::chunk_frames);
+    auto recorded = around.begin() + TapeFile::chunk_frames * TapeFile::channels;
+    REQUIRE(std::equal(data.begin(), data.end(), recorded));
+    REQUIRE(std::all_of(around.begin(), recorded, [](float f) { return f == 0; }));
+    REQUIRE(std::all_of(recorded + data.size(), around.end(), [](float f) { return f == 0; }));
+  }
+
+  TEST_CASE("Lossless tape", "[TapeFile] [util]") {
+    fs::path path = test::dir / "lossless.tape";
+    fs::create_directories(test::dir);
+    fs::remove(path);
+
+    constexpr auto channels = TapeFile::channels;
+    // Not a whole number of blocks, and not starting on one
+    constexpr int n = 3 * TapeFile::block_frames + 1000;
+    TapeFile::Position position = TapeFile::chunk_frames - 2 * TapeFile::block_frames + 100;
+    std::vector<float> data(n * channels);
+    for (int f = 0; f < n; f++) {
+      for (int c = 0; c < channels; c++) {
+        data[f * channels + c] =
+          0.5f * std::sin(0.01f * (c + 1) * f) + 0.01f * Random::get<float>(-1, 1);
+      }
+    }
+
+    {
+      TapeFile tf;
+      tf.open(path, TapeFile::Encoding::lossless);
+      REQUIRE(tf.encoding() == TapeFile::Encoding::lossless);
+      REQUIRE(tf.block_offset(position) == -1);
+      tf.write_frames(position, data.data(), n);
+      REQUIRE(tf.block_size(position) > 0);
+      REQUIRE(tf.block_size(position - TapeFile::block_frames) == 0);
+      // A whole block, which is smaller than the raw frames
+      auto whole = position + TapeFile::block_frames;
+      REQUIRE(tf.block_size(whole) < TapeFile::block_frames * TapeFile::frame_bytes);
+
+      // Overwrite part of a block
+      std::vector<float> patch(100 * channels, 0.25f);
+      tf.write_frames(whole + 10, patch.data(), 100);
+      std::copy(patch.begin(), patch.end(), data.begin() + (whole + 10 - position) * channels);
+    }
+
+    TapeFile tf;
+    // The encoding of an existing file is kept
+    tf.open(path);
+    REQUIRE(tf.encoding() == TapeFile::Encoding::lossless);
+    std::vector<float> got(data.size());
+    tf.read_frames(position, got.data(), n);
+    REQUIRE(got == data);
+
+    // Around the recording, in the blocks it only partly fills
+    std::vector<float> around((n + 2 * TapeFile::block_frames) * channels, 1.f);
+    tf.read_frames(position - TapeFile::block_frames, around.data(),
+                   n + 2 * TapeFile::block_frames);
+    auto recorded = around.begin() + TapeFile::block_frames * channels;
+    REQUIRE(std::equal(data.begin(), data.end(), recorded));
+    REQUIRE(std::all_of(around.begin(), recorded, [](float f) { return f == 0; }));
+    REQUIRE(std::all_of(recorded + data.size(), around.end(), [](float f) { return f == 0; }));
+  }
+
+  TEST_CASE("Importing the WAV tape", "[TapeFile] [util]") {
+    fs::path wav_path = test::dir / "legacy.wav";
+    fs::create_directories(test::dir);
+    fs::remove(wav_path);
+
+    constexpr auto channels = TapeFile::channels;
+    // Silence, then a recording that does not end on a block
+    constexpr int silence = TapeFile::chunk_frames;
+    constexpr int n = silence + TapeFile::block_frames + 1000;
+    std::vector<float> data(n * channels, 0.f);
+    std::generate(data.begin() + silence * channels, data.end(),
+                  [] { return Random::get<float>(-1, 1); });
+
+    {
+      LegacyTapeFile wav;
+      wav.open(wav_path);
+      wav.seek(0);
+      wav.write_samples(data.data(), data.size());
+      wav.slices[1].count = 2;
+      wav.slices[1].array[0] = {100, 2000};
+      wav.slices[1].array[1] = {3000, 4000000000};
+      wav.close();
+    }
+
+    for (auto encoding : {TapeFile::Encoding::raw, TapeFile::Encoding::lossless}) {
+      fs::path path = test::dir / "imported.tape";
+      fs::remove(path);
+
+      {
+        TapeFile tf;
+        tf.open(path, encoding);
+        tf.import_wav(wav_path);
+        if (encoding == TapeFile::Encoding::raw) {
+          // The silence was not written
+          REQUIRE(tf.offset(0) == -1);
+          REQUIRE(tf.offset(silence) >= 0);
+        } else {
+          REQUIRE(tf.block_size(0) == 0);
+          REQUIRE(tf.block_size(silence) > 0);
+        }
+      }
+
+      TapeFile tf;
+      tf.open(path);
+      std::vector<float> got(data.size());
+      tf.read_frames(0, got.data(), n);
+      REQUIRE(got == data);
+      REQUIRE(tf.slices[0].count == 0);
+      REQUIRE(tf.slices[1].count == 2);
+      REQUIRE(tf.slices[1].array[0] == TapeFile::SliceData{100, 2000});
+      REQUIRE(tf.slices[1].array[1] == TapeFile::SliceData{3000, 4000000000});
+    }
+
+    // The WAV file is kept
+    REQUIRE(fs::exists(wav_path));
+  }
+
+  TEST_CASE("Opening a file that is not a tape", "[TapeFile] [util]") {
+    fs::path path = test::dir / "not_a.tape";
+    fs::create_directories(test::dir);
+    {
+      std::ofstream out(path.c_str(), std::ios::trunc);
+      out << "Not a tape";
+    }
+    TapeFile tf;
+    REQUIRE_THROWS_AS(tf.open(path), util::exception);
+    REQUIRE_FALSE(tf.is_open());
   }
 }
@@ -0,0 +1,84 @@
+#include "testing.t.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "util/uring_file.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("LatencyHistogram", "[util] [UringFile]") {
+    using namespace std::chrono_literals;
+    LatencyHistogram h;
+    REQUIRE(h.percentile(0.5) == 0);
+    h.add(0us);
+    h.add(3us);
+    h.add(3us);
+    h.add(1000us);
+    REQUIRE(h.total() == 4);
+    REQUIRE(h.count(0) == 1);
+    REQUIRE(h.count(1) == 2);
+    REQUIRE(h.count(9) == 1);
+    REQUIRE(h.percentile(0.5) == 4);
+    REQUIRE(h.percentile(1) == 1024);
+  }
+
+  TEST_CASE("UringFile", "[util] [UringFile]") {
+
+    fs::path path = test::dir / "uring.bytes";
+    fs::create_directories(test::dir);
+    fs::remove(path);
+
+    std::unique_ptr<UringFile> file;
+    try {
+      file = std::make_unique<UringFile>(path, 8);
+    } catch (util::exception& e) {
+      // Kernels without io_uring, or sandboxes that block it, fall back to
+      // blocking I/O
+      LOGI("Skipping UringFile tests: {}", e.what());
+      return;
+    }
+
+    constexpr int chunks = 16;
+    constexpr int chunk  = 4096;
+    std::vector<std::byte> data(chunks * chunk);
+    std::generate(data.begin(), data.end(), [] { return std::byte(Random::get<unsigned char>()); });
+
+    // More requests than the queue has room for
+    int written = 0;
+    for (int i = 0; i < chunks;) {
+      if (file->write(i * chunk, data.data() + i * chunk, chunk, i)) {
+        i++;
+        continue;
+      }
+      file->reap(1, [&](const UringFile::Completion& c) {
+        REQUIRE(c.op == UringFile::Op::write);
+        REQUIRE(c.result == chunk);
+        written++;
+      });
+    }
+    while (file->in_flight() > 0) {
+      file->reap(1, [&](const UringFile::Completion& c) { written += c.result == chunk; });
+    }
+    REQUIRE(written == chunks);
+    REQUIRE(fs::file_size(path) == data.size());
+
+    std::vector<std::byte> got(data.size());
+    std::vector<bool> done(chunks, false);
+    for (int i = 0; i < chunks; i++) {
+      while (!file->read(i * chunk, got.data() + i * chunk, chunk, i)) {
+        file->reap(1, [&](const UringFile::Completion& c) { done[c.tag] = c.result == chunk; });
+      }
+    }
+    while (file->in_flight() > 0) {
+      file->reap(1, [&](const UringFile::Completion& c) { done[c.tag] = c.result == chunk; });
+    }
+    REQUIRE(std::all_of(done.begin(), done.end(), [](bool b) { return b; }));
+    REQUIRE(got == data);
+
+    REQUIRE(file->latency(UringFile::Op::write).total() == chunks);
+    // The probe read at construction counts too
+    REQUIRE(file->latency(UringFile::Op::read).total() == chunks + 1);
+  }
+
+} // namespace otto::util
@@ -0,0 +1,66 @@
+#include "testing.t.hpp"
+
+#include <thread>
+
+#include "util/wakeup.hpp"
+
+namespace otto::util {
+
+  using namespace std::chrono_literals;
+
+  TEST_CASE("wakeup", "[wakeup] [util]") {
+
+    wakeup signal;
+
+    SECTION("Waiting without a notification times out") {
+      auto start = std::chrono::steady_clock::now();
+      REQUIRE_FALSE(signal.wait_for(10ms));
+      REQUIRE(std::chrono::steady_clock::now() - start >= 10ms);
+    }
+
+    SECTION("A pending notification returns at once") {
+      REQUIRE(signal.notify());
+      REQUIRE(signal.wait_for(10s));
+      REQUIRE_FALSE(signal.wait_for(1ms));
+    }
+
+    SECTION("Notifications coalesce") {
+      REQUIRE(signal.notify());
+      REQUIRE_FALSE(signal.notify());
+      REQUIRE_FALSE(signal.notify());
+      REQUIRE(signal.wait_for(10s));
+      REQUIRE_FALSE(signal.wait_for(1ms));
+      REQUIRE(signal.notify());
+    }
+
+    SECTION("A sleeping waiter is woken") {
+      std::thread notifier([&] {
+        std::this_thread::sleep_for(10ms);
+        signal.notify();
+      });
+      auto start = std::chrono::steady_clock::now();
+      REQUIRE(signal.wait_for(10s));
+      REQUIRE(std::chrono::steady_clock::now() - start < 5s);
+      notifier.join();
+    }
+
+    SECTION("No notification is lost") {
+      constexpr int count = 10000;
+      std::atomic_int sent{0};
+      std::thread notifier([&] {
+        for (int i = 0; i < count; i++) {
+          sent++;
+          signal.notify();
+        }
+      });
+      // Every notification is followed by a wakeup that sees it
+      int seen = 0;
+      while (seen < count) {
+        REQUIRE(signal.wait_for(10s));
+        seen = sent;
+      }
+      notifier.join();
+    }
+  }
+
+} // namespace otto::util